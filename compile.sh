@@ -12,5 +12,3 @@ mkdir -p dump # for graphic dumps from frontend / middleend
 ./bin/front               $1                      /tmp/$filename.ast
 ./bin/middle              /tmp/$filename.ast      /tmp/$filename.opt.ast
 ./bin/x64_compiler        /tmp/$filename.opt.ast  $2
-
-chmod +x $2
\ No newline at end of file
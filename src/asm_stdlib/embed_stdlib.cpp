@@ -0,0 +1,517 @@
+#include <assert.h>
+#include <ctype.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common.h"
+#include "../lib/file.h"
+
+// -------------------------------------------------------------------------------------------------
+// Build time tool: stdlib.o + stdlib.out -> header with stdlib image, that is compiled into x64_compiler
+// -------------------------------------------------------------------------------------------------
+
+const char ENTRY_SUFFIX[] = "_asm";
+const char IMPL_SUFFIX[]  = "_impl";
+
+const int BYTES_PER_LINE = 16;
+
+// -------------------------------------------------------------------------------------------------
+
+struct stdlib_entry_t {
+    const char *name;
+    size_t name_len;    // Without ENTRY_SUFFIX
+    uint64_t offset;
+
+    uint32_t impl_section;  // Implementation behind entry table, `<name>_impl`
+    uint64_t impl_offset;
+};
+
+/// Rel32 at `offset` = address of section `target` + `addend` - address of rel32
+struct stdlib_reloc_t {
+    uint64_t offset;
+    uint32_t target;
+    int64_t addend;
+};
+
+struct stdlib_section_t {
+    const char *name;
+    const uint8_t *code;
+    uint64_t size;
+    uint64_t align;
+
+    stdlib_reloc_t *relocs;
+    size_t relocs_count;
+};
+
+struct stdlib_image_t {
+    const uint8_t *text;
+    uint64_t text_addr;
+    uint64_t text_size;
+
+    uint64_t data_addr;
+    uint64_t data_size;
+
+    stdlib_entry_t *entries;
+    size_t entries_count;
+
+    stdlib_section_t *sections;   // Executable sections of stdlib.o, .bss is section number `sections_count`
+    size_t sections_count;
+    uint64_t bss_align;
+    uint32_t *section_map;        // Section of stdlib.o -> section of image, UINT32_MAX if it isn't embedded
+};
+
+// -------------------------------------------------------------------------------------------------
+
+static result_t load_segments(stdlib_image_t *image, const mmaped_file_t *binary);
+static result_t load_entries(stdlib_image_t *image, const mmaped_file_t *object);
+static result_t load_sections(stdlib_image_t *image, const mmaped_file_t *object);
+static result_t load_relocs(stdlib_section_t *section, const mmaped_file_t *object, const Elf64_Shdr *rela,
+                            const stdlib_image_t *image);
+static result_t find_impl(stdlib_entry_t *entry, const stdlib_image_t *image, const Elf64_Sym *symbols,
+                          size_t symbols_count, const char *strtab);
+static const Elf64_Shdr *find_section(const mmaped_file_t *object, const char *name);
+static const Elf64_Sym *get_symbols(const mmaped_file_t *object, size_t *symbols_count, const char **strtab);
+static bool is_valid_elf(const mmaped_file_t *file, uint16_t type);
+static int compare_entries(const void *lhs, const void *rhs);
+
+static result_t write_header(const stdlib_image_t *image, const char *filename);
+static void write_sections(FILE *header, const stdlib_image_t *image);
+static void write_bytes(FILE *header, const uint8_t *bytes, uint64_t size);
+static void write_upper_name(FILE *header, const char *name, size_t name_len);
+static void free_image(stdlib_image_t *image);
+
+// -------------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: embed_stdlib <stdlib.o> <stdlib.out> <output header>\n");
+        return EXIT_FAILURE;
+    }
+
+    const mmaped_file_t object = mmap_file_or_warn(argv[1]);
+    const mmaped_file_t binary = mmap_file_or_warn(argv[2]);
+
+    stdlib_image_t image = {};
+    result_t res = (object.data && binary.data) ? result_t::OK : result_t::ERROR;
+
+    if (res == result_t::OK) { res = load_segments(&image, &binary); }
+    if (res == result_t::OK) { res = load_sections(&image, &object); }
+    if (res == result_t::OK) { res = load_entries (&image, &object); }
+    if (res == result_t::OK) { res = write_header (&image, argv[3]); }
+
+    free_image(&image);
+    if (object.data) { mmap_close(object); }
+    if (binary.data) { mmap_close(binary); }
+
+    return (res == result_t::OK) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Static
+// -------------------------------------------------------------------------------------------------
+
+/// Prelinked stdlib: one executable segment with code and optional zero-filled writable segment
+static result_t load_segments(stdlib_image_t *image, const mmaped_file_t *binary) {
+    if (!is_valid_elf(binary, ET_EXEC)) {
+        fprintf(stderr, "embed_stdlib: stdlib binary is not x86-64 executable\n");
+        return result_t::ERROR;
+    }
+
+    const Elf64_Ehdr *elf_hdr = (const Elf64_Ehdr *) binary->data;
+    const Elf64_Phdr *phdrs   = (const Elf64_Phdr *) (binary->data + elf_hdr->e_phoff);
+
+    const Elf64_Phdr *text = nullptr;
+    const Elf64_Phdr *data = nullptr;
+
+    for (uint i = 0; i < elf_hdr->e_phnum; ++i) {
+        if (phdrs[i].p_type != PT_LOAD) {
+            continue;
+        }
+
+        if (phdrs[i].p_flags & PF_X) {
+            if (text) {
+                fprintf(stderr, "embed_stdlib: more than one text segment in stdlib\n");
+                return result_t::ERROR;
+            }
+            text = &phdrs[i];
+        } else if (phdrs[i].p_flags & PF_W) {
+            if (data || phdrs[i].p_filesz != 0) {
+                fprintf(stderr, "embed_stdlib: stdlib data must be one zero-filled segment\n");
+                return result_t::ERROR;
+            }
+            data = &phdrs[i];
+        }
+    }
+
+    if (!text || text->p_offset + text->p_filesz > binary->size) {
+        fprintf(stderr, "embed_stdlib: no valid text segment in stdlib\n");
+        return result_t::ERROR;
+    }
+
+    image->text      = binary->data + text->p_offset;
+    image->text_addr = text->p_vaddr;
+    image->text_size = text->p_filesz;
+
+    image->data_addr = (data) ? data->p_vaddr : 0;
+    image->data_size = (data) ? data->p_memsz : 0;
+
+    return result_t::OK;
+}
+
+/// Executable sections and .bss of stdlib.o with their relocations
+static result_t load_sections(stdlib_image_t *image, const mmaped_file_t *object) {
+    if (!is_valid_elf(object, ET_REL)) {
+        fprintf(stderr, "embed_stdlib: stdlib object is not x86-64 relocatable object\n");
+        return result_t::ERROR;
+    }
+
+    const Elf64_Ehdr *elf_hdr  = (const Elf64_Ehdr *) object->data;
+    const Elf64_Shdr *sections = (const Elf64_Shdr *) (object->data + elf_hdr->e_shoff);
+    const char       *shstrtab = (const char *) (object->data + sections[elf_hdr->e_shstrndx].sh_offset);
+
+    image->sections     = (stdlib_section_t *) calloc(elf_hdr->e_shnum, sizeof(stdlib_section_t));
+    image->section_map  = (uint32_t *) calloc(elf_hdr->e_shnum, sizeof(uint32_t));
+    UNWRAP_NULLPTR (image->sections);
+    UNWRAP_NULLPTR (image->section_map);
+
+    const Elf64_Shdr *bss = find_section(object, ".bss");
+    if (bss && bss->sh_type == SHT_NOBITS) {
+        image->bss_align = bss->sh_addralign;
+    } else {
+        bss = nullptr;
+    }
+
+    for (uint i = 0; i < elf_hdr->e_shnum; ++i) {
+        image->section_map[i] = UINT32_MAX;
+
+        const Elf64_Shdr *section = &sections[i];
+        if (section->sh_type != SHT_PROGBITS || !(section->sh_flags & SHF_EXECINSTR)) {
+            continue;
+        }
+
+        image->section_map[i] = (uint32_t) image->sections_count;
+        image->sections[image->sections_count++] = {
+            .name  = shstrtab + section->sh_name,
+            .code  = object->data + section->sh_offset,
+            .size  = section->sh_size,
+            .align = (section->sh_addralign) ? section->sh_addralign : 1
+        };
+    }
+
+    if (bss) {
+        image->section_map[bss - sections] = (uint32_t) image->sections_count;
+    }
+
+    for (uint i = 0; i < elf_hdr->e_shnum; ++i) {
+        const Elf64_Shdr *rela = &sections[i];
+        if (rela->sh_type == SHT_REL) {
+            fprintf(stderr, "embed_stdlib: relocations without addend are not supported\n");
+            return result_t::ERROR;
+        }
+
+        if (rela->sh_type != SHT_RELA || image->section_map[rela->sh_info] == UINT32_MAX) {
+            continue;
+        }
+
+        UNWRAP_ERROR (load_relocs(&image->sections[image->section_map[rela->sh_info]], object, rela, image));
+    }
+
+    return result_t::OK;
+}
+
+/// Only rel32 relocations are expected: calls, jumps and rip-relative operands
+static result_t load_relocs(stdlib_section_t *section, const mmaped_file_t *object, const Elf64_Shdr *rela,
+                            const stdlib_image_t *image) {
+    size_t symbols_count = 0;
+    const char *strtab = nullptr;
+    const Elf64_Sym *symbols = get_symbols(object, &symbols_count, &strtab);
+    UNWRAP_NULLPTR (symbols);
+
+    const Elf64_Rela *relocs = (const Elf64_Rela *) (object->data + rela->sh_offset);
+    const size_t relocs_count = rela->sh_size / sizeof(Elf64_Rela);
+
+    section->relocs = (stdlib_reloc_t *) calloc(relocs_count + 1, sizeof(stdlib_reloc_t));
+    UNWRAP_NULLPTR (section->relocs);
+
+    for (size_t i = 0; i < relocs_count; ++i) {
+        const uint32_t type   = (uint32_t) ELF64_R_TYPE(relocs[i].r_info);
+        const size_t   sym    = ELF64_R_SYM(relocs[i].r_info);
+        const Elf64_Sym *symbol = (sym < symbols_count) ? &symbols[sym] : nullptr;
+
+        if (type != R_X86_64_PC32 && type != R_X86_64_PLT32) {
+            fprintf(stderr, "embed_stdlib: unsupported relocation type %u in %s\n", type, section->name);
+            return result_t::ERROR;
+        }
+
+        if (!symbol || symbol->st_shndx == SHN_UNDEF || symbol->st_shndx >= SHN_LORESERVE ||
+            image->section_map[symbol->st_shndx] == UINT32_MAX) {
+            fprintf(stderr, "embed_stdlib: relocation in %s targets symbol outside of stdlib sections\n",
+                            section->name);
+            return result_t::ERROR;
+        }
+
+        section->relocs[section->relocs_count++] = {
+            .offset = relocs[i].r_offset,
+            .target = image->section_map[symbol->st_shndx],
+            .addend = relocs[i].r_addend + (int64_t) symbol->st_value
+        };
+    }
+
+    return result_t::OK;
+}
+
+/// Entries are global `<name>_asm` symbols of .text, which starts text segment (ld puts .text before .text.*)
+static result_t load_entries(stdlib_image_t *image, const mmaped_file_t *object) {
+    const Elf64_Shdr *sections = (const Elf64_Shdr *) (object->data + ((const Elf64_Ehdr *) object->data)->e_shoff);
+    const Elf64_Shdr *text = find_section(object, ".text");
+
+    if (!text || text->sh_size > image->text_size) {
+        fprintf(stderr, "embed_stdlib: stdlib object doesn't match binary: no entry table at start of text\n");
+        return result_t::ERROR;
+    }
+
+    size_t symbols_count = 0;
+    const char *strtab = nullptr;
+    const Elf64_Sym *symbols = get_symbols(object, &symbols_count, &strtab);
+    UNWRAP_NULLPTR (symbols);
+
+    const uint16_t text_index = (uint16_t) (text - sections);
+
+    image->entries = (stdlib_entry_t *) calloc(symbols_count, sizeof(stdlib_entry_t));
+    UNWRAP_NULLPTR (image->entries);
+
+    for (size_t i = 0; i < symbols_count; ++i) {
+        const Elf64_Sym *symbol = &symbols[i];
+        const char *name = strtab + symbol->st_name;
+
+        const size_t name_len   = strlen(name);
+        const size_t suffix_len = sizeof(ENTRY_SUFFIX) - 1;
+
+        if (ELF64_ST_BIND(symbol->st_info) != STB_GLOBAL || symbol->st_shndx != text_index ||
+            name_len <= suffix_len || strcmp(name + name_len - suffix_len, ENTRY_SUFFIX) != 0) {
+            continue;
+        }
+
+        stdlib_entry_t *entry = &image->entries[image->entries_count++];
+        *entry = {.name = name, .name_len = name_len - suffix_len, .offset = symbol->st_value};
+
+        UNWRAP_ERROR (find_impl(entry, image, symbols, symbols_count, strtab));
+    }
+
+    qsort(image->entries, image->entries_count, sizeof(stdlib_entry_t), compare_entries);
+
+    return result_t::OK;
+}
+
+/// Compact binaries call `<name>_impl` directly, without entry table
+static result_t find_impl(stdlib_entry_t *entry, const stdlib_image_t *image, const Elf64_Sym *symbols,
+                          size_t symbols_count, const char *strtab) {
+    const size_t suffix_len = sizeof(IMPL_SUFFIX) - 1;
+
+    for (size_t i = 0; i < symbols_count; ++i) {
+        const char *name = strtab + symbols[i].st_name;
+
+        if (strncmp(name, entry->name, entry->name_len) != 0 || strlen(name) != entry->name_len + suffix_len ||
+            strcmp(name + entry->name_len, IMPL_SUFFIX) != 0) {
+            continue;
+        }
+
+        if (symbols[i].st_shndx >= SHN_LORESERVE || image->section_map[symbols[i].st_shndx] == UINT32_MAX ||
+            image->section_map[symbols[i].st_shndx] == image->sections_count) {
+            break;
+        }
+
+        entry->impl_section = image->section_map[symbols[i].st_shndx];
+        entry->impl_offset  = symbols[i].st_value;
+        return result_t::OK;
+    }
+
+    fprintf(stderr, "embed_stdlib: no executable %.*s%s for entry %s\n", (int) entry->name_len, entry->name,
+                                                                           IMPL_SUFFIX, entry->name);
+    return result_t::ERROR;
+}
+
+static const Elf64_Shdr *find_section(const mmaped_file_t *object, const char *name) {
+    const Elf64_Ehdr *elf_hdr  = (const Elf64_Ehdr *) object->data;
+    const Elf64_Shdr *sections = (const Elf64_Shdr *) (object->data + elf_hdr->e_shoff);
+    const char       *shstrtab = (const char *) (object->data + sections[elf_hdr->e_shstrndx].sh_offset);
+
+    for (uint i = 0; i < elf_hdr->e_shnum; ++i) {
+        if (strcmp(shstrtab + sections[i].sh_name, name) == 0) {
+            return &sections[i];
+        }
+    }
+
+    return nullptr;
+}
+
+static const Elf64_Sym *get_symbols(const mmaped_file_t *object, size_t *symbols_count, const char **strtab) {
+    const Elf64_Shdr *sections = (const Elf64_Shdr *) (object->data + ((const Elf64_Ehdr *) object->data)->e_shoff);
+    const Elf64_Shdr *symtab   = find_section(object, ".symtab");
+
+    if (!symtab) {
+        fprintf(stderr, "embed_stdlib: no symbols in stdlib object\n");
+        return nullptr;
+    }
+
+    *symbols_count = symtab->sh_size / sizeof(Elf64_Sym);
+    *strtab = (const char *) (object->data + sections[symtab->sh_link].sh_offset);
+
+    return (const Elf64_Sym *) (object->data + symtab->sh_offset);
+}
+
+static bool is_valid_elf(const mmaped_file_t *file, uint16_t type) {
+    const Elf64_Ehdr *elf_hdr = (const Elf64_Ehdr *) file->data;
+
+    return file->size >= sizeof(Elf64_Ehdr) && memcmp(elf_hdr->e_ident, ELFMAG, SELFMAG) == 0 &&
+           elf_hdr->e_ident[EI_CLASS] == ELFCLASS64 && elf_hdr->e_machine == EM_X86_64 && elf_hdr->e_type == type;
+}
+
+static int compare_entries(const void *lhs, const void *rhs) {
+    uint64_t lhs_offset = ((const stdlib_entry_t *) lhs)->offset;
+    uint64_t rhs_offset = ((const stdlib_entry_t *) rhs)->offset;
+
+    return (lhs_offset > rhs_offset) - (lhs_offset < rhs_offset);
+}
+
+static void free_image(stdlib_image_t *image) {
+    for (size_t i = 0; i < image->sections_count; ++i) {
+        free(image->sections[i].relocs);
+    }
+
+    free(image->sections);
+    free(image->section_map);
+    free(image->entries);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static result_t write_header(const stdlib_image_t *image, const char *filename) {
+    FILE *header = open_file_or_warn(filename, "w");
+    UNWRAP_NULLPTR (header);
+
+    fprintf(header, "// Generated by embed_stdlib from stdlib.o and stdlib.out, don't edit\n\n"
+                    "#ifndef X64_TRANSLATOR_STDLIB_IMAGE_H\n"
+                    "#define X64_TRANSLATOR_STDLIB_IMAGE_H\n\n"
+                    "#include <stddef.h>\n"
+                    "#include <stdint.h>\n\n"
+                    "namespace x64 {\n");
+
+    fprintf(header, "    /// Entry table at the start of stdlib, each entry is aligned to 8 bytes\n"
+                    "    enum class STDLIB_BINARY_OFFSETS {\n");
+    for (size_t i = 0; i < image->entries_count; ++i) {
+        fprintf(header, "        ");
+        write_upper_name(header, image->entries[i].name, image->entries[i].name_len);
+        fprintf(header, " = 0x%02lx,\n", image->entries[i].offset);
+    }
+    fprintf(header, "    };\n\n");
+
+    fprintf(header, "    const uint64_t STDLIB_TEXT_ADDR = 0x%lx;\n"
+                    "    const uint64_t STDLIB_DATA_ADDR = 0x%lx;\n"
+                    "    const size_t   STDLIB_DATA_SIZE = 0x%lx;\n\n",
+                    image->text_addr, image->data_addr, image->data_size);
+
+    fprintf(header, "    /// Text segment of stdlib, linked at STDLIB_TEXT_ADDR\n"
+                    "    inline constexpr uint8_t STDLIB_TEXT[] = {");
+    write_bytes(header, image->text, image->text_size);
+    fprintf(header, "\n    };\n\n");
+
+    write_sections(header, image);
+
+    fprintf(header, "}\n\n"
+                    "#endif //X64_TRANSLATOR_STDLIB_IMAGE_H\n");
+
+    bool is_ok = !ferror(header);
+    is_ok = (fclose(header) == 0) && is_ok;
+
+    if (!is_ok) {
+        fprintf(stderr, "embed_stdlib: failed to write '%s'\n", filename);
+        return result_t::ERROR;
+    }
+
+    return result_t::OK;
+}
+
+/// Unlinked sections for compact layout, that contains only sections reachable from called entries
+static void write_sections(FILE *header, const stdlib_image_t *image) {
+    fprintf(header, "    /// Rel32 at `offset` = address of section `target` + `addend` - address of rel32\n"
+                    "    struct stdlib_reloc_t {\n"
+                    "        uint32_t offset;\n"
+                    "        uint32_t target;    // Section number, STDLIB_BSS_SECTION for .bss\n"
+                    "        int64_t  addend;\n"
+                    "    };\n\n"
+                    "    struct stdlib_section_t {\n"
+                    "        const uint8_t *code;\n"
+                    "        uint32_t size;\n"
+                    "        uint32_t align;\n"
+                    "        const stdlib_reloc_t *relocs;\n"
+                    "        uint32_t relocs_count;\n"
+                    "    };\n\n"
+                    "    struct stdlib_symbol_t {\n"
+                    "        uint32_t section;\n"
+                    "        uint32_t offset;\n"
+                    "    };\n\n");
+
+    for (size_t i = 0; i < image->sections_count; ++i) {
+        const stdlib_section_t *section = &image->sections[i];
+
+        fprintf(header, "    // %s\n"
+                        "    inline constexpr uint8_t STDLIB_SECTION_%zu_CODE[] = {", section->name, i);
+        write_bytes(header, section->code, section->size);
+        fprintf(header, "\n    };\n\n");
+
+        if (section->relocs_count == 0) {
+            continue;
+        }
+
+        fprintf(header, "    inline constexpr stdlib_reloc_t STDLIB_SECTION_%zu_RELOCS[] = {\n", i);
+        for (size_t j = 0; j < section->relocs_count; ++j) {
+            const stdlib_reloc_t *reloc = &section->relocs[j];
+            fprintf(header, "        {.offset = 0x%lx, .target = %u, .addend = %ld},\n", reloc->offset, reloc->target,
+                                                                                            reloc->addend);
+        }
+        fprintf(header, "    };\n\n");
+    }
+
+    fprintf(header, "    inline constexpr stdlib_section_t STDLIB_SECTIONS[] = {\n");
+    for (size_t i = 0; i < image->sections_count; ++i) {
+        const stdlib_section_t *section = &image->sections[i];
+
+        fprintf(header, "        {.code = STDLIB_SECTION_%zu_CODE, .size = 0x%lx, .align = %lu, ", i, section->size,
+                                                                                                    section->align);
+        if (section->relocs_count) {
+            fprintf(header, ".relocs = STDLIB_SECTION_%zu_RELOCS, .relocs_count = %zu},\n", i, section->relocs_count);
+        } else {
+            fprintf(header, ".relocs = nullptr, .relocs_count = 0},\n");
+        }
+    }
+    fprintf(header, "    };\n\n");
+
+    fprintf(header, "    const uint32_t STDLIB_SECTIONS_COUNT = %zu;\n"
+                    "    const uint32_t STDLIB_BSS_SECTION    = %zu;\n"
+                    "    const size_t   STDLIB_BSS_ALIGN      = %lu;\n\n",
+                    image->sections_count, image->sections_count, (image->bss_align) ? image->bss_align : 1);
+
+    fprintf(header, "    /// Implementations behind entry table\n");
+    for (size_t i = 0; i < image->entries_count; ++i) {
+        const stdlib_entry_t *entry = &image->entries[i];
+
+        fprintf(header, "    const stdlib_symbol_t STDLIB_");
+        write_upper_name(header, entry->name, entry->name_len);
+        fprintf(header, "_IMPL = {.section = %u, .offset = 0x%lx};\n", entry->impl_section, entry->impl_offset);
+    }
+}
+
+static void write_bytes(FILE *header, const uint8_t *bytes, uint64_t size) {
+    for (uint64_t i = 0; i < size; ++i) {
+        fprintf(header, "%s0x%02x,", (i % BYTES_PER_LINE == 0) ? "\n        " : " ", bytes[i]);
+    }
+}
+
+/// `output_raw` -> `OUTPUT_RAW`
+static void write_upper_name(FILE *header, const char *name, size_t name_len) {
+    for (size_t i = 0; i < name_len; ++i) {
+        fputc(toupper((unsigned char) name[i]), header);
+    }
+}
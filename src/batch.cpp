@@ -0,0 +1,224 @@
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "batch.h"
+#include "lib/file.h"
+#include "lib/work_pool.h"
+#include "x64/x64_elf.h"
+
+// -------------------------------------------------------------------------------------------------
+// Consts
+// -------------------------------------------------------------------------------------------------
+
+const size_t DEFAULT_JOBS_CAPACITY = 16;
+
+const char MANIFEST_DELIMS[] = " \t\r\n";
+
+// -------------------------------------------------------------------------------------------------
+// Types
+// -------------------------------------------------------------------------------------------------
+
+struct batch_ctx_t {
+    batch_t *batch;
+    const compile_options_t *options;
+};
+
+// -------------------------------------------------------------------------------------------------
+// Prototypes
+// -------------------------------------------------------------------------------------------------
+
+static result_t add_job(batch_t *self, const char *ast_filename, const char *output_filename);
+static void compile_job(void *ctx, size_t index);
+static result_t compile_file(const char *ast_filename, const char *output_filename, const compile_options_t *options);
+
+static void print_summary(const batch_t *self, double total_ms, FILE *report);
+static int compare_doubles(const void *lhs, const void *rhs);
+static double get_time_ms();
+
+// -------------------------------------------------------------------------------------------------
+// Public
+// -------------------------------------------------------------------------------------------------
+
+result_t batch_load(batch_t *self, const char *manifest) {
+    assert (self && manifest && "Invalid pointers");
+
+    bool is_stdin = (strcmp(manifest, "-") == 0);
+    FILE *stream = (is_stdin) ? stdin : open_file_or_warn(manifest, "r");
+    UNWRAP_NULLPTR (stream);
+
+    result_t res = result_t::OK;
+
+    char  *line     = nullptr;
+    size_t line_cap = 0;
+    uint   line_num = 0;
+
+    while (res == result_t::OK && getline(&line, &line_cap, stream) != -1) {
+        line_num++;
+
+        char *save_ptr = nullptr;
+        const char *ast_filename    = strtok_r(line,    MANIFEST_DELIMS, &save_ptr);
+        const char *output_filename = strtok_r(nullptr, MANIFEST_DELIMS, &save_ptr);
+
+        if (!ast_filename || ast_filename[0] == '#') {
+            continue;
+        }
+
+        if (!output_filename || strtok_r(nullptr, MANIFEST_DELIMS, &save_ptr)) {
+            log (ERROR, "%s:%u: expected '<input ast file> <output binary file>'", manifest, line_num);
+            res = result_t::ERROR;
+            break;
+        }
+
+        res = add_job(self, ast_filename, output_filename);
+    }
+
+    free(line);
+    if (!is_stdin) {
+        fclose(stream);
+    }
+
+    return res;
+}
+
+void batch_free(batch_t *self) {
+    for (size_t i = 0; i < self->jobs_count; ++i) {
+        free(self->jobs[i].ast_filename);
+        free(self->jobs[i].output_filename);
+    }
+
+    free(self->jobs);
+    *self = {};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+result_t batch_run(batch_t *self, const compile_options_t *options, uint threads, FILE *report) {
+    assert (self && options && report && "Invalid pointers");
+
+    double start_ms = get_time_ms();
+
+    // Jobs are the unit of parallelism, so each of them is encoded by its own thread only
+    compile_options_t job_options = *options;
+    job_options.jobs = 1;
+
+    batch_ctx_t ctx = {.batch = self, .options = &job_options};
+    work_pool_run(self->jobs_count, (threads > 0) ? threads : 1, compile_job, &ctx);
+
+    double total_ms = get_time_ms() - start_ms;
+
+    // Printed after all jobs, so lines are in manifest order and don't interleave
+    result_t res = result_t::OK;
+    for (size_t i = 0; i < self->jobs_count; ++i) {
+        const batch_job_t *job = &self->jobs[i];
+
+        fprintf(report, "%s %s -> %s (%.2f ms)\n", (job->result == result_t::OK) ? "ok    " : "FAILED",
+                job->ast_filename, job->output_filename, job->latency_ms);
+
+        if (job->result != result_t::OK) {
+            res = result_t::ERROR;
+        }
+    }
+
+    print_summary(self, total_ms, report);
+
+    return res;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Static
+// -------------------------------------------------------------------------------------------------
+
+static result_t add_job(batch_t *self, const char *ast_filename, const char *output_filename) {
+    if (self->jobs_count == self->jobs_capacity) {
+        size_t new_capacity = (self->jobs_capacity) ? 2 * self->jobs_capacity : DEFAULT_JOBS_CAPACITY;
+
+        batch_job_t *new_jobs = (batch_job_t *) realloc(self->jobs, new_capacity * sizeof(batch_job_t));
+        UNWRAP_NULLPTR (new_jobs);
+
+        self->jobs          = new_jobs;
+        self->jobs_capacity = new_capacity;
+    }
+
+    batch_job_t job = {.ast_filename = strdup(ast_filename), .output_filename = strdup(output_filename),
+                       .result = result_t::ERROR};
+
+    if (!job.ast_filename || !job.output_filename) {
+        free(job.ast_filename);
+        free(job.output_filename);
+        return result_t::ERROR;
+    }
+
+    self->jobs[self->jobs_count++] = job;
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void compile_job(void *ctx, size_t index) {
+    batch_ctx_t *batch_ctx = (batch_ctx_t *) ctx;
+    batch_job_t *job = &batch_ctx->batch->jobs[index];
+
+    double start_ms = get_time_ms();
+    job->result     = compile_file(job->ast_filename, job->output_filename, batch_ctx->options);
+    job->latency_ms = get_time_ms() - start_ms;
+}
+
+static result_t compile_file(const char *ast_filename, const char *output_filename, const compile_options_t *options) {
+    const mmaped_file_t src = mmap_file_or_warn(ast_filename);
+    UNWRAP_NULLPTR (src.data);
+
+    x64::code_t *x64_code = compile_ast((const char *) src.data, x64::output_t::BINARY, options);
+    mmap_close(src);
+    UNWRAP_NULLPTR (x64_code);
+
+    result_t res = x64::save(x64_code, output_filename);
+    x64::code_delete(x64_code);
+
+    return res;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void print_summary(const batch_t *self, double total_ms, FILE *report) {
+    size_t failed_count = 0;
+    for (size_t i = 0; i < self->jobs_count; ++i) {
+        failed_count += (self->jobs[i].result != result_t::OK);
+    }
+
+    fprintf(report, "Batch: %zu jobs, %zu failed, %.2f ms total, %.1f jobs/s\n", self->jobs_count, failed_count,
+            total_ms, (total_ms > 0) ? (double) self->jobs_count * 1000 / total_ms : 0);
+
+    if (self->jobs_count == 0) {
+        return;
+    }
+
+    double *latencies = (double *) calloc(self->jobs_count, sizeof(double));
+    if (!latencies) {
+        return;
+    }
+
+    for (size_t i = 0; i < self->jobs_count; ++i) {
+        latencies[i] = self->jobs[i].latency_ms;
+    }
+    qsort(latencies, self->jobs_count, sizeof(double), compare_doubles);
+
+    size_t last = self->jobs_count - 1;
+    fprintf(report, "Latency: p50 %.2f ms, p95 %.2f ms, max %.2f ms\n",
+            latencies[last * 50 / 100], latencies[last * 95 / 100], latencies[last]);
+
+    free(latencies);
+}
+
+static int compare_doubles(const void *lhs, const void *rhs) {
+    double lhs_value = *(const double *) lhs;
+    double rhs_value = *(const double *) rhs;
+
+    return (lhs_value > rhs_value) - (lhs_value < rhs_value);
+}
+
+static double get_time_ms() {
+    timespec time = {};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (double) time.tv_sec * 1e3 + (double) time.tv_nsec / 1e6;
+}
@@ -0,0 +1,35 @@
+#ifndef X64_TRANSLATOR_BATCH_H
+#define X64_TRANSLATOR_BATCH_H
+
+#include <stdio.h>
+#include "common.h"
+#include "compiler.h"
+
+/// One line of manifest: `<input ast file> <output binary file>`
+struct batch_job_t {
+    char *ast_filename;
+    char *output_filename;
+
+    result_t result;
+    double latency_ms;  // Load, compile and save
+};
+
+/// Many ASTs compiled to ELF binaries by one process, so startup is paid once
+struct batch_t {
+    batch_job_t *jobs;
+    size_t jobs_count;
+    size_t jobs_capacity;
+};
+
+/// Read manifest from file or from stdin if `manifest` is "-". Empty lines and lines starting with '#' are skipped
+result_t batch_load(batch_t *self, const char *manifest);
+void batch_free(batch_t *self);
+
+/**
+ * @brief Compile all jobs on `threads` threads, each job is compiled serially. Progress and summary go to `report`
+ *
+ * @return ERROR if any job failed, others are still compiled
+ */
+result_t batch_run(batch_t *self, const compile_options_t *options, uint threads, FILE *report);
+
+#endif //X64_TRANSLATOR_BATCH_H
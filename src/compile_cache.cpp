@@ -0,0 +1,702 @@
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "compile_cache.h"
+#include "lib/file.h"
+#include "x64/x64_elf.h"
+
+// -------------------------------------------------------------------------------------------------
+// Consts
+// -------------------------------------------------------------------------------------------------
+
+const uint64_t CACHE_FORMAT_VERSION = 1;    // Bump on changes of entry layout
+
+const char STATS_FILENAME[]   = "stats";
+const char TMP_FILENAME[]     = "tmp.XXXXXX";
+const char BINARY_ENTRY_EXT[] = ".elf";
+const char JIT_ENTRY_EXT[]    = ".jit";
+const char FRAGMENT_ENTRY_EXT[] = ".obj";
+
+const uint64_t JIT_ENTRY_MAGIC        = 0x74696a343678; // "x64jit"
+const size_t   JIT_ENTRY_TABLE_OFFSET = 4096;           // Header takes first page, so code is page aligned in file
+
+const uint64_t FRAGMENT_ENTRY_MAGIC   = 0x6a626f343678; // "x64obj"
+
+const int DEFAULT_ENTRIES_CAPACITY = 64;
+
+// -------------------------------------------------------------------------------------------------
+// Types
+// -------------------------------------------------------------------------------------------------
+
+/// Followed by PIC table (zeroed) and code at JIT_ENTRY_TABLE_OFFSET
+struct jit_entry_header_t {
+    uint64_t magic;
+    uint64_t ram_size;
+    uint64_t code_size;     // PIC table and code
+};
+
+/// Followed by code, relocations and labels
+struct fragment_entry_header_t {
+    uint64_t magic;
+    uint64_t code_size;
+    uint64_t relocs_count;
+    uint64_t labels_count;
+};
+
+struct entry_info_t {
+    char name[NAME_MAX + 1];
+    size_t size;
+    struct timespec last_use;
+};
+
+// -------------------------------------------------------------------------------------------------
+// Prototypes
+// -------------------------------------------------------------------------------------------------
+
+static void hash_bytes(uint64_t hash[2], const void *data, size_t size);
+static void hash_file_version(uint64_t hash[2], const char *filename);
+static void hash_func_instruction(uint64_t hash[2], const ir::instruction_t *ir_instruct, const ir::code_t *ir_code,
+                                  size_t func_index, const size_t *func_by_begin);
+static bool is_valid_fragment(const x64::fragment_t *fragment);
+
+static void entry_path(char *path, const compile_cache_t *self, const cache_key_t *key, const char *ext);
+static int  open_tmp_file(const compile_cache_t *self, char *tmp_path);
+static result_t commit_tmp_file(compile_cache_t *self, int fd, const char *tmp_path, const char *path,
+                                bool is_evicting = true);
+
+static result_t copy_file(int dst_fd, int src_fd);
+static result_t copy_entry(int fd, void *entry_fd);
+static result_t write_all(int fd, const void *data, size_t size);
+
+static void add_stats(compile_cache_t *self, uint64_t hits, uint64_t misses, uint64_t evictions);
+static cache_stats_t read_stats(compile_cache_t *self);
+static void evict(compile_cache_t *self);
+static entry_info_t *list_entries(const compile_cache_t *self, size_t *count, size_t *total_size);
+static bool is_entry_name(const char *name);
+
+// -------------------------------------------------------------------------------------------------
+// Public
+// -------------------------------------------------------------------------------------------------
+
+result_t cache_open(compile_cache_t *self, const char *dir, size_t max_size) {
+    assert (self && dir && "Invalid pointers");
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        log (ERROR, "Failed to create cache directory '%s': %s", dir, strerror(errno));
+        return result_t::ERROR;
+    }
+
+    char stats_path[PATH_MAX] = "";
+    snprintf(stats_path, sizeof(stats_path), "%s/%s", dir, STATS_FILENAME);
+
+    self->stats_fd = open(stats_path, O_RDWR | O_CREAT, 0644);
+    if (self->stats_fd < 0) {
+        log (ERROR, "Failed to open cache stats '%s': %s", stats_path, strerror(errno));
+        return result_t::ERROR;
+    }
+
+    self->dir      = dir;
+    self->max_size = max_size;
+
+    return result_t::OK;
+}
+
+void cache_close(compile_cache_t *self) {
+    if (self->is_eviction_pending) {
+        evict(self);
+    }
+
+    close(self->stats_fd);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+cache_key_t cache_key(const void *ast, size_t ast_size, const compile_options_t *options, x64::output_t output) {
+    assert (ast && options && "Invalid pointers");
+
+    cache_key_t key = {};
+
+    // Same compiler build (by size and modification time) with embedded stdlib, same entry layout
+    const uint64_t version[] = {CACHE_FORMAT_VERSION};
+    hash_bytes(key.hash, version, sizeof(version));
+    hash_file_version(key.hash, "/proc/self/exe");
+
+    const uint64_t options_words[] = {options->unroll_factor, options->ram_size, options->raw_output, options->pic,
+                                      options->compact, options->emit_obj, options->shared, (uint64_t) output};
+    hash_bytes(key.hash, options_words, sizeof(options_words));
+
+    hash_bytes(key.hash, ast, ast_size);
+
+    return key;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+result_t cache_fetch_binary(compile_cache_t *self, const cache_key_t *key, const char *filename, mode_t mode) {
+    char path[PATH_MAX] = "";
+    entry_path(path, self, key, BINARY_ENTRY_EXT);
+
+    int entry_fd = open(path, O_RDONLY);
+    if (entry_fd < 0) {
+        add_stats(self, 0, 1, 0);
+        return result_t::ERROR;
+    }
+
+    result_t res = x64::write_atomically(filename, copy_entry, &entry_fd, mode);
+    if (res == result_t::OK) {
+        futimens(entry_fd, nullptr);    // Entry is recently used now
+    }
+
+    close(entry_fd);
+
+    add_stats(self, res == result_t::OK, res == result_t::ERROR, 0);
+    return res;
+}
+
+result_t cache_store_binary(compile_cache_t *self, const cache_key_t *key, const char *filename) {
+    int output_fd = open(filename, O_RDONLY);
+    if (output_fd < 0) { return result_t::ERROR; }
+
+    char tmp_path[PATH_MAX] = "";
+    int tmp_fd = open_tmp_file(self, tmp_path);
+    if (tmp_fd < 0) {
+        close(output_fd);
+        return result_t::ERROR;
+    }
+
+    result_t res = copy_file(tmp_fd, output_fd);
+    close(output_fd);
+
+    char path[PATH_MAX] = "";
+    entry_path(path, self, key, BINARY_ENTRY_EXT);
+
+    if (res == result_t::OK) {
+        return commit_tmp_file(self, tmp_fd, tmp_path, path);
+    }
+
+    close(tmp_fd);
+    unlink(tmp_path);
+    return result_t::ERROR;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+x64::code_t *cache_fetch_jit(compile_cache_t *self, const cache_key_t *key) {
+    char path[PATH_MAX] = "";
+    entry_path(path, self, key, JIT_ENTRY_EXT);
+
+    int entry_fd = open(path, O_RDONLY);
+    if (entry_fd < 0) {
+        add_stats(self, 0, 1, 0);
+        return nullptr;
+    }
+
+    jit_entry_header_t header = {};
+    bool is_valid = pread(entry_fd, &header, sizeof(header), 0) == sizeof(header) &&
+                    header.magic == JIT_ENTRY_MAGIC && header.code_size > x64::PIC_TABLE_SIZE &&
+                    get_file_size(entry_fd) == JIT_ENTRY_TABLE_OFFSET + header.code_size;
+
+    x64::code_t *code = (is_valid) ? x64::code_new(x64::output_t::JIT, header.ram_size) : nullptr;
+
+    if (code && x64::code_map_pic(code, entry_fd, JIT_ENTRY_TABLE_OFFSET, header.code_size) == result_t::ERROR) {
+        x64::code_delete(code);
+        code = nullptr;
+    }
+
+    if (code) {
+        futimens(entry_fd, nullptr);    // Entry is recently used now
+    }
+
+    close(entry_fd);
+
+    add_stats(self, code != nullptr, code == nullptr, 0);
+    return code;
+}
+
+result_t cache_store_jit(compile_cache_t *self, const cache_key_t *key, const x64::code_t *code) {
+    assert (code->pic && code->output_type == x64::output_t::JIT && "Only PIC code can be cached");
+
+    char tmp_path[PATH_MAX] = "";
+    int tmp_fd = open_tmp_file(self, tmp_path);
+    if (tmp_fd < 0) { return result_t::ERROR; }
+
+    static const uint8_t zero_page[JIT_ENTRY_TABLE_OFFSET] = {};
+    static_assert(sizeof(zero_page) >= x64::PIC_TABLE_SIZE);
+
+    const jit_entry_header_t header = {
+            .magic     = JIT_ENTRY_MAGIC,
+            .ram_size  = code->ram_size,
+            .code_size = code->exec_buf_size
+    };
+
+    // Table is stored zeroed: it holds addresses of this process
+    result_t res = result_t::OK;
+    if (write_all(tmp_fd, &header, sizeof(header)) == result_t::ERROR ||
+        write_all(tmp_fd, zero_page, JIT_ENTRY_TABLE_OFFSET - sizeof(header)) == result_t::ERROR ||
+        write_all(tmp_fd, zero_page, x64::PIC_TABLE_SIZE) == result_t::ERROR ||
+        write_all(tmp_fd, code->exec_buf + x64::PIC_TABLE_SIZE,
+                          code->exec_buf_size - x64::PIC_TABLE_SIZE) == result_t::ERROR) {
+        res = result_t::ERROR;
+    }
+
+    char path[PATH_MAX] = "";
+    entry_path(path, self, key, JIT_ENTRY_EXT);
+
+    if (res == result_t::OK) {
+        return commit_tmp_file(self, tmp_fd, tmp_path, path);
+    }
+
+    close(tmp_fd);
+    unlink(tmp_path);
+    return result_t::ERROR;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+result_t cache_func_keys(ir::code_t *ir_code, const compile_options_t *options, cache_key_t *keys) {
+    assert (ir_code && options && keys && "Invalid pointers");
+
+    size_t *func_by_begin = (size_t *) calloc(ir_code->size + 1, sizeof(size_t));
+    UNWRAP_NULLPTR (func_by_begin);
+
+    for (size_t i = 0; i < ir_code->funcs_count; ++i) {
+        func_by_begin[ir_code->funcs[i].begin] = i + 1;
+    }
+
+    // Fragments are linked into ELF only, their code depends on compiler build and on these options only
+    cache_key_t base_key = {};
+    const uint64_t version[] = {CACHE_FORMAT_VERSION, FRAGMENT_ENTRY_MAGIC};
+    hash_bytes(base_key.hash, version, sizeof(version));
+    hash_file_version(base_key.hash, "/proc/self/exe");
+
+    const uint64_t options_words[] = {options->raw_output, options->pic};
+    hash_bytes(base_key.hash, options_words, sizeof(options_words));
+
+    for (size_t i = 0; i < ir_code->funcs_count; ++i) {
+        keys[i] = base_key;
+    }
+
+    // Functions are sorted and don't overlap, so they are hashed in one walk
+    size_t func_index = 0;
+
+    for (ir::instruction_t *ir_instruct = ir_code->instructions; ir_instruct;
+                            ir_instruct = ir::next_insruction(ir_instruct)) {
+        while (func_index < ir_code->funcs_count && ir_instruct->index >= ir_code->funcs[func_index].end) {
+            func_index++;
+        }
+
+        if (func_index == ir_code->funcs_count) {
+            break;
+        }
+
+        if (ir_instruct->index >= ir_code->funcs[func_index].begin) {
+            hash_func_instruction(keys[func_index].hash, ir_instruct, ir_code, func_index, func_by_begin);
+        }
+    }
+
+    free(func_by_begin);
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+x64::fragment_t *cache_fetch_fragment(compile_cache_t *self, const cache_key_t *key) {
+    char path[PATH_MAX] = "";
+    entry_path(path, self, key, FRAGMENT_ENTRY_EXT);
+
+    int entry_fd = open(path, O_RDONLY);
+    if (entry_fd < 0) {
+        add_stats(self, 0, 1, 0);
+        return nullptr;
+    }
+
+    fragment_entry_header_t header = {};
+    bool is_valid = pread(entry_fd, &header, sizeof(header), 0) == sizeof(header) &&
+                    header.magic == FRAGMENT_ENTRY_MAGIC &&
+                    get_file_size(entry_fd) == sizeof(header) + header.code_size +
+                                               header.relocs_count * sizeof(x64::reloc_t) +
+                                               header.labels_count * sizeof(mapping_t);
+
+    x64::fragment_t *fragment = (is_valid) ? x64::fragment_new() : nullptr;
+
+    if (fragment) {
+        const size_t relocs_size = header.relocs_count * sizeof(x64::reloc_t);
+        const size_t labels_size = header.labels_count * sizeof(mapping_t);
+        const off_t  relocs_pos  = (off_t) (sizeof(header) + header.code_size);
+        const off_t  labels_pos  = relocs_pos + (off_t) relocs_size;
+
+        fragment->code   = (uint8_t *)      malloc(header.code_size + 1);
+        fragment->relocs = (x64::reloc_t *) calloc(header.relocs_count + 1, sizeof(x64::reloc_t));
+        fragment->labels = (mapping_t *)    calloc(header.labels_count + 1, sizeof(mapping_t));
+
+        fragment->size            = header.code_size;
+        fragment->relocs_count    = header.relocs_count;
+        fragment->relocs_capacity = header.relocs_count + 1;
+        fragment->labels_count    = header.labels_count;
+
+        is_valid = fragment->code && fragment->relocs && fragment->labels &&
+                   pread(entry_fd, fragment->code, header.code_size, sizeof(header)) == (ssize_t) header.code_size &&
+                   pread(entry_fd, fragment->relocs, relocs_size, relocs_pos) == (ssize_t) relocs_size &&
+                   pread(entry_fd, fragment->labels, labels_size, labels_pos) == (ssize_t) labels_size &&
+                   is_valid_fragment(fragment);
+    }
+
+    if (is_valid) {
+        futimens(entry_fd, nullptr);    // Entry is recently used now
+    } else {
+        x64::fragment_delete(fragment);
+        fragment = nullptr;
+    }
+
+    close(entry_fd);
+
+    add_stats(self, fragment != nullptr, fragment == nullptr, 0);
+    return fragment;
+}
+
+result_t cache_store_fragment(compile_cache_t *self, const cache_key_t *key, const x64::fragment_t *fragment) {
+    char tmp_path[PATH_MAX] = "";
+    int tmp_fd = open_tmp_file(self, tmp_path);
+    if (tmp_fd < 0) { return result_t::ERROR; }
+
+    const fragment_entry_header_t header = {
+            .magic        = FRAGMENT_ENTRY_MAGIC,
+            .code_size    = fragment->size,
+            .relocs_count = fragment->relocs_count,
+            .labels_count = fragment->labels_count
+    };
+
+    result_t res = result_t::OK;
+    if (write_all(tmp_fd, &header, sizeof(header)) == result_t::ERROR ||
+        write_all(tmp_fd, fragment->code,   fragment->size) == result_t::ERROR ||
+        write_all(tmp_fd, fragment->relocs, fragment->relocs_count * sizeof(x64::reloc_t)) == result_t::ERROR ||
+        write_all(tmp_fd, fragment->labels, fragment->labels_count * sizeof(mapping_t))    == result_t::ERROR) {
+        res = result_t::ERROR;
+    }
+
+    char path[PATH_MAX] = "";
+    entry_path(path, self, key, FRAGMENT_ENTRY_EXT);
+
+    if (res == result_t::OK) {
+        self->is_eviction_pending = true;
+        return commit_tmp_file(self, tmp_fd, tmp_path, path, false);
+    }
+
+    close(tmp_fd);
+    unlink(tmp_path);
+    return result_t::ERROR;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void cache_print_stats(compile_cache_t *self, FILE *stream) {
+    cache_stats_t stats = read_stats(self);
+
+    size_t count = 0;
+    size_t total_size = 0;
+    free(list_entries(self, &count, &total_size));
+
+    uint64_t requests = stats.hits + stats.misses;
+
+    fprintf(stream, "Cache '%s': %zu entries, %zu / %zu bytes\n", self->dir, count, total_size, self->max_size);
+    fprintf(stream, "  hits: %lu, misses: %lu (hit rate %.1f%%), evictions: %lu\n",
+                    stats.hits, stats.misses, (requests) ? 100.0 * (double) stats.hits / (double) requests : 0.0,
+                    stats.evictions);
+}
+
+// -------------------------------------------------------------------------------------------------
+// Static
+// -------------------------------------------------------------------------------------------------
+
+/// Two independent 64-bit lanes of multiply-rotate hash, a collision would silently run wrong program
+static void hash_bytes(uint64_t hash[2], const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *) data;
+
+    uint64_t lane0 = hash[0] ^ 0x9e3779b97f4a7c15;
+    uint64_t lane1 = hash[1] ^ 0xc2b2ae3d27d4eb4f;
+
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, (size - i < sizeof(word)) ? size - i : sizeof(word));
+
+        lane0 = ((lane0 ^ word) * 0xff51afd7ed558ccd);
+        lane0 = (lane0 << 31) | (lane0 >> 33);
+        lane1 = ((lane1 + word) * 0xc4ceb9fe1a85ec53);
+        lane1 = (lane1 << 27) | (lane1 >> 37);
+    }
+
+    lane0 ^= size;
+    lane1 ^= size;
+
+    // Finalizer of MurmurHash3
+    lane0 ^= lane0 >> 33; lane0 *= 0xff51afd7ed558ccd; lane0 ^= lane0 >> 33;
+    lane1 ^= lane1 >> 29; lane1 *= 0xc4ceb9fe1a85ec53; lane1 ^= lane1 >> 32;
+
+    hash[0] = lane0;
+    hash[1] = lane1;
+}
+
+static void hash_file_version(uint64_t hash[2], const char *filename) {
+    struct stat st = {};
+    stat(filename, &st);
+
+    const uint64_t version[] = {(uint64_t) st.st_size, (uint64_t) st.st_mtim.tv_sec, (uint64_t) st.st_mtim.tv_nsec};
+    hash_bytes(hash, version, sizeof(version));
+}
+
+/// Targets of jumps and calls are IR indices, so they are replaced by values, that don't depend on function position
+static void hash_func_instruction(uint64_t hash[2], const ir::instruction_t *ir_instruct, const ir::code_t *ir_code,
+                                  size_t func_index, const size_t *func_by_begin) {
+    const ir::func_range_t *range = &ir_code->funcs[func_index];
+
+    uint64_t target_type = 0;
+    uint64_t imm_arg     = ir_instruct->imm_arg;
+
+    // Same as relocation targets, see x64::reloc_target_t
+    if (ir::is_jump(ir_instruct->type)) {
+        const size_t callee = (imm_arg <= ir_code->size && imm_arg != range->begin) ? func_by_begin[imm_arg] : 0;
+
+        target_type = (uint64_t) ((callee) ? x64::reloc_target_t::FUNC : x64::reloc_target_t::LABEL);
+        imm_arg     = (callee) ? ir_code->funcs[callee - 1].func : imm_arg - range->begin;
+    }
+
+    const uint64_t words[] = {
+            (uint64_t) ir_instruct->type,
+            (uint64_t) (ir_instruct->need_imm_arg | ir_instruct->need_reg_arg << 1 | ir_instruct->need_mem_arg << 2),
+            ir_instruct->reg_num,
+            (uint64_t) ir_instruct->scale_arg,
+            target_type,
+            imm_arg
+    };
+
+    hash_bytes(hash, words, sizeof(words));
+}
+
+/// Entry is written by the same compiler build (it's in key), but file may be damaged
+static bool is_valid_fragment(const x64::fragment_t *fragment) {
+    for (size_t i = 0; i < fragment->relocs_count; ++i) {
+        const x64::reloc_t *reloc = &fragment->relocs[i];
+        const size_t imm_size = (reloc->type == x64::reloc_type_t::ABS64) ? sizeof(uint64_t) : sizeof(uint32_t);
+
+        bool is_known_type   = reloc->type == x64::reloc_type_t::ABS64 || reloc->type == x64::reloc_type_t::REL32;
+        bool is_known_target = reloc->target_type == x64::reloc_target_t::LABEL ||
+                               reloc->target_type == x64::reloc_target_t::FUNC  ||
+                               reloc->target_type == x64::reloc_target_t::OFFSET;
+
+        if (!is_known_type || !is_known_target || reloc->position + imm_size > fragment->size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void entry_path(char *path, const compile_cache_t *self, const cache_key_t *key, const char *ext) {
+    snprintf(path, PATH_MAX, "%s/%016lx%016lx%s", self->dir, key->hash[0], key->hash[1], ext);
+}
+
+static int open_tmp_file(const compile_cache_t *self, char *tmp_path) {
+    snprintf(tmp_path, PATH_MAX, "%s/%s", self->dir, TMP_FILENAME);
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        log (WARN, "Failed to create file in cache: %s", strerror(errno));
+    }
+
+    return fd;
+}
+
+/// Rename is atomic, so other processes see either no entry or complete one
+static result_t commit_tmp_file(compile_cache_t *self, int fd, const char *tmp_path, const char *path,
+                                bool is_evicting) {
+    bool is_ok = fchmod(fd, 0644) == 0 && close(fd) == 0 && rename(tmp_path, path) == 0;
+
+    if (!is_ok) {
+        log (WARN, "Failed to store cache entry '%s': %s", path, strerror(errno));
+        unlink(tmp_path);
+        return result_t::ERROR;
+    }
+
+    if (is_evicting) {
+        evict(self);
+    }
+
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Reflink (shares blocks on CoW file systems), falls back to in-kernel copy
+static result_t copy_file(int dst_fd, int src_fd) {
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+        return result_t::OK;
+    }
+
+    size_t size = get_file_size(src_fd);
+    off_t offset = 0;
+
+    while ((size_t) offset < size) {
+        ssize_t copied = sendfile(dst_fd, src_fd, &offset, size - (size_t) offset);
+        if (copied <= 0) { return result_t::ERROR; }
+    }
+
+    return result_t::OK;
+}
+
+/// Writer of x64::write_atomically()
+static result_t copy_entry(int fd, void *entry_fd) {
+    return copy_file(fd, *(int *) entry_fd);
+}
+
+static result_t write_all(int fd, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *) data;
+
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written <= 0) { return result_t::ERROR; }
+
+        bytes += written;
+        size  -= (size_t) written;
+    }
+
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void add_stats(compile_cache_t *self, uint64_t hits, uint64_t misses, uint64_t evictions) {
+    flock(self->stats_fd, LOCK_EX);
+
+    cache_stats_t stats = {};
+    pread(self->stats_fd, &stats, sizeof(stats), 0);
+
+    stats.hits      += hits;
+    stats.misses    += misses;
+    stats.evictions += evictions;
+
+    pwrite(self->stats_fd, &stats, sizeof(stats), 0);
+
+    flock(self->stats_fd, LOCK_UN);
+}
+
+static cache_stats_t read_stats(compile_cache_t *self) {
+    cache_stats_t stats = {};
+
+    flock(self->stats_fd, LOCK_SH);
+    pread(self->stats_fd, &stats, sizeof(stats), 0);
+    flock(self->stats_fd, LOCK_UN);
+
+    return stats;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int compare_last_use(const void *lhs, const void *rhs) {
+    const struct timespec *lhs_time = &((const entry_info_t *) lhs)->last_use;
+    const struct timespec *rhs_time = &((const entry_info_t *) rhs)->last_use;
+
+    if (lhs_time->tv_sec != rhs_time->tv_sec) {
+        return (lhs_time->tv_sec < rhs_time->tv_sec) ? -1 : 1;
+    }
+
+    return (lhs_time->tv_nsec < rhs_time->tv_nsec) ? -1 : (lhs_time->tv_nsec > rhs_time->tv_nsec);
+}
+
+/// Remove least recently used entries (by modification time, it is updated on hits) above max_size
+static void evict(compile_cache_t *self) {
+    // Stats lock also serializes evictions, so concurrent processes don't delete entries by stale listings
+    flock(self->stats_fd, LOCK_EX);
+
+    size_t count = 0;
+    size_t total_size = 0;
+    entry_info_t *entries = list_entries(self, &count, &total_size);
+    if (!entries || total_size <= self->max_size) {
+        flock(self->stats_fd, LOCK_UN);
+        free(entries);
+        return;
+    }
+
+    qsort(entries, count, sizeof(entry_info_t), compare_last_use);
+
+    uint64_t evicted = 0;
+    for (size_t i = 0; i < count && total_size > self->max_size; ++i) {
+        char path[PATH_MAX] = "";
+        snprintf(path, sizeof(path), "%s/%s", self->dir, entries[i].name);
+
+        // Mapped entries stay valid after unlink
+        if (unlink(path) == 0) {
+            evicted++;
+        }
+
+        total_size -= entries[i].size;
+    }
+
+    flock(self->stats_fd, LOCK_UN);
+
+    free(entries);
+    add_stats(self, 0, 0, evicted);
+}
+
+/// Cache entries with their sizes and last use times, nullptr on failure
+static entry_info_t *list_entries(const compile_cache_t *self, size_t *count, size_t *total_size) {
+    DIR *dir = opendir(self->dir);
+    if (!dir) { return nullptr; }
+
+    size_t capacity = DEFAULT_ENTRIES_CAPACITY;
+    entry_info_t *entries = (entry_info_t *) calloc(capacity, sizeof(entry_info_t));
+
+    *count = 0;
+    *total_size = 0;
+
+    struct dirent *dirent = nullptr;
+    while (entries && (dirent = readdir(dir))) {
+        struct stat st = {};
+        if (!is_entry_name(dirent->d_name) || fstatat(dirfd(dir), dirent->d_name, &st, 0) != 0) {
+            continue;
+        }
+
+        if (*count == capacity) {
+            capacity *= 2;
+            entry_info_t *tmp_buf = (entry_info_t *) realloc(entries, capacity * sizeof(entry_info_t));
+            if (!tmp_buf) {
+                free(entries);
+                entries = nullptr;
+                break;
+            }
+
+            entries = tmp_buf;
+        }
+
+        entry_info_t *entry = &entries[(*count)++];
+        strncpy(entry->name, dirent->d_name, NAME_MAX);
+        entry->size     = (size_t) st.st_size;
+        entry->last_use = st.st_mtim;
+
+        *total_size += entry->size;
+    }
+
+    closedir(dir);
+    return entries;
+}
+
+static bool is_entry_name(const char *name) {
+    size_t len = strlen(name);
+    size_t ext_len = sizeof(BINARY_ENTRY_EXT) - 1;
+    static_assert(sizeof(BINARY_ENTRY_EXT) == sizeof(JIT_ENTRY_EXT));
+    static_assert(sizeof(BINARY_ENTRY_EXT) == sizeof(FRAGMENT_ENTRY_EXT));
+
+    return len > ext_len && (strcmp(name + len - ext_len, BINARY_ENTRY_EXT)   == 0 ||
+                             strcmp(name + len - ext_len, JIT_ENTRY_EXT)      == 0 ||
+                             strcmp(name + len - ext_len, FRAGMENT_ENTRY_EXT) == 0);
+}
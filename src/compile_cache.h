@@ -0,0 +1,60 @@
+#ifndef X64_TRANSLATOR_COMPILE_CACHE_H
+#define X64_TRANSLATOR_COMPILE_CACHE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "common.h"
+#include "compiler.h"
+#include "x64/x64.h"
+
+const size_t DEFAULT_CACHE_MAX_SIZE = 256 * 1024 * 1024;
+
+/// Shared by all processes using the same directory, counters are updated under lock of stats file
+struct cache_stats_t {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+struct compile_cache_t {
+    const char *dir;
+    size_t max_size;    // Least recently used entries are evicted above it
+
+    int stats_fd;
+    bool is_eviction_pending;   // Function fragments are stored by hundreds, so they are evicted on close
+};
+
+/// Hash of AST bytes, compiler build and options
+struct cache_key_t {
+    uint64_t hash[2];
+};
+
+result_t cache_open(compile_cache_t *self, const char *dir, size_t max_size);
+void cache_close(compile_cache_t *self);
+
+cache_key_t cache_key(const void *ast, size_t ast_size, const compile_options_t *options, x64::output_t output);
+
+/// Copy (reflink if possible) cached ELF to `filename` with `mode` atomically, see x64::save. Returns ERROR on miss
+result_t cache_fetch_binary(compile_cache_t *self, const cache_key_t *key, const char *filename, mode_t mode);
+result_t cache_store_binary(compile_cache_t *self, const cache_key_t *key, const char *filename);
+
+/// Map cached PIC code for JIT. Returns nullptr on miss
+x64::code_t *cache_fetch_jit(compile_cache_t *self, const cache_key_t *key);
+result_t cache_store_jit(compile_cache_t *self, const cache_key_t *key, const x64::code_t *code);
+
+/**
+ * @brief Keys of functions of `ir_code->funcs` for cache_fetch_fragment()
+ *
+ * @note Key is a hash of function IR (so of its AST, frame and addresses of globals it uses) and of options.
+ *       Calls and jumps out of function are hashed as function numbers and IR indices relative to its begin,
+ *       so key doesn't change, when code before function or functions it calls are changed
+ */
+result_t cache_func_keys(ir::code_t *ir_code, const compile_options_t *options, cache_key_t *keys);
+
+/// Cached code of function, see x64::translate_incremental. Returns nullptr on miss
+x64::fragment_t *cache_fetch_fragment(compile_cache_t *self, const cache_key_t *key);
+result_t cache_store_fragment(compile_cache_t *self, const cache_key_t *key, const x64::fragment_t *fragment);
+
+void cache_print_stats(compile_cache_t *self, FILE *stream);
+
+#endif //X64_TRANSLATOR_COMPILE_CACHE_H
@@ -0,0 +1,132 @@
+#include "compile_cache.h"
+#include "compiler.h"
+#include "ir/ir.h"
+#include "ir/ast_converter.h"
+#include "ir/loop_unroller.h"
+#include "lib/tree.h"
+#include "x64/x64_elf.h"
+
+// -------------------------------------------------------------------------------------------------
+
+x64::code_t *compile_ast(const char *ast_text, x64::output_t output, const compile_options_t *options) {
+    assert (ast_text && options && "Invalid pointers");
+
+    ir::code_t *ir_code = compile_ast_to_ir(ast_text, options);
+    if (!ir_code) { return nullptr; }
+
+    size_t ram_size = x64::choose_ram_size(options->ram_size, ir_code);
+
+    // RAM and stdlib addresses of object are known only after linking
+    bool is_object = (options->emit_obj || options->shared) && output == x64::output_t::BINARY;
+
+    x64::code_t *x64_code = x64::code_new(output, ram_size);
+    if (x64_code) {
+        x64_code->raw_output = options->raw_output;
+        x64_code->pic        = options->pic || is_object;
+        x64_code->jobs       = options->jobs;
+
+        result_t res = result_t::OK;
+        if (options->compact && output == x64::output_t::BINARY) {
+            res = x64::link_compact_stdlib(x64_code, ir_code);
+        }
+
+        // Lazy code keeps IR to translate functions later
+        bool is_lazy = options->lazy && output == x64::output_t::JIT && !options->pic;
+        if (res == result_t::OK) {
+            res = (is_lazy)   ? x64::translate_lazy   (x64_code, ir_code) :
+                  (is_object) ? x64::translate_object (x64_code, ir_code, options->shared)
+                              : x64::translate_from_ir(x64_code, ir_code);
+        }
+        if (is_lazy) { ir_code = nullptr; }
+
+        if (res == result_t::ERROR) {
+            x64::code_delete(x64_code);
+            x64_code = nullptr;
+        }
+    }
+
+    if (ir_code) {
+        ir::code_delete(ir_code);
+    }
+
+    return x64_code;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+x64::code_t *compile_ast_incremental(const char *ast_text, const compile_options_t *options, compile_cache_t *cache) {
+    assert (ast_text && options && cache && "Invalid pointers");
+
+    ir::code_t *ir_code = compile_ast_to_ir(ast_text, options);
+    if (!ir_code) { return nullptr; }
+
+    const size_t funcs_count = ir_code->funcs_count;
+
+    cache_key_t      *keys      = (cache_key_t *)      calloc(funcs_count + 1, sizeof(cache_key_t));
+    x64::fragment_t **fragments = (x64::fragment_t **) calloc(funcs_count + 1, sizeof(x64::fragment_t *));
+
+    x64::code_t *x64_code = nullptr;
+    if (keys && fragments && cache_func_keys(ir_code, options, keys) == result_t::OK) {
+        x64_code = x64::code_new(x64::output_t::BINARY, x64::choose_ram_size(options->ram_size, ir_code));
+    }
+
+    if (x64_code) {
+        x64_code->raw_output = options->raw_output;
+        x64_code->pic        = options->pic;
+        x64_code->jobs       = options->jobs;
+
+        size_t cached_count = 0;
+        for (size_t i = 0; i < funcs_count; ++i) {
+            fragments[i] = cache_fetch_fragment(cache, &keys[i]);
+            cached_count += (fragments[i] != nullptr);
+        }
+
+        if (x64::translate_incremental(x64_code, ir_code, fragments) == result_t::OK) {
+            log (INFO, "Functions taken from cache: %zu of %zu", cached_count, funcs_count);
+
+            for (size_t i = 0; i < funcs_count; ++i) {
+                const x64::fragment_link_t *link = &x64_code->links[i];
+
+                if (!link->is_cached && cache_store_fragment(cache, &keys[i], link->fragment) == result_t::ERROR) {
+                    log (WARN, "Failed to store function in cache");
+                }
+            }
+        } else {
+            x64::code_delete(x64_code);
+            x64_code = nullptr;
+        }
+    }
+
+    free(fragments);
+    free(keys);
+    ir::code_delete(ir_code);
+
+    return x64_code;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+ir::code_t *compile_ast_to_ir(const char *ast_text, const compile_options_t *options) {
+    assert (ast_text && options && "Invalid pointers");
+
+    tree::tree_t ast = tree::load_tree (ast_text);
+    if (!ast.head_node) { return nullptr; }
+
+    ir::code_t *ir_code = ir::code_new();
+
+    ir::unroll_stats_t unroll_stats = {};
+    result_t res = (ir_code) ? ir::unroll_loops(&ast, options->unroll_factor, &unroll_stats) : result_t::ERROR;
+
+    if (res == result_t::OK) {
+        res = ir::from_ast(ir_code, &ast);
+    }
+
+    tree::dtor(&ast);
+
+    if (res == result_t::ERROR && ir_code) {
+        ir::code_delete(ir_code);
+        return nullptr;
+    }
+
+    return ir_code;
+}
@@ -0,0 +1,31 @@
+#ifndef X64_TRANSLATOR_COMPILER_H
+#define X64_TRANSLATOR_COMPILER_H
+
+#include "common.h"
+#include "x64/x64.h"
+
+struct compile_cache_t;
+
+struct compile_options_t {
+    uint unroll_factor;
+    size_t ram_size;    // 0 to choose from static estimate, see x64::choose_ram_size
+    bool raw_output;
+    bool pic;           // Position independent code, see x64::PIC_TABLE_SLOTS
+    bool compact;       // ELF only: one segment with used stdlib routines only, see x64::link_compact_stdlib
+    bool emit_obj;      // ELF only: relocatable object with C ABI entry of each function, see x64::translate_object
+    bool shared;        // ELF only: shared library with the same entries as relocatable object
+    bool lazy;          // JIT only: translate functions on first call, see x64::translate_lazy
+    uint jobs;          // Threads encoding functions in parallel, 0 or 1 to encode serially
+    uint64_t tier_threshold;    // Interpreter only: hits before function is compiled to native code, 0 to disable
+};
+
+/// AST text -> optimized IR, shared by all backends. Returns nullptr on error
+ir::code_t *compile_ast_to_ir(const char *ast_text, const compile_options_t *options);
+
+/// AST text -> x64 code, for writing ELF or for JIT execution. Returns nullptr on error
+x64::code_t *compile_ast(const char *ast_text, x64::output_t output, const compile_options_t *options);
+
+/// AST text -> x64 code for writing ELF, only functions, that are not in cache, are translated and stored there
+x64::code_t *compile_ast_incremental(const char *ast_text, const compile_options_t *options, compile_cache_t *cache);
+
+#endif //X64_TRANSLATOR_COMPILER_H
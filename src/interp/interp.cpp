@@ -0,0 +1,870 @@
+#include <assert.h>
+#include <setjmp.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "interp.h"
+#include "../x64/x64.h"
+#include "../x64/x64_stdlib.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+// Consts
+//----------------------------------------------------------------------------------------------------------------------
+
+const uint8_t REG_RAX     = 0;  // Accumulator of LOAD / STORE / *_ACC instructions
+const uint8_t REG_NONE    = 8;  // Always zero, memory operands without index register use it
+const uint8_t REGS_COUNT  = 9;
+
+const size_t NO_FUNC = SIZE_MAX;
+
+// Conditions are listed in this order in every conditional op group
+#define INTERP_CONDS(COND) COND(E) COND(NE) COND(A) COND(AE) COND(B) COND(BE)
+
+#define INTERP_OPS(OP)                                                                              \
+    OP(PUSH_IMM)    OP(PUSH_REG)    OP(PUSH_MEM)    OP(POP_REG)     OP(POP_MEM)                     \
+    OP(ADD)         OP(SUB)         OP(MUL)         OP(DIV)         OP(AND)         OP(OR)          \
+    OP(INP)         OP(OUT)         OP(OUT_RAW)     OP(SQRT)        OP(HALT)                        \
+    OP(JMP)         OP(CALL)        OP(RET)                                                         \
+    OP(JE)          OP(JNE)         OP(JA)          OP(JAE)         OP(JB)          OP(JBE)         \
+    OP(SETE)        OP(SETNE)       OP(SETA)        OP(SETAE)       OP(SETB)        OP(SETBE)       \
+    OP(CMOVE)       OP(CMOVNE)      OP(CMOVA)       OP(CMOVAE)      OP(CMOVB)       OP(CMOVBE)      \
+    OP(LOAD_IMM)    OP(LOAD_REG)    OP(LOAD_MEM)    OP(STORE_MEM)                                   \
+    OP(ADD_ACC_IMM) OP(ADD_ACC_REG) OP(ADD_ACC_MEM)                                                 \
+    OP(SUB_ACC_IMM) OP(SUB_ACC_REG) OP(SUB_ACC_MEM)                                                 \
+    OP(MUL_ACC_REG) OP(MUL_ACC_MEM) OP(LEA_ACC_MEM)                                                 \
+    /* Superinstructions */                                                                         \
+    OP(REG_ADD_IMM)         /* push reg; push imm; add/sub; pop reg  (frame switch around calls) */ \
+    OP(PUSH_MEM_ADD_IMM)    /* push [m]; push imm; add/sub                                       */ \
+    OP(MEM_ADD_IMM)         /* load [m]; add_acc imm; store [m2]     (counters)                  */ \
+    OP(CMP_MEM_IMM_JE)  OP(CMP_MEM_IMM_JNE) OP(CMP_MEM_IMM_JA)  /* push [m]; push imm; jcc       */ \
+    OP(CMP_MEM_IMM_JAE) OP(CMP_MEM_IMM_JB)  OP(CMP_MEM_IMM_JBE) /* (loop conditions)             */ \
+    /* Tiering */                                                                                   \
+    OP(CALL_COUNTED)        /* call, that counts hits of callee                                  */ \
+    OP(CALL_NATIVE)         /* call of callee's native code                                      */ \
+    OP(COUNT_BACK_EDGE)     /* before back edge jump of function's loop                          */ \
+    OP(NOP)                 /* counter of function, that is already native                       */
+
+//----------------------------------------------------------------------------------------------------------------------
+// Types
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace interp {
+    enum op_kind_t {
+#define OP_KIND(name) name,
+        INTERP_OPS(OP_KIND)
+#undef OP_KIND
+    };
+
+    enum cond_t {
+#define COND_KIND(name) COND_##name,
+        INTERP_CONDS(COND_KIND)
+#undef COND_KIND
+    };
+
+    /// Where program was decoded from, used only while decoding
+    struct decoder_t {
+        const ir::instruction_t **instructions;
+        size_t size;
+        bool *is_jump_target;
+
+        size_t *op_targets;     // IR index of destination for each jump op
+        const void *const *handlers;
+
+        const ir::func_range_t *funcs;
+        size_t *func_at;        // Function containing each IR instruction or NO_FUNC, only when tiering
+
+        bool raw_output;
+    };
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Static Prototypes
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace interp {
+    static void execute(program_t *self, const void *const **handlers);
+
+    static result_t decode(program_t *self, const ir::code_t *ir_code);
+    static size_t decode_one(decoder_t *decoder, size_t index, op_t *op, size_t *target);
+    static size_t decode_superinstruction(decoder_t *decoder, size_t index, op_t *op, size_t *target);
+    static size_t decode_cond_jump(decoder_t *decoder, size_t index, cond_t *cond);
+
+    static bool can_fuse(const decoder_t *decoder, size_t index, size_t count);
+    static bool is_push_imm(const ir::instruction_t *instruct);
+    static void set_mem_operand(op_t *op, const ir::instruction_t *instruct);
+    static int64_t fixed_imm(const ir::instruction_t *instruct);
+
+    static result_t map_with_guard(uint8_t **buf, size_t size, size_t guard_offset);
+
+    static size_t *map_funcs(const ir::code_t *ir_code);
+    static void add_tier_counter(program_t *self, decoder_t *decoder, size_t index, size_t target);
+    static void tier_up(program_t *self, size_t func);
+}
+
+/**
+ * @brief Run native code of function on interpreter's stack and registers
+ *
+ * @return New top of interpreter's stack: it holds function result, as after interpreted call
+ */
+extern "C" uint64_t *interp_call_native(const uint8_t *entry, uint64_t *sp, uint64_t *regs, uint8_t *ram);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Public
+//----------------------------------------------------------------------------------------------------------------------
+
+interp::program_t *interp::program_new(ir::code_t *ir_code, size_t ram_size, bool raw_output,
+                                       uint64_t tier_threshold) {
+    assert (ir_code && "Invalid pointer");
+    assert (ram_size % STACK_GUARD_SIZE == 0 && "RAM size must be page aligned");
+
+    program_t *self = (program_t *) calloc(1, sizeof(program_t));
+    if (!self) { return nullptr; }
+
+    self->ram_size       = ram_size;
+    self->raw_output     = raw_output;
+    self->tier_threshold = tier_threshold;
+
+    if (tier_threshold) {
+        self->ir_code = ir_code;
+        self->funcs   = (tier_func_t *) calloc(ir_code->funcs_count + 1, sizeof(tier_func_t));
+        if (!self->funcs) {
+            free(self);
+            return nullptr;
+        }
+    }
+
+    // Guard page after RAM, as in native code, and below stack, that grows down
+    if (map_with_guard(&self->ram_buf,   ram_size   + x64::RAM_GUARD_SIZE, ram_size) == result_t::ERROR ||
+        map_with_guard(&self->stack_buf, STACK_SIZE + STACK_GUARD_SIZE,    0)        == result_t::ERROR ||
+        decode(self, ir_code) == result_t::ERROR) {
+        program_delete(self);
+        return nullptr;
+    }
+
+    return self;
+}
+
+void interp::program_delete(program_t *self) {
+    if (!self) { return; }
+
+    if (self->ram_buf)   { munmap(self->ram_buf,   self->ram_size + x64::RAM_GUARD_SIZE); }
+    if (self->stack_buf) { munmap(self->stack_buf, STACK_SIZE + STACK_GUARD_SIZE); }
+
+    if (self->native)       { x64::code_delete(self->native); }
+    if (self->owns_ir_code) { ir::code_delete(self->ir_code); }
+
+    free(self->funcs);
+    free(self->ops);
+    free(self);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+interp::program_t *interp::compile(const char *ast_text, const compile_options_t *options) {
+    assert (ast_text && options && "Invalid pointers");
+
+    ir::code_t *ir_code = compile_ast_to_ir(ast_text, options);
+    if (!ir_code) { return nullptr; }
+
+    program_t *self = program_new(ir_code, x64::choose_ram_size(options->ram_size, ir_code), options->raw_output,
+                                  options->tier_threshold);
+
+    // Tiered program compiles native code from IR later
+    if (self && options->tier_threshold) {
+        self->owns_ir_code = true;
+    } else {
+        ir::code_delete(ir_code);
+    }
+
+    return self;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+result_t interp::run(program_t *self, const x64::jit_io_t *io) {
+    assert (self && "Invalid pointer");
+
+    jmp_buf halt;
+    const x64::stdlib_hooks_t hooks = {
+            .input  = (io) ? io->input  : nullptr,
+            .output = (io) ? io->output : nullptr,
+            .ctx    = (io) ? io->ctx    : nullptr,
+            .halt   = &halt
+    };
+
+    // Pages of previous run are dropped, they are zero again on next touch
+    if (madvise(self->ram_buf, self->ram_size, MADV_DONTNEED) != 0) {
+        log (ERROR, "Failed to reset interpreter RAM");
+        return result_t::ERROR;
+    }
+
+    const x64::stdlib_hooks_t *prev_hooks = x64::stdlib_set_hooks(&hooks);
+
+    // Program always ends with HALT, that longjmps back here
+    if (setjmp(halt) == 0) {
+        execute(self, nullptr);
+    }
+
+    x64::stdlib_set_hooks(prev_hooks);
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Execution
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline uint64_t load(const uint8_t *addr) {
+    uint64_t value = 0;
+    memcpy(&value, addr, sizeof(value)); // Frame base is multiple of 100, so accesses may be unaligned
+    return value;
+}
+
+static inline void store(uint8_t *addr, uint64_t value) {
+    memcpy(addr, &value, sizeof(value));
+}
+
+// Comparisons are signed, as native jg / jl / setg / cmovg are
+#define CMP_E(  lhs, rhs) ((int64_t) (lhs) == (int64_t) (rhs))
+#define CMP_NE( lhs, rhs) ((int64_t) (lhs) != (int64_t) (rhs))
+#define CMP_A(  lhs, rhs) ((int64_t) (lhs) >  (int64_t) (rhs))
+#define CMP_AE( lhs, rhs) ((int64_t) (lhs) >= (int64_t) (rhs))
+#define CMP_B(  lhs, rhs) ((int64_t) (lhs) <  (int64_t) (rhs))
+#define CMP_BE( lhs, rhs) ((int64_t) (lhs) <= (int64_t) (rhs))
+
+/**
+ * @brief Run decoded program from its first op until HALT
+ *
+ * @param handlers If not nullptr, only table of handler addresses (indexed by op_kind_t) is returned through it:
+ *                 labels are local to this function, while decoder needs them
+ */
+static void interp::execute(program_t *self, const void *const **handlers) {
+#define HANDLER_ADDR(name) &&handler_##name,
+    static const void *const HANDLERS[] = { INTERP_OPS(HANDLER_ADDR) };
+#undef HANDLER_ADDR
+
+    if (handlers) {
+        *handlers = HANDLERS;
+        return;
+    }
+
+    uint64_t regs[REGS_COUNT] = {};
+    uint8_t *const ram = self->ram_buf;
+    uint64_t *sp = (uint64_t *) (self->stack_buf + STACK_GUARD_SIZE + STACK_SIZE);
+    const op_t *op = self->ops;
+
+#define DISPATCH()  goto *op->handler
+#define NEXT()      { ++op; DISPATCH(); }
+#define MEM()       (ram + regs[op->reg]  + op->disp)
+#define MEM2()      (ram + regs[op->reg2] + op->disp2)
+#define PUSH(value) { uint64_t pushed_ = (value); *--sp = pushed_; }
+#define POP()       (*sp++)
+
+    DISPATCH();
+
+    // Stack
+
+    handler_PUSH_IMM: PUSH((uint64_t) op->value);   NEXT();
+    handler_PUSH_REG: PUSH(regs[op->reg]);          NEXT();
+    handler_PUSH_MEM: PUSH(load(MEM()));            NEXT();
+    handler_POP_REG:  regs[op->reg] = POP();        NEXT();
+    handler_POP_MEM:  store(MEM(), POP());          NEXT();
+
+    // Arithmetic, top of stack is right operand
+
+    handler_ADD: { uint64_t rhs = POP(); *sp += rhs; NEXT(); }
+    handler_SUB: { uint64_t rhs = POP(); *sp -= rhs; NEXT(); }
+    handler_AND: { uint64_t rhs = POP(); *sp &= rhs; NEXT(); }
+    handler_OR:  { uint64_t rhs = POP(); *sp |= rhs; NEXT(); }
+
+    // Intermediate products are 128-bit, as rdx:rax of imul
+    handler_MUL: {
+        int64_t rhs = (int64_t) POP();
+        *sp = (uint64_t) (int64_t) ((__int128) (int64_t) *sp * rhs / FIXED_PRECISION_MULTIPLIER);
+        NEXT();
+    }
+
+    handler_DIV: {
+        int64_t rhs = (int64_t) POP();
+        *sp = (uint64_t) (int64_t) ((__int128) (int64_t) *sp * FIXED_PRECISION_MULTIPLIER / rhs);
+        NEXT();
+    }
+
+    // Stdlib
+
+    handler_INP:     PUSH((uint64_t) x64::stdlib_inp());     NEXT();
+    handler_OUT:     x64::stdlib_out    ((int64_t) POP());   NEXT();
+    handler_OUT_RAW: x64::stdlib_out_raw((int64_t) POP());   NEXT();
+    handler_SQRT:    *sp = x64::stdlib_sqrt(*sp);            NEXT();
+    handler_HALT:    x64::stdlib_halt();
+
+    // Control flow, return address is pointer to next op
+
+    handler_JMP:  op = op->target;                                  DISPATCH();
+    handler_CALL: PUSH((uint64_t) (op + 1)); op = op->target;       DISPATCH();
+    handler_RET:  op = (const op_t *) POP();                        DISPATCH();
+
+#define COND_HANDLERS(cond)                                                             \
+    handler_J##cond: {                                                                  \
+        uint64_t rhs = POP();                                                           \
+        uint64_t lhs = POP();                                                           \
+        op = (CMP_##cond(lhs, rhs)) ? op->target : op + 1;                              \
+        DISPATCH();                                                                     \
+    }                                                                                   \
+                                                                                        \
+    handler_SET##cond: {                                                                \
+        uint64_t rhs = POP();                                                           \
+        *sp = (CMP_##cond(*sp, rhs)) ? FIXED_PRECISION_MULTIPLIER : 0;                  \
+        NEXT();                                                                         \
+    }                                                                                   \
+                                                                                        \
+    handler_CMOV##cond: {                                                               \
+        uint64_t else_value = POP();                                                    \
+        uint64_t then_value = POP();                                                    \
+        uint64_t rhs        = POP();                                                    \
+        *sp = (CMP_##cond(*sp, rhs)) ? then_value : else_value;                         \
+        NEXT();                                                                         \
+    }                                                                                   \
+                                                                                        \
+    handler_CMP_MEM_IMM_J##cond:                                                        \
+        op = (CMP_##cond(load(MEM()), op->value)) ? op->target : op + 1;                \
+        DISPATCH();
+
+    INTERP_CONDS(COND_HANDLERS)
+#undef COND_HANDLERS
+
+    // Accumulator
+
+    handler_LOAD_IMM:    regs[REG_RAX]  = (uint64_t) op->value;                         NEXT();
+    handler_LOAD_REG:    regs[REG_RAX]  = regs[op->reg];                                NEXT();
+    handler_LOAD_MEM:    regs[REG_RAX]  = load(MEM());                                  NEXT();
+    handler_STORE_MEM:   store(MEM(), regs[REG_RAX]);                                   NEXT();
+    handler_ADD_ACC_IMM: regs[REG_RAX] += (uint64_t) op->value;                         NEXT();
+    handler_ADD_ACC_REG: regs[REG_RAX] += regs[op->reg];                                NEXT();
+    handler_ADD_ACC_MEM: regs[REG_RAX] += load(MEM());                                  NEXT();
+    handler_SUB_ACC_IMM: regs[REG_RAX] -= (uint64_t) op->value;                         NEXT();
+    handler_SUB_ACC_REG: regs[REG_RAX] -= regs[op->reg];                                NEXT();
+    handler_SUB_ACC_MEM: regs[REG_RAX] -= load(MEM());                                  NEXT();
+    handler_MUL_ACC_REG: regs[REG_RAX]  = regs[op->reg] * (uint64_t) op->value;         NEXT();
+    handler_MUL_ACC_MEM: regs[REG_RAX]  = load(MEM())   * (uint64_t) op->value;         NEXT();
+    handler_LEA_ACC_MEM: regs[REG_RAX] += load(MEM())   * (uint64_t) op->value;         NEXT();
+
+    // Superinstructions
+
+    handler_REG_ADD_IMM:      regs[op->reg] += (uint64_t) op->value;                    NEXT();
+    handler_PUSH_MEM_ADD_IMM: PUSH(load(MEM()) + (uint64_t) op->value);                 NEXT();
+    handler_MEM_ADD_IMM: {
+        regs[REG_RAX] = load(MEM()) + (uint64_t) op->value;
+        store(MEM2(), regs[REG_RAX]);
+        NEXT();
+    }
+
+    // Tiering, op value is function index
+
+    handler_CALL_COUNTED:
+        if (++self->funcs[op->value].hits >= self->tier_threshold) {
+            tier_up(self, (size_t) op->value);  // Patches this op too
+            DISPATCH();
+        }
+
+        PUSH((uint64_t) (op + 1));
+        op = op->target;
+        DISPATCH();
+
+    handler_CALL_NATIVE:
+        sp = interp_call_native(self->funcs[op->value].native_entry, sp, regs, ram);
+        NEXT();
+
+    // There is no on-stack replacement: running call finishes in interpreter, next ones are native
+    handler_COUNT_BACK_EDGE:
+        if (++self->funcs[op->value].hits >= self->tier_threshold) {
+            tier_up(self, (size_t) op->value);
+        }
+        NEXT();
+
+    handler_NOP: NEXT();
+
+#undef DISPATCH
+#undef NEXT
+#undef MEM
+#undef MEM2
+#undef PUSH
+#undef POP
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Decoding
+//----------------------------------------------------------------------------------------------------------------------
+
+static result_t interp::decode(program_t *self, const ir::code_t *ir_code) {
+    decoder_t decoder = {.size = ir_code->size, .funcs = ir_code->funcs, .raw_output = self->raw_output};
+    execute(nullptr, &decoder.handlers);
+
+    // Ops never outnumber IR instructions (twice with back edge counters), last op is HALT for jumps to end of code
+    size_t ops_capacity = (self->tier_threshold) ? 2 * ir_code->size + 1 : ir_code->size + 1;
+
+    self->ops              = (op_t *)  calloc(ops_capacity, sizeof(op_t));
+    decoder.instructions   = (const ir::instruction_t **) calloc(ir_code->size + 1, sizeof(ir::instruction_t *));
+    decoder.is_jump_target = (bool *)   calloc(ir_code->size + 1, sizeof(bool));
+    decoder.op_targets     = (size_t *) calloc(ops_capacity, sizeof(size_t));
+    decoder.func_at        = (self->tier_threshold) ? map_funcs(ir_code) : nullptr;
+    size_t *ir_to_op       = (size_t *) calloc(ir_code->size + 1, sizeof(size_t));
+
+    result_t res = (self->ops && decoder.instructions && decoder.is_jump_target && decoder.op_targets && ir_to_op &&
+                    (decoder.func_at || !self->tier_threshold)) ? result_t::OK : result_t::ERROR;
+
+    size_t index = 0;
+    for (const ir::instruction_t *instruct = ir_code->instructions; instruct && res == result_t::OK;
+                                  instruct = instruct->next) {
+        decoder.instructions[index++] = instruct;
+
+        if (ir::is_jump(instruct->type) && instruct->imm_arg <= ir_code->size) {
+            decoder.is_jump_target[instruct->imm_arg] = true;
+        }
+    }
+
+    // Superinstructions don't span jump targets, so every target starts its own op
+    for (index = 0; index < ir_code->size && res == result_t::OK; ) {
+        ir_to_op[index] = self->ops_count;
+
+        size_t target = SIZE_MAX;
+        size_t decoded = decode_one(&decoder, index, &self->ops[self->ops_count], &target);
+        if (!decoded) {
+            log (ERROR, "Interpreter: unsupported IR instruction %zu", index);
+            res = result_t::ERROR;
+            break;
+        }
+
+        if (self->tier_threshold && target <= ir_code->size) {
+            add_tier_counter(self, &decoder, index, target);
+        }
+
+        decoder.op_targets[self->ops_count++] = target;
+        index += decoded;
+    }
+
+    if (res == result_t::OK) {
+        ir_to_op[ir_code->size] = self->ops_count;
+        self->ops[self->ops_count++].handler = decoder.handlers[HALT];
+
+        for (size_t i = 0; i < self->ops_count; ++i) {
+            if (decoder.op_targets[i] <= ir_code->size) {
+                self->ops[i].target = &self->ops[ir_to_op[decoder.op_targets[i]]];
+            }
+        }
+
+        log (INFO, "Interpreter: %zu IR instructions decoded into %zu ops", ir_code->size, self->ops_count);
+    }
+
+    free(decoder.instructions);
+    free(decoder.is_jump_target);
+    free(decoder.op_targets);
+    free(decoder.func_at);
+    free(ir_to_op);
+
+    return res;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#define SET_KIND(kind) op->handler = decoder->handlers[kind]
+
+/// Decode instruction at `index` (with following ones, if they form superinstruction). Returns number of them, 0 on error
+static size_t interp::decode_one(decoder_t *decoder, size_t index, op_t *op, size_t *target) {
+    size_t fused = decode_superinstruction(decoder, index, op, target);
+    if (fused) { return fused; }
+
+    const ir::instruction_t *instruct = decoder->instructions[index];
+    op->reg   = (instruct->need_reg_arg) ? instruct->reg_num : REG_NONE;
+    op->value = fixed_imm(instruct);
+
+    bool is_mem = instruct->need_mem_arg;
+    bool is_reg = !is_mem && instruct->need_reg_arg;
+
+    if (is_mem) {
+        set_mem_operand(op, instruct);
+    }
+
+    cond_t cond = COND_E;
+    size_t jump_size = decode_cond_jump(decoder, index, &cond);
+    if (jump_size) {
+        SET_KIND((int) JE + cond);
+        *target = decoder->instructions[index + jump_size - 1]->imm_arg;
+        return jump_size;
+    }
+
+    switch (instruct->type) {
+        case ir::instruction_type_t::PUSH: SET_KIND((is_mem) ? PUSH_MEM : (is_reg) ? PUSH_REG : PUSH_IMM); break;
+        case ir::instruction_type_t::POP:
+            if (!is_mem && !is_reg) { return 0; }
+            SET_KIND((is_mem) ? POP_MEM : POP_REG);
+            break;
+
+        case ir::instruction_type_t::ADD:  SET_KIND(ADD);  break;
+        case ir::instruction_type_t::SUB:  SET_KIND(SUB);  break;
+        case ir::instruction_type_t::MUL:  SET_KIND(MUL);  break;
+        case ir::instruction_type_t::DIV:  SET_KIND(DIV);  break;
+        case ir::instruction_type_t::AND:  SET_KIND(AND);  break;
+        case ir::instruction_type_t::OR:   SET_KIND(OR);   break;
+
+        case ir::instruction_type_t::INP:  SET_KIND(INP);  break;
+        case ir::instruction_type_t::OUT:  SET_KIND((decoder->raw_output) ? OUT_RAW : OUT); break;
+        case ir::instruction_type_t::SQRT: SET_KIND(SQRT); break;
+        case ir::instruction_type_t::HALT: SET_KIND(HALT); break;
+        case ir::instruction_type_t::RET:  SET_KIND(RET);  break;
+
+        case ir::instruction_type_t::JMP:
+        case ir::instruction_type_t::CALL:
+            SET_KIND((instruct->type == ir::instruction_type_t::JMP) ? JMP : CALL);
+            *target = instruct->imm_arg;
+            break;
+
+        case ir::instruction_type_t::SETE:   SET_KIND(SETE);   break;
+        case ir::instruction_type_t::SETNE:  SET_KIND(SETNE);  break;
+        case ir::instruction_type_t::SETA:   SET_KIND(SETA);   break;
+        case ir::instruction_type_t::SETAE:  SET_KIND(SETAE);  break;
+        case ir::instruction_type_t::SETB:   SET_KIND(SETB);   break;
+        case ir::instruction_type_t::SETBE:  SET_KIND(SETBE);  break;
+
+        case ir::instruction_type_t::CMOVE:  SET_KIND(CMOVE);  break;
+        case ir::instruction_type_t::CMOVNE: SET_KIND(CMOVNE); break;
+        case ir::instruction_type_t::CMOVA:  SET_KIND(CMOVA);  break;
+        case ir::instruction_type_t::CMOVAE: SET_KIND(CMOVAE); break;
+        case ir::instruction_type_t::CMOVB:  SET_KIND(CMOVB);  break;
+        case ir::instruction_type_t::CMOVBE: SET_KIND(CMOVBE); break;
+
+        case ir::instruction_type_t::LOAD:    SET_KIND((is_mem) ? LOAD_MEM    : (is_reg) ? LOAD_REG    : LOAD_IMM);    break;
+        case ir::instruction_type_t::ADD_ACC: SET_KIND((is_mem) ? ADD_ACC_MEM : (is_reg) ? ADD_ACC_REG : ADD_ACC_IMM); break;
+        case ir::instruction_type_t::SUB_ACC: SET_KIND((is_mem) ? SUB_ACC_MEM : (is_reg) ? SUB_ACC_REG : SUB_ACC_IMM); break;
+
+        case ir::instruction_type_t::STORE:
+            if (!is_mem) { return 0; }
+            SET_KIND(STORE_MEM);
+            break;
+
+        case ir::instruction_type_t::MUL_ACC:
+            if (!is_mem && !is_reg) { op->reg = REG_RAX; }      // `imul rax, rax, k` without operand
+            op->value = instruct->scale_arg;
+            SET_KIND((is_mem) ? MUL_ACC_MEM : MUL_ACC_REG);
+            break;
+
+        case ir::instruction_type_t::LEA_ACC:
+            if (!is_mem) { return 0; }
+            op->value = instruct->scale_arg;
+            SET_KIND(LEA_ACC_MEM);
+            break;
+
+        // Conditional jumps are decoded by decode_cond_jump above
+        case ir::instruction_type_t::JE:
+        case ir::instruction_type_t::JNE:
+        case ir::instruction_type_t::JA:
+        case ir::instruction_type_t::JAE:
+        case ir::instruction_type_t::JB:
+        case ir::instruction_type_t::JBE:
+
+        case ir::instruction_type_t::INC:
+        case ir::instruction_type_t::DEC:
+        case ir::instruction_type_t::SIN:
+        case ir::instruction_type_t::COS:
+        default:
+            return 0;
+    }
+
+    return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static size_t interp::decode_superinstruction(decoder_t *decoder, size_t index, op_t *op, size_t *target) {
+    const ir::instruction_t *const *instructions = decoder->instructions + index;
+    const ir::instruction_t *first = instructions[0];
+
+    using ir::instruction_type_t;
+
+    // push reg; push imm; add/sub; pop reg
+    if (can_fuse(decoder, index, 4) && first->type == instruction_type_t::PUSH && first->need_reg_arg &&
+        !first->need_mem_arg && is_push_imm(instructions[1]) &&
+        (instructions[2]->type == instruction_type_t::ADD || instructions[2]->type == instruction_type_t::SUB) &&
+        instructions[3]->type == instruction_type_t::POP && instructions[3]->need_reg_arg &&
+        !instructions[3]->need_mem_arg && instructions[3]->reg_num == first->reg_num) {
+        SET_KIND(REG_ADD_IMM);
+        op->reg   = first->reg_num;
+        op->value = fixed_imm(instructions[1]);
+        if (instructions[2]->type == instruction_type_t::SUB) { op->value = (int64_t) (0 - (uint64_t) op->value); }
+        return 4;
+    }
+
+    // load [m]; add_acc/sub_acc imm; store [m2]
+    if (can_fuse(decoder, index, 3) && first->type == instruction_type_t::LOAD && first->need_mem_arg &&
+        (instructions[1]->type == instruction_type_t::ADD_ACC || instructions[1]->type == instruction_type_t::SUB_ACC) &&
+        !instructions[1]->need_mem_arg && !instructions[1]->need_reg_arg &&
+        instructions[2]->type == instruction_type_t::STORE && instructions[2]->need_mem_arg) {
+        SET_KIND(MEM_ADD_IMM);
+        set_mem_operand(op, first);
+
+        op_t dst = {};
+        set_mem_operand(&dst, instructions[2]);
+        op->reg2  = dst.reg;
+        op->disp2 = dst.disp;
+
+        op->value = fixed_imm(instructions[1]);
+        if (instructions[1]->type == instruction_type_t::SUB_ACC) { op->value = (int64_t) (0 - (uint64_t) op->value); }
+        return 3;
+    }
+
+    if (!(first->type == instruction_type_t::PUSH && first->need_mem_arg) || !can_fuse(decoder, index, 3) ||
+        !is_push_imm(instructions[1])) {
+        return 0;
+    }
+
+    set_mem_operand(op, first);
+    op->value = fixed_imm(instructions[1]);
+
+    // push [m]; push imm; jcc (or setcc; push 0; je / jne)
+    cond_t cond = COND_E;
+    size_t jump_size = decode_cond_jump(decoder, index + 2, &cond);
+    if (jump_size) {
+        SET_KIND((int) CMP_MEM_IMM_JE + cond);
+        *target = decoder->instructions[index + 2 + jump_size - 1]->imm_arg;
+        return 2 + jump_size;
+    }
+
+    // push [m]; push imm; add/sub
+    if (instructions[2]->type == instruction_type_t::ADD || instructions[2]->type == instruction_type_t::SUB) {
+        SET_KIND(PUSH_MEM_ADD_IMM);
+        if (instructions[2]->type == instruction_type_t::SUB) { op->value = (int64_t) (0 - (uint64_t) op->value); }
+        return 3;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Recognize conditional jump at `index`: jcc itself or `setcc; push 0; je / jne`, that converter emits for
+ *        conditions of `if` and `while`
+ *
+ * @return Number of instructions (0 if it is not conditional jump), jump target is argument of the last one
+ */
+static size_t interp::decode_cond_jump(decoder_t *decoder, size_t index, cond_t *cond) {
+    if (index >= decoder->size) {
+        return 0;
+    }
+
+    using ir::instruction_type_t;
+    const ir::instruction_t *first = decoder->instructions[index];
+
+    if (first->type == instruction_type_t::JE)  { *cond = COND_E;  return 1; }
+    if (first->type == instruction_type_t::JNE) { *cond = COND_NE; return 1; }
+    if (first->type == instruction_type_t::JA)  { *cond = COND_A;  return 1; }
+    if (first->type == instruction_type_t::JAE) { *cond = COND_AE; return 1; }
+    if (first->type == instruction_type_t::JB)  { *cond = COND_B;  return 1; }
+    if (first->type == instruction_type_t::JBE) { *cond = COND_BE; return 1; }
+
+    if (!can_fuse(decoder, index, 3) || !is_push_imm(decoder->instructions[index + 1]) ||
+        decoder->instructions[index + 1]->imm_arg != 0) {
+        return 0;
+    }
+
+    instruction_type_t jump_type = decoder->instructions[index + 2]->type;
+    if (jump_type != instruction_type_t::JE && jump_type != instruction_type_t::JNE) {
+        return 0;
+    }
+
+    // `je` jumps when condition is false (result is 0), so condition is inverted
+    bool is_inverted = (jump_type == instruction_type_t::JE);
+
+    if (first->type == instruction_type_t::SETE)  { *cond = (is_inverted) ? COND_NE : COND_E;  return 3; }
+    if (first->type == instruction_type_t::SETNE) { *cond = (is_inverted) ? COND_E  : COND_NE; return 3; }
+    if (first->type == instruction_type_t::SETA)  { *cond = (is_inverted) ? COND_BE : COND_A;  return 3; }
+    if (first->type == instruction_type_t::SETAE) { *cond = (is_inverted) ? COND_B  : COND_AE; return 3; }
+    if (first->type == instruction_type_t::SETB)  { *cond = (is_inverted) ? COND_AE : COND_B;  return 3; }
+    if (first->type == instruction_type_t::SETBE) { *cond = (is_inverted) ? COND_A  : COND_BE; return 3; }
+
+    return 0;
+}
+
+#undef SET_KIND
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Instructions [index, index + count) exist and only the first of them may be jump target
+static bool interp::can_fuse(const decoder_t *decoder, size_t index, size_t count) {
+    if (index + count > decoder->size) {
+        return false;
+    }
+
+    for (size_t i = index + 1; i < index + count; ++i) {
+        if (decoder->is_jump_target[i]) { return false; }
+    }
+
+    return true;
+}
+
+static bool interp::is_push_imm(const ir::instruction_t *instruct) {
+    return instruct->type == ir::instruction_type_t::PUSH && instruct->need_imm_arg &&
+           !instruct->need_mem_arg && !instruct->need_reg_arg;
+}
+
+/// RAM + index register + imm * 8, as x64 backend addresses memory
+static void interp::set_mem_operand(op_t *op, const ir::instruction_t *instruct) {
+    op->reg  = (instruct->need_reg_arg) ? instruct->reg_num : REG_NONE;
+    op->disp = (instruct->need_imm_arg) ? (int32_t) (uint32_t) (instruct->imm_arg * sizeof(uint64_t)) : 0;
+}
+
+/// Immediate is sign extended imm32 in native code
+static int64_t interp::fixed_imm(const ir::instruction_t *instruct) {
+    return (int32_t) (uint32_t) (instruct->imm_arg * FIXED_PRECISION_MULTIPLIER);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Tiering
+//----------------------------------------------------------------------------------------------------------------------
+
+static size_t *interp::map_funcs(const ir::code_t *ir_code) {
+    size_t *func_at = (size_t *) calloc(ir_code->size + 1, sizeof(size_t));
+    if (!func_at) { return nullptr; }
+
+    for (size_t i = 0; i <= ir_code->size; ++i) {
+        func_at[i] = NO_FUNC;
+    }
+
+    for (size_t func = 0; func < ir_code->funcs_count; ++func) {
+        for (size_t i = ir_code->funcs[func].begin; i < ir_code->funcs[func].end; ++i) {
+            func_at[i] = func;
+        }
+    }
+
+    return func_at;
+}
+
+/// Make last decoded op count hits of function: calls of it and back edges of its loops
+static void interp::add_tier_counter(program_t *self, decoder_t *decoder, size_t index, size_t target) {
+    op_t *op = &self->ops[self->ops_count];
+
+    if (op->handler == decoder->handlers[CALL]) {
+        size_t func = decoder->func_at[target];
+
+        if (func != NO_FUNC && decoder->funcs[func].begin == target) {
+            op->handler = decoder->handlers[CALL_COUNTED];
+            op->value   = (int64_t) func;
+        }
+
+        return;
+    }
+
+    size_t func = decoder->func_at[index];
+    if (func == NO_FUNC || target > index || target < decoder->funcs[func].begin) {
+        return;
+    }
+
+    // Counter goes before jump, so jumps to this instruction pass through it too
+    self->ops[self->ops_count + 1] = *op;
+    *op = {.handler = decoder->handlers[COUNT_BACK_EDGE], .value = (int64_t) func};
+
+    decoder->op_targets[self->ops_count++] = SIZE_MAX;
+}
+
+/// Compile native code if it is not done yet and redirect calls of function to it
+static void interp::tier_up(program_t *self, size_t func) {
+    const void *const *handlers = nullptr;
+    execute(nullptr, &handlers);
+
+    tier_func_t *tier_func = &self->funcs[func];
+    tier_func->is_tiered_up = true;
+
+    // Whole program is encoded at once, so native functions call each other directly
+    if (!self->native && !self->is_native_failed) {
+        self->native = x64::code_new(x64::output_t::JIT, self->ram_size);
+
+        if (self->native) {
+            self->native->raw_output = self->raw_output;
+
+            if (x64::translate_from_ir(self->native, self->ir_code) == result_t::ERROR) {
+                x64::code_delete(self->native);
+                self->native = nullptr;
+            }
+        }
+
+        if (!self->native) {
+            log (WARN, "Failed to compile native code, program stays interpreted");
+            self->is_native_failed = true;
+        }
+    }
+
+    if (self->native) {
+        tier_func->native_entry = self->native->exec_buf +
+                                  addr_transl_translate(self->native->addr_transl, self->ir_code->funcs[func].begin);
+    }
+
+    for (size_t i = 0; i < self->ops_count; ++i) {
+        op_t *op = &self->ops[i];
+        if (op->value != (int64_t) func) { continue; }
+
+        if (op->handler == handlers[CALL_COUNTED]) {
+            op->handler = handlers[(self->native) ? CALL_NATIVE : CALL];
+        } else if (op->handler == handlers[COUNT_BACK_EDGE]) {
+            op->handler = handlers[NOP];
+        }
+    }
+
+    log (DEBUG, "Interpreter: function %lu tiered up", self->ir_code->funcs[func].func);
+}
+
+// Host's callee-saved registers are saved, as native code uses rbx and r12. Host stack pointer is kept in r15
+asm (R"(
+    .text
+    .type interp_call_native, @function
+interp_call_native:
+    pushq %rbx
+    pushq %rbp
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+
+    movq  %rsp, %r15
+    movq  %rdx, %r14
+    movq  %rdi, %r11
+    movq  %rsi, %rsp
+    movq  %rcx, %r8
+
+    movq   0(%r14), %rax
+    movq   8(%r14), %rcx
+    movq  16(%r14), %rdx
+    movq  24(%r14), %rbx
+    movq  40(%r14), %rbp
+    movq  48(%r14), %rsi
+    movq  56(%r14), %rdi
+
+    callq *%r11
+
+    movq  %rax,  0(%r14)
+    movq  %rcx,  8(%r14)
+    movq  %rdx, 16(%r14)
+    movq  %rbx, 24(%r14)
+    movq  %rbp, 40(%r14)
+    movq  %rsi, 48(%r14)
+    movq  %rdi, 56(%r14)
+
+    movq  %rsp, %rax
+    movq  %r15, %rsp
+
+    popq  %r15
+    popq  %r14
+    popq  %r13
+    popq  %r12
+    popq  %rbp
+    popq  %rbx
+    ret
+    .size interp_call_native, .-interp_call_native
+)");
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static result_t interp::map_with_guard(uint8_t **buf, size_t size, size_t guard_offset) {
+    *buf = (uint8_t *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (*buf == MAP_FAILED) {
+        *buf = nullptr;
+        return result_t::ERROR;
+    }
+
+    return (mprotect(*buf + guard_offset, x64::RAM_GUARD_SIZE, PROT_NONE) == 0) ? result_t::OK : result_t::ERROR;
+}
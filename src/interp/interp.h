@@ -0,0 +1,76 @@
+#ifndef X64_TRANSLATOR_INTERP_H
+#define X64_TRANSLATOR_INTERP_H
+
+#include <stdint.h>
+#include "../common.h"
+#include "../compiler.h"
+#include "../ir/ir.h"
+#include "../x64/x64.h"
+#include "../x64/x64_jit.h"
+
+namespace interp {
+    const size_t STACK_SIZE       = 8 * 1024 * 1024;  // Same as default native stack limit
+    const size_t STACK_GUARD_SIZE = 4096;             // Inaccessible page below stack, so overflow faults as natively
+
+    const uint64_t DEFAULT_TIER_UP_THRESHOLD = 1000;  // Calls and loop iterations before function is compiled
+
+    /// Decoded IR instruction or superinstruction. Handlers jump straight to next op's handler (direct threading)
+    struct op_t {
+        const void *handler;
+
+        int64_t value;      // Fixed point immediate or integer scale
+        int64_t disp;       // Memory operand: RAM + regs[reg] + disp
+        int64_t disp2;      // Second memory operand of superinstructions: RAM + regs[reg2] + disp2
+        uint8_t reg;
+        uint8_t reg2;
+
+        const op_t *target; // Jump and call destination
+    };
+
+    /// Function, that is interpreted until it gets hot. Then its calls are patched to native code
+    struct tier_func_t {
+        uint64_t hits;              // Calls and back edges of its loops
+        const uint8_t *native_entry;
+        bool is_tiered_up;
+    };
+
+    /// Compiled program, that can be run any number of times
+    struct program_t {
+        op_t *ops;
+        size_t ops_count;
+
+        uint64_t tier_threshold;    // 0 if program is only interpreted
+        tier_func_t *funcs;         // Same order as ir_code->funcs
+        ir::code_t *ir_code;        // Native code is compiled from it on first tier up
+        bool owns_ir_code;
+        x64::code_t *native;        // Whole program in JIT buffer, only functions are entered
+        bool is_native_failed;
+
+        uint8_t *ram_buf;
+        size_t ram_size;    // Usable bytes, guard page follows them as in native code
+
+        uint8_t *stack_buf; // Values and return addresses share one stack, as in native code
+
+        bool raw_output;
+    };
+
+    /**
+     * @brief Decode IR for execution
+     *
+     * @param tier_threshold Hits of function before it is compiled to native code, 0 to only interpret.
+     *                       When it is set, `ir_code` must outlive program
+     *
+     * @note Semantics match native code: fixed point values, memory layout and stdlib calls are the same.
+     *       Registers are changed only by IR instructions that name them (native code also clobbers scratch ones)
+     */
+    program_t *program_new(ir::code_t *ir_code, size_t ram_size, bool raw_output, uint64_t tier_threshold);
+    void program_delete(program_t *self);
+
+    /// Compile AST text up to IR and decode it, tiering is set by options->tier_threshold. Returns nullptr on error
+    program_t *compile(const char *ast_text, const compile_options_t *options);
+
+    /// Run program until HALT and return to caller, I/O is the same as in x64::jit_run()
+    result_t run(program_t *self, const x64::jit_io_t *io);
+}
+
+#endif //X64_TRANSLATOR_INTERP_H
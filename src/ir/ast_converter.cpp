@@ -16,6 +16,13 @@ enum passes {
 };
 
 const int DEFAULT_VARS_CAPACITY       = 16;
+const int DEFAULT_FRAME_GRAPH_CAPACITY = 16;
+
+enum frame_state_t {
+    FRAME_NOT_VISITED = 0,
+    FRAME_IN_PROGRESS,
+    FRAME_DONE,
+};
 
 
 // -------------------------------------------------------------------------------------------------
@@ -33,6 +40,11 @@ namespace ir {
     static void emit_instruction_write(code_t *self, instruction_t *ir_instruct);
 
     static bool start_new_pass(converter_t *converter);
+
+    static result_t frame_graph_ctor(frame_graph_t *self);
+    static void frame_graph_dtor(frame_graph_t *self);
+    static size_t estimate_ram_size(const frame_graph_t *graph);
+    static bool frame_depth(const frame_graph_t *graph, uint index, frame_state_t *states, uint64_t *depths);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -54,6 +66,10 @@ result_t ir::from_ast(ir::code_t *self, const tree::tree_t *tree) {
         need_another_pass = start_new_pass(converter);
     }
 
+    register_func_frame(converter, GLOBAL_FRAME, (uint) converter->frame_size);
+    self->ram_size        = estimate_ram_size(&converter->frame_graph);
+    self->top_level_frame = (uint64_t) converter->frame_size * FIXED_PRECISION_MULTIPLIER;
+
     converter_delete(converter);
     return result_t::OK;
 }
@@ -103,6 +119,58 @@ void ir::register_function_label(converter_t *converter, uint64_t func_num) {
 
 // -------------------------------------------------------------------------------------------------
 
+void ir::register_func_frame(converter_t *converter, uint64_t func_num, uint vars_count) {
+    if (converter->pass_index != PASS_INDEX_TO_WRITE) {
+        return;
+    }
+
+    frame_graph_t *graph = &converter->frame_graph;
+
+    if (graph->frames_size == graph->frames_capacity) {
+        graph->frames = (func_frame_t *) realloc (graph->frames, 2 * graph->frames_capacity * sizeof (func_frame_t));
+        graph->frames_capacity *= 2;
+    }
+
+    graph->frames[graph->frames_size++] = {.func = func_num, .size = vars_count * sizeof (uint64_t)};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Function body is [begin, current end of code)
+result_t ir::register_func_range(converter_t *converter, code_t *ir_code, uint64_t func_num, size_t begin,
+                                 uint args_count) {
+    if (converter->pass_index != PASS_INDEX_TO_WRITE) {
+        return result_t::OK;
+    }
+
+    const func_range_t range = {.func = func_num, .begin = begin, .end = ir_code->size, .args_count = args_count};
+    return code_add_func(ir_code, &range);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void ir::register_call(converter_t *converter, uint64_t callee_num) {
+    if (converter->pass_index != PASS_INDEX_TO_WRITE) {
+        return;
+    }
+
+    frame_graph_t *graph = &converter->frame_graph;
+
+    if (graph->calls_size == graph->calls_capacity) {
+        graph->calls = (call_site_t *) realloc (graph->calls, 2 * graph->calls_capacity * sizeof (call_site_t));
+        graph->calls_capacity *= 2;
+    }
+
+    // Frame index register is increased by frame size as fixed point value, see convert_func_call
+    graph->calls[graph->calls_size++] = {
+        .caller = (converter->in_func) ? converter->cur_func : GLOBAL_FRAME,
+        .callee = callee_num,
+        .offset = (uint64_t) converter->frame_size * FIXED_PRECISION_MULTIPLIER
+    };
+}
+
+// -------------------------------------------------------------------------------------------------
+
 void ir::update_last_instruction_args(converter_t *converter, code_t *ir_code, instruction_t *instruction) {
     if (converter->pass_index == PASS_INDEX_TO_WRITE) {
         ir_code->last_instruction->need_reg_arg = instruction->need_reg_arg;
@@ -132,6 +200,11 @@ static ir::converter_t *ir::converter_new() {
     self->indexed_label_transl = addr_transl_new();
     self->func_label_transl    = addr_transl_new();
 
+    if (frame_graph_ctor(&self->frame_graph) == result_t::ERROR) {
+        converter_delete(self);
+        return nullptr;
+    }
+
     return self;
 }
 
@@ -143,6 +216,7 @@ static void ir::converter_delete(converter_t *self) {
         vars_dtor(&self->local_vars);
         addr_transl_delete(self->indexed_label_transl);
         addr_transl_delete(self->func_label_transl);
+        frame_graph_dtor(&self->frame_graph);
 
         free(self);
     }
@@ -200,3 +274,95 @@ static bool ir::start_new_pass(converter_t *converter) {
 
     return false;
 }
+
+// -------------------------------------------------------------------------------------------------
+
+static result_t ir::frame_graph_ctor(frame_graph_t *self) {
+    assert(self);
+
+    self->calls  = (call_site_t  *) calloc (DEFAULT_FRAME_GRAPH_CAPACITY, sizeof (call_site_t));
+    self->frames = (func_frame_t *) calloc (DEFAULT_FRAME_GRAPH_CAPACITY, sizeof (func_frame_t));
+    if (!self->calls || !self->frames) { return result_t::ERROR; }
+
+    self->calls_size      = 0;
+    self->calls_capacity  = DEFAULT_FRAME_GRAPH_CAPACITY;
+    self->frames_size     = 0;
+    self->frames_capacity = DEFAULT_FRAME_GRAPH_CAPACITY;
+
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void ir::frame_graph_dtor(frame_graph_t *self) {
+    assert (self != nullptr && "invalid pointer");
+
+    free(self->calls);
+    free(self->frames);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Deepest RAM byte used by global code and its calls, 0 if call graph has cycles
+static size_t ir::estimate_ram_size(const frame_graph_t *graph) {
+    assert (graph != nullptr && "invalid pointer");
+
+    frame_state_t *states = (frame_state_t *) calloc (graph->frames_size, sizeof (frame_state_t));
+    uint64_t      *depths = (uint64_t      *) calloc (graph->frames_size, sizeof (uint64_t));
+
+    size_t ram_size = 0;
+
+    if (states && depths) {
+        // Global frame is registered last
+        uint global_index = graph->frames_size - 1;
+        assert (graph->frames[global_index].func == GLOBAL_FRAME);
+
+        if (frame_depth(graph, global_index, states, depths)) {
+            ram_size = depths[global_index];
+        } else {
+            log (INFO, "Recursive calls: RAM size can't be estimated statically");
+        }
+    }
+
+    free(states);
+    free(depths);
+    return ram_size;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool ir::frame_depth(const frame_graph_t *graph, uint index, frame_state_t *states, uint64_t *depths) {
+    if (states[index] == FRAME_DONE)        { return true;  }
+    if (states[index] == FRAME_IN_PROGRESS) { return false; }
+
+    states[index] = FRAME_IN_PROGRESS;
+
+    const uint64_t func = graph->frames[index].func;
+    uint64_t depth = graph->frames[index].size;
+
+    for (uint i = 0; i < graph->calls_size; ++i) {
+        const call_site_t *call = &graph->calls[i];
+        if (call->caller != func) {
+            continue;
+        }
+
+        for (uint callee = 0; callee < graph->frames_size; ++callee) {
+            if (graph->frames[callee].func != call->callee) {
+                continue;
+            }
+
+            if (!frame_depth(graph, callee, states, depths)) {
+                return false;
+            }
+
+            if (call->offset + depths[callee] > depth) {
+                depth = call->offset + depths[callee];
+            }
+            break;
+        }
+    }
+
+    states[index] = FRAME_DONE;
+    depths[index] = depth;
+    return true;
+}
@@ -12,6 +12,31 @@ namespace ir {
         unsigned int capacity;
     };
 
+    const uint64_t GLOBAL_FRAME = UINT64_MAX;   // Caller of calls from top level code
+
+    /// Callee frame starts `offset` bytes above caller frame
+    struct call_site_t {
+        uint64_t caller;
+        uint64_t callee;
+        uint64_t offset;
+    };
+
+    struct func_frame_t {
+        uint64_t func;
+        uint64_t size;  // Bytes of frame slots
+    };
+
+    /// Call graph with frame sizes, collected on write pass to estimate RAM usage
+    struct frame_graph_t {
+        call_site_t *calls;
+        uint calls_size;
+        uint calls_capacity;
+
+        func_frame_t *frames;
+        uint frames_size;
+        uint frames_capacity;
+    };
+
     struct converter_t {
         vars_t global_vars;
         vars_t local_vars;
@@ -19,6 +44,9 @@ namespace ir {
         bool in_func;
         int global_frame_size_store;
         int frame_size;
+        uint64_t cur_func;
+
+        frame_graph_t frame_graph;
 
         uint cur_label_index;
 
@@ -35,12 +63,21 @@ namespace ir {
     uint get_label_index(converter_t *converter);
     void register_numeric_label (converter_t *converter, uint64_t label_num);
     void register_function_label(converter_t *converter, uint64_t func_num);
+    void register_func_frame(converter_t *converter, uint64_t func_num, uint vars_count);
+    result_t register_func_range(converter_t *converter, code_t *ir_code, uint64_t func_num, size_t begin,
+                                 uint args_count);
+    void register_call(converter_t *converter, uint64_t callee_num);
     void update_last_instruction_args(converter_t *converter, code_t *ir_code, instruction_t *instruction);
 
     // From ast_converter_generators.cpp
     result_t subtree_convert(converter_t *converter, tree::node_t * node, code_t * ir_code, bool result_used = true);
     void emit_code_begin(converter_t *converter, code_t *ir_code);
     void emit_code_end  (converter_t *converter, code_t *ir_code);
+    result_t get_var_code(converter_t *converter, int var_num, code_t *ir_code);
+
+    // From ast_converter_selector.cpp
+    bool is_selectable_expr(tree::node_t *node);
+    result_t select_expr(converter_t *converter, tree::node_t *node, code_t *ir_code);
 
 }
 
@@ -5,14 +5,7 @@
 // Consts
 // -------------------------------------------------------------------------------------------------
 
-enum REGISTERS {
-    REG_RAX = 0,
-    REG_RBX = 1,
-    REG_RCX = 2,
-    REG_RDX = 3,
-};
-
-const int BASE_MEM_REG = REG_RDX;
+const int BASE_MEM_REG = ir::REG_RDX;
 
 // -------------------------------------------------------------------------------------------------
 // Prototypes
@@ -21,6 +14,7 @@ const int BASE_MEM_REG = REG_RDX;
 namespace ir {
     static result_t convert_op              (converter_t *converter, tree::node_t *node, code_t *ir_code);
     static result_t convert_if              (converter_t *converter, tree::node_t *node, code_t *ir_code);
+    static result_t convert_if_to_cmov      (converter_t *converter, tree::node_t *node, code_t *ir_code);
     static result_t convert_while           (converter_t *converter, tree::node_t *node, code_t *ir_code);
     static result_t convert_func_call       (converter_t *converter, tree::node_t *node, code_t *ir_code);
     static result_t convert_func_def        (converter_t *converter, tree::node_t *node, code_t *ir_code);
@@ -28,15 +22,22 @@ namespace ir {
     static result_t convert_and             (converter_t *converter, tree::node_t *node, code_t *ir_code);
     static result_t convert_or              (converter_t *converter, tree::node_t *node, code_t *ir_code);
     static result_t convert_logical_operands(converter_t *converter, tree::node_t *node, code_t *ir_code);
+    static result_t convert_short_circuit   (converter_t *converter, tree::node_t *node, code_t *ir_code, bool is_and);
+    static result_t convert_boolified       (converter_t *converter, tree::node_t *node, code_t *ir_code);
+
+    static bool is_pure_and_cheap(tree::node_t *node);
+    static bool is_boolean_expr  (tree::node_t *node);
+    static bool is_cmov_convertible(tree::node_t *node);
+    static tree::node_t *get_single_statement(tree::node_t *block);
+    static instruction_type_t get_cmov_type(tree::op_t comparator);
 
     static int convert_func_call_args(converter_t *converter, tree::node_t *node, code_t *ir_code);
     static int convert_func_def_args (converter_t *converter, tree::node_t *node, code_t *ir_code);
 
-    static void emit_push_true_false(converter_t *converter, instruction_type_t jmp_type, code_t *ir_code);
     static void emit_out(converter_t *converter, code_t *ir_code);
     static result_t emit_assig(converter_t *converter, uint64_t var_num, code_t *ir_code);
+    static void emit_ret_with_result(converter_t *converter, code_t *ir_code);
 
-    static result_t get_var_code(converter_t *converter, int var_num, code_t *ir_code);
     static void register_var(converter_t *converter, int var_num);
 
     static void clear_local_vars (converter_t *converter);
@@ -81,6 +82,44 @@ void ir::emit_code_end(converter_t *converter, code_t *ir_code) {
 
 // -------------------------------------------------------------------------------------------------
 
+result_t ir::get_var_code(converter_t *converter, int var_num, code_t *ir_code) {
+    assert (converter   != nullptr && "Invalid pointer");
+    assert (ir_code != nullptr && "Invalid pointer");
+
+    instruction_t new_instruction = {};
+
+    for (unsigned int i = 0; i < converter->local_vars.size; ++i) {
+        if (converter->local_vars.name_indexes[i] == var_num) {
+            new_instruction.need_mem_arg = true;
+            new_instruction.need_reg_arg = true;
+            new_instruction.need_imm_arg = true;
+            new_instruction.reg_num      = BASE_MEM_REG;
+            new_instruction.imm_arg      = i;
+
+            update_last_instruction_args(converter, ir_code, &new_instruction);
+
+            return result_t::OK;
+        }
+    }
+
+    for (unsigned int i = 0; i < converter->global_vars.size; ++i) {
+        if (converter->global_vars.name_indexes[i] == var_num) {
+            new_instruction.need_mem_arg = true;
+            new_instruction.need_reg_arg = false;
+            new_instruction.need_imm_arg = true;
+            new_instruction.imm_arg      = i;
+
+            update_last_instruction_args(converter, ir_code, &new_instruction);
+            return result_t::OK;
+        }
+    }
+
+    log (ERROR, "FAILED to get var code %d", var_num);
+    return result_t::ERROR;
+}
+
+// -------------------------------------------------------------------------------------------------
+
 result_t ir::subtree_convert(converter_t *converter, tree::node_t *node, code_t *ir_code, bool result_used) {
     assert (converter && ir_code);
 
@@ -156,12 +195,10 @@ result_t ir::subtree_convert(converter_t *converter, tree::node_t *node, code_t
     UNWRAP_ERROR(subtree_convert(converter, node->right, ir_code));  \
     EMIT_NONE(opcode);
 
-#define EMIT_PUSH_TRUE_FALSE(jump_opcode) emit_push_true_false(converter, ir::instruction_type_t::jump_opcode, ir_code)
-
 #define EMIT_COMPARATOR(opcode)                                      \
     UNWRAP_ERROR(subtree_convert(converter, node->left,  ir_code));  \
     UNWRAP_ERROR(subtree_convert(converter, node->right, ir_code));  \
-    EMIT_PUSH_TRUE_FALSE (opcode)
+    EMIT_NONE(opcode);
 
 
 result_t ir::convert_op(converter_t *converter, tree::node_t *node, code_t *ir_code) {
@@ -171,6 +208,12 @@ result_t ir::convert_op(converter_t *converter, tree::node_t *node, code_t *ir_c
 
     assert (node->type == tree::node_type_t::OP);
 
+    if (is_selectable_expr(node)) {
+        UNWRAP_ERROR(select_expr(converter, node, ir_code));  // ... rax = expr ...
+        EMIT_R(PUSH, REG_RAX);                                // push rax
+        return result_t::OK;
+    }
+
     switch ((tree::op_t) node->data)
     {
         case tree::op_t::ADD: EMIT_BINARY_OP(ADD); break;
@@ -199,6 +242,13 @@ result_t ir::convert_op(converter_t *converter, tree::node_t *node, code_t *ir_c
             break;
 
         case tree::op_t::ASSIG:
+            if (is_selectable_expr(node->right)) {
+                UNWRAP_ERROR(select_expr(converter, node->right, ir_code));    // ... rax = expr ...
+                EMIT_NONE(STORE);                                             // mov var, rax
+                UNWRAP_ERROR(get_var_code(converter, node->left->data, ir_code));
+                break;
+            }
+
             UNWRAP_ERROR(subtree_convert(converter, node->right, ir_code));
             emit_assig(converter, node->left->data, ir_code);
             break;
@@ -207,17 +257,17 @@ result_t ir::convert_op(converter_t *converter, tree::node_t *node, code_t *ir_c
             EMIT_NONE(INP);
             break;
 
-        case tree::op_t::EQ:  EMIT_COMPARATOR (JE);  break;
-        case tree::op_t::GT:  EMIT_COMPARATOR (JA);  break;
-        case tree::op_t::LT:  EMIT_COMPARATOR (JB);  break;
-        case tree::op_t::GE:  EMIT_COMPARATOR (JAE); break;
-        case tree::op_t::LE:  EMIT_COMPARATOR (JBE); break;
-        case tree::op_t::NEQ: EMIT_COMPARATOR (JNE); break;
+        case tree::op_t::EQ:  EMIT_COMPARATOR (SETE);  break;
+        case tree::op_t::GT:  EMIT_COMPARATOR (SETA);  break;
+        case tree::op_t::LT:  EMIT_COMPARATOR (SETB);  break;
+        case tree::op_t::GE:  EMIT_COMPARATOR (SETAE); break;
+        case tree::op_t::LE:  EMIT_COMPARATOR (SETBE); break;
+        case tree::op_t::NEQ: EMIT_COMPARATOR (SETNE); break;
 
         case tree::op_t::NOT:
             UNWRAP_ERROR(subtree_convert(converter, node->right, ir_code));
             EMIT_I(PUSH, 0);
-            EMIT_PUSH_TRUE_FALSE(JE);
+            EMIT_NONE(SETE);
             break;
 
         case tree::op_t::AND:
@@ -246,6 +296,10 @@ result_t ir::convert_if(converter_t *converter, tree::node_t *node, code_t *ir_c
     assert (ir_code   != nullptr && "invalid pointer");
     assert (node->type == tree::node_type_t::IF && "Invalid call");
 
+    if (is_cmov_convertible(node)) {
+        return convert_if_to_cmov(converter, node, ir_code);
+    }
+
     UNWRAP_ERROR(subtree_convert(converter, node->left, ir_code));
     EMIT_I(PUSH, 0);
 
@@ -274,6 +328,47 @@ result_t ir::convert_if(converter_t *converter, tree::node_t *node, code_t *ir_c
 
 // -------------------------------------------------------------------------------------------------
 
+/// Branchless `if`: both values are computed and one of them is selected with cmov
+result_t ir::convert_if_to_cmov(converter_t *converter, tree::node_t *node, code_t *ir_code) {
+    assert (converter && node && ir_code && "Invalid pointers");
+
+    tree::node_t *cond      = node->left;
+    tree::node_t *then_stmt = get_single_statement((node->right->left) ? node->right->left : node->right->right);
+    tree::node_t *else_stmt = (node->right->left) ? get_single_statement(node->right->right) : nullptr;
+
+    // Condition is computed first, as in branch version
+    instruction_type_t cmov_type = instruction_type_t::CMOVNE;
+    if (cond->type == tree::node_type_t::OP && get_cmov_type((tree::op_t) cond->data) != instruction_type_t::CMOVNE) {
+        UNWRAP_ERROR(subtree_convert(converter, cond->left,  ir_code));     // ... lhs of comparison ...
+        UNWRAP_ERROR(subtree_convert(converter, cond->right, ir_code));     // ... rhs of comparison ...
+        cmov_type = get_cmov_type((tree::op_t) cond->data);
+    } else {
+        UNWRAP_ERROR(subtree_convert(converter, cond, ir_code));            // ... condition ...
+        EMIT_I(PUSH, 0);                                                          // cond != 0
+    }
+
+    if (then_stmt->type == tree::node_type_t::RETURN) {
+        UNWRAP_ERROR(subtree_convert(converter, then_stmt->right, ir_code));  // ... then value ...
+        UNWRAP_ERROR(subtree_convert(converter, else_stmt->right, ir_code));  // ... else value ...
+        emit_instruction_wrapper(converter, ir_code, cmov_type, false, false, false, 0, 0);
+                                                                                    // push cond ? then : else
+        emit_ret_with_result(converter, ir_code);                                   // ret
+    } else {
+        UNWRAP_ERROR(subtree_convert(converter, then_stmt->right, ir_code));  // ... then value ...
+
+        tree::node_t *else_value = (else_stmt) ? else_stmt->right : then_stmt->left; // Triangle: var keeps value
+        UNWRAP_ERROR(subtree_convert(converter, else_value, ir_code));        // ... else value ...
+
+        emit_instruction_wrapper(converter, ir_code, cmov_type, false, false, false, 0, 0);
+                                                                                    // push cond ? then : else
+        UNWRAP_ERROR(emit_assig(converter, (uint64_t) then_stmt->left->data, ir_code)); // pop var
+    }
+
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
 result_t ir::convert_while(converter_t *converter, tree::node_t *node, code_t *ir_code) {
     assert (converter && node && ir_code && "Invalid pointers");
     assert (node->type == tree::node_type_t::WHILE && "Invalid call");
@@ -304,16 +399,20 @@ result_t ir::convert_func_def(converter_t *converter, tree::node_t *node, code_t
     converter->global_frame_size_store = converter->frame_size;
     converter->frame_size = 0;
     converter->in_func = true;
+    converter->cur_func = (uint64_t) node->data;
 
     GET_LABEL(func_def_end_label, func_def_end_ir_indx);
 
     EMIT_I (JMP, func_def_end_ir_indx);                                     // jmp func_def_end
     register_function_label(converter, node->data);               // func:
+    size_t func_begin = ir_code->size;
 
-    convert_func_def_args(converter, node->left, ir_code);            // ... load func args ...
+    int args_count = convert_func_def_args(converter, node->left, ir_code);   // ... load func args ...
     UNWRAP_ERROR(subtree_convert(converter, node->right, ir_code));   // ... func body ...
 
     register_numeric_label(converter, func_def_end_label);        // func_def_end:
+    register_func_frame(converter, (uint64_t) node->data, (uint) converter->frame_size);
+    UNWRAP_ERROR(register_func_range(converter, ir_code, (uint64_t) node->data, func_begin, (uint) args_count));
 
     converter->in_func = false;
     clear_local_vars (converter);
@@ -329,6 +428,7 @@ result_t ir::convert_func_call(converter_t *converter, tree::node_t *node, code_
     assert (node->type == tree::node_type_t::FUNC_CALL && "Invalid call");
 
     int arg_counter = convert_func_call_args(converter, node->right, ir_code);   // ... load func args into stack ...
+    register_call(converter, (uint64_t) node->data);
 
     EMIT_R(PUSH, REG_RDX);                                                             //
     EMIT_I(PUSH, converter->frame_size);                                               //
@@ -353,12 +453,7 @@ result_t ir::convert_ret(converter_t *converter, tree::node_t *node, code_t *ir_
     assert(converter && node && ir_code);
 
     UNWRAP_ERROR(subtree_convert(converter, node->right, ir_code, true)); // ... ret arg ...
-    EMIT_R(POP, REG_RAX);   //
-    EMIT_R(POP, REG_RBX);   // * Exchange ret addr and func res
-    EMIT_R(PUSH, REG_RAX);  // pop rax, rbx
-    EMIT_R(PUSH, REG_RBX);  // push rax, rbx
-
-    EMIT_NONE(RET);         // ret
+    emit_ret_with_result(converter, ir_code);
 
     return result_t::OK;
 }
@@ -438,25 +533,6 @@ static int ir::convert_func_def_args(converter_t *converter, tree::node_t *node,
 
 // -------------------------------------------------------------------------------------------------
 
-static void ir::emit_push_true_false(converter_t *converter, instruction_type_t jmp_type, code_t *ir_code) {
-    GET_LABEL(push_one_label, push_one_ir_indx);
-    GET_LABEL(end_label, end_ir_indx);
-
-    emit_instruction_wrapper(converter, ir_code, jmp_type, false, false, true,
-                                                                                        0, push_one_ir_indx);
-                                                                    // Jxx push_one
-    EMIT_I(PUSH, 0);                                                // push 0
-    EMIT_I(JMP, end_ir_indx);                                       // jmp end
-
-    register_numeric_label(converter, push_one_label);    // push_one:
-
-    EMIT_I(PUSH, 1);                                                // push 1
-
-    register_numeric_label(converter, end_label);         // end:
-}
-
-// -------------------------------------------------------------------------------------------------
-
 static void ir::emit_out(converter_t *converter, code_t *ir_code) {
     assert(converter && ir_code);
 
@@ -469,6 +545,19 @@ static void ir::emit_out(converter_t *converter, code_t *ir_code) {
 
 // -------------------------------------------------------------------------------------------------
 
+static void ir::emit_ret_with_result(converter_t *converter, code_t *ir_code) {
+    assert(converter && ir_code);
+
+    EMIT_R(POP, REG_RAX);   //
+    EMIT_R(POP, REG_RBX);   // * Exchange ret addr and func res
+    EMIT_R(PUSH, REG_RAX);  // pop rax, rbx
+    EMIT_R(PUSH, REG_RBX);  // push rax, rbx
+
+    EMIT_NONE(RET);         // ret
+}
+
+// -------------------------------------------------------------------------------------------------
+
 static result_t ir::emit_assig(converter_t *converter, uint64_t var_num, code_t *ir_code) {
     assert(converter && ir_code);
 
@@ -481,20 +570,64 @@ static result_t ir::emit_assig(converter_t *converter, uint64_t var_num, code_t
 // -------------------------------------------------------------------------------------------------
 
 static result_t ir::convert_logical_operands(converter_t *converter, tree::node_t *node, code_t *ir_code) {
-    UNWRAP_ERROR(subtree_convert(converter, node->left, ir_code));  // ... compute left operand ...
-    EMIT_I(PUSH, 0);                                                      // * boolify lhs *
-    EMIT_PUSH_TRUE_FALSE(JNE);                                            // push (lhs != 0)
-    UNWRAP_ERROR(subtree_convert(converter, node->right, ir_code)); // ... compute right operand ...
-    EMIT_I(PUSH, 0);                                                      // * boolify rhs *
-    EMIT_PUSH_TRUE_FALSE(JNE);                                            // push (rhs != 0)
+    UNWRAP_ERROR(convert_boolified(converter, node->left,  ir_code));  // push (lhs != 0)
+    UNWRAP_ERROR(convert_boolified(converter, node->right, ir_code));  // push (rhs != 0)
+
+    return result_t::OK;
 }
 
+// -------------------------------------------------------------------------------------------------
+
+static result_t ir::convert_boolified(converter_t *converter, tree::node_t *node, code_t *ir_code) {
+    UNWRAP_ERROR(subtree_convert(converter, node, ir_code));  // ... compute operand ...
+
+    if (!is_boolean_expr(node)) {
+        EMIT_I(PUSH, 0);                                            // * boolify *
+        EMIT_NONE(SETNE);                                           // push (operand != 0)
+    }
+
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static result_t ir::convert_short_circuit(converter_t *converter, tree::node_t *node, code_t *ir_code, bool is_and) {
+    GET_LABEL(short_label, short_ir_indx);
+    GET_LABEL(end_label, end_ir_indx);
+
+    // && stops at first false operand, || stops at first true one
+    instruction_type_t short_jmp = (is_and) ? instruction_type_t::JE : instruction_type_t::JNE;
+
+    UNWRAP_ERROR(subtree_convert(converter, node->left, ir_code));   // ... compute left operand ...
+    EMIT_I(PUSH, 0);                                                       //
+    emit_instruction_wrapper(converter, ir_code, short_jmp, false, false, true, 0, short_ir_indx);
+                                                                           // J(E|NE) short
+
+    UNWRAP_ERROR(subtree_convert(converter, node->right, ir_code));  // ... compute right operand ...
+    EMIT_I(PUSH, 0);                                                       //
+    emit_instruction_wrapper(converter, ir_code, short_jmp, false, false, true, 0, short_ir_indx);
+                                                                           // J(E|NE) short
+
+    EMIT_I(PUSH, (is_and) ? 1 : 0);                                        // push result if no short circuit
+    EMIT_I(JMP, end_ir_indx);                                              // jmp end
+
+    register_numeric_label(converter, short_label);              // short:
+    EMIT_I(PUSH, (is_and) ? 0 : 1);                                        // push short circuit result
+
+    register_numeric_label(converter, end_label);                // end:
+
+    return result_t::OK;
+}
 
 // -------------------------------------------------------------------------------------------------
 
 result_t ir::convert_or(converter_t *converter, tree::node_t *node, code_t *ir_code) {
-    convert_logical_operands(converter, node, ir_code);
-    EMIT_NONE(ADD); // If at least one != 0, it will be != 0
+    if (!is_pure_and_cheap(node->left) || !is_pure_and_cheap(node->right)) {
+        return convert_short_circuit(converter, node, ir_code, false);
+    }
+
+    UNWRAP_ERROR(convert_logical_operands(converter, node, ir_code));
+    EMIT_NONE(OR); // Both are boolified to 0 or 1.00 (100), so bitwise or is enough
 
     return result_t::OK;
 }
@@ -502,50 +635,171 @@ result_t ir::convert_or(converter_t *converter, tree::node_t *node, code_t *ir_c
 // -------------------------------------------------------------------------------------------------
 
 result_t ir::convert_and(converter_t *converter, tree::node_t *node, code_t *ir_code) {
-    convert_logical_operands(converter, node, ir_code);
-    EMIT_PUSH_TRUE_FALSE(JE); // If both are != 0, it will be != 0
+    if (!is_pure_and_cheap(node->left) || !is_pure_and_cheap(node->right)) {
+        return convert_short_circuit(converter, node, ir_code, true);
+    }
+
+    UNWRAP_ERROR(convert_logical_operands(converter, node, ir_code));
+    EMIT_NONE(AND); // Both are boolified to 0 or 1.00 (100), so bitwise and is enough
 
     return result_t::OK;
 }
 
-#undef EMIT_PUSH_TRUE_FALSE
+// -------------------------------------------------------------------------------------------------
+
+/// Can operand be evaluated even if it's result is not needed: no side effects, calls or traps (division)
+static bool ir::is_pure_and_cheap(tree::node_t *node) {
+    if (node == nullptr) {
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::VAL || node->type == tree::node_type_t::VAR) {
+        return true;
+    }
+
+    if (node->type != tree::node_type_t::OP) {
+        return false;
+    }
+
+    switch ((tree::op_t) node->data) {
+        case tree::op_t::ADD:
+        case tree::op_t::SUB:
+        case tree::op_t::EQ:
+        case tree::op_t::GT:
+        case tree::op_t::LT:
+        case tree::op_t::GE:
+        case tree::op_t::LE:
+        case tree::op_t::NEQ:
+        case tree::op_t::NOT:
+        case tree::op_t::AND:
+        case tree::op_t::OR:
+            return is_pure_and_cheap(node->left) && is_pure_and_cheap(node->right);
+
+        case tree::op_t::MUL:
+        case tree::op_t::DIV:
+        case tree::op_t::SQRT:
+        case tree::op_t::INPUT:
+        case tree::op_t::OUTPUT:
+        case tree::op_t::ASSIG:
+        case tree::op_t::SIN:
+        case tree::op_t::COS:
+        default:
+            return false;
+    }
+}
 
 // -------------------------------------------------------------------------------------------------
 
-static result_t ir::get_var_code(converter_t *converter, int var_num, code_t *ir_code) {
-    assert (converter   != nullptr && "Invalid pointer");
-    assert (ir_code != nullptr && "Invalid pointer");
+/// Is expression result already boolean: 0 or 1.00 (100 in fixed point)
+static bool ir::is_boolean_expr(tree::node_t *node) {
+    if (node->type != tree::node_type_t::OP) {
+        return false;
+    }
 
-    instruction_t new_instruction = {};
+    switch ((tree::op_t) node->data) {
+        case tree::op_t::EQ:
+        case tree::op_t::GT:
+        case tree::op_t::LT:
+        case tree::op_t::GE:
+        case tree::op_t::LE:
+        case tree::op_t::NEQ:
+        case tree::op_t::NOT:
+        case tree::op_t::AND:
+        case tree::op_t::OR:
+            return true;
 
-    for (unsigned int i = 0; i < converter->local_vars.size; ++i) {
-        if (converter->local_vars.name_indexes[i] == var_num) {
-            new_instruction.need_mem_arg = true;
-            new_instruction.need_reg_arg = true;
-            new_instruction.need_imm_arg = true;
-            new_instruction.reg_num      = BASE_MEM_REG;
-            new_instruction.imm_arg      = i;
+        case tree::op_t::ADD:
+        case tree::op_t::SUB:
+        case tree::op_t::MUL:
+        case tree::op_t::DIV:
+        case tree::op_t::SQRT:
+        case tree::op_t::INPUT:
+        case tree::op_t::OUTPUT:
+        case tree::op_t::ASSIG:
+        case tree::op_t::SIN:
+        case tree::op_t::COS:
+        default:
+            return false;
+    }
+}
 
-            update_last_instruction_args(converter, ir_code, &new_instruction);
+// -------------------------------------------------------------------------------------------------
 
-            return result_t::OK;
+/// Diamond (`if {x = a} else {x = b}`, `if {ret a} else {ret b}`) or triangle (`if {x = a}`) with pure values
+static bool ir::is_cmov_convertible(tree::node_t *node) {
+    assert(node->type == tree::node_type_t::IF);
+
+    bool has_else = node->right->left != nullptr;
+
+    tree::node_t *then_stmt = get_single_statement((has_else) ? node->right->left : node->right->right);
+    tree::node_t *else_stmt = (has_else) ? get_single_statement(node->right->right) : nullptr;
+
+    if (then_stmt == nullptr || (has_else && else_stmt == nullptr)) {
+        return false;
+    }
+
+    bool then_is_assig = then_stmt->type == tree::node_type_t::OP && (tree::op_t) then_stmt->data == tree::op_t::ASSIG;
+
+    if (then_is_assig) {
+        if (!is_pure_and_cheap(then_stmt->right)) {
+            return false;
+        }
+
+        if (!has_else) {
+            return true;
         }
+
+        return else_stmt->type == tree::node_type_t::OP && (tree::op_t) else_stmt->data == tree::op_t::ASSIG &&
+               else_stmt->left->data == then_stmt->left->data && is_pure_and_cheap(else_stmt->right);
     }
 
-    for (unsigned int i = 0; i < converter->global_vars.size; ++i) {
-        if (converter->global_vars.name_indexes[i] == var_num) {
-            new_instruction.need_mem_arg = true;
-            new_instruction.need_reg_arg = false;
-            new_instruction.need_imm_arg = true;
-            new_instruction.imm_arg      = i;
+    return then_stmt->type == tree::node_type_t::RETURN && has_else &&
+           else_stmt->type == tree::node_type_t::RETURN &&
+           is_pure_and_cheap(then_stmt->right) && is_pure_and_cheap(else_stmt->right);
+}
 
-            update_last_instruction_args(converter, ir_code, &new_instruction);
-            return result_t::OK;
+// -------------------------------------------------------------------------------------------------
+
+/// Returns block's statement if block consists of exactly one statement
+static tree::node_t *ir::get_single_statement(tree::node_t *block) {
+    while (block != nullptr && block->type == tree::node_type_t::FICTIOUS) {
+        if (block->left != nullptr && block->right != nullptr) {
+            return nullptr;
         }
+
+        block = (block->left) ? block->left : block->right;
     }
 
-    log (ERROR, "FAILED to get var code %d", var_num);
-    return result_t::ERROR;
+    return block;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static ir::instruction_type_t ir::get_cmov_type(tree::op_t comparator) {
+    switch (comparator) {
+        case tree::op_t::EQ:  return instruction_type_t::CMOVE;
+        case tree::op_t::GT:  return instruction_type_t::CMOVA;
+        case tree::op_t::LT:  return instruction_type_t::CMOVB;
+        case tree::op_t::GE:  return instruction_type_t::CMOVAE;
+        case tree::op_t::LE:  return instruction_type_t::CMOVBE;
+        case tree::op_t::NEQ: return instruction_type_t::CMOVNE;
+
+        case tree::op_t::ADD:
+        case tree::op_t::SUB:
+        case tree::op_t::MUL:
+        case tree::op_t::DIV:
+        case tree::op_t::SQRT:
+        case tree::op_t::INPUT:
+        case tree::op_t::OUTPUT:
+        case tree::op_t::NOT:
+        case tree::op_t::AND:
+        case tree::op_t::OR:
+        case tree::op_t::ASSIG:
+        case tree::op_t::SIN:
+        case tree::op_t::COS:
+        default:
+            return instruction_type_t::CMOVNE;
+    }
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -0,0 +1,271 @@
+#include <assert.h>
+#include "../common.h"
+#include "ir.h"
+#include "ast_converter_common.h"
+
+// -------------------------------------------------------------------------------------------------
+// Consts
+// -------------------------------------------------------------------------------------------------
+
+const int ACC_REG     = ir::REG_RAX;  // Result of selected expression
+const int SPILL_REG   = ir::REG_RBX;  // Right operand of non-tileable binary op
+
+// -------------------------------------------------------------------------------------------------
+// Types
+// -------------------------------------------------------------------------------------------------
+
+namespace ir {
+    // How expression can be used as second operand of accumulator instruction
+    enum class operand_kind_t {
+        IMM,        // `add rax, imm32`
+        MEM,        // `add rax, [var]`
+        SCALED_MEM, // `lea rax, [rax + var*scale]`
+        COMPLEX,    // needs its own register
+    };
+}
+
+// -------------------------------------------------------------------------------------------------
+// Prototypes
+// -------------------------------------------------------------------------------------------------
+
+namespace ir {
+    static result_t select_additive(converter_t *converter, tree::node_t *node, code_t *ir_code);
+    static result_t select_mul     (converter_t *converter, tree::node_t *node, code_t *ir_code);
+
+    static bool is_selectable_operand(tree::node_t *node);
+    static operand_kind_t get_operand_kind(tree::node_t *node);
+    static tree::node_t *get_const_factor(tree::node_t *mul, tree::node_t **other);
+
+    static bool is_op(tree::node_t *node, tree::op_t op);
+
+    static void emit_acc_instruction(converter_t *converter, code_t *ir_code, instruction_type_t type,
+                                     bool has_imm_arg, uint64_t imm, int32_t scale);
+    static result_t emit_acc_mem_instruction(converter_t *converter, code_t *ir_code, instruction_type_t type,
+                                             int var_num, int32_t scale);
+    static void emit_reg_instruction(converter_t *converter, code_t *ir_code, instruction_type_t type, int reg);
+}
+
+// -------------------------------------------------------------------------------------------------
+// Protected
+// -------------------------------------------------------------------------------------------------
+
+/// Arithmetic subtree (`+`, `-`, `* const` over vars and consts), which is better computed in register
+bool ir::is_selectable_expr(tree::node_t *node) {
+    if (node == nullptr || node->type != tree::node_type_t::OP) {
+        return false;
+    }
+
+    tree::node_t *factor = nullptr;
+
+    if (is_op(node, tree::op_t::MUL)) {
+        // Only `x * const` is exact without fixed point division
+        if (get_const_factor(node, &factor) == nullptr) {
+            return false;
+        }
+    } else if (!is_op(node, tree::op_t::ADD) && !is_op(node, tree::op_t::SUB)) {
+        return false;
+    }
+
+    return is_selectable_operand(node->left) && is_selectable_operand(node->right);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Maximal munch: cover expression with largest matching x64 patterns, result is left in rax
+ *
+ * @note Expression must satisfy is_selectable_expr(), so it is pure and operands can be computed in any order
+ */
+result_t ir::select_expr(converter_t *converter, tree::node_t *node, code_t *ir_code) {
+    assert (converter && node && ir_code && "Invalid pointers");
+
+    if (node->type == tree::node_type_t::VAL) {
+        emit_acc_instruction(converter, ir_code, instruction_type_t::LOAD, true, (uint64_t) node->data, 0);
+                                                                                          // mov rax, imm
+        return result_t::OK;
+    }
+
+    if (node->type == tree::node_type_t::VAR) {
+        return emit_acc_mem_instruction(converter, ir_code, instruction_type_t::LOAD, node->data, 0);
+                                                                                          // mov rax, [var]
+    }
+
+    assert (node->type == tree::node_type_t::OP && "Unexpected node in selectable expression");
+
+    if (is_op(node, tree::op_t::MUL)) {
+        return select_mul(converter, node, ir_code);
+    }
+
+    return select_additive(converter, node, ir_code);
+}
+
+// -------------------------------------------------------------------------------------------------
+// Static
+// -------------------------------------------------------------------------------------------------
+
+static result_t ir::select_additive(converter_t *converter, tree::node_t *node, code_t *ir_code) {
+    bool is_add = is_op(node, tree::op_t::ADD);
+
+    tree::node_t *lhs = node->left;
+    tree::node_t *rhs = node->right;
+
+    // Commutative: keep the one that can't be an operand on the left
+    if (is_add && get_operand_kind(rhs) == operand_kind_t::COMPLEX) {
+        tree::node_t *tmp = lhs;
+        lhs = rhs;
+        rhs = tmp;
+    }
+
+    instruction_type_t type = (is_add) ? instruction_type_t::ADD_ACC : instruction_type_t::SUB_ACC;
+    tree::node_t *scaled    = nullptr;
+
+    switch (get_operand_kind(rhs)) {
+        case operand_kind_t::IMM:
+            UNWRAP_ERROR(select_expr(converter, lhs, ir_code));                 // ... rax = lhs ...
+            emit_acc_instruction(converter, ir_code, type, true, (uint64_t) rhs->data, 0); // add/sub rax, imm
+            break;
+
+        case operand_kind_t::MEM:
+            UNWRAP_ERROR(select_expr(converter, lhs, ir_code));                 // ... rax = lhs ...
+            UNWRAP_ERROR(emit_acc_mem_instruction(converter, ir_code, type, rhs->data, 0));
+                                                                                    // add/sub rax, [var]
+            break;
+
+        case operand_kind_t::SCALED_MEM:
+            if (is_add) {
+                tree::node_t *factor = get_const_factor(rhs, &scaled);
+
+                UNWRAP_ERROR(select_expr(converter, lhs, ir_code));             // ... rax = lhs ...
+                UNWRAP_ERROR(emit_acc_mem_instruction(converter, ir_code, instruction_type_t::LEA_ACC,
+                                                      scaled->data, factor->data));
+                                                                                    // lea rax, [rax + var*scale]
+                break;
+            }
+            [[fallthrough]];
+
+        case operand_kind_t::COMPLEX:
+        default:
+            UNWRAP_ERROR(select_expr(converter, rhs, ir_code));                 // ... rax = rhs ...
+            emit_reg_instruction(converter, ir_code, instruction_type_t::PUSH, ACC_REG);   // push rax
+            UNWRAP_ERROR(select_expr(converter, lhs, ir_code));                 // ... rax = lhs ...
+            emit_reg_instruction(converter, ir_code, instruction_type_t::POP,  SPILL_REG); // pop rcx
+            emit_reg_instruction(converter, ir_code, type, SPILL_REG);                     // add/sub rax, rcx
+            break;
+    }
+
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static result_t ir::select_mul(converter_t *converter, tree::node_t *node, code_t *ir_code) {
+    tree::node_t *other  = nullptr;
+    tree::node_t *factor = get_const_factor(node, &other);
+    assert (factor && "Only multiplication by const is selectable");
+
+    // Fixed point: (x * 100) * k == x * (k * 100) / 100, so raw value is just multiplied by k
+    if (other->type == tree::node_type_t::VAR) {
+        return emit_acc_mem_instruction(converter, ir_code, instruction_type_t::MUL_ACC, other->data, factor->data);
+                                                                                    // imul rax, [var], k
+    }
+
+    UNWRAP_ERROR(select_expr(converter, other, ir_code));                       // ... rax = other ...
+    emit_acc_instruction(converter, ir_code, instruction_type_t::MUL_ACC, false, 0, factor->data);
+                                                                                    // imul rax, rax, k
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool ir::is_selectable_operand(tree::node_t *node) {
+    if (node->type == tree::node_type_t::VAR) {
+        return true;
+    }
+
+    if (node->type == tree::node_type_t::VAL) {
+        return fits_imm(node->data);
+    }
+
+    return is_selectable_expr(node);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static ir::operand_kind_t ir::get_operand_kind(tree::node_t *node) {
+    if (node->type == tree::node_type_t::VAL && fits_imm(node->data)) {
+        return operand_kind_t::IMM;
+    }
+
+    if (node->type == tree::node_type_t::VAR) {
+        return operand_kind_t::MEM;
+    }
+
+    tree::node_t *scaled = nullptr;
+    tree::node_t *factor = (is_op(node, tree::op_t::MUL)) ? get_const_factor(node, &scaled) : nullptr;
+
+    if (factor && scaled->type == tree::node_type_t::VAR &&
+        (factor->data == 2 || factor->data == 4 || factor->data == 8)) {
+        return operand_kind_t::SCALED_MEM;
+    }
+
+    return operand_kind_t::COMPLEX;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Returns VAL operand of multiplication and stores the other one to `other`, nullptr if there is no such
+static tree::node_t *ir::get_const_factor(tree::node_t *mul, tree::node_t **other) {
+    if (mul->right->type == tree::node_type_t::VAL) {
+        *other = mul->left;
+        return mul->right;
+    }
+
+    if (mul->left->type == tree::node_type_t::VAL) {
+        *other = mul->right;
+        return mul->left;
+    }
+
+    return nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool ir::is_op(tree::node_t *node, tree::op_t op) {
+    return node->type == tree::node_type_t::OP && (tree::op_t) node->data == op;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void ir::emit_acc_instruction(converter_t *converter, code_t *ir_code, instruction_type_t type,
+                                     bool has_imm_arg, uint64_t imm, int32_t scale) {
+    instruction_t instruct = {
+            .type         = type,
+            .need_imm_arg = has_imm_arg,
+            .imm_arg      = imm,
+            .scale_arg    = scale
+    };
+
+    emit_instruction(converter, ir_code, &instruct);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static result_t ir::emit_acc_mem_instruction(converter_t *converter, code_t *ir_code, instruction_type_t type,
+                                             int var_num, int32_t scale) {
+    emit_acc_instruction(converter, ir_code, type, false, 0, scale);
+    UNWRAP_ERROR(get_var_code(converter, var_num, ir_code));
+
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void ir::emit_reg_instruction(converter_t *converter, code_t *ir_code, instruction_type_t type, int reg) {
+    instruction_t instruct = {
+            .type         = type,
+            .need_reg_arg = true,
+            .reg_num      = (unsigned char) reg
+    };
+
+    emit_instruction(converter, ir_code, &instruct);
+}
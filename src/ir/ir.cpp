@@ -3,6 +3,8 @@
 #include "../common.h"
 #include "ir.h"
 
+const size_t DEFAULT_FUNCS_CAPACITY = 16;
+
 //----------------------------------------------------------------------------------------------------------------------
 // Public
 //----------------------------------------------------------------------------------------------------------------------
@@ -26,6 +28,7 @@ void ir::code_delete(code_t *self) {
         }
     }
 
+    free(self->funcs);
     free(self);
 }
 
@@ -55,6 +58,25 @@ void ir::code_insert(code_t *self, instruction_t *instruction) {
 
 //----------------------------------------------------------------------------------------------------------------------
 
+result_t ir::code_add_func(code_t *self, const func_range_t *range) {
+    assert(self && range);
+
+    if (self->funcs_count == self->funcs_capacity) {
+        size_t new_capacity = (self->funcs_capacity) ? 2 * self->funcs_capacity : DEFAULT_FUNCS_CAPACITY;
+
+        func_range_t *new_funcs = (func_range_t *) realloc(self->funcs, new_capacity * sizeof(func_range_t));
+        if (!new_funcs) { return result_t::ERROR; }
+
+        self->funcs          = new_funcs;
+        self->funcs_capacity = new_capacity;
+    }
+
+    self->funcs[self->funcs_count++] = *range;
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
 ir::instruction_t *ir::next_insruction(instruction_t *self) {
     return self->next;
 }
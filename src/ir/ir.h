@@ -1,10 +1,28 @@
 #ifndef X64_TRANSLATOR_IR_H
 #define X64_TRANSLATOR_IR_H
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include "../common.h"
 
 namespace ir {
+    /// Register numbers in reg_num of IR instructions
+    enum REGISTERS {
+        REG_RAX = 0,
+        REG_RBX = 1,
+        REG_RCX = 2,
+        REG_RDX = 3,
+    };
+
+    /// Constant is exact as imm32 in fixed point, which backend pushes
+    inline bool fits_imm(long long value) {
+        const long long limit = INT_MAX / FIXED_PRECISION_MULTIPLIER;
+        return -limit <= value && value <= limit;
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
     enum class instruction_type_t {
         PUSH = 0,
         POP,
@@ -29,8 +47,36 @@ namespace ir {
         JB,
         JA,
         JAE,
+        AND,
+        OR,
+        SETE,
+        SETNE,
+        SETBE,
+        SETB,
+        SETA,
+        SETAE,
+        CMOVE,
+        CMOVNE,
+        CMOVBE,
+        CMOVB,
+        CMOVA,
+        CMOVAE,
+        LOAD,
+        STORE,
+        ADD_ACC,
+        SUB_ACC,
+        MUL_ACC,
+        LEA_ACC,
     };
 
+    /// Instruction, which imm_arg is index of target instruction
+    inline bool is_jump(instruction_type_t type) {
+        return type == instruction_type_t::JMP || type == instruction_type_t::CALL ||
+               type == instruction_type_t::JE  || type == instruction_type_t::JNE  ||
+               type == instruction_type_t::JA  || type == instruction_type_t::JAE  ||
+               type == instruction_type_t::JB  || type == instruction_type_t::JBE;
+    }
+
 //----------------------------------------------------------------------------------------------------------------------
 
     struct instruction_t {
@@ -43,11 +89,22 @@ namespace ir {
 
         unsigned char reg_num;
         uint64_t imm_arg;
+        int32_t scale_arg;  // Integer multiplier of MUL_ACC / LEA_ACC
 
         size_t index;
         instruction_t *next;
     };
 
+//----------------------------------------------------------------------------------------------------------------------
+
+    /// Instructions [begin, end) are body of function `func`, begin is target of its calls
+    struct func_range_t {
+        uint64_t func;
+        size_t begin;
+        size_t end;
+        uint args_count;    // Stored to first slots of callee frame by caller, see convert_func_call
+    };
+
 //----------------------------------------------------------------------------------------------------------------------
 
     struct code_t {
@@ -55,6 +112,13 @@ namespace ir {
         size_t size;
 
         instruction_t *last_instruction;
+
+        size_t ram_size;    // Static estimate of RAM bytes used by globals and call frames, 0 if unbounded (recursion)
+        uint64_t top_level_frame;   // Frame register value in calls from top level code: globals size in fixed point
+
+        func_range_t *funcs;
+        size_t funcs_count;
+        size_t funcs_capacity;
     };
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -63,6 +127,7 @@ namespace ir {
     void code_delete(code_t *self);
 
     void code_insert(code_t *self, instruction_t *instruction);
+    result_t code_add_func(code_t *self, const func_range_t *range);
     ir::instruction_t *next_insruction(instruction_t *self);
 }
 
@@ -0,0 +1,490 @@
+#include <assert.h>
+#include <limits.h>
+#include "ir.h"
+#include "loop_unroller.h"
+
+// -------------------------------------------------------------------------------------------------
+// Consts
+// -------------------------------------------------------------------------------------------------
+
+const int MAX_UNROLLED_BODY_NODES = 128;// Code segment is small, so we don't unroll big loops
+const uint MAX_DERIVED_VARS       = 8;  // Max number of strength-reduced `iv * const` per loop
+
+// -------------------------------------------------------------------------------------------------
+// Types
+// -------------------------------------------------------------------------------------------------
+
+namespace ir {
+    struct unroller_t {
+        uint factor;
+        unroll_stats_t *stats;
+
+        bool *assigned_in_funcs;  // var index -> is it assigned inside some function
+        int vars_count;
+        int next_free_var;        // For derived induction vars
+    };
+
+    struct counted_loop_t {
+        int var;
+        int step;                 // Increment per iteration (without fixed precision multiplier)
+        tree::op_t cmp;           // Normalized condition: `var cmp bound`
+        tree::node_t *bound;
+        tree::node_t *increment;  // Top-level `var = var + step` statement of loop body
+    };
+
+    struct derived_var_t {
+        int var;
+        int multiplier;
+    };
+}
+
+// -------------------------------------------------------------------------------------------------
+// Prototypes
+// -------------------------------------------------------------------------------------------------
+
+namespace ir {
+    static result_t unroll_subtree(unroller_t *unroller, tree::node_t *node);
+    static bool recognize_counted_loop(unroller_t *unroller, tree::node_t *loop, counted_loop_t *loop_info);
+    static bool recognize_with_var(unroller_t *unroller, tree::node_t *loop, tree::node_t *var_node,
+                                   tree::node_t *bound, tree::op_t cmp, counted_loop_t *loop_info);
+
+    static result_t strength_reduce(unroller_t *unroller, counted_loop_t *loop_info, tree::node_t *body,
+                                    tree::node_t **init_code);
+    static void replace_iv_muls(tree::node_t *node, counted_loop_t *loop_info, derived_var_t *derived,
+                                uint *derived_count, unroller_t *unroller);
+
+    static void collect_max_var (unroller_t *unroller, tree::node_t *node);
+    static void collect_func_assigs(unroller_t *unroller, tree::node_t *node, bool in_func);
+
+    static tree::node_t *find_top_level_assig(tree::node_t *node, int var);
+    static bool get_increment_step(tree::node_t *assig, int var, int *step);
+    static int  count_assigs(tree::node_t *node, int var);
+    static int  count_nodes (tree::node_t *node);
+    static bool contains_type(tree::node_t *node, tree::node_type_t type);
+
+    static bool is_var(tree::node_t *node);
+    static bool is_op (tree::node_t *node, tree::op_t op);
+    static tree::op_t flip_comparator(tree::op_t cmp);
+    static tree::node_t *new_seq(tree::node_t *first, tree::node_t *second);
+}
+
+// -------------------------------------------------------------------------------------------------
+// Public
+// -------------------------------------------------------------------------------------------------
+
+result_t ir::unroll_loops(tree::tree_t *tree, uint factor, unroll_stats_t *stats) {
+    assert(tree && stats);
+
+    if (tree->head_node == nullptr) {
+        return result_t::OK;
+    }
+
+    unroller_t unroller = {.factor = factor, .stats = stats};
+
+    collect_max_var(&unroller, tree->head_node);
+    unroller.next_free_var = unroller.vars_count;
+
+    unroller.assigned_in_funcs = (bool *) calloc((size_t) unroller.vars_count + 1, sizeof(bool));
+    UNWRAP_NULLPTR(unroller.assigned_in_funcs);
+    collect_func_assigs(&unroller, tree->head_node, false);
+
+    result_t res = unroll_subtree(&unroller, tree->head_node);
+    free(unroller.assigned_in_funcs);
+
+    log(INFO, "Loop unroller: %u loops, %u counted, %u unrolled (factor %u), %u muls strength reduced",
+              stats->loops_total, stats->loops_counted, stats->loops_unrolled, factor, stats->muls_strength_reduced);
+
+    return res;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Static
+// -------------------------------------------------------------------------------------------------
+
+static result_t ir::unroll_subtree(unroller_t *unroller, tree::node_t *node) {
+    if (node == nullptr) {
+        return result_t::OK;
+    }
+
+    // Inner loops first
+    UNWRAP_ERROR(unroll_subtree(unroller, node->left));
+    UNWRAP_ERROR(unroll_subtree(unroller, node->right));
+
+    if (node->type != tree::node_type_t::WHILE) {
+        return result_t::OK;
+    }
+
+    unroller->stats->loops_total++;
+
+    counted_loop_t loop_info = {};
+    if (!recognize_counted_loop(unroller, node, &loop_info)) {
+        return result_t::OK;
+    }
+
+    unroller->stats->loops_counted++;
+    log(INFO, "Counted loop: var %d, step %d", loop_info.var, loop_info.step);
+
+    tree::node_t *init_code = nullptr;
+    UNWRAP_ERROR(strength_reduce(unroller, &loop_info, node->right, &init_code));
+
+    // Remainder loop is the original one
+    tree::node_t *remainder = tree::new_node(tree::node_type_t::WHILE, 0, node->left, node->right);
+    UNWRAP_NULLPTR(remainder);
+
+    tree::node_t *result = remainder;
+
+    long long lookahead = (long long) loop_info.step * ((long long) unroller->factor - 1);
+    bool can_unroll = unroller->factor > 1 && fits_imm(lookahead) &&
+                      count_nodes(remainder->right) * (long long) unroller->factor <= MAX_UNROLLED_BODY_NODES;
+
+    if (can_unroll) {
+        // Main loop condition: all `factor` iterations would run in original loop
+        tree::node_t *cond = tree::new_node(tree::node_type_t::OP, loop_info.cmp,
+                tree::new_node(tree::node_type_t::OP, tree::op_t::ADD,
+                               tree::new_node(tree::node_type_t::VAR, loop_info.var),
+                               tree::new_node(tree::node_type_t::VAL, (int) lookahead)),
+                tree::copy_subtree(loop_info.bound));
+        UNWRAP_NULLPTR(cond);
+
+        tree::node_t *body = tree::copy_subtree(remainder->right);
+        for (uint i = 1; i < unroller->factor; ++i) {
+            body = new_seq(body, tree::copy_subtree(remainder->right));
+            UNWRAP_NULLPTR(body);
+        }
+
+        tree::node_t *unrolled = tree::new_node(tree::node_type_t::WHILE, 0, cond, body);
+        UNWRAP_NULLPTR(unrolled);
+
+        result = new_seq(unrolled, remainder);
+        UNWRAP_NULLPTR(result);
+
+        unroller->stats->loops_unrolled++;
+    }
+
+    if (init_code) {
+        result = new_seq(init_code, result);
+        UNWRAP_NULLPTR(result);
+    }
+
+    // Replace loop node in place, so parent's pointer stays valid
+    tree::move_node(node, result);
+
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool ir::recognize_counted_loop(unroller_t *unroller, tree::node_t *loop, counted_loop_t *loop_info) {
+    assert(loop->type == tree::node_type_t::WHILE);
+
+    tree::node_t *cond = loop->left;
+    tree::node_t *body = loop->right;
+
+    if (cond == nullptr || body == nullptr || cond->type != tree::node_type_t::OP) {
+        return false;
+    }
+
+    tree::op_t cmp = (tree::op_t) cond->data;
+    if (cmp != tree::op_t::LT && cmp != tree::op_t::LE && cmp != tree::op_t::GT && cmp != tree::op_t::GE) {
+        return false;
+    }
+
+    // Copying these subtrees would register variables / functions twice
+    if (contains_type(body, tree::node_type_t::VAR_DEF) || contains_type(body, tree::node_type_t::FUNC_DEF)) {
+        return false;
+    }
+
+    return recognize_with_var(unroller, loop, cond->left, cond->right, cmp, loop_info) ||
+           recognize_with_var(unroller, loop, cond->right, cond->left, flip_comparator(cmp), loop_info);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool ir::recognize_with_var(unroller_t *unroller, tree::node_t *loop, tree::node_t *var_node,
+                                   tree::node_t *bound, tree::op_t cmp, counted_loop_t *loop_info) {
+    if (!is_var(var_node) || bound == nullptr) {
+        return false;
+    }
+
+    int var = var_node->data;
+    tree::node_t *body = loop->right;
+    bool has_calls = contains_type(body, tree::node_type_t::FUNC_CALL);
+
+    // Bound must be loop invariant
+    if (is_var(bound)) {
+        if (bound->data == var || count_assigs(body, bound->data) != 0) {
+            return false;
+        }
+
+        if (has_calls && unroller->assigned_in_funcs[bound->data]) {
+            return false;
+        }
+    } else if (bound->type != tree::node_type_t::VAL) {
+        return false;
+    }
+
+    // Induction var is changed only once per iteration
+    if (count_assigs(body, var) != 1 || (has_calls && unroller->assigned_in_funcs[var])) {
+        return false;
+    }
+
+    tree::node_t *increment = find_top_level_assig(body, var);
+    int step = 0;
+    if (!increment || !get_increment_step(increment, var, &step)) {
+        return false;
+    }
+
+    bool increasing = (cmp == tree::op_t::LT || cmp == tree::op_t::LE);
+    if ((increasing && step <= 0) || (!increasing && step >= 0)) {
+        return false;
+    }
+
+    loop_info->var       = var;
+    loop_info->step      = step;
+    loop_info->cmp       = cmp;
+    loop_info->bound     = bound;
+    loop_info->increment = increment;
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static result_t ir::strength_reduce(unroller_t *unroller, counted_loop_t *loop_info, tree::node_t *body,
+                                    tree::node_t **init_code) {
+    derived_var_t derived[MAX_DERIVED_VARS] = {};
+    uint derived_count = 0;
+
+    replace_iv_muls(body, loop_info, derived, &derived_count, unroller);
+
+    tree::node_t *increment = loop_info->increment;
+
+    for (uint i = 0; i < derived_count; ++i) {
+        int var = derived[i].var;
+
+        // let derived = var * multiplier  (before loop)
+        tree::node_t *init = new_seq(tree::new_node(tree::node_type_t::VAR_DEF, var),
+                tree::new_node(tree::node_type_t::OP, tree::op_t::ASSIG,
+                               tree::new_node(tree::node_type_t::VAR, var),
+                               tree::new_node(tree::node_type_t::OP, tree::op_t::MUL,
+                                              tree::new_node(tree::node_type_t::VAR, loop_info->var),
+                                              tree::new_node(tree::node_type_t::VAL, derived[i].multiplier))));
+        UNWRAP_NULLPTR(init);
+        *init_code = (*init_code) ? new_seq(*init_code, init) : init;
+        UNWRAP_NULLPTR(*init_code);
+
+        // derived = derived + step * multiplier  (right after iv increment)
+        tree::node_t *update = tree::new_node(tree::node_type_t::OP, tree::op_t::ASSIG,
+                tree::new_node(tree::node_type_t::VAR, var),
+                tree::new_node(tree::node_type_t::OP, tree::op_t::ADD,
+                               tree::new_node(tree::node_type_t::VAR, var),
+                               tree::new_node(tree::node_type_t::VAL, loop_info->step * derived[i].multiplier)));
+        UNWRAP_NULLPTR(update);
+
+        tree::node_t *increment_copy = tree::new_node(increment->type, increment->data,
+                                                      increment->left, increment->right);
+        UNWRAP_NULLPTR(increment_copy);
+
+        tree::change_node(increment, tree::node_type_t::FICTIOUS, 0);
+        increment->left  = increment_copy;
+        increment->right = update;
+    }
+
+    unroller->stats->muls_strength_reduced += derived_count;
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void ir::replace_iv_muls(tree::node_t *node, counted_loop_t *loop_info, derived_var_t *derived,
+                                uint *derived_count, unroller_t *unroller) {
+    if (node == nullptr || node == loop_info->increment) {
+        return;
+    }
+
+    replace_iv_muls(node->left,  loop_info, derived, derived_count, unroller);
+    replace_iv_muls(node->right, loop_info, derived, derived_count, unroller);
+
+    if (!is_op(node, tree::op_t::MUL) || !node->left || !node->right) {
+        return;
+    }
+
+    tree::node_t *const_node = nullptr;
+    if (is_var(node->left) && node->left->data == loop_info->var && node->right->type == tree::node_type_t::VAL) {
+        const_node = node->right;
+    } else if (is_var(node->right) && node->right->data == loop_info->var &&
+               node->left->type == tree::node_type_t::VAL) {
+        const_node = node->left;
+    } else {
+        return;
+    }
+
+    int multiplier = const_node->data;
+    if (!fits_imm((long long) multiplier * loop_info->step)) {
+        return;
+    }
+
+    uint derived_index = 0;
+    while (derived_index < *derived_count && derived[derived_index].multiplier != multiplier) {
+        derived_index++;
+    }
+
+    if (derived_index == *derived_count) {
+        if (*derived_count == MAX_DERIVED_VARS) {
+            return;
+        }
+
+        derived[derived_index].var        = unroller->next_free_var++;
+        derived[derived_index].multiplier = multiplier;
+        (*derived_count)++;
+    }
+
+    tree::del_childs(node);
+    tree::change_node(node, tree::node_type_t::VAR, derived[derived_index].var);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void ir::collect_max_var(unroller_t *unroller, tree::node_t *node) {
+    if (node == nullptr) {
+        return;
+    }
+
+    if (node->type == tree::node_type_t::VAR || node->type == tree::node_type_t::VAR_DEF) {
+        if (node->data >= unroller->vars_count) {
+            unroller->vars_count = node->data + 1;
+        }
+    }
+
+    collect_max_var(unroller, node->left);
+    collect_max_var(unroller, node->right);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void ir::collect_func_assigs(unroller_t *unroller, tree::node_t *node, bool in_func) {
+    if (node == nullptr) {
+        return;
+    }
+
+    in_func = in_func || node->type == tree::node_type_t::FUNC_DEF;
+
+    if (in_func && is_op(node, tree::op_t::ASSIG) && is_var(node->left) && node->left->data >= 0) {
+        unroller->assigned_in_funcs[node->left->data] = true;
+    }
+
+    collect_func_assigs(unroller, node->left,  in_func);
+    collect_func_assigs(unroller, node->right, in_func);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static tree::node_t *ir::find_top_level_assig(tree::node_t *node, int var) {
+    if (node == nullptr) {
+        return nullptr;
+    }
+
+    if (node->type == tree::node_type_t::FICTIOUS) {
+        tree::node_t *found = find_top_level_assig(node->left, var);
+        return (found) ? found : find_top_level_assig(node->right, var);
+    }
+
+    if (is_op(node, tree::op_t::ASSIG) && is_var(node->left) && node->left->data == var) {
+        return node;
+    }
+
+    return nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool ir::get_increment_step(tree::node_t *assig, int var, int *step) {
+    tree::node_t *expr = assig->right;
+    if (expr == nullptr || expr->left == nullptr || expr->right == nullptr) {
+        return false;
+    }
+
+    if (is_op(expr, tree::op_t::ADD)) {
+        if (is_var(expr->left) && expr->left->data == var && expr->right->type == tree::node_type_t::VAL) {
+            *step = expr->right->data;
+            return true;
+        }
+
+        if (is_var(expr->right) && expr->right->data == var && expr->left->type == tree::node_type_t::VAL) {
+            *step = expr->left->data;
+            return true;
+        }
+    }
+
+    if (is_op(expr, tree::op_t::SUB) && expr->right->data != INT_MIN) {
+        if (is_var(expr->left) && expr->left->data == var && expr->right->type == tree::node_type_t::VAL) {
+            *step = -expr->right->data;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int ir::count_assigs(tree::node_t *node, int var) {
+    if (node == nullptr) {
+        return 0;
+    }
+
+    int count = (is_op(node, tree::op_t::ASSIG) && is_var(node->left) && node->left->data == var) ? 1 : 0;
+
+    return count + count_assigs(node->left, var) + count_assigs(node->right, var);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static int ir::count_nodes(tree::node_t *node) {
+    if (node == nullptr) {
+        return 0;
+    }
+
+    return 1 + count_nodes(node->left) + count_nodes(node->right);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool ir::contains_type(tree::node_t *node, tree::node_type_t type) {
+    if (node == nullptr) {
+        return false;
+    }
+
+    return node->type == type || contains_type(node->left, type) || contains_type(node->right, type);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static bool ir::is_var(tree::node_t *node) {
+    return node != nullptr && node->type == tree::node_type_t::VAR;
+}
+
+static bool ir::is_op(tree::node_t *node, tree::op_t op) {
+    return node != nullptr && node->type == tree::node_type_t::OP && (tree::op_t) node->data == op;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static tree::op_t ir::flip_comparator(tree::op_t cmp) {
+    if (cmp == tree::op_t::LT) { return tree::op_t::GT; }
+    if (cmp == tree::op_t::GT) { return tree::op_t::LT; }
+    if (cmp == tree::op_t::LE) { return tree::op_t::GE; }
+    if (cmp == tree::op_t::GE) { return tree::op_t::LE; }
+
+    return cmp;  // Symmetric (==, !=) or not a comparator
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static tree::node_t *ir::new_seq(tree::node_t *first, tree::node_t *second) {
+    if (first == nullptr || second == nullptr) {
+        return nullptr;
+    }
+
+    return tree::new_node(tree::node_type_t::FICTIOUS, 0, first, second);
+}
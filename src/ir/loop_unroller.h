@@ -0,0 +1,27 @@
+#ifndef X64_TRANSLATOR_LOOP_UNROLLER_H
+#define X64_TRANSLATOR_LOOP_UNROLLER_H
+
+#include "../common.h"
+#include "../lib/tree.h"
+
+namespace ir {
+    const uint DEFAULT_UNROLL_FACTOR = 4;
+    const uint MAX_UNROLL_FACTOR     = 64;  // Unrolled body is limited to 128 nodes, so bigger ones are never applied
+
+    struct unroll_stats_t {
+        uint loops_total;           // All while loops in program
+        uint loops_counted;         // Loops with recognized induction variable
+        uint loops_unrolled;        // Counted loops that were actually unrolled
+        uint muls_strength_reduced; // `iv * const` expressions replaced with derived induction vars
+    };
+
+    /**
+     * @brief Recognize counted while loops (`(bound < iv) while { ... ; step + iv = iv }`), strength reduce
+     *        induction variable multiplications in their bodies and unroll them by `factor` with remainder loop
+     *
+     * @param factor Unroll factor, values < 2 disable unrolling (strength reduction is still applied)
+     */
+    result_t unroll_loops(tree::tree_t *tree, uint factor, unroll_stats_t *stats);
+}
+
+#endif //X64_TRANSLATOR_LOOP_UNROLLER_H
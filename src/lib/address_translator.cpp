@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <string.h>
 #include "../common.h"
 #include "log.h"
 #include "address_translator.h"
@@ -12,6 +13,7 @@ const int START_CAPACITY = 16;
 //----------------------------------------------------------------------------------------------------------------------
 
 static result_t addr_transl_resize(addr_transl_t *self);
+static size_t addr_transl_lower_bound(const addr_transl_t *self, uint64_t old_addr);
 
 //----------------------------------------------------------------------------------------------------------------------
 // Public
@@ -43,51 +45,51 @@ result_t addr_transl_insert(addr_transl_t* self, uint64_t old_addr, uint64_t new
     //TODO Тут будут двойные вставки, мб стоит их исключить
     // Или какой-нибудь #ifdef PARANOID пройтись по массиву и сверить что новый новый = старый новый
 
-    self->mappings[self->size].old_addr = old_addr;
-    self->mappings[self->size].new_addr = new_addr;
+    // Addresses mostly come in ascending order, so it is usually append
+    size_t pos = self->size;
+    if (pos > 0 && self->mappings[pos - 1].old_addr > old_addr) {
+        pos = addr_transl_lower_bound(self, old_addr);
 
-    self->size++;
+        // Earlier translation of the same address wins, as with linear search
+        while (pos < self->size && self->mappings[pos].old_addr == old_addr) {
+            pos++;
+        }
 
-    return result_t::OK;
-}
+        memmove(self->mappings + pos + 1, self->mappings + pos, (self->size - pos) * sizeof (mapping_t));
+    }
 
-//----------------------------------------------------------------------------------------------------------------------
+    self->mappings[pos].old_addr = old_addr;
+    self->mappings[pos].new_addr = new_addr;
 
-uint64_t addr_transl_translate(addr_transl_t* self, uint64_t old_addr) {
-    for (size_t i = 0; i < self->size; ++i) {
-        if (self->mappings[i].old_addr == old_addr) {
-            return self->mappings[i].new_addr;
-        }
-    }
+    self->size++;
 
-    log(DEBUG, "Failed to translate addr %d", old_addr);
-    return ERROR;
+    return result_t::OK;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-result_t addr_transl_remember_old_addr(addr_transl_t* self, uint64_t old_addr) {
-    if (self->old_addr_is_stored) {
-        log(ERROR, "Trying to remember old addr, but struct is already holding one...");
-        return result_t::ERROR;
+result_t addr_transl_set(addr_transl_t* self, uint64_t old_addr, uint64_t new_addr) {
+    size_t pos = addr_transl_lower_bound(self, old_addr);
+
+    if (pos < self->size && self->mappings[pos].old_addr == old_addr) {
+        self->mappings[pos].new_addr = new_addr;
+        return result_t::OK;
     }
 
-    self->old_addr_is_stored = true;
-    self->stored_old_addr = old_addr;
-    return result_t::OK;
+    return addr_transl_insert(self, old_addr, new_addr);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-result_t addr_transl_insert_if_remembered_addr(addr_transl_t* self, uint64_t new_addr) {
-    if (!self->old_addr_is_stored) {
-        return result_t::OK;
-    }
+uint64_t addr_transl_translate(addr_transl_t* self, uint64_t old_addr) {
+    size_t pos = addr_transl_lower_bound(self, old_addr);
 
-    UNWRAP_ERROR (addr_transl_insert(self, self->stored_old_addr, new_addr) )
+    if (pos < self->size && self->mappings[pos].old_addr == old_addr) {
+        return self->mappings[pos].new_addr;
+    }
 
-    self->old_addr_is_stored = false;
-    return result_t::OK;
+    log(DEBUG, "Failed to translate addr %d", old_addr);
+    return ERROR;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -106,4 +108,24 @@ static result_t addr_transl_resize(addr_transl_t *self) {
         log(ERROR, "Failed to resize array from %d to %d elements", self->capacity, new_capacity);
         return result_t::ERROR;
     }
-}
\ No newline at end of file
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Index of the first mapping with old_addr not less than given one
+static size_t addr_transl_lower_bound(const addr_transl_t *self, uint64_t old_addr) {
+    size_t left  = 0;
+    size_t right = self->size;
+
+    while (left < right) {
+        size_t mid = left + (right - left) / 2;
+
+        if (self->mappings[mid].old_addr < old_addr) {
+            left = mid + 1;
+        } else {
+            right = mid;
+        }
+    }
+
+    return left;
+}
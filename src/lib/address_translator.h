@@ -14,13 +14,11 @@ struct mapping_t {
     uint64_t new_addr;
 };
 
+/// Mappings are sorted by old_addr, so translation is binary search
 struct addr_transl_t {
     mapping_t *mappings;
     size_t size;
     size_t capacity;
-
-    bool old_addr_is_stored;
-    uint64_t stored_old_addr;
 };
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -29,9 +27,8 @@ addr_transl_t *addr_transl_new();
 void addr_transl_delete(addr_transl_t *self);
 
 result_t addr_transl_insert(addr_transl_t* self, uint64_t old_addr, uint64_t new_addr);
-
-result_t addr_transl_remember_old_addr(addr_transl_t* self, uint64_t old_addr);
-result_t addr_transl_insert_if_remembered_addr(addr_transl_t* self, uint64_t new_addr);
+/// Replace translation of `old_addr` or insert it, if there is none
+result_t addr_transl_set(addr_transl_t* self, uint64_t old_addr, uint64_t new_addr);
 
 uint64_t addr_transl_translate(addr_transl_t* self, uint64_t old_addr);
 
@@ -5,6 +5,7 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include "file.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -22,6 +23,7 @@ mmaped_file_t mmap_file_or_warn(const char *name) {
 
     unsigned char *mmap_memory = (unsigned char *) mmap(nullptr, filesize, PROT_READ | PROT_WRITE,
                                                         MAP_PRIVATE, fd, 0);
+    close(fd);  // Mapping holds the file, so many files can be mapped at once
 
     if (mmap_memory == MAP_FAILED) {
         fprintf (stderr, "Failed to map memory on file '%s', reason: %s\n", name, strerror(errno));
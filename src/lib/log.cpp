@@ -26,8 +26,9 @@ static inline void current_time (char *buf, size_t buf_size);
 //----------------------------------------------------------------------------------------------------------------------
 // Static variables
 //----------------------------------------------------------------------------------------------------------------------
-log LOG_LEVEL = log::DEBUG;
-FILE *LOG_OUT_STREAM = stdout;
+// Library may be embedded into host program (see x64::jit_compile), so it doesn't write into host's stdout by default
+log LOG_LEVEL = log::WARN;
+FILE *LOG_OUT_STREAM = stderr;
 
 //----------------------------------------------------------------------------------------------------------------------
 // Public
@@ -94,10 +95,10 @@ static inline void current_time (char *buf, size_t buf_size)
     assert (buf_size >= 9 && "Small buffer");
 
     time_t rawtime;
-    struct tm * timeinfo;
+    struct tm timeinfo = {};
 
     time ( &rawtime );
-    timeinfo = localtime ( &rawtime );
+    localtime_r ( &rawtime, &timeinfo );    // Functions are translated in parallel, see work_pool
 
-    strftime (buf, buf_size, "%H:%M:%S", timeinfo);
+    strftime (buf, buf_size, "%H:%M:%S", &timeinfo);
 }
\ No newline at end of file
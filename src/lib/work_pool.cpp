@@ -0,0 +1,159 @@
+#include <assert.h>
+#include <unistd.h>
+#include "../common.h"
+#include "log.h"
+#include "work_pool.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+
+struct worker_t {
+    work_pool_t *pool;
+    uint index;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Prototypes
+//----------------------------------------------------------------------------------------------------------------------
+
+static void *work_pool_worker(void *arg);
+static bool work_pool_take(work_pool_t *self, uint thread, size_t *task_index);
+static bool work_pool_steal(work_pool_t *self, uint thread);
+
+//----------------------------------------------------------------------------------------------------------------------
+// Public
+//----------------------------------------------------------------------------------------------------------------------
+
+void work_pool_run(size_t tasks_count, uint threads_count, work_task_t task, void *ctx) {
+    assert (task);
+
+    if (threads_count > tasks_count) {
+        threads_count = (uint) tasks_count;
+    }
+
+    work_deque_t *deques = (threads_count > 1) ? (work_deque_t *) calloc(threads_count, sizeof(work_deque_t)) : nullptr;
+    pthread_t    *threads = (deques) ? (pthread_t *) calloc(threads_count, sizeof(pthread_t)) : nullptr;
+    worker_t     *workers = (deques) ? (worker_t *)  calloc(threads_count, sizeof(worker_t))  : nullptr;
+
+    // Nothing to share or no memory for sharing: everything is done by calling thread
+    if (!deques || !threads || !workers) {
+        free(deques);
+        free(threads);
+        free(workers);
+
+        for (size_t i = 0; i < tasks_count; ++i) {
+            task(ctx, i);
+        }
+
+        return;
+    }
+
+    work_pool_t pool = {.deques = deques, .threads_count = threads_count, .task = task, .ctx = ctx};
+
+    for (uint i = 0; i < threads_count; ++i) {
+        pthread_mutex_init(&deques[i].lock, nullptr);
+        deques[i].begin = tasks_count *  i      / threads_count;
+        deques[i].end   = tasks_count * (i + 1) / threads_count;
+
+        workers[i] = {.pool = &pool, .index = i};
+    }
+
+    // Tasks of thread, that failed to start, are stolen by others
+    bool *is_started = (bool *) calloc(threads_count, sizeof(bool));
+    for (uint i = 1; i < threads_count && is_started; ++i) {
+        is_started[i] = (pthread_create(&threads[i], nullptr, work_pool_worker, &workers[i]) == 0);
+        if (!is_started[i]) {
+            log (WARN, "Failed to start worker thread %u", i);
+        }
+    }
+
+    work_pool_worker(&workers[0]);
+
+    for (uint i = 1; i < threads_count && is_started; ++i) {
+        if (is_started[i]) {
+            pthread_join(threads[i], nullptr);
+        }
+    }
+
+    for (uint i = 0; i < threads_count; ++i) {
+        pthread_mutex_destroy(&deques[i].lock);
+    }
+
+    free(is_started);
+    free(deques);
+    free(threads);
+    free(workers);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uint work_pool_default_threads() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 0) ? (uint) cpus : 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Static
+//----------------------------------------------------------------------------------------------------------------------
+
+static void *work_pool_worker(void *arg) {
+    worker_t *worker = (worker_t *) arg;
+    work_pool_t *pool = worker->pool;
+
+    size_t task_index = 0;
+
+    // Tasks don't create new ones, so when nothing can be stolen, all tasks are taken
+    do {
+        while (work_pool_take(pool, worker->index, &task_index)) {
+            pool->task(pool->ctx, task_index);
+        }
+    } while (work_pool_steal(pool, worker->index));
+
+    return nullptr;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static bool work_pool_take(work_pool_t *self, uint thread, size_t *task_index) {
+    work_deque_t *deque = &self->deques[thread];
+    bool is_taken = false;
+
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->begin < deque->end) {
+        *task_index = --deque->end;
+        is_taken = true;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return is_taken;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Move first half of some other thread's tasks to own empty deque. Returns false if all deques are empty
+static bool work_pool_steal(work_pool_t *self, uint thread) {
+    for (uint i = 1; i < self->threads_count; ++i) {
+        work_deque_t *victim = &self->deques[(thread + i) % self->threads_count];
+
+        pthread_mutex_lock(&victim->lock);
+
+        size_t stolen_begin = victim->begin;
+        size_t stolen_end   = victim->begin + (victim->end - victim->begin + 1) / 2;
+        victim->begin = stolen_end;
+
+        pthread_mutex_unlock(&victim->lock);
+
+        if (stolen_begin < stolen_end) {
+            work_deque_t *deque = &self->deques[thread];
+
+            pthread_mutex_lock(&deque->lock);
+            deque->begin = stolen_begin;
+            deque->end   = stolen_end;
+            pthread_mutex_unlock(&deque->lock);
+
+            return true;
+        }
+    }
+
+    return false;
+}
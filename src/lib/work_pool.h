@@ -0,0 +1,42 @@
+#ifndef X64_TRANSLATOR_WORK_POOL_H
+#define X64_TRANSLATOR_WORK_POOL_H
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef void (*work_task_t)(void *ctx, size_t index);
+
+/// Tasks [begin, end) of one thread: owner takes them from the end, thieves take half from the beginning
+struct work_deque_t {
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+};
+
+struct work_pool_t {
+    work_deque_t *deques;
+    uint threads_count;
+
+    work_task_t task;
+    void *ctx;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Run `task(ctx, i)` for each i in [0, tasks_count) on `threads_count` threads and wait for all of them
+ *
+ * @note Calling thread is one of them. Tasks are dealt to threads in contiguous chunks, thread that has done its own
+ *       steals from others, so uneven tasks are balanced. If threads can't be started, tasks run on fewer of them
+ */
+void work_pool_run(size_t tasks_count, uint threads_count, work_task_t task, void *ctx);
+
+/// Online CPUs, at least 1
+uint work_pool_default_threads();
+
+#endif //X64_TRANSLATOR_WORK_POOL_H
@@ -1,47 +1,407 @@
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include "batch.h"
+#include "compile_cache.h"
+#include "compiler.h"
+#include "interp/interp.h"
 #include "x64/x64.h"
-#include "ir/ir.h"
-#include "ir/ast_converter.h"
-#include "lib/tree.h"
+#include "ir/loop_unroller.h"
 #include "lib/file.h"
+#include "lib/work_pool.h"
 #include "x64/x64_elf.h"
+#include "x64/x64_encoder.h"
+#include "x64/x64_jit.h"
+#include "x64/x64_stdlib.h"
 
-result_t load_and_compile(const char *ast_filename, const char *output_filename);
+const uint64_t DEFAULT_BENCH_ENCODER_COUNT = 100000000;
+const uint64_t DEFAULT_BENCH_FORMAT_COUNT  = 10000000;
+const uint     MAX_JOBS                    = 1024;
+
+struct options_t {
+    const char *ast_filename;
+    const char *output_filename;
+
+    compile_options_t compile;
+    bool run;                     // Execute in process instead of writing binary
+    bool interpret;               // Execute IR by interpreter instead of writing binary
+    const char *batch_manifest;   // nullptr if not requested, "-" for stdin
+
+    const char *cache_dir;        // nullptr if cache is disabled
+    size_t cache_max_size;
+    bool cache_stats;
+    bool incremental;             // Translate only functions, that are not in cache
+
+    uint64_t bench_encoder_count; // 0 if not requested
+    uint64_t bench_format_count;  // 0 if not requested
+};
+
+result_t parse_options(options_t *options, int argc, char *argv[]);
+result_t load_and_compile(const options_t *options);
+result_t compile_batch(const options_t *options);
+static result_t compile_binary(const options_t *options, const char *ast_text, compile_cache_t *cache,
+                               const cache_key_t *key);
+static result_t compile_and_run(const options_t *options, const char *ast_text, compile_cache_t *cache,
+                                const cache_key_t *key);
+static result_t parse_count(const char *str, uint max, uint *count);
+static result_t parse_count64(const char *str, uint64_t *count);
+static void setup_logs(const options_t *options);
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        log(ERROR, "Invalid number of parameters: expected 2");
-        fprintf(stderr, "Usage: x64_compiler <input ast file> <output binary file>");
+    options_t options = {};
+
+    if (parse_options(&options, argc, argv) == result_t::ERROR) {
+        log(ERROR, "Invalid parameters");
+        fprintf(stderr, "Usage: x64_compiler [--unroll <factor>] [--raw-output] [--ram-size <bytes>] [--pic]\n"
+                        "                    [--jobs[=<n>]] [--compact | --emit-obj | --shared]\n"
+                        "                    [--cache-dir <dir> [--cache-max-size <bytes>] [--cache-stats]\n"
+                        "                                   [--incremental]]\n"
+                        "                    <input ast file> <output binary file>\n"
+                        "       x64_compiler --run [--raw-output] [--ram-size <bytes>] [--pic] [--jobs[=<n>]]\n"
+                        "                    [--cache-dir <dir> ...] <input ast file>\n"
+                        "       x64_compiler --run --lazy [--raw-output] [--ram-size <bytes>] <input ast file>\n"
+                        "       x64_compiler --batch <manifest file or -> [--jobs[=<n>]] [--unroll <factor>]\n"
+                        "                    [--raw-output] [--ram-size <bytes>] [--pic]\n"
+                        "                    [--compact | --emit-obj | --shared]\n"
+                        "       x64_compiler --interpret [--tiered[=<threshold>]] [--raw-output] [--ram-size <bytes>]\n"
+                        "                    <input ast file>\n"
+                        "       x64_compiler --bench-encoder[=<instructions count>]\n"
+                        "       x64_compiler --bench-format[=<values count>]\n");
         return ERROR;
     }
 
+    if (options.bench_encoder_count > 0 || options.bench_format_count > 0) {
+        if (options.bench_encoder_count > 0) { x64::bench_encoder(options.bench_encoder_count); }
+        if (options.bench_format_count  > 0) { x64::bench_format (options.bench_format_count);  }
+        return 0;
+    }
+
+    setup_logs(&options);
 
-    result_t res = load_and_compile(argv[1], argv[2]);
+    result_t res = (options.batch_manifest) ? compile_batch(&options) : load_and_compile(&options);
 
     if (res == result_t::OK) {
         return 0;
     }
 
     log(ERROR, "Program failed: see logs");
+    return ERROR;
 }
 
-result_t load_and_compile(const char *ast_filename, const char *output_filename) {
-    const mmaped_file_t src = mmap_file_or_warn(ast_filename);
+result_t parse_options(options_t *options, int argc, char *argv[]) {
+    const option long_options[] = {
+            {"unroll",         required_argument, nullptr, 'u'},
+            {"raw-output",     no_argument,       nullptr, 'r'},
+            {"ram-size",       required_argument, nullptr, 'm'},
+            {"run",            no_argument,       nullptr, 'x'},
+            {"pic",            no_argument,       nullptr, 'p'},
+            {"compact",        no_argument,       nullptr, 'C'},
+            {"emit-obj",       no_argument,       nullptr, 'O'},
+            {"shared",         no_argument,       nullptr, 'S'},
+            {"lazy",           no_argument,       nullptr, 'l'},
+            {"jobs",           optional_argument, nullptr, 'j'},
+            {"interpret",      no_argument,       nullptr, 'i'},
+            {"tiered",         optional_argument, nullptr, 't'},
+            {"batch",          required_argument, nullptr, 'B'},
+            {"cache-dir",      required_argument, nullptr, 'c'},
+            {"cache-max-size", required_argument, nullptr, 'M'},
+            {"cache-stats",    no_argument,       nullptr, 's'},
+            {"incremental",    no_argument,       nullptr, 'n'},
+            {"bench-encoder",  optional_argument, nullptr, 'b'},
+            {"bench-format",   optional_argument, nullptr, 'f'},
+            {nullptr,          0,                 nullptr,  0 }
+    };
+
+    options->compile.unroll_factor = ir::DEFAULT_UNROLL_FACTOR;
+    options->cache_max_size        = DEFAULT_CACHE_MAX_SIZE;
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "u:rm:xpilj::", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'u':
+                UNWRAP_ERROR(parse_count(optarg, ir::MAX_UNROLL_FACTOR, &options->compile.unroll_factor));
+                break;
+
+            case 'r':
+                options->compile.raw_output = true;
+                break;
+
+            case 'm':
+                UNWRAP_ERROR(parse_count64(optarg, &options->compile.ram_size));
+                break;
+
+            case 'x':
+                options->run = true;
+                break;
+
+            case 'p':
+                options->compile.pic = true;
+                break;
+
+            case 'C':
+                options->compile.compact = true;
+                break;
+
+            case 'O':
+                options->compile.emit_obj = true;
+                break;
+
+            case 'S':
+                options->compile.shared = true;
+                break;
+
+            case 'l':
+                options->compile.lazy = true;
+                break;
+
+            case 'j':
+                if (optarg) {
+                    UNWRAP_ERROR(parse_count(optarg, MAX_JOBS, &options->compile.jobs));
+                } else {
+                    options->compile.jobs = work_pool_default_threads();
+                }
+                break;
+
+            case 'i':
+                options->interpret = true;
+                break;
+
+            case 't':
+                options->interpret = true;
+                if (optarg) {
+                    UNWRAP_ERROR(parse_count64(optarg, &options->compile.tier_threshold));
+                } else {
+                    options->compile.tier_threshold = interp::DEFAULT_TIER_UP_THRESHOLD;
+                }
+                break;
+
+            case 'B':
+                options->batch_manifest = optarg;
+                break;
+
+            case 'c':
+                options->cache_dir = optarg;
+                break;
+
+            case 'M':
+                UNWRAP_ERROR(parse_count64(optarg, &options->cache_max_size));
+                break;
+
+            case 's':
+                options->cache_stats = true;
+                break;
+
+            case 'n':
+                options->incremental = true;
+                break;
+
+            case 'b':
+                options->bench_encoder_count = (optarg) ? strtoull(optarg, nullptr, 10)
+                                                        : DEFAULT_BENCH_ENCODER_COUNT;
+                break;
+
+            case 'f':
+                options->bench_format_count = (optarg) ? strtoull(optarg, nullptr, 10)
+                                                       : DEFAULT_BENCH_FORMAT_COUNT;
+                break;
+
+            default:
+                return result_t::ERROR;
+        }
+    }
+
+    if (options->bench_encoder_count > 0 || options->bench_format_count > 0) {
+        return (argc == optind) ? result_t::OK : result_t::ERROR;
+    }
+
+    // Object and shared library have own layouts with stdlib sections bundled into .text
+    bool is_object = options->compile.emit_obj || options->compile.shared;
+    if ((options->compile.emit_obj && options->compile.shared) || (is_object && options->compile.compact)) {
+        return result_t::ERROR;
+    }
+
+    // Outputs are listed in manifest, each of them is compiled once, so cache is not used
+    if (options->batch_manifest) {
+        bool is_compatible = !options->run && !options->interpret && !options->compile.lazy && !options->cache_dir &&
+                             !options->incremental;
+        return (is_compatible && argc == optind) ? result_t::OK : result_t::ERROR;
+    }
+
+    // Stubs hold absolute addresses of this process
+    if (options->compile.lazy && (!options->run || options->compile.pic)) {
+        return result_t::ERROR;
+    }
+
+    bool is_in_process = options->run || options->interpret;
+
+    // Functions are linked when ELF is written
+    if (options->incremental && (is_in_process || !options->cache_dir)) {
+        return result_t::ERROR;
+    }
+
+    // Compact layout is ELF only. Cached fragments have stdlib addresses of usual layout
+    if (options->compile.compact && (is_in_process || options->incremental)) {
+        return result_t::ERROR;
+    }
+
+    // Object is written only from whole program, functions are not linked from cached fragments
+    if (is_object && (is_in_process || options->incremental)) {
+        return result_t::ERROR;
+    }
+
+    if (argc - optind != ((is_in_process) ? 1 : 2)) {
+        return result_t::ERROR;
+    }
+
+    options->ast_filename    = argv[optind];
+    options->output_filename = (is_in_process) ? nullptr : argv[optind + 1];
+
+    return result_t::OK;
+}
+
+result_t load_and_compile(const options_t *options) {
+    const mmaped_file_t src = mmap_file_or_warn(options->ast_filename);
     UNWRAP_NULLPTR( src.data );
 
-    const char *tree_section = (char *) src.data;
-    tree::tree_t ast = tree::load_tree (tree_section);
-    UNWRAP_NULLPTR(ast.head_node);
+    const char *ast_text = (char *) src.data;
+
+    // Interpreter starts immediately, so there is nothing to cache
+    if (options->interpret) {
+        interp::program_t *program = interp::compile(ast_text, &options->compile);
+        mmap_close(src);
+        UNWRAP_NULLPTR(program);
+
+        result_t res = interp::run(program, nullptr);
+        interp::program_delete(program);
 
-    ir::code_t *ir_code = ir::code_new(); UNWRAP_NULLPTR(ir_code);
-    UNWRAP_ERROR (ir::from_ast(ir_code, &ast));
-    tree::dtor(&ast);
+        return res;
+    }
+
+    // Cache failures only cost recompilation.
+    // Lazy code is incomplete until all functions are called, so it's not cached
+    compile_cache_t cache = {};
+    compile_cache_t *cache_ptr = nullptr;
+    if (options->cache_dir && !options->compile.lazy &&
+        cache_open(&cache, options->cache_dir, options->cache_max_size) == result_t::OK) {
+        cache_ptr = &cache;
+    }
 
-    x64::code_t *x64_code = x64::code_new(x64::output_t::BINARY);
-    UNWRAP_ERROR (x64::translate_from_ir(x64_code, ir_code));
-    ir::code_delete(ir_code);
+    result_t res = result_t::OK;
+
+    if (options->run) {
+        // Only position independent code can be mapped at another address
+        options_t run_options = *options;
+        run_options.compile.pic |= (cache_ptr != nullptr);
+
+        cache_key_t key = cache_key(src.data, src.size, &run_options.compile, x64::output_t::JIT);
+        res = compile_and_run(&run_options, ast_text, cache_ptr, &key);
+    } else {
+        cache_key_t key = cache_key(src.data, src.size, &options->compile, x64::output_t::BINARY);
+        res = compile_binary(options, ast_text, cache_ptr, &key);
+    }
+
+    mmap_close(src);
+
+    if (cache_ptr) {
+        if (options->cache_stats) { cache_print_stats(cache_ptr, stderr); }
+        cache_close(cache_ptr);
+    }
 
-    UNWRAP_ERROR (x64::save(x64_code, output_filename));
+    return res;
+}
+
+result_t compile_batch(const options_t *options) {
+    batch_t batch = {};
+
+    result_t res = batch_load(&batch, options->batch_manifest);
+    if (res == result_t::OK) {
+        // Jobs are compiled in parallel instead of functions of one job
+        res = batch_run(&batch, &options->compile, options->compile.jobs, stderr);
+    }
+
+    batch_free(&batch);
+    return res;
+}
+
+static result_t compile_binary(const options_t *options, const char *ast_text, compile_cache_t *cache,
+                               const cache_key_t *key) {
+    mode_t mode = (options->compile.emit_obj) ? x64::OBJECT_MODE : x64::BINARY_MODE;
+    if (cache && cache_fetch_binary(cache, key, options->output_filename, mode) == result_t::OK) {
+        return result_t::OK;
+    }
+
+    x64::code_t *x64_code = (options->incremental && cache)
+                          ? compile_ast_incremental(ast_text, &options->compile, cache)
+                          : compile_ast(ast_text, x64::output_t::BINARY, &options->compile);
+    UNWRAP_NULLPTR(x64_code);
+
+    result_t res = x64::save(x64_code, options->output_filename);
     x64::code_delete(x64_code);
 
+    if (cache && res == result_t::OK && cache_store_binary(cache, key, options->output_filename) == result_t::ERROR) {
+        log(WARN, "Failed to store binary in cache");
+    }
+
+    return res;
+}
+
+static result_t compile_and_run(const options_t *options, const char *ast_text, compile_cache_t *cache,
+                                const cache_key_t *key) {
+    x64::code_t *cached_code = (cache) ? cache_fetch_jit(cache, key) : nullptr;
+
+    x64::jit_program_t cached_program = {.code = cached_code};
+    x64::jit_program_t *program = (cached_code) ? &cached_program : x64::jit_compile(ast_text, &options->compile);
+    UNWRAP_NULLPTR(program);
+
+    if (cache && !cached_code && cache_store_jit(cache, key, program->code) == result_t::ERROR) {
+        log(WARN, "Failed to store code in cache");
+    }
+
+    result_t res = x64::jit_run(program, nullptr);
+
+    if (cached_code) {
+        x64::code_delete(cached_code);
+    } else {
+        x64::jit_delete(program);
+    }
+
+    return res;
+}
+
+/// Whole `str` is decimal number in [1, max]
+static result_t parse_count(const char *str, uint max, uint *count) {
+    uint64_t value = 0;
+    UNWRAP_ERROR(parse_count64(str, &value));
+
+    if (value > max) {
+        return result_t::ERROR;
+    }
+
+    *count = (uint) value;
+    return result_t::OK;
+}
+
+/// Whole `str` is positive decimal number, that fits into 64 bits
+static result_t parse_count64(const char *str, uint64_t *count) {
+    char *end = nullptr;
+    errno = 0;
+
+    unsigned long long value = strtoull(str, &end, 10);
+    // strtoull skips spaces and negates "-<n>" by itself
+    if (!isdigit((unsigned char) str[0]) || errno != 0 || *end != '\0' || value == 0) {
+        return result_t::ERROR;
+    }
+
+    *count = value;
     return result_t::OK;
-}
\ No newline at end of file
+}
+
+/// Compiler writing binary keeps full log on stdout. Program compiled in process writes to the same stdout, so compiler
+/// keeps library defaults there: only warnings on stderr. It includes --tiered (implies --interpret), which translates
+/// functions while the program is running
+static void setup_logs(const options_t *options) {
+    if (!options->run && !options->interpret) {
+        set_log_level(log::DEBUG);
+        set_log_stream(stdout);
+    }
+}
@@ -5,12 +5,24 @@
 #include "x64_generators.h"
 #include "x64_consts.h"
 #include "x64_elf.h"
+#include "x64_peephole.h"
+#include "x64_encoder.h"
+#include "x64_stdlib.h"
 #include "x64.h"
+#include "../lib/work_pool.h"
 
 //----------------------------------------------------------------------------------------------------------------------
 
 const int PAGE_SIZE                   = 4096;  // Standart memory page size
-const int EXEC_BUF_THRESHOLD          = 15;    // maximum 15 bytes per x64 instruction
+const int EXEC_BUF_THRESHOLD          = x64::ENCODING_BUF_SIZE; // encoding is copied as a whole
+
+const size_t LAZY_RESERVED_BYTES_PER_INSTRUCTION = 64;  // Upper bound of IR instruction or function stub encoding
+const size_t LAZY_CALL_SITES_CAPACITY            = 4;
+
+const size_t FRAGMENT_RELOCS_CAPACITY = 8;
+
+const size_t WRAPPER_RESERVED_BYTES         = 64;  // Upper bound of object wrapper encoding without arguments
+const size_t WRAPPER_RESERVED_BYTES_PER_ARG = 16;
 
 enum passes {
     PASS_INDEX_TO_CALC_OFFSETS =  0,
@@ -19,30 +31,101 @@ enum passes {
     TOTAL_PASS_COUNT
 };
 
+namespace x64 {
+    struct lazy_func_t {
+        size_t stub_offset;
+        bool is_translated;
+
+        size_t *call_sites;     // Offsets of `mov rax, %stub` immediates, that are patched with translated address
+        size_t call_sites_count;
+        size_t call_sites_capacity;
+    };
+
+    struct lazy_t {
+        ir::code_t *ir_code;
+        bool *is_jump_target;
+        size_t *func_by_begin;  // ir index -> 1 + index of function starting there, 0 if there is none
+        ir::instruction_t **entries;    // First instructions of functions
+
+        lazy_func_t *funcs;     // Same order as ir_code->funcs
+    };
+
+    /// Function translated in parallel with others: code is written to own buffer, but offsets are of whole program
+    struct unit_t {
+        code_t code;
+        ir::instruction_t *first;
+        size_t end;
+
+        result_t result;
+    };
+
+    struct parallel_ctx_t {
+        code_t *program;
+        ir::code_t *ir_code;
+        const bool *is_jump_target;
+        const size_t *body_end;
+
+        unit_t *units;      // Same order as ir_code->funcs
+        result_t result;    // Of top level code
+
+        const size_t *func_by_begin; // Incremental only: ir index -> 1 + index of function starting there, 0 if none
+    };
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // Prototypes
 //----------------------------------------------------------------------------------------------------------------------
 
 // Internal methods
 namespace x64 {
+    static result_t translate_top_level(code_t *self, ir::code_t *ir_code, const bool *is_jump_target,
+                                        const size_t *body_end);
+    static result_t encode_top_level_pass(code_t *self, ir::code_t *ir_code, const bool *is_jump_target,
+                                          const size_t *body_end);
+    static result_t encode_ir_range(code_t *self, ir::instruction_t *ir_instruct, size_t end,
+                                    const bool *is_jump_target, const size_t *body_end);
     static void encode_one_ir_instruction(code_t *self, ir::instruction_t *ir_instruct);
+    static bool *collect_jump_targets(ir::code_t *ir_code);
+    static size_t *collect_func_body_ends(ir::code_t *ir_code);
+    static ir::instruction_t **collect_func_entries(ir::code_t *ir_code);
 
-    static void emit_instruction_calc_offset(code_t *self, instruction_t *x64_instruct);
-    static void emit_instruction_write      (code_t *self, instruction_t *x64_instruct);
+    static result_t translate_parallel(code_t *self, ir::code_t *ir_code, const bool *is_jump_target);
+    static result_t translate_units(parallel_ctx_t *ctx);
+    static void encode_unit(void *ctx, size_t index);
+    static result_t units_result(const parallel_ctx_t *ctx);
+    static result_t unit_ctor(unit_t *self, const code_t *program, ir::instruction_t *first, size_t end);
+    static void unit_dtor(unit_t *self);
 
-    static void resize_if_needed(code_t *self);
-    static void start_new_pass  (code_t *self);
+    static size_t *collect_func_by_begin(ir::code_t *ir_code);
+    static result_t add_cached_labels(code_t *self, const fragment_t *fragment, size_t func_begin, size_t origin);
+    static result_t add_unit_labels(fragment_t *fragment, const addr_transl_t *unit_transl, size_t func_begin);
+    static result_t finish_fragment(fragment_t *fragment, const code_t *unit_code, const parallel_ctx_t *ctx,
+                                    size_t func_index);
+    static result_t resolve_links(code_t *self, ir::code_t *ir_code);
+    static result_t resolve_reloc(code_t *self, ir::code_t *ir_code, size_t func_begin, const reloc_t *reloc,
+                                  uint64_t *target_offset);
+
+    static lazy_t *lazy_new(ir::code_t *ir_code);
+    static void lazy_delete(lazy_t *self);
+    static result_t emit_lazy_stubs(code_t *self);
+    static result_t translate_lazy_func(code_t *self, size_t func_index);
+
+    static result_t emit_object_wrappers(code_t *self, const ir::code_t *ir_code);
+    static void object_delete(object_t *self);
+
+    static result_t reserve_exec_buf(code_t *self, size_t capacity);
+    static result_t start_new_pass  (code_t *self);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 // Public
 //----------------------------------------------------------------------------------------------------------------------
 
-x64::code_t *x64::code_new(output_t output) {
+x64::code_t *x64::code_new(output_t output, size_t ram_size) {
     code_t *self = (code_t *) calloc(1, sizeof(code_t));
     if (!self) { return nullptr;}
 
-    result_t ctor_res = code_ctor(self, output);
+    result_t ctor_res = code_ctor(self, output, ram_size);
     if (ctor_res == result_t::ERROR) {
         free(self);
         return nullptr;
@@ -51,21 +134,28 @@ x64::code_t *x64::code_new(output_t output) {
     return self;
 }
 
-result_t x64::code_ctor(code_t *self, output_t output) {
+result_t x64::code_ctor(code_t *self, output_t output, size_t ram_size) {
+    assert (ram_size % PAGE_SIZE == 0 && "RAM size must be page aligned");
+
     self->exec_buf = (uint8_t *) mmap(nullptr, PAGE_SIZE, PROT_EXEC | PROT_WRITE,
                                                                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
     if (self->exec_buf == MAP_FAILED) { return result_t::ERROR;}
 
+    self->exec_buf_capacity = PAGE_SIZE;
+    self->ram_size          = ram_size;
+
     if (output == output_t::JIT) {
-        self->ram_buf = (uint8_t *) mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE,
-                                         MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        self->ram_buf = (uint8_t *) mmap(nullptr, ram_size + RAM_GUARD_SIZE, PROT_READ | PROT_WRITE,
+                                         MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
         if (self->ram_buf == MAP_FAILED) { return result_t::ERROR; }
-    }
 
-    self->exec_buf_capacity = PAGE_SIZE;
-    self->ram_buf_capacity  = PAGE_SIZE;
+        self->ram_buf_capacity = ram_size + RAM_GUARD_SIZE;
+        if (mprotect(self->ram_buf + ram_size, RAM_GUARD_SIZE, PROT_NONE) != 0) { return result_t::ERROR; }
+    }
 
     self->addr_transl = addr_transl_new();
+    self->peephole    = peephole_new();
+    if (!self->addr_transl || !self->peephole) { return result_t::ERROR; }
     self->pass_index = 0;
     self->output_type = output;
 
@@ -83,108 +173,318 @@ void x64::code_delete(code_t *self) {
 
 void x64::code_dtor(code_t *self) {
     munmap(self->exec_buf, self->exec_buf_capacity);
-    munmap(self->ram_buf, self->ram_buf_capacity);
+    if (self->ram_buf) {
+        munmap(self->ram_buf, self->ram_buf_capacity);
+    }
     addr_transl_delete(self->addr_transl);
+    peephole_delete(self->peephole);
+    lazy_delete(self->lazy);
+
+    for (size_t i = 0; i < self->links_count; ++i) {
+        fragment_delete(self->links[i].fragment);
+        free(self->links[i].targets);
+    }
+    free(self->links);
+
+    stdlib_link_delete(self->stdlib_link);
+    object_delete(self->object);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+size_t x64::choose_ram_size(size_t requested, const ir::code_t *ir_code) {
+    assert(ir_code);
+
+    size_t ram_size = requested;
+
+    if (!ram_size) {
+        ram_size = (ir_code->ram_size) ? ir_code->ram_size : DEFAULT_RAM_SIZE;
+    } else if (ir_code->ram_size > requested) {
+        log (WARN, "RAM size %zu is less than statically estimated %zu, program may fault", requested,
+                                                                                           ir_code->ram_size);
+    }
+
+    return (ram_size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
 result_t x64::translate_from_ir(x64::code_t *self, ir::code_t *ir_code) {
-    while (self->pass_index < TOTAL_PASS_COUNT) {
-        ir::instruction_t *ir_instruct = ir_code->instructions;
+    // Peephole can't merge instructions across these, so only their addresses are stored
+    bool *is_jump_target = collect_jump_targets(ir_code);
+    UNWRAP_NULLPTR(is_jump_target);
 
-        emit_code_preparation(self);
+    // Functions are independent apart from addresses of each other, so they can be encoded at the same time
+    result_t res = (self->jobs > 1 && ir_code->funcs_count > 0) ? translate_parallel (self, ir_code, is_jump_target)
+                                                                : translate_top_level(self, ir_code, is_jump_target,
+                                                                                      nullptr);
+    free(is_jump_target);
+    UNWRAP_ERROR(res);
 
-        while (ir_instruct) {
-            if (self->pass_index == PASS_INDEX_TO_CALC_OFFSETS) {
-                result_t res = addr_transl_remember_old_addr(self->addr_transl, ir_instruct->index);
-                UNWRAP_ERROR(res);
-            }
+    if (self->pic) {
+        emit_pic_table(self);
+    }
 
-            encode_one_ir_instruction(self, ir_instruct);
+    return result_t::OK;
+}
+
+result_t x64::translate_lazy(code_t *self, ir::code_t *ir_code) {
+    assert (self->output_type == output_t::JIT && !self->pic && "Stubs use absolute addresses in JIT buffer");
+
+    self->lazy = lazy_new(ir_code);
+    if (!self->lazy) {
+        ir::code_delete(ir_code);
+        return result_t::ERROR;
+    }
+
+    // Code is written at absolute addresses long after first passes, so buffer must never move
+    UNWRAP_ERROR(reserve_exec_buf(self, (ir_code->size + ir_code->funcs_count) * LAZY_RESERVED_BYTES_PER_INSTRUCTION
+                                        + EXEC_BUF_THRESHOLD));
+
+    size_t *body_end = collect_func_body_ends(ir_code);
+    UNWRAP_NULLPTR(body_end);
 
-            ir_instruct = ir::next_insruction(ir_instruct);
+    result_t res = translate_top_level(self, ir_code, self->lazy->is_jump_target, body_end);
+    free(body_end);
+
+    return res;
+}
+
+result_t x64::translate_incremental(code_t *self, ir::code_t *ir_code, fragment_t **cached) {
+    assert (self->output_type == output_t::BINARY && "Functions are linked only when ELF is written");
+
+    self->links = (fragment_link_t *) calloc(ir_code->funcs_count + 1, sizeof(fragment_link_t));
+    if (!self->links) {
+        for (size_t i = 0; i < ir_code->funcs_count; ++i) {
+            fragment_delete(cached[i]);
         }
 
-        start_new_pass(self);
+        return result_t::ERROR;
+    }
+
+    // Code owns fragments from now on, even if translation fails
+    self->links_count = ir_code->funcs_count;
+    for (size_t i = 0; i < ir_code->funcs_count; ++i) {
+        self->links[i] = {.fragment = cached[i], .is_cached = (cached[i] != nullptr)};
+    }
+
+    bool *is_jump_target = collect_jump_targets(ir_code);
+    UNWRAP_NULLPTR(is_jump_target);
+
+    // Each function is a unit even with single job: it's written to own buffer and becomes fragment
+    result_t res = translate_parallel(self, ir_code, is_jump_target);
+    free(is_jump_target);
+    UNWRAP_ERROR(res);
+
+    UNWRAP_ERROR(resolve_links(self, ir_code));
+
+    if (self->pic) {
+        emit_pic_table(self);
     }
 
     return result_t::OK;
 }
 
+result_t x64::translate_object(code_t *self, ir::code_t *ir_code, bool is_shared) {
+    assert (self->output_type == output_t::BINARY && self->pic && "Object references RAM and stdlib by PIC table");
+
+    self->object = (object_t *) calloc(1, sizeof(object_t));
+    UNWRAP_NULLPTR(self->object);
+
+    object_t *object  = self->object;
+    object->is_shared = is_shared;
+    object->relocs    = fragment_new();
+    object->symbols   = (object_symbol_t *) calloc(ir_code->funcs_count + 1, sizeof(object_symbol_t));
+    if (!object->relocs || !object->symbols) { return result_t::ERROR; }
+
+    // Parallel units record relocations into own fragments only
+    self->jobs     = 1;
+    self->fragment = object->relocs;
+
+    result_t res = translate_from_ir(self, ir_code);
+    if (res == result_t::OK) {
+        res = emit_object_wrappers(self, ir_code);
+    }
+
+    // Dropped by record_reloc(), if some relocation is lost
+    if (!self->fragment) {
+        res = result_t::ERROR;
+    }
+
+    self->fragment = nullptr;
+    return res;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 
-[[noreturn]]
-void x64::execute(code_t *self) {
-    asm ("mov %1, %%r8\n"
-         "jmp %0\n": :"r" (self->exec_buf), "r" (self->ram_buf) : "r8");
+x64::fragment_t *x64::fragment_new() {
+    return (fragment_t *) calloc(1, sizeof(fragment_t));
+}
+
+void x64::fragment_delete(fragment_t *self) {
+    if (!self) {
+        return;
+    }
+
+    free(self->code);
+    free(self->relocs);
+    free(self->labels);
+    free(self);
+}
+
+result_t x64::fragment_add_reloc(fragment_t *self, const reloc_t *reloc) {
+    if (self->relocs_count == self->relocs_capacity) {
+        size_t new_capacity = (self->relocs_capacity) ? 2 * self->relocs_capacity : FRAGMENT_RELOCS_CAPACITY;
+        reloc_t *relocs = (reloc_t *) realloc(self->relocs, new_capacity * sizeof(reloc_t));
+        UNWRAP_NULLPTR(relocs);
+
+        self->relocs          = relocs;
+        self->relocs_capacity = new_capacity;
+    }
+
+    self->relocs[self->relocs_count++] = *reloc;
+    return result_t::OK;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-// Generators
+
+size_t x64::code_entry_offset(const code_t *self) {
+    return (self->pic) ? PIC_TABLE_SIZE : 0;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 
-void x64::emit_instruction(code_t *self, instruction_t *x64_instruct) {
-    switch (self->pass_index) {
-        case PASS_INDEX_TO_CALC_OFFSETS:
-            emit_instruction_calc_offset(self, x64_instruct);
-            break;
+result_t x64::code_map_pic(code_t *self, int fd, size_t offset, size_t code_size) {
+    assert (self->output_type == output_t::JIT && "Only JIT code can be mapped");
+    assert (offset % PAGE_SIZE == 0 && code_size > PIC_TABLE_SIZE);
 
-        case PASS_INDEX_TO_WRITE:
-            emit_instruction_write(self, x64_instruct);
-            break;
+    size_t capacity = (code_size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
 
-        default:
-            assert(0 && "Unexpected pass_index");
-            break;
+    // Table page is private and writable, code pages are shared with other processes through page cache
+    uint8_t *exec_buf = (uint8_t *) mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                                         MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (exec_buf == MAP_FAILED) { return result_t::ERROR; }
+
+    void *code = mmap(exec_buf + PIC_TABLE_SIZE, code_size - PIC_TABLE_SIZE, PROT_READ | PROT_EXEC,
+                      MAP_PRIVATE | MAP_FIXED, fd, (off_t) (offset + PIC_TABLE_SIZE));
+    if (code == MAP_FAILED) {
+        munmap(exec_buf, capacity);
+        return result_t::ERROR;
     }
+
+    munmap(self->exec_buf, self->exec_buf_capacity);
+
+    self->exec_buf          = exec_buf;
+    self->exec_buf_capacity = capacity;
+    self->exec_buf_size     = code_size;
+    self->pic               = true;
+
+    emit_pic_table(self);
+    return result_t::OK;
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// Lazy translation
 //----------------------------------------------------------------------------------------------------------------------
 
-static void x64::emit_instruction_calc_offset(code_t *self, instruction_t *x64_instruct) {
-    uint command_size = 1; // Opcode
-    if (x64_instruct->require_REX)    { command_size += 1; }
-    if (x64_instruct->require_prefix) { command_size += 1; }
-    if (x64_instruct->require_ModRM)  { command_size += 1; }
-    if (x64_instruct->require_SIB)    { command_size += 1; }
-    if (x64_instruct->require_imm32)  { command_size += sizeof(uint32_t); }
-    if (x64_instruct->require_imm64)  { command_size += sizeof(uint64_t); }
-
-    uint64_t base_addr = (self->output_type == output_t::JIT) ? (uint64_t) self->exec_buf : x64::CODE_BASE_ADDR;
+JIT_CALLED uint64_t x64::lazy_compile(code_t *self, uint64_t func_index) {
+    assert (self && self->lazy && func_index < self->lazy->ir_code->funcs_count);
 
-    addr_transl_insert_if_remembered_addr(self->addr_transl,  base_addr + self->exec_buf_size);
+    // There is no way to report error to JIT code, and without function it can't continue
+    if (!self->lazy->funcs[func_index].is_translated && translate_lazy_func(self, func_index) == result_t::ERROR) {
+        log (ERROR, "Failed to translate function %lu on its first call", self->lazy->ir_code->funcs[func_index].func);
+        abort();
+    }
 
-    self->exec_buf_size += command_size;
+    const uint64_t func_begin = self->lazy->ir_code->funcs[func_index].begin;
+    return code_base_addr(self) + addr_transl_translate(self->addr_transl, func_begin);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-#define EMIT_OPTIONAL_FIELD(fieldname, type)                                                                            \
-    if (x64_instruct->require_##fieldname) {                                                                            \
-        log (INFO, "\t " #fieldname " field: DEC=%d HEX=0x%x", x64_instruct->fieldname, x64_instruct->fieldname);       \
-        *((type *) (self->exec_buf + self->exec_buf_size)) = x64_instruct->fieldname;                                   \
-        self->exec_buf_size += sizeof(type);                                                                            \
+void x64::lazy_add_call_site(code_t *self, uint64_t target, size_t imm_offset) {
+    lazy_t *lazy = self->lazy;
+    assert (lazy);
+
+    if (self->pass_index != PASS_INDEX_TO_WRITE || target > lazy->ir_code->size || !lazy->func_by_begin[target]) {
+        return;
+    }
+
+    lazy_func_t *func = &lazy->funcs[lazy->func_by_begin[target] - 1];
+    if (func->is_translated) {
+        return;
+    }
+
+    // Unrecorded site still works, it just calls function through stub
+    if (func->call_sites_count == func->call_sites_capacity) {
+        size_t new_capacity = (func->call_sites_capacity) ? 2 * func->call_sites_capacity : LAZY_CALL_SITES_CAPACITY;
+        size_t *call_sites = (size_t *) realloc(func->call_sites, new_capacity * sizeof(size_t));
+        if (!call_sites) { return; }
+
+        func->call_sites          = call_sites;
+        func->call_sites_capacity = new_capacity;
     }
 
-static void x64::emit_instruction_write(code_t *self, instruction_t *x64_instruct) {
-    log (INFO, "Emitting instruction...");
+    func->call_sites[func->call_sites_count++] = imm_offset;
+}
+
+void x64::record_reloc(code_t *self, reloc_type_t type, size_t position, reloc_target_t target_type, uint64_t target) {
+    if (!self->fragment || self->pass_index != PASS_INDEX_TO_WRITE) {
+        return;
+    }
 
-    EMIT_OPTIONAL_FIELD(REX,    uint8_t)
-    EMIT_OPTIONAL_FIELD(prefix, uint8_t)
+    // Targets are IR indices of this build for now, they are made independent of it in finish_fragment()
+    const reloc_t reloc = {
+            .position    = position - self->exec_buf_origin,
+            .type        = type,
+            .target_type = target_type,
+            .target      = (int64_t) target
+    };
+
+    // Fragment without all relocations can't be linked, unit is failed after pass (see finish_fragment)
+    if (fragment_add_reloc(self->fragment, &reloc) == result_t::ERROR) {
+        log (ERROR, "Failed to record relocation");
+        self->fragment = nullptr;
+    }
+}
 
-    log(INFO, "\tOpcode: %x", x64_instruct->opcode);
-    self->exec_buf[self->exec_buf_size++] = x64_instruct->opcode;
+//----------------------------------------------------------------------------------------------------------------------
+// Generators
+//----------------------------------------------------------------------------------------------------------------------
 
-    EMIT_OPTIONAL_FIELD(ModRM, uint8_t)
-    EMIT_OPTIONAL_FIELD(SIB,   uint8_t)
-    EMIT_OPTIONAL_FIELD(imm32, uint32_t)
-    EMIT_OPTIONAL_FIELD(imm64, uint64_t)
+void x64::emit_instruction(code_t *self, instruction_t *x64_instruct) {
+    form_t form = encode_form(*x64_instruct);
+    peephole_emit(self, &form);
+}
 
-    resize_if_needed(self);
+void x64::emit_form(code_t *self, const form_t *form) {
+    peephole_emit(self, form);
 }
 
-#undef EMIT_OPTIONAL_FIELD
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::commit_instruction(code_t *self, const encoding_t *encoding) {
+    switch (self->pass_index) {
+        case PASS_INDEX_TO_CALC_OFFSETS:
+            self->exec_buf_size += encoding->length;
+            break;
+
+        case PASS_INDEX_TO_WRITE: {
+            // Buffer is reserved after first pass, so it never moves while absolute addresses are written.
+            // Function encoded in parallel writes its own buffer, see unit_t
+            const size_t buf_offset = self->exec_buf_size - self->exec_buf_origin;
+            assert (buf_offset + EXEC_BUF_THRESHOLD <= self->exec_buf_capacity);
+
+            write_encoding(self->exec_buf + buf_offset, encoding);
+            self->exec_buf_size += encoding->length;
+            break;
+        }
+
+        default:
+            assert(0 && "Unexpected pass_index");
+            break;
+    }
+}
 
 //----------------------------------------------------------------------------------------------------------------------
 // Static
@@ -232,6 +532,38 @@ static void x64::encode_one_ir_instruction(code_t *self, ir::instruction_t *ir_i
             emit_cond_jmp(self, ir_instruct);
             break;
 
+        case ir::instruction_type_t::AND:
+        case ir::instruction_type_t::OR:
+            emit_and_or(self, ir_instruct);
+            break;
+
+        case ir::instruction_type_t::SETE:
+        case ir::instruction_type_t::SETNE:
+        case ir::instruction_type_t::SETA:
+        case ir::instruction_type_t::SETAE:
+        case ir::instruction_type_t::SETB:
+        case ir::instruction_type_t::SETBE:
+            emit_set_cond(self, ir_instruct);
+            break;
+
+        case ir::instruction_type_t::CMOVE:
+        case ir::instruction_type_t::CMOVNE:
+        case ir::instruction_type_t::CMOVA:
+        case ir::instruction_type_t::CMOVAE:
+        case ir::instruction_type_t::CMOVB:
+        case ir::instruction_type_t::CMOVBE:
+            emit_cmov(self, ir_instruct);
+            break;
+
+        case ir::instruction_type_t::LOAD:
+        case ir::instruction_type_t::STORE:
+        case ir::instruction_type_t::ADD_ACC:
+        case ir::instruction_type_t::SUB_ACC:
+        case ir::instruction_type_t::MUL_ACC:
+        case ir::instruction_type_t::LEA_ACC:
+            emit_acc_op(self, ir_instruct);
+            break;
+
         case ir::instruction_type_t::INC:
         case ir::instruction_type_t::DEC:
         case ir::instruction_type_t::SIN:
@@ -244,21 +576,662 @@ static void x64::encode_one_ir_instruction(code_t *self, ir::instruction_t *ir_i
 
 //----------------------------------------------------------------------------------------------------------------------
 
-static void x64::resize_if_needed(x64::code_t *self) {
-    if (self->exec_buf_size + EXEC_BUF_THRESHOLD >= self->exec_buf_capacity) {
-        self->exec_buf = (uint8_t*) mremap(self->exec_buf, self->exec_buf_capacity,
-                                                                2*self->exec_buf_capacity, MREMAP_MAYMOVE);
+/// Translate code outside of functions in `body_end` (see collect_func_body_ends), all code if it is nullptr
+static result_t x64::translate_top_level(code_t *self, ir::code_t *ir_code, const bool *is_jump_target,
+                                         const size_t *body_end) {
+    self->exec_buf_size = code_entry_offset(self);
+
+    while (self->pass_index < TOTAL_PASS_COUNT) {
+        UNWRAP_ERROR(encode_top_level_pass(self, ir_code, is_jump_target, body_end));
+        UNWRAP_ERROR(start_new_pass(self));
+    }
+
+    return result_t::OK;
+}
+
+static result_t x64::encode_top_level_pass(code_t *self, ir::code_t *ir_code, const bool *is_jump_target,
+                                           const size_t *body_end) {
+    emit_code_preparation(self);
+
+    UNWRAP_ERROR(encode_ir_range(self, ir_code->instructions, ir_code->size, is_jump_target, body_end));
+
+    if (self->lazy) {
+        UNWRAP_ERROR(emit_lazy_stubs(self));
+    }
+
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Encode instructions from `ir_instruct` up to index `end`, skipping function bodies in `body_end` if it is set
+static result_t x64::encode_ir_range(code_t *self, ir::instruction_t *ir_instruct, size_t end,
+                                     const bool *is_jump_target, const size_t *body_end) {
+    while (ir_instruct && ir_instruct->index < end) {
+        // Function is translated apart
+        if (body_end && body_end[ir_instruct->index]) {
+            size_t func_end = body_end[ir_instruct->index];
+
+            while (ir_instruct && ir_instruct->index < func_end) {
+                ir_instruct = ir::next_insruction(ir_instruct);
+            }
+
+            continue;
+        }
+
+        if (is_jump_target[ir_instruct->index]) {
+            peephole_flush(self);
+
+            // Offsets from code start: JIT buffer may still move before write pass
+            if (self->pass_index == PASS_INDEX_TO_CALC_OFFSETS) {
+                // Lazy function start is already mapped to its stub, that is replaced now
+                const size_t offset = self->exec_buf_size;
+                UNWRAP_ERROR((self->lazy) ? addr_transl_set   (self->addr_transl, ir_instruct->index, offset)
+                                          : addr_transl_insert(self->addr_transl, ir_instruct->index, offset));
+            }
+        }
+
+        encode_one_ir_instruction(self, ir_instruct);
+
+        ir_instruct = ir::next_insruction(ir_instruct);
+    }
+
+    peephole_flush(self);
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static x64::lazy_t *x64::lazy_new(ir::code_t *ir_code) {
+    lazy_t *self = (lazy_t *) calloc(1, sizeof(lazy_t));
+    if (!self) { return nullptr; }
+
+    self->ir_code        = ir_code;
+    self->is_jump_target = collect_jump_targets(ir_code);
+    self->entries        = collect_func_entries(ir_code);
+    self->func_by_begin  = collect_func_by_begin(ir_code);
+    self->funcs          = (lazy_func_t *) calloc(ir_code->funcs_count + 1,  sizeof(lazy_func_t));
+
+    if (!self->is_jump_target || !self->entries || !self->func_by_begin || !self->funcs) {
+        lazy_delete(self);
+        return nullptr;
+    }
+
+    return self;
+}
+
+static void x64::lazy_delete(lazy_t *self) {
+    if (!self) {
+        return;
+    }
+
+    if (self->funcs) {
+        for (size_t i = 0; i < self->ir_code->funcs_count; ++i) {
+            free(self->funcs[i].call_sites);
+        }
+    }
+
+    free(self->funcs);
+    free(self->func_by_begin);
+    free(self->entries);
+    free(self->is_jump_target);
+    ir::code_delete(self->ir_code);
+    free(self);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Stubs follow top level code, calls to functions go to them until functions are translated
+static result_t x64::emit_lazy_stubs(code_t *self) {
+    const ir::code_t *ir_code = self->lazy->ir_code;
+
+    for (size_t i = 0; i < ir_code->funcs_count; ++i) {
+        peephole_flush(self);
+
+        if (self->pass_index == PASS_INDEX_TO_CALC_OFFSETS) {
+            self->lazy->funcs[i].stub_offset = self->exec_buf_size;
+            UNWRAP_ERROR(addr_transl_insert(self->addr_transl, ir_code->funcs[i].begin, self->exec_buf_size));
+        }
+
+        emit_lazy_stub(self, i);
+    }
+
+    peephole_flush(self);
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Append function to exec_buf, then redirect its stub and recorded calls to it
+static result_t x64::translate_lazy_func(code_t *self, size_t func_index) {
+    lazy_func_t *func = &self->lazy->funcs[func_index];
+    const ir::func_range_t *range = &self->lazy->ir_code->funcs[func_index];
+
+    // Recursive calls go straight to function, not to its stub
+    func->is_translated = true;
+
+    const size_t func_offset = self->exec_buf_size;
+    UNWRAP_ERROR(addr_transl_set(self->addr_transl, range->begin, func_offset));
+
+    for (self->pass_index = PASS_INDEX_TO_CALC_OFFSETS; self->pass_index < TOTAL_PASS_COUNT; self->pass_index++) {
+        self->exec_buf_size = func_offset;
+        peephole_reset(self->peephole);
+
+        UNWRAP_ERROR(encode_ir_range(self, self->lazy->entries[func_index], range->end, self->lazy->is_jump_target,
+                                     nullptr));
+
+        if (self->exec_buf_size + EXEC_BUF_THRESHOLD > self->exec_buf_capacity) {
+            log (ERROR, "Reserved JIT buffer of %zu bytes is too small for function %lu", self->exec_buf_capacity,
+                                                                                          range->func);
+            return result_t::ERROR;
+        }
+    }
+
+    const size_t   func_end  = self->exec_buf_size;
+    const uint64_t func_addr = code_base_addr(self) + func_offset;
+
+    // Calls from translated code, that were not recorded, still go through stub
+    self->pass_index    = PASS_INDEX_TO_WRITE;
+    self->exec_buf_size = func->stub_offset;
+    emit_abs_jmp(self, func_addr);
+    peephole_flush(self);
+
+    self->pass_index    = TOTAL_PASS_COUNT;
+    self->exec_buf_size = func_end;
+
+    for (size_t i = 0; i < func->call_sites_count; ++i) {
+        memcpy(self->exec_buf + func->call_sites[i], &func_addr, sizeof(func_addr));
+    }
+
+    free(func->call_sites);
+    func->call_sites          = nullptr;
+    func->call_sites_count    = 0;
+    func->call_sites_capacity = 0;
+
+    log (INFO, "Translated function %lu: %zu bytes", range->func, func_end - func_offset);
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Relocatable object
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Wrappers are appended after translation, so they are written in one pass
+static result_t x64::emit_object_wrappers(code_t *self, const ir::code_t *ir_code) {
+    object_t *object = self->object;
+
+    self->pass_index = PASS_INDEX_TO_WRITE;
+    peephole_reset(self->peephole);
+
+    for (size_t i = 0; i < ir_code->funcs_count; ++i) {
+        const ir::func_range_t *range = &ir_code->funcs[i];
 
-        self->exec_buf_capacity *= 2;
+        // Buffer may move: code is position independent
+        UNWRAP_ERROR(reserve_exec_buf(self, self->exec_buf_size + WRAPPER_RESERVED_BYTES + EXEC_BUF_THRESHOLD
+                                            + range->args_count * WRAPPER_RESERVED_BYTES_PER_ARG));
+
+        const size_t offset = self->exec_buf_size;
+        emit_object_wrapper(self, range, ir_code->top_level_frame);
+        peephole_flush(self);
+
+        object->symbols[object->symbols_count++] = {.func = range->func, .offset = offset,
+                                                    .size = self->exec_buf_size - offset};
     }
+
+    self->pass_index = TOTAL_PASS_COUNT;
+    return result_t::OK;
+}
+
+static void x64::object_delete(object_t *self) {
+    if (self) {
+        fragment_delete(self->relocs);
+        free(self->symbols);
+    }
+
+    free(self);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-static void x64::start_new_pass(code_t *self) {
+static result_t x64::reserve_exec_buf(x64::code_t *self, size_t capacity) {
+    if (capacity <= self->exec_buf_capacity) {
+        return result_t::OK;
+    }
+
+    capacity = (capacity + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+    uint8_t *exec_buf = (uint8_t*) mremap(self->exec_buf, self->exec_buf_capacity, capacity, MREMAP_MAYMOVE);
+    if (exec_buf == MAP_FAILED) { return result_t::ERROR; }
+
+    self->exec_buf          = exec_buf;
+    self->exec_buf_capacity = capacity;
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+uint64_t x64::code_base_addr(const code_t *self) {
+    if (self->program) {
+        return code_base_addr(self->program);
+    }
+
+    if (self->output_type == output_t::JIT) {
+        return (uint64_t) self->exec_buf;
+    }
+
+    return (self->stdlib_link) ? self->stdlib_link->code_addr : (uint64_t) x64::CODE_BASE_ADDR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static result_t x64::start_new_pass(code_t *self) {
     if (self->pass_index + 1 < TOTAL_PASS_COUNT) {
-        self->exec_buf_size = 0;
+        // Code size is known after first pass, so buffer is resized (and maybe moved) only here
+        UNWRAP_ERROR (reserve_exec_buf(self, self->exec_buf_size + EXEC_BUF_THRESHOLD));
+        self->exec_buf_size = code_entry_offset(self);
+    } else {
+        peephole_log_stats(self->peephole);
     }
 
+    peephole_reset(self->peephole);
+
     self->pass_index++;
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Returns array `ir index -> is there jmp / call / j?? to it`
+static bool *x64::collect_jump_targets(ir::code_t *ir_code) {
+    bool *is_jump_target = (bool *) calloc(ir_code->size + 1, sizeof(bool));
+    if (!is_jump_target) { return nullptr; }
+
+    for (ir::instruction_t *ir_instruct = ir_code->instructions; ir_instruct;
+                            ir_instruct = ir::next_insruction(ir_instruct)) {
+        if (ir::is_jump(ir_instruct->type) && ir_instruct->imm_arg <= ir_code->size) {
+            is_jump_target[ir_instruct->imm_arg] = true;
+        }
+    }
+
+    // Wrappers of relocatable object enter functions, that program itself may never call
+    for (size_t i = 0; i < ir_code->funcs_count; ++i) {
+        is_jump_target[ir_code->funcs[i].begin] = true;
+    }
+
+    return is_jump_target;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Returns array `ir index -> end of function body starting there, 0 if there is none`
+static size_t *x64::collect_func_body_ends(ir::code_t *ir_code) {
+    size_t *body_end = (size_t *) calloc(ir_code->size + 1, sizeof(size_t));
+    if (!body_end) { return nullptr; }
+
+    for (size_t i = 0; i < ir_code->funcs_count; ++i) {
+        body_end[ir_code->funcs[i].begin] = ir_code->funcs[i].end;
+    }
+
+    return body_end;
+}
+
+/// Returns array `ir index -> 1 + index of function starting there, 0 if there is none`
+static size_t *x64::collect_func_by_begin(ir::code_t *ir_code) {
+    size_t *func_by_begin = (size_t *) calloc(ir_code->size + 1, sizeof(size_t));
+    if (!func_by_begin) { return nullptr; }
+
+    for (size_t i = 0; i < ir_code->funcs_count; ++i) {
+        func_by_begin[ir_code->funcs[i].begin] = i + 1;
+    }
+
+    return func_by_begin;
+}
+
+/// Returns array `function index -> its first instruction`
+static ir::instruction_t **x64::collect_func_entries(ir::code_t *ir_code) {
+    ir::instruction_t **entries = (ir::instruction_t **) calloc(ir_code->funcs_count + 1, sizeof(ir::instruction_t *));
+    if (!entries) { return nullptr; }
+
+    // Functions are registered in order of their definitions, so both lists are sorted by index
+    size_t func_index = 0;
+
+    for (ir::instruction_t *ir_instruct = ir_code->instructions; ir_instruct && func_index < ir_code->funcs_count;
+                            ir_instruct = ir::next_insruction(ir_instruct)) {
+        if (ir_instruct->index == ir_code->funcs[func_index].begin) {
+            entries[func_index++] = ir_instruct;
+        }
+    }
+
+    return entries;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Parallel translation
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Functions are encoded by thread pool into their own buffers and then copied after top level code
+static result_t x64::translate_parallel(code_t *self, ir::code_t *ir_code, const bool *is_jump_target) {
+    size_t *body_end            = collect_func_body_ends(ir_code);
+    ir::instruction_t **entries = collect_func_entries(ir_code);
+    unit_t *units               = (unit_t *) calloc(ir_code->funcs_count, sizeof(unit_t));
+    size_t *func_by_begin       = (self->links) ? collect_func_by_begin(ir_code) : nullptr;
+
+    result_t res = (body_end && entries && units && (func_by_begin || !self->links)) ? result_t::OK
+                                                                                      : result_t::ERROR;
+
+    for (size_t i = 0; i < ir_code->funcs_count && res == result_t::OK; ++i) {
+        // Cached function has no unit, it's only placed by layout
+        if (self->links && self->links[i].is_cached) {
+            continue;
+        }
+
+        res = unit_ctor(&units[i], self, entries[i], ir_code->funcs[i].end);
+
+        if (res == result_t::OK && self->links) {
+            self->links[i].fragment = units[i].code.fragment = fragment_new();
+            res = (self->links[i].fragment) ? result_t::OK : result_t::ERROR;
+        }
+    }
+
+    if (res == result_t::OK) {
+        parallel_ctx_t ctx = {
+                .program        = self,
+                .ir_code        = ir_code,
+                .is_jump_target = is_jump_target,
+                .body_end       = body_end,
+                .units          = units,
+                .func_by_begin  = func_by_begin
+        };
+
+        res = translate_units(&ctx);
+    }
+
+    for (size_t i = 0; units && i < ir_code->funcs_count; ++i) {
+        unit_dtor(&units[i]);
+    }
+
+    free(func_by_begin);
+    free(units);
+    free(entries);
+    free(body_end);
+
+    return res;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static result_t x64::translate_units(parallel_ctx_t *ctx) {
+    code_t *self = ctx->program;
+    const size_t units_count = ctx->ir_code->funcs_count;
+
+    self->exec_buf_size = code_entry_offset(self);
+
+    // Offsets of units are not known yet, so they remember their jump targets from 0 in their own translators
+    work_pool_run(units_count + 1, self->jobs, encode_unit, ctx);
+    UNWRAP_ERROR(units_result(ctx));
+
+    // Units follow top level code, now all jump targets are known
+    size_t offset = self->exec_buf_size;
+
+    for (size_t i = 0; i < units_count; ++i) {
+        code_t *unit_code = &ctx->units[i].code;
+        const size_t func_begin = ctx->ir_code->funcs[i].begin;
+
+        if (self->links) {
+            self->links[i].origin = offset;
+        }
+
+        if (self->links && self->links[i].is_cached) {
+            UNWRAP_ERROR(add_cached_labels(self, self->links[i].fragment, func_begin, offset));
+            offset += self->links[i].fragment->size;
+            continue;
+        }
+
+        if (unit_code->fragment) {
+            UNWRAP_ERROR(add_unit_labels(unit_code->fragment, unit_code->addr_transl, func_begin));
+        }
+
+        for (size_t j = 0; j < unit_code->addr_transl->size; ++j) {
+            const mapping_t *mapping = &unit_code->addr_transl->mappings[j];
+            UNWRAP_ERROR(addr_transl_insert(self->addr_transl, mapping->old_addr, mapping->new_addr + offset));
+        }
+
+        UNWRAP_ERROR(reserve_exec_buf(unit_code, unit_code->exec_buf_size + EXEC_BUF_THRESHOLD));
+
+        addr_transl_delete(unit_code->addr_transl);
+        unit_code->addr_transl     = self->addr_transl;
+        unit_code->exec_buf_origin = offset;
+
+        offset += unit_code->exec_buf_size;
+
+        unit_code->exec_buf_size = unit_code->exec_buf_origin;
+        peephole_reset(unit_code->peephole);
+        unit_code->pass_index++;
+    }
+
+    self->exec_buf_size = offset;
+    UNWRAP_ERROR(start_new_pass(self));
+
+    // Translator is only read now. Each unit writes own buffer, as encodings are copied with tail of garbage
+    work_pool_run(units_count + 1, self->jobs, encode_unit, ctx);
+    UNWRAP_ERROR(units_result(ctx));
+
+    for (size_t i = 0; i < units_count; ++i) {
+        const code_t *unit_code = &ctx->units[i].code;
+
+        // Functions of incremental build are written by save() from fragments, exec_buf has holes for them
+        if (self->links) {
+            UNWRAP_ERROR((self->links[i].is_cached) ? result_t::OK
+                                                    : finish_fragment(self->links[i].fragment, unit_code, ctx, i));
+            continue;
+        }
+
+        memcpy(self->exec_buf + unit_code->exec_buf_origin, unit_code->exec_buf,
+               unit_code->exec_buf_size - unit_code->exec_buf_origin);
+    }
+
+    self->exec_buf_size = offset;
+    return start_new_pass(self);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Task of work pool: 0 is top level code, others are functions
+static void x64::encode_unit(void *ctx, size_t index) {
+    parallel_ctx_t *parallel_ctx = (parallel_ctx_t *) ctx;
+
+    if (index == 0) {
+        parallel_ctx->result = encode_top_level_pass(parallel_ctx->program, parallel_ctx->ir_code,
+                                                     parallel_ctx->is_jump_target, parallel_ctx->body_end);
+        return;
+    }
+
+    // Cached function of incremental build
+    unit_t *unit = &parallel_ctx->units[index - 1];
+    if (!unit->first) {
+        return;
+    }
+
+    unit->result = encode_ir_range(&unit->code, unit->first, unit->end, parallel_ctx->is_jump_target, nullptr);
+}
+
+static result_t x64::units_result(const parallel_ctx_t *ctx) {
+    UNWRAP_ERROR(ctx->result);
+
+    for (size_t i = 0; i < ctx->ir_code->funcs_count; ++i) {
+        UNWRAP_ERROR(ctx->units[i].result);
+    }
+
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static result_t x64::unit_ctor(unit_t *self, const code_t *program, ir::instruction_t *first, size_t end) {
+    *self = {.first = first, .end = end};
+
+    code_t *code = &self->code;
+    code->program     = program;
+    code->output_type = program->output_type;
+    code->raw_output  = program->raw_output;
+    code->pic         = program->pic;
+
+    // Unit is never executed, it is copied into program
+    code->exec_buf = (uint8_t *) mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (code->exec_buf == MAP_FAILED) {
+        code->exec_buf = nullptr;
+        return result_t::ERROR;
+    }
+
+    code->exec_buf_capacity = PAGE_SIZE;
+
+    code->addr_transl = addr_transl_new();
+    code->peephole    = peephole_new();
+    if (!code->addr_transl || !code->peephole) { return result_t::ERROR; }
+
+    return result_t::OK;
+}
+
+static void x64::unit_dtor(unit_t *self) {
+    code_t *code = &self->code;
+
+    if (code->exec_buf) {
+        munmap(code->exec_buf, code->exec_buf_capacity);
+    }
+
+    // After first pass unit uses translator of program
+    if (code->addr_transl && code->addr_transl != code->program->addr_transl) {
+        addr_transl_delete(code->addr_transl);
+    }
+
+    peephole_delete(code->peephole);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Incremental translation
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Labels of cached function are placed at `origin`, so code outside of it can jump to them
+static result_t x64::add_cached_labels(code_t *self, const fragment_t *fragment, size_t func_begin, size_t origin) {
+    for (size_t i = 0; i < fragment->labels_count; ++i) {
+        const mapping_t *label = &fragment->labels[i];
+        UNWRAP_ERROR(addr_transl_insert(self->addr_transl, func_begin + label->old_addr, origin + label->new_addr));
+    }
+
+    return result_t::OK;
+}
+
+/// Translator of unit maps its labels to offsets from its start, they are stored relative to function begin
+static result_t x64::add_unit_labels(fragment_t *fragment, const addr_transl_t *unit_transl, size_t func_begin) {
+    fragment->labels = (mapping_t *) calloc(unit_transl->size + 1, sizeof(mapping_t));
+    UNWRAP_NULLPTR(fragment->labels);
+
+    for (size_t i = 0; i < unit_transl->size; ++i) {
+        fragment->labels[i] = {.old_addr = unit_transl->mappings[i].old_addr - func_begin,
+                               .new_addr = unit_transl->mappings[i].new_addr};
+    }
+
+    fragment->labels_count = unit_transl->size;
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Copy written unit into fragment and make its relocations independent of IR positions of this build
+static result_t x64::finish_fragment(fragment_t *fragment, const code_t *unit_code, const parallel_ctx_t *ctx,
+                                     size_t func_index) {
+    // Relocation was lost, see record_reloc()
+    if (unit_code->fragment != fragment) {
+        return result_t::ERROR;
+    }
+
+    fragment->size = unit_code->exec_buf_size - unit_code->exec_buf_origin;
+    fragment->code = (uint8_t *) malloc(fragment->size + 1);
+    UNWRAP_NULLPTR(fragment->code);
+
+    memcpy(fragment->code, unit_code->exec_buf, fragment->size);
+
+    const ir::func_range_t *range = &ctx->ir_code->funcs[func_index];
+
+    for (size_t i = 0; i < fragment->relocs_count; ++i) {
+        reloc_t *reloc = &fragment->relocs[i];
+        if (reloc->target_type != reloc_target_t::LABEL) {
+            continue;
+        }
+
+        // Other functions are found by number: their IR positions change with code before them
+        const uint64_t target = (uint64_t) reloc->target;
+        const size_t   callee = (target <= ctx->ir_code->size && target != range->begin)
+                              ? ctx->func_by_begin[target] : 0;
+
+        if (callee) {
+            reloc->target_type = reloc_target_t::FUNC;
+            reloc->target      = (int64_t) ctx->ir_code->funcs[callee - 1].func;
+        } else {
+            reloc->target      = (int64_t) (target - range->begin);
+        }
+    }
+
+    return result_t::OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Layout is known, so relocations of all fragments get their offsets in exec_buf, save() writes them
+static result_t x64::resolve_links(code_t *self, ir::code_t *ir_code) {
+    for (size_t i = 0; i < self->links_count; ++i) {
+        fragment_link_t *link = &self->links[i];
+
+        link->targets = (uint64_t *) calloc(link->fragment->relocs_count + 1, sizeof(uint64_t));
+        UNWRAP_NULLPTR(link->targets);
+
+        for (size_t j = 0; j < link->fragment->relocs_count; ++j) {
+            UNWRAP_ERROR(resolve_reloc(self, ir_code, ir_code->funcs[i].begin, &link->fragment->relocs[j],
+                                       &link->targets[j]));
+        }
+    }
+
+    return result_t::OK;
+}
+
+static result_t x64::resolve_reloc(code_t *self, ir::code_t *ir_code, size_t func_begin, const reloc_t *reloc,
+                                   uint64_t *target_offset) {
+    uint64_t label = 0;
+
+    switch (reloc->target_type) {
+        case reloc_target_t::OFFSET:
+            *target_offset = (uint64_t) reloc->target;
+            return result_t::OK;
+
+        case reloc_target_t::LABEL:
+            label = func_begin + (uint64_t) reloc->target;
+            break;
+
+        case reloc_target_t::FUNC: {
+            size_t func_index = 0;
+            while (func_index < ir_code->funcs_count && ir_code->funcs[func_index].func != (uint64_t) reloc->target) {
+                func_index++;
+            }
+
+            if (func_index == ir_code->funcs_count) {
+                log (ERROR, "Relocation refers to undefined function %ld", reloc->target);
+                return result_t::ERROR;
+            }
+
+            label = ir_code->funcs[func_index].begin;
+            break;
+        }
+
+        default:
+            assert (0 && "Unexpected relocation target");
+            return result_t::ERROR;
+    }
+
+    *target_offset = addr_transl_translate(self->addr_transl, label);
+    if (*target_offset == (uint64_t) ERROR) {
+        log (ERROR, "Relocation refers to unknown label %lu", label);
+        return result_t::ERROR;
+    }
+
+    return result_t::OK;
 }
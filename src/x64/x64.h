@@ -8,11 +8,109 @@
 
 
 namespace x64 {
+    struct peephole_t;
+    struct lazy_t;
+
+    const size_t DEFAULT_RAM_SIZE = 64 * 1024 * 1024;  // For programs with recursion, pages are backed only on touch
+    const size_t RAM_GUARD_SIZE   = 4096;              // Inaccessible page after RAM, so frame overflow faults
+
+    /// Slots of table, that precedes position independent code. Filled with addresses when code is loaded
+    enum class PIC_TABLE_SLOTS {
+        RAM = 0,
+        INPUT,
+        OUTPUT,
+        OUTPUT_RAW,
+        SQRT,
+        EXIT,
+    };
+
+    const size_t PIC_TABLE_SIZE = 4096;  // Whole page, so code stays page aligned and table can be mapped apart
+
     enum class output_t {
         JIT,
         BINARY
     };
 
+    /// How address of relocation target is written
+    enum class reloc_type_t {
+        ABS64,      // imm64 of `mov rax, %addr`: CODE_BASE_ADDR + target offset
+        REL32,      // Last 4 bytes of instruction: target offset - offset of next instruction
+    };
+
+    enum class reloc_target_t {
+        LABEL,      // IR index relative to begin of fragment's function
+        FUNC,       // First instruction of function with this number, see ir::func_range_t
+        OFFSET,     // Offset in exec_buf, e.g. PIC table slot
+    };
+
+    /// Immediate in function code, that depends on its position or on positions of other code
+    struct reloc_t {
+        uint64_t position;  // Offset of immediate in fragment code
+        reloc_type_t type;
+        reloc_target_t target_type;
+        int64_t target;
+    };
+
+    /// Code of one function, that can be linked into any build of program with the same function IR
+    struct fragment_t {
+        uint8_t *code;
+        size_t size;
+
+        reloc_t *relocs;
+        size_t relocs_count;
+        size_t relocs_capacity;
+
+        mapping_t *labels;  // IR index relative to function begin -> offset in code
+        size_t labels_count;
+    };
+
+    /// Addresses of stdlib functions called by generated code
+    struct stdlib_addrs {
+        uint64_t inp;
+        uint64_t out;
+        uint64_t out_raw;
+        uint64_t sqrt;
+        uint64_t halt;
+    };
+
+    /// Compact ELF: stdlib sections used by program, linked right after headers and before generated code
+    struct stdlib_link_t {
+        uint8_t *text;
+        size_t text_size;
+        uint64_t text_addr;
+        uint64_t code_addr;
+
+        uint64_t data_addr;     // stdlib .bss, right below RAM
+        size_t data_size;
+
+        stdlib_addrs addrs;     // 0 for functions, that are not linked
+    };
+
+    /// C ABI wrapper of function in relocatable object, exported as `rl_func_<func>`
+    struct object_symbol_t {
+        uint64_t func;
+        size_t offset;      // In exec_buf, wrappers follow translated code
+        size_t size;
+    };
+
+    /// Relocatable object: PIC table is written as data section, its references in code become relocations
+    struct object_t {
+        fragment_t *relocs;     // Recorded while whole program is written, positions are offsets in exec_buf
+
+        object_symbol_t *symbols;   // Same order as ir_code->funcs
+        size_t symbols_count;
+
+        bool is_shared;     // Written as shared library with the same symbols, see save()
+    };
+
+    /// Function, that is written by save() at `origin` of exec_buf with relocations resolved to `targets`
+    struct fragment_link_t {
+        fragment_t *fragment;
+        bool is_cached;     // Taken from caller, otherwise translated now
+        size_t origin;
+        uint64_t *targets;  // Offsets in exec_buf, same order as fragment->relocs
+    };
+
     struct code_t {
         uint8_t *exec_buf;
         size_t exec_buf_capacity;
@@ -20,24 +118,82 @@ namespace x64 {
 
         uint8_t *ram_buf;
         size_t ram_buf_capacity;
+        size_t ram_size;    // Usable bytes of RAM, both in JIT and in ELF, guard page follows them
 
         addr_transl_t *addr_transl;
+        peephole_t *peephole;
         uint pass_index;
 
         output_t output_type;
+        bool raw_output;    // Print values without "OUTPUT: " prefix
+        bool pic;           // Position independent: exec_buf starts with PIC table, code uses only relative addresses
+
+        lazy_t *lazy;       // Functions are translated on first call, nullptr if whole program is translated at once
+        uint jobs;          // Threads encoding functions in parallel, 0 or 1 to encode serially
+
+        const code_t *program;  // Whole program, if this is its function encoded in parallel with others
+        size_t exec_buf_origin; // Offset of exec_buf start in whole program
+
+        fragment_t *fragment;   // Function, whose relocations are recorded while it's written (incremental build)
+        fragment_link_t *links; // Functions, that fill holes after top level code in exec_buf, nullptr if none
+        size_t links_count;
+
+        stdlib_link_t *stdlib_link; // Compact ELF layout with stripped stdlib, nullptr for usual one
+        object_t *object;           // Relocatable object instead of executable, nullptr for usual ELF
     };
 
 //----------------------------------------------------------------------------------------------------------------------
 
-    result_t code_ctor(code_t *self, output_t output);
-    code_t  *code_new(output_t output);
+    result_t code_ctor(code_t *self, output_t output, size_t ram_size);
+    code_t  *code_new(output_t output, size_t ram_size);
     void code_dtor(code_t *self);
     void code_delete(code_t *self);
 
+    /// Requested size if it is not 0, otherwise static estimate from IR or DEFAULT_RAM_SIZE. Page aligned
+    size_t choose_ram_size(size_t requested, const ir::code_t *ir_code);
+
     result_t translate_from_ir(code_t *self, ir::code_t *ir_code);
 
-    [[noreturn]]
-    void execute(code_t *self);
+    /**
+     * @brief Translate only top level code, each function starts as stub, that translates it on first call
+     *
+     * @note Takes ownership of `ir_code`: it is needed until all functions are called. Only for JIT without PIC
+     */
+    result_t translate_lazy(code_t *self, ir::code_t *ir_code);
+
+    /**
+     * @brief Translate top level code into exec_buf and each function into fragment, that is linked by save()
+     *
+     * @param cached Fragment for each function of ir_code->funcs, if it's already translated, or nullptr.
+     *               Fragments are taken by code. Translated ones are in `links` with `is_cached` unset
+     *
+     * @note Only for ELF output: exec_buf has holes for functions, so code can't be executed in place
+     */
+    result_t translate_incremental(code_t *self, ir::code_t *ir_code, fragment_t **cached);
+
+    /**
+     * @brief Translate whole program and append System V ABI wrapper of each function, see object_t
+     *
+     * @param is_shared Write shared library (ET_DYN) instead of relocatable object
+     *
+     * @note Only for ELF output with PIC. Functions are encoded serially, so all relocations are in one fragment
+     */
+    result_t translate_object(code_t *self, ir::code_t *ir_code, bool is_shared);
+
+    fragment_t *fragment_new();
+    void fragment_delete(fragment_t *self);
+    result_t fragment_add_reloc(fragment_t *self, const reloc_t *reloc);
+
+    /// Offset of first instruction in exec_buf: PIC_TABLE_SIZE in PIC mode, 0 otherwise
+    size_t code_entry_offset(const code_t *self);
+
+    /**
+     * @brief Replace exec_buf of JIT code with PIC code mapped read-only from file, PIC table is filled for this process
+     *
+     * @param offset    Page aligned file offset of PIC table, code follows it
+     * @param code_size Size of PIC table and code (exec_buf_size of compiled code)
+     */
+    result_t code_map_pic(code_t *self, int fd, size_t offset, size_t code_size);
 }
 
 #endif //X64_TRANSLATOR_X64_H
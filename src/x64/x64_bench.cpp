@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <time.h>
+#include "../common.h"
+#include "x64_consts.h"
+#include "x64_encoder.h"
+#include "x64_stdlib.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+
+const uint BENCH_BUF_SIZE = 1 << 16;
+
+const uint FORMAT_RECORD_MAX = 32; // Same as OUT_RECORD_MAX in stdlib
+
+//----------------------------------------------------------------------------------------------------------------------
+// Instruction mix
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace x64::bench_mix {
+    // Roughly what one `x = x + y * 2` statement in a loop body is translated to
+    constexpr form_t MIX[] = {
+        make_form({.opcode = PUSH_reg | (uint8_t) REG_RAX}),
+        make_form({.opcode = POP_reg  | (uint8_t) REG_RCX}),
+        make_form({.require_imm32 = true, .opcode = PUSH_imm, .imm32 = 500}),
+        make_form({.require_REX = true, .require_ModRM = true, .require_SIB = true, .require_disp32 = true,
+                   .REX = REX_BYTE_IF_NUM_REGS | REX_BYTE_IF_64_BIT, .opcode = MOV_reg_mem,
+                   .ModRM = IMM_MODRM_MODE_BIT | DOUBLE_REG_MODRM_MODE_BIT,
+                   .SIB = REG_RBX << SIB_INDEX_OFFSET, .disp32 = 16}),
+        make_form({.require_REX = true, .require_ModRM = true, .require_SIB = true,
+                   .REX = REX_BYTE_IF_64_BIT, .opcode = ADD_mem_reg, .ModRM = DOUBLE_REG_MODRM_MODE_BIT,
+                   .SIB = (REG_RSP << SIB_BASE_OFFSET) | (REG_RSP << SIB_INDEX_OFFSET)}),
+        make_form({.require_REX = true, .require_imm64 = true, .REX = REX_BYTE_IF_64_BIT,
+                   .opcode = MOV_reg_imm | (uint8_t) REG_RAX, .imm64 = 0x401000}),
+        make_form({.require_REX = true, .require_ModRM = true, .REX = REX_BYTE_IF_64_BIT, .opcode = CMP_reg_reg,
+                   .ModRM = ONLY_REG_MODRM_MODE_BIT | (REG_RCX << MODRM_RM_OFFSET) | REG_RAX}),
+        make_form({.require_prefix = true, .require_imm32 = true, .prefix = CONDJMP_imm_prefix,
+                   .opcode = JNE_imm, .imm32 = 0x40}),
+    };
+
+    const uint MIX_SIZE = sizeof(MIX) / sizeof(MIX[0]);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Static Prototypes
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace x64 {
+    static uint legacy_write(uint8_t *buf, const instruction_t *x64_instruct);
+    static char *per_digit_format(char *buf, int64_t value);
+
+    static double get_time_sec();
+    static void print_result(const char *name, uint64_t instructions_count, double time, uint64_t checksum);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Public
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::bench_encoder(uint64_t instructions_count) {
+    uint8_t *buf = (uint8_t *) calloc(BENCH_BUF_SIZE + ENCODING_BUF_SIZE, sizeof(uint8_t));
+    if (!buf) { return; }
+
+    printf("Encoding %lu instructions (mix of %u forms)\n", instructions_count, bench_mix::MIX_SIZE);
+
+    // Field by field writer, as all instructions were emitted before
+    uint pos = 0;
+    uint64_t checksum = 0;
+    double start = get_time_sec();
+
+    for (uint64_t i = 0; i < instructions_count; ++i) {
+        pos += legacy_write(buf + pos, &bench_mix::MIX[i % bench_mix::MIX_SIZE].instruction);
+        if (pos >= BENCH_BUF_SIZE) { checksum += buf[pos / 2]; pos = 0; }
+    }
+
+    print_result("field by field", instructions_count, get_time_sec() - start, checksum + pos);
+
+    // Runtime encode() + fixed size copy: instructions with operands known only during translation
+    pos = 0;
+    checksum = 0;
+    start = get_time_sec();
+
+    for (uint64_t i = 0; i < instructions_count; ++i) {
+        encoding_t encoding = encode(bench_mix::MIX[i % bench_mix::MIX_SIZE].instruction);
+        write_encoding(buf + pos, &encoding);
+
+        pos += encoding.length;
+        if (pos >= BENCH_BUF_SIZE) { checksum += buf[pos / 2]; pos = 0; }
+    }
+
+    print_result("runtime encode", instructions_count, get_time_sec() - start, checksum + pos);
+
+    // Precomputed compile time templates: fixed size copy only
+    pos = 0;
+    checksum = 0;
+    start = get_time_sec();
+
+    for (uint64_t i = 0; i < instructions_count; ++i) {
+        const encoding_t *encoding = &bench_mix::MIX[i % bench_mix::MIX_SIZE].encoding;
+        write_encoding(buf + pos, encoding);
+
+        pos += encoding->length;
+        if (pos >= BENCH_BUF_SIZE) { checksum += buf[pos / 2]; pos = 0; }
+    }
+
+    print_result("precomputed form", instructions_count, get_time_sec() - start, checksum + pos);
+
+    free(buf);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::bench_format(uint64_t values_count) {
+    char *buf = (char *) calloc(BENCH_BUF_SIZE + FORMAT_RECORD_MAX, sizeof(char));
+    if (!buf) { return; }
+
+    printf("Formatting %lu values\n", values_count);
+
+    // Values grow, so all lengths of integer part are covered
+    const uint64_t step = (uint64_t) INT64_MAX / values_count + 1;
+
+    // One division per digit, as output_asm formatted values before
+    uint pos = 0;
+    uint64_t checksum = 0;
+    double start = get_time_sec();
+
+    for (uint64_t i = 0; i < values_count; ++i) {
+        int64_t value = (int64_t) (i * step) * ((i & 1) ? -1 : 1);
+        pos = (uint) (per_digit_format(buf + pos, value) - buf);
+        if (pos >= BENCH_BUF_SIZE) { checksum += (uint8_t) buf[pos / 2]; pos = 0; }
+    }
+
+    print_result("per digit", values_count, get_time_sec() - start, checksum + pos);
+
+    // Two digits per step from lookup table
+    pos = 0;
+    checksum = 0;
+    start = get_time_sec();
+
+    for (uint64_t i = 0; i < values_count; ++i) {
+        int64_t value = (int64_t) (i * step) * ((i & 1) ? -1 : 1);
+        pos = (uint) (stdlib_format(buf + pos, value) - buf);
+        if (pos >= BENCH_BUF_SIZE) { checksum += (uint8_t) buf[pos / 2]; pos = 0; }
+    }
+
+    print_result("digit pairs", values_count, get_time_sec() - start, checksum + pos);
+
+    free(buf);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Static
+//----------------------------------------------------------------------------------------------------------------------
+
+#define WRITE_OPTIONAL_FIELD(fieldname, type)                                                                           \
+    if (x64_instruct->require_##fieldname) {                                                                            \
+        memcpy(buf + size, &x64_instruct->fieldname, sizeof(type));                                                     \
+        size += sizeof(type);                                                                                           \
+    }
+
+static uint x64::legacy_write(uint8_t *buf, const instruction_t *x64_instruct) {
+    uint size = 0;
+
+    WRITE_OPTIONAL_FIELD(REX,    uint8_t)
+    WRITE_OPTIONAL_FIELD(prefix, uint8_t)
+
+    buf[size++] = x64_instruct->opcode;
+
+    WRITE_OPTIONAL_FIELD(ModRM,  uint8_t)
+    WRITE_OPTIONAL_FIELD(SIB,    uint8_t)
+    WRITE_OPTIONAL_FIELD(disp32, uint32_t)
+    WRITE_OPTIONAL_FIELD(imm32,  uint32_t)
+    WRITE_OPTIONAL_FIELD(imm64,  uint64_t)
+
+    return size;
+}
+
+#undef WRITE_OPTIONAL_FIELD
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// Reference for stdlib_format(): `[-]int.frac\n`, digits are extracted one by one from the end
+static char *x64::per_digit_format(char *buf, int64_t value) {
+    char tmp[FORMAT_RECORD_MAX] = {};
+    uint64_t abs_value = (value < 0) ? -(uint64_t) value : (uint64_t) value;
+
+    char *cur = tmp + FORMAT_RECORD_MAX;
+    *--cur = '\n';
+    *--cur = (char) ('0' + abs_value % 10); abs_value /= 10;
+    *--cur = (char) ('0' + abs_value % 10); abs_value /= 10;
+    *--cur = '.';
+
+    while (abs_value > 0) {
+        *--cur = (char) ('0' + abs_value % 10);
+        abs_value /= 10;
+    }
+
+    if (value < 0) {
+        *--cur = '-';
+    }
+
+    uint len = (uint) (tmp + FORMAT_RECORD_MAX - cur);
+    memcpy(buf, cur, len);
+
+    return buf + len;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double x64::get_time_sec() {
+    timespec time = {};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (double) time.tv_sec + (double) time.tv_nsec / 1e9;
+}
+
+static void x64::print_result(const char *name, uint64_t instructions_count, double time, uint64_t checksum) {
+    printf("%-18s %10.1f M/s  (%.3f s, checksum %lu)\n", name,
+           (double) instructions_count / time / 1e6, time, checksum);
+}
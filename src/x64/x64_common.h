@@ -13,6 +13,7 @@ namespace x64 {
             bool require_prefix :1;
             bool require_ModRM  :1;
             bool require_SIB    :1;
+            bool require_disp32 :1;
             bool require_imm32  :1;
             bool require_imm64  :1;
         };
@@ -23,11 +24,27 @@ namespace x64 {
         uint8_t ModRM;
         uint8_t SIB;
 
+        uint32_t disp32;
         uint32_t imm32;
         uint64_t imm64;
     };
 
-    void emit_instruction(code_t *self, instruction_t *x64_instruct);
+    struct encoding_t;
+
+    void emit_instruction (code_t *self, instruction_t *x64_instruct);
+    void commit_instruction(code_t *self, const encoding_t *encoding);
+
+    /// Address of exec_buf start at runtime: CODE_BASE_ADDR in ELF, exec_buf itself in JIT
+    uint64_t code_base_addr(const code_t *self);
+
+    /// Called from function stub on first call: translate function and return its address
+    uint64_t lazy_compile(code_t *self, uint64_t func_index);
+
+    /// Remember immediate of `mov rax, %target` at `imm_offset`, if target is stub, so it is patched on translation
+    void lazy_add_call_site(code_t *self, uint64_t target, size_t imm_offset);
+
+    /// Remember immediate at `position` of exec_buf, if function fragment is written, see translate_incremental
+    void record_reloc(code_t *self, reloc_type_t type, size_t position, reloc_target_t target_type, uint64_t target);
 }
 
 #endif //X64_TRANSLATOR_X64_COMMON_H
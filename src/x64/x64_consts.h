@@ -47,13 +47,24 @@ namespace x64 {
         POP_mem       = 0x8F,
         ADD_mem_reg   = 0x01,
         SUB_mem_reg   = 0x29,
+        AND_mem_reg   = 0x21,
+        OR_mem_reg    = 0x09,
         DIVMUL_reg    = 0xF7,
-        MOV_reg_imm   = 0x48,
         MOV_reg_imm64 = 0xC7,
         CALL_reg      = 0xFF,
         CMP_reg_reg   = 0x39,
         RET_none      = 0xC3,
         CQO_none      = 0x99,
+        IMUL_reg_imm  = 0x69,
+        MOV_reg_mem   = 0x8B,
+        MOV_mem_reg   = 0x89,
+        ADD_reg_mem   = 0x03,
+        SUB_reg_mem   = 0x2B,
+        ARITH_reg_imm = 0x81,
+        LEA_reg_mem   = 0x8D,
+        MOV_reg_imm   = 0xB8, // + reg; imm64 with REX.W, imm32 (zero extended) without
+        CALL_rel32    = 0xE8,
+        JMP_rel32     = 0xE9,
 
         // Cond jumps prefix
         CONDJMP_imm_prefix = 0x0F,
@@ -65,6 +76,27 @@ namespace x64 {
         JNE_imm  = 0x85, // jne
         JNG_imm  = 0x8e, // jle
         JG_imm   = 0x8f, // jg
+
+        // Two byte opcodes prefix
+        TWO_BYTE_OPCODE_prefix = 0x0F,
+
+        // Set byte on condition opcodes (with TWO_BYTE_OPCODE_prefix)
+        SETL_reg  = 0x9c,
+        SETGE_reg = 0x9d,
+        SETE_reg  = 0x94,
+        SETNE_reg = 0x95,
+        SETLE_reg = 0x9e,
+        SETG_reg  = 0x9f,
+
+        MOVZX_reg_reg8 = 0xB6, // (with TWO_BYTE_OPCODE_prefix)
+
+        // Conditional move opcodes (with TWO_BYTE_OPCODE_prefix)
+        CMOVL_reg_reg  = 0x4c,
+        CMOVGE_reg_reg = 0x4d,
+        CMOVE_reg_reg  = 0x44,
+        CMOVNE_reg_reg = 0x45,
+        CMOVLE_reg_reg = 0x4e,
+        CMOVG_reg_reg  = 0x4f,
     };
 
     // --- --- --- Some opcode consts --- --- ---
@@ -72,14 +104,21 @@ namespace x64 {
     const int LOWER_REG_BITS_MASK       = 0b0111;       // SIB part of register
     const int REX_BYTE_IF_NUM_REGS      = 0b01000001;   // REX mask if using numered register in instruction
     const int REX_BYTE_IF_64_BIT        = 0b01001000;
+    const int REX_PREFIX_BASE           = 0b01000000;   // 0100WRXB
+    const int REX_W_BIT                 = 0b1000;       // 64 bit operand size
+    const int REX_R_BIT                 = 0b0100;       // Extension of ModRM.reg
+    const int REX_B_BIT                 = 0b0001;       // Extension of ModRM.rm / opcode register
 
     const int IMM_MODRM_MODE_BIT        = 0b10000000;
     const int DOUBLE_REG_MODRM_MODE_BIT = 0b00000100;
     const int SINGLE_REG_MODRM_MODE_BIT = 0b00000000;
     const int ONLY_REG_MODRM_MODE_BIT   = 0b11000000;
+    const int RIP_RELATIVE_MODRM_RM     = 0b00000101;   // With SINGLE_REG_MODRM_MODE_BIT: [rip + disp32]
 
     const int MODRM_MUL_REG_BITS        = 0b00101000;
     const int MODRM_DIV_REG_BITS        = 0b00111000;
+    const int MODRM_ADD_REG_BITS        = 0b00000000;
+    const int MODRM_SUB_REG_BITS        = 0b00101000;
 
     const int PUSH_MOD_REG_BITS         = 0b00110000;
     const int POP_MOD_REG_BITS          = 0b00000000;
@@ -88,9 +127,11 @@ namespace x64 {
     const int JMP_MOD_REG_BITS          = 0b00100000;
 
     const int MODRM_RM_OFFSET           = 3;
+    const int MODRM_REG_FIELD_MASK      = 0b00111000;
 
     const int SIB_INDEX_OFFSET          = 3;
     const int SIB_BASE_OFFSET           = 0;
+    const int SIB_SCALE_OFFSET          = 6;
 
     const int DEBUG_SYSCALL_BYTE        = 0xCC;
 }
@@ -1,5 +1,12 @@
 #include "x64_elf.h"
+#include "x64_common.h"
 #include <elf.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 // -------------------------------------------------------------------------------------------------
 
@@ -7,8 +14,10 @@
 // - System header
 // - Generated code header
 // - stdlib code header
+// - stdlib data (.bss with output buffer) header
 // - RAM (.bss) header
-const int NUM_PHEADERS = 4;
+// - RAM guard header
+const int NUM_PHEADERS = 6;
 
 const Elf64_Ehdr ELF_HEADER = {
         .e_ident = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, // Magic signature
@@ -31,7 +40,7 @@ const Elf64_Ehdr ELF_HEADER = {
         .e_ehsize   = sizeof(Elf64_Ehdr),	       // Size of this header.
 
         .e_phentsize = sizeof(Elf64_Phdr),         // Size of Programm header table entry.
-        .e_phnum     = NUM_PHEADERS,               // Number of pheader entries. (system + stdlib + code + bss)
+        .e_phnum     = NUM_PHEADERS,               // Number of pheader entries. (system + stdlib + code + 2 bss + guard)
 
         .e_shentsize = sizeof(Elf64_Shdr),         // Size of Segment header entry.
         .e_shnum     = 0,                          // Number of segments in programm.
@@ -63,66 +72,489 @@ const Elf64_Phdr CODE_PHEADER_TEMPLATE = {
         .p_align  = 4096, /* (min mem alignment in bytes) */
 };
 
-const Elf64_Phdr STDLIB_PHEADER = {
+const Elf64_Phdr STDLIB_PHEADER_TEMPLATE = {
         .p_type   = PT_LOAD,
         .p_flags  = PF_R | PF_X,
         .p_offset = x64::STDLIB_FILE_POS,  /* (bytes into file) */
         .p_vaddr  = x64::STDLIB_BASE_ADDR, /* (virtual addr at runtime) */
         .p_paddr  = x64::STDLIB_BASE_ADDR, /* (physical addr at runtime) */
-        .p_filesz = x64::STDLIB_SIZE,      /* (bytes in file) */
-        .p_memsz  = x64::STDLIB_SIZE,      /* (bytes in mem at runtime) */
+
+        // This fields will be updated later with sizes from embedded stdlib
+        .p_filesz = 0,                     /* (bytes in file) */
+        .p_memsz  = 0,                     /* (bytes in mem at runtime) */
         .p_align  = 4096,                  /* (min mem alignment in bytes) */
 };
 
-const Elf64_Phdr BSS_PHEADER = {
+const Elf64_Phdr STDLIB_DATA_PHEADER_TEMPLATE = {
+        .p_type   = PT_LOAD,
+        .p_flags  = PF_R | PF_W,
+        .p_offset = 0,                          /* (bytes into file) */
+        .p_vaddr  = x64::STDLIB_DATA_BASE_ADDR, /* (virtual addr at runtime) */
+        .p_paddr  = x64::STDLIB_DATA_BASE_ADDR, /* (physical addr at runtime) */
+        .p_filesz = 0,                          /* (bytes in file) */
+
+        // This field will be updated later with size from embedded stdlib
+        .p_memsz  = 0,                          /* (bytes in mem at runtime) */
+        .p_align  = 4096,                       /* (min mem alignment in bytes) */
+};
+
+const Elf64_Phdr BSS_PHEADER_TEMPLATE = {
         .p_type   = PT_LOAD,
         .p_flags  = PF_R | PF_W,
         .p_offset = 0          , /* (bytes into file) */
         .p_vaddr  = x64::RAM_BASE_ADDR   , /* (virtual addr at runtime) */
         .p_paddr  = x64::RAM_BASE_ADDR   , /* (physical addr at runtime) */
         .p_filesz = 0          , /* (bytes in file) */
-        .p_memsz  = x64::RAMSIZE, /* (bytes in mem at runtime) */
+
+        // This field will be updated later with RAM size of code
+        .p_memsz  = 0          , /* (bytes in mem at runtime) */
         .p_align  = 4096       , /* (min mem alignment in bytes) */
 };
 
+// Kernel maps zero-filled part of segment always writable, ignoring p_flags.
+// So guard page is file backed (any page of file) and mapped without access rights.
+const Elf64_Phdr GUARD_PHEADER_TEMPLATE = {
+        .p_type   = PT_LOAD,
+        .p_flags  = 0,                   /* no access */
+        .p_offset = 0,                   /* (bytes into file) */
+
+        // This fields will be updated later, guard follows RAM
+        .p_vaddr  = 0,                   /* (virtual addr at runtime) */
+        .p_paddr  = 0,                   /* (physical addr at runtime) */
+
+        .p_filesz = x64::RAM_GUARD_SIZE, /* (bytes in file) */
+        .p_memsz  = x64::RAM_GUARD_SIZE, /* (bytes in mem at runtime) */
+        .p_align  = 4096,                /* (min mem alignment in bytes) */
+};
+
+// Compact layout: headers, stdlib and code are one segment, stdlib .bss is right below RAM
+const int COMPACT_NUM_PHEADERS = 3;
+
+const uint64_t COMPACT_CODE_ALIGN = 16;
+const uint64_t COMPACT_DATA_ALIGN = 4096;
+
+const Elf64_Phdr COMPACT_TEXT_PHEADER_TEMPLATE = {
+        .p_type   = PT_LOAD,
+        .p_flags  = PF_R | PF_X,
+        .p_offset = 0,                      /* (bytes into file) */
+        .p_vaddr  = x64::COMPACT_BASE_ADDR, /* (virtual addr at runtime) */
+        .p_paddr  = x64::COMPACT_BASE_ADDR, /* (physical addr at runtime) */
+
+        // This fields will be updated later, segment ends with generated code
+        .p_filesz = 0,                      /* (bytes in file) */
+        .p_memsz  = 0,                      /* (bytes in mem at runtime) */
+        .p_align  = 4096,                   /* (min mem alignment in bytes) */
+};
+
+static_assert(x64::STDLIB_TEXT_ADDR == x64::STDLIB_BASE_ADDR, "stdlib must be linked at STDLIB_BASE_ADDR");
+static_assert(x64::STDLIB_DATA_ADDR == x64::STDLIB_DATA_BASE_ADDR || x64::STDLIB_DATA_SIZE == 0,
+              "stdlib .bss must be linked at STDLIB_DATA_BASE_ADDR");
+static_assert(sizeof(x64::STDLIB_TEXT) <= x64::CODE_BASE_ADDR - x64::STDLIB_BASE_ADDR,
+              "stdlib must fit before generated code");
+
+/// Gaps between headers, stdlib and code are shorter than page
+const uint8_t ZERO_PAGE[4096] = {};
+
+const char TMP_SUFFIX[] = ".XXXXXX";
+
+// Relocatable object: PIC table is data section, its references in code are relocated by linker
+enum OBJECT_SECTIONS {
+    NULL_SECTION,
+    TEXT_SECTION,           // Generated code and wrappers, then used stdlib sections
+    TEXT_RELA_SECTION,
+    TABLE_SECTION,          // PIC table (.data.rel.ro)
+    TABLE_RELA_SECTION,
+    BSS_SECTION,            // RAM, then stdlib .bss
+    NOTE_STACK_SECTION,     // .note.GNU-stack: object doesn't need executable stack
+    SYMTAB_SECTION,
+    STRTAB_SECTION,
+    SHSTRTAB_SECTION,
+
+    OBJECT_SECTIONS_COUNT
+};
+
+const char OBJECT_SECTION_NAMES[OBJECT_SECTIONS_COUNT][24] = {
+        "", ".text", ".rela.text", ".data.rel.ro", ".rela.data.rel.ro", ".bss", ".note.GNU-stack", ".symtab",
+        ".strtab", ".shstrtab"
+};
+
+enum OBJECT_SYMBOLS {
+    NULL_SYMBOL,
+    TEXT_SYMBOL,            // Sections are targets of relocations
+    TABLE_SYMBOL,
+    BSS_SYMBOL,
+    RAM_SYMBOL,             // First global
+    FLUSH_SYMBOL,
+
+    FUNC_SYMBOLS            // One for each function, see x64::object_symbol_t
+};
+
+const char OBJECT_RAM_SYMBOL[]         = "rl_ram";
+const char OBJECT_FLUSH_SYMBOL[]       = "rl_flush";
+const char OBJECT_FUNC_SYMBOL_FORMAT[] = "rl_func_%lu";
+const size_t OBJECT_SYMBOL_NAME_MAX    = 32;
+
+const int PIC_TABLE_SLOTS_COUNT = (int) x64::PIC_TABLE_SLOTS::EXIT + 1;
+
+/// stdlib routine of each PIC table slot, RAM slot has none
+const x64::stdlib_symbol_t *const TABLE_SLOT_IMPLS[PIC_TABLE_SLOTS_COUNT] = {
+        nullptr, &x64::STDLIB_INPUT_IMPL, &x64::STDLIB_OUTPUT_IMPL, &x64::STDLIB_OUTPUT_RAW_IMPL,
+        &x64::STDLIB_SQRT_IMPL, &x64::STDLIB_EXIT_IMPL
+};
+
+const uint64_t OBJECT_TEXT_ALIGN = 16;
+const uint64_t OBJECT_DATA_ALIGN = 8;
+const uint64_t OBJECT_BSS_ALIGN  = 4096;
+
+// Shared library: linked at 0 with file offsets equal to addresses, loader relocates only PIC table
+enum SHARED_SECTIONS {
+    SHARED_NULL_SECTION,
+    SHARED_DYNSYM_SECTION,
+    SHARED_RELA_SECTION,
+    SHARED_HASH_SECTION,
+    SHARED_DYNSTR_SECTION,
+    SHARED_TEXT_SECTION,
+    SHARED_DYNAMIC_SECTION,
+    SHARED_TABLE_SECTION,
+    SHARED_BSS_SECTION,         // RAM of each process, that loaded library, then stdlib .bss
+    SHARED_SHSTRTAB_SECTION,
+
+    SHARED_SECTIONS_COUNT
+};
+
+const char SHARED_SECTION_NAMES[SHARED_SECTIONS_COUNT][16] = {
+        "", ".dynsym", ".rela.dyn", ".hash", ".dynstr", ".text", ".dynamic", ".data.rel.ro", ".bss", ".shstrtab"
+};
+
+enum SHARED_PHEADERS {
+    SHARED_TEXT_PHEADER,        // Headers, dynamic symbols and code, pages are shared by all processes
+    SHARED_DATA_PHEADER,        // .dynamic, PIC table and .bss
+    SHARED_DYNAMIC_PHEADER,
+    SHARED_STACK_PHEADER,       // PT_GNU_STACK: dlopen() doesn't make stack executable
+
+    SHARED_PHEADERS_COUNT
+};
+
+// DT_HASH, DT_STRTAB, DT_SYMTAB, DT_STRSZ, DT_SYMENT, DT_RELA, DT_RELASZ, DT_RELAENT, DT_RELACOUNT, DT_NULL
+const int SHARED_DYNAMIC_COUNT = 10;
+
+const uint64_t SHARED_PAGE_SIZE = 4096;
+
+const uint32_t SHARED_RAM_SYMBOL = 1;   // Follows null symbol, see add_exported_symbols()
+
 // -------------------------------------------------------------------------------------------------
-// Macros
+// Types
 // -------------------------------------------------------------------------------------------------
 
-#define UNWRAP_WRITE(expr) if ((expr) != 1) { return result_t::ERROR; }
+/// Context of write_regions_to_fd()
+struct regions_t {
+    iovec *iov;
+    int count;
+};
 
-// -------------------------------------------------------------------------------------------------
+/// Everything before stdlib, built in memory to be written at once
+struct elf_headers_t {
+    Elf64_Ehdr elf_header;
+    Elf64_Phdr pheaders[NUM_PHEADERS];
+};
+
+struct compact_elf_headers_t {
+    Elf64_Ehdr elf_header;
+    Elf64_Phdr pheaders[COMPACT_NUM_PHEADERS];
+};
+
+/// Relocatable object, built in memory to be written at once
+struct elf_object_t {
+    Elf64_Ehdr elf_header;
+
+    uint8_t *text;
+    size_t text_size;
+    uint64_t text_align;
+    bool is_used[x64::STDLIB_SECTIONS_COUNT + 1];               // Index STDLIB_BSS_SECTION is stdlib .bss
+    uint64_t section_offsets[x64::STDLIB_SECTIONS_COUNT + 1];   // In .text, stdlib .bss one is in .bss
+
+    uint64_t table[PIC_TABLE_SLOTS_COUNT];  // Zeros, all slots are relocated
+    size_t bss_size;
+
+    Elf64_Rela *text_relocs;
+    size_t text_relocs_count;
+    Elf64_Rela table_relocs[PIC_TABLE_SLOTS_COUNT];
+    size_t table_relocs_count;
+
+    Elf64_Sym *symbols;
+    size_t symbols_count;
+    char *strtab;
+    size_t strtab_size;
+    char shstrtab[sizeof(OBJECT_SECTION_NAMES)];
+    size_t shstrtab_size;
+
+    Elf64_Shdr sections[OBJECT_SECTIONS_COUNT];
+};
+
+struct shared_elf_headers_t {
+    Elf64_Ehdr elf_header;
+    Elf64_Phdr pheaders[SHARED_PHEADERS_COUNT];
+};
+
+/// Shared library: relocatable object, laid out at final addresses, with dynamic section and symbols
+struct elf_shared_t {
+    shared_elf_headers_t headers;
+
+    elf_object_t object;    // Its symbols are dynamic ones, table relocations become R_X86_64_RELATIVE
 
-static result_t load_stdlib(FILE *output, const char *filename);
+    uint32_t *hash;         // nbucket, nchain, buckets, chains
+    size_t hash_size;
+    Elf64_Dyn dynamic[SHARED_DYNAMIC_COUNT];
+
+    uint64_t section_addrs[SHARED_SECTIONS_COUNT];
+    char shstrtab[sizeof(SHARED_SECTION_NAMES)];
+    size_t shstrtab_size;
+
+    Elf64_Shdr sections[SHARED_SECTIONS_COUNT];
+};
+
+enum ELF_REGIONS {
+    HEADERS_REGION,
+    HEADERS_GAP_REGION,
+    STDLIB_REGION,
+    STDLIB_GAP_REGION,
+    CODE_REGION,
+
+    REGIONS_COUNT
+};
+
+enum OBJECT_REGIONS {
+    OBJECT_HEADER_REGION,
+    OBJECT_TEXT_REGION,
+    OBJECT_TEXT_GAP_REGION,
+    OBJECT_TABLE_REGION,
+    OBJECT_TEXT_RELA_REGION,
+    OBJECT_TABLE_RELA_REGION,
+    OBJECT_SYMTAB_REGION,
+    OBJECT_STRTAB_REGION,
+    OBJECT_SHSTRTAB_REGION,
+    OBJECT_SHSTRTAB_GAP_REGION,
+    OBJECT_SECTIONS_REGION,
+
+    OBJECT_REGIONS_COUNT
+};
+
+enum SHARED_REGIONS {
+    SHARED_HEADERS_REGION,
+    SHARED_DYNSYM_REGION,
+    SHARED_RELA_REGION,
+    SHARED_HASH_REGION,
+    SHARED_DYNSTR_REGION,
+    SHARED_TEXT_GAP_REGION,
+    SHARED_TEXT_REGION,
+    SHARED_DATA_GAP_REGION,
+    SHARED_DYNAMIC_REGION,
+    SHARED_TABLE_REGION,
+    SHARED_SHSTRTAB_REGION,
+    SHARED_SHSTRTAB_GAP_REGION,
+    SHARED_SECTIONS_REGION,
+
+    SHARED_REGIONS_COUNT
+};
 
 // -------------------------------------------------------------------------------------------------
 
+static void fill_headers(elf_headers_t *headers, const x64::code_t *code);
+static void fill_compact_headers(compact_elf_headers_t *headers, const x64::code_t *code);
+static void link_fragment(x64::code_t *code, const x64::fragment_link_t *link);
+static result_t write_regions(const char *filename, iovec *regions, int regions_count, mode_t mode);
+static result_t write_regions_to_fd(int fd, void *regions);
+static result_t pwritev_all(int fd, iovec *iov, int iov_count);
+static iovec region(const void *base, size_t len);
+
+static result_t save_object(const x64::code_t *code, const char *filename);
+static result_t link_object_text(elf_object_t *object, const x64::code_t *code);
+static void add_object_table_relocs(elf_object_t *object);
+static result_t add_object_symbols(elf_object_t *object, const x64::code_t *code);
+static result_t alloc_object_symbols(elf_object_t *object, size_t capacity);
+static void add_exported_symbols(elf_object_t *object, const x64::code_t *code, uint16_t text_section,
+                                 uint16_t bss_section);
+static void add_object_symbol(elf_object_t *object, const char *name, unsigned char info, uint16_t section,
+                              uint64_t value, uint64_t size);
+static void fill_object_sections(elf_object_t *object, iovec *regions);
+
+static result_t save_shared(const x64::code_t *code, const char *filename);
+static result_t add_shared_symbols(elf_shared_t *shared, const x64::code_t *code);
+static result_t fill_shared_hash(elf_shared_t *shared);
+static void layout_shared(elf_shared_t *shared, iovec *regions);
+static result_t relocate_shared(elf_shared_t *shared);
+static void fill_shared_headers(elf_shared_t *shared, const uint64_t *offsets, const iovec *regions);
+static uint64_t get_shared_symbol_addr(const elf_shared_t *shared, uint32_t symbol);
+static uint32_t elf_hash(const char *name);
+
+static void mark_used_section(bool *is_used, uint32_t section);
+static bool get_used_impl(ir::instruction_type_t type, bool raw_output, x64::stdlib_symbol_t *impl);
+static uint64_t align_up(uint64_t value, uint64_t align);
+
+// -------------------------------------------------------------------------------------------------
 
 result_t x64::save(code_t *self, const char *filename) {
     assert(self && filename && "Invalid pointers");
-    FILE *binary = open_file_or_warn(filename, "wb");
-    UNWRAP_NULLPTR(binary);
 
-    Elf64_Phdr code_pheader = CODE_PHEADER_TEMPLATE;
-    code_pheader.p_filesz = self->exec_buf_size;
-    code_pheader.p_memsz  = self->exec_buf_size;
+    if (self->object) {
+        return (self->object->is_shared) ? save_shared(self, filename) : save_object(self, filename);
+    }
+
+    // Link functions of incremental build into holes after top level code, so code is one region
+    for (size_t i = 0; i < self->links_count; ++i) {
+        link_fragment(self, &self->links[i]);
+    }
+
+    iovec regions[REGIONS_COUNT] = {};
+    regions[CODE_REGION] = {self->exec_buf, self->exec_buf_size};
+
+    if (self->stdlib_link) {
+        const stdlib_link_t *link = self->stdlib_link;
+
+        compact_elf_headers_t headers = {};
+        fill_compact_headers(&headers, self);
+
+        regions[HEADERS_REGION]     = {&headers, sizeof(headers)};
+        regions[HEADERS_GAP_REGION] = region(ZERO_PAGE, link->text_addr - COMPACT_BASE_ADDR - sizeof(headers));
+        regions[STDLIB_REGION]      = {link->text, link->text_size};
+        regions[STDLIB_GAP_REGION]  = region(ZERO_PAGE, link->code_addr - link->text_addr - link->text_size);
+
+        return write_regions(filename, regions, REGIONS_COUNT, x64::BINARY_MODE);
+    }
+
+    elf_headers_t headers = {};
+    fill_headers(&headers, self);
+
+    regions[HEADERS_REGION]     = {&headers, sizeof(headers)};
+    regions[HEADERS_GAP_REGION] = region(ZERO_PAGE, STDLIB_FILE_POS - sizeof(headers));
+    regions[STDLIB_REGION]      = region(STDLIB_TEXT, sizeof(STDLIB_TEXT));
+    regions[STDLIB_GAP_REGION]  = region(ZERO_PAGE, CODE_FILE_POS - STDLIB_FILE_POS - sizeof(STDLIB_TEXT));
+
+    return write_regions(filename, regions, REGIONS_COUNT, x64::BINARY_MODE);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+result_t x64::link_compact_stdlib(code_t *self, const ir::code_t *ir_code) {
+    assert (self && ir_code && "Invalid pointers");
+    assert (self->output_type == output_t::BINARY && !self->stdlib_link);
+
+    stdlib_link_t *link = (stdlib_link_t *) calloc(1, sizeof(stdlib_link_t));
+    UNWRAP_NULLPTR (link);
+    self->stdlib_link = link;
+
+    // Index STDLIB_BSS_SECTION is stdlib .bss, it is referenced by relocations as any other section
+    bool is_used[STDLIB_SECTIONS_COUNT + 1] = {};
+    stdlib_symbol_t impl = {};
+
+    for (const ir::instruction_t *instruct = ir_code->instructions; instruct; instruct = instruct->next) {
+        if (get_used_impl(instruct->type, self->raw_output, &impl)) {
+            mark_used_section(is_used, impl.section);
+        }
+    }
+
+    // Sections keep their order from stdlib.o, so the same IR gives the same binary
+    uint64_t section_addrs[STDLIB_SECTIONS_COUNT + 1] = {};
+
+    link->text_addr = COMPACT_BASE_ADDR + align_up(sizeof(compact_elf_headers_t), COMPACT_CODE_ALIGN);
+    uint64_t addr   = link->text_addr;
+
+    for (uint32_t i = 0; i < STDLIB_SECTIONS_COUNT; ++i) {
+        if (is_used[i]) {
+            addr = align_up(addr, STDLIB_SECTIONS[i].align);
+            section_addrs[i] = addr;
+            addr += STDLIB_SECTIONS[i].size;
+        }
+    }
+
+    link->text_size = addr - link->text_addr;
+    link->code_addr = align_up(addr, COMPACT_CODE_ALIGN);
+
+    link->data_size = (is_used[STDLIB_BSS_SECTION]) ? STDLIB_DATA_SIZE : 0;
+    link->data_addr = RAM_BASE_ADDR - align_up(link->data_size, COMPACT_DATA_ALIGN);
+    section_addrs[STDLIB_BSS_SECTION] = link->data_addr;
+
+    link->text = (uint8_t *) calloc(link->text_size + 1, sizeof(uint8_t));
+    UNWRAP_NULLPTR (link->text);
+
+    for (uint32_t i = 0; i < STDLIB_SECTIONS_COUNT; ++i) {
+        if (!is_used[i]) {
+            continue;
+        }
+
+        const stdlib_section_t *section = &STDLIB_SECTIONS[i];
+        uint8_t *code = link->text + (section_addrs[i] - link->text_addr);
+        memcpy(code, section->code, section->size);
+
+        // Only rel32 relocations are left in stdlib.o, embed_stdlib checks it: S + A - P
+        for (uint32_t j = 0; j < section->relocs_count; ++j) {
+            const stdlib_reloc_t *reloc = &section->relocs[j];
+
+            int64_t rel_pos = (int64_t) (section_addrs[reloc->target] - section_addrs[i] - reloc->offset)
+                            + reloc->addend;
+            if (rel_pos != (int32_t) rel_pos) {
+                log (ERROR, "stdlib relocation is out of rel32 range");
+                return result_t::ERROR;
+            }
+
+            int32_t rel32 = (int32_t) rel_pos;
+            memcpy(code + reloc->offset, &rel32, sizeof(rel32));
+        }
+    }
+
+    // Unused routines are left zero, generators never call them
+    if (get_used_impl(ir::instruction_type_t::INP, self->raw_output, &impl)) {
+        link->addrs.inp = section_addrs[impl.section] + impl.offset;
+    }
+    if (get_used_impl(ir::instruction_type_t::OUT, self->raw_output, &impl)) {
+        (self->raw_output ? link->addrs.out_raw : link->addrs.out) = section_addrs[impl.section] + impl.offset;
+    }
+    if (get_used_impl(ir::instruction_type_t::SQRT, self->raw_output, &impl)) {
+        link->addrs.sqrt = section_addrs[impl.section] + impl.offset;
+    }
+    if (get_used_impl(ir::instruction_type_t::HALT, self->raw_output, &impl)) {
+        link->addrs.halt = section_addrs[impl.section] + impl.offset;
+    }
+
+    log (INFO, "Compact stdlib: %zu of %zu bytes linked", link->text_size, sizeof(STDLIB_TEXT));
+    return result_t::OK;
+}
+
+void x64::stdlib_link_delete(stdlib_link_t *self) {
+    if (self) {
+        free(self->text);
+    }
+
+    free(self);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+result_t x64::write_atomically(const char *filename, output_writer_t writer, void *ctx, mode_t mode) {
+    assert (filename && writer && "Invalid pointers");
+
+    char tmp_filename[PATH_MAX] = "";
+    if (snprintf(tmp_filename, PATH_MAX, "%s%s", filename, TMP_SUFFIX) >= PATH_MAX) {
+        log (ERROR, "Too long output filename '%s'", filename);
+        return result_t::ERROR;
+    }
 
-    // Dump Headers
-    UNWRAP_WRITE (fwrite(&ELF_HEADER, sizeof(ELF_HEADER), 1, binary));
-    UNWRAP_WRITE (fwrite(&SYSTEM_PHEADER, sizeof(SYSTEM_PHEADER), 1, binary));
-    UNWRAP_WRITE (fwrite(&code_pheader, sizeof(code_pheader), 1, binary));
-    UNWRAP_WRITE (fwrite(&STDLIB_PHEADER, sizeof(STDLIB_PHEADER), 1, binary));
-    UNWRAP_WRITE (fwrite(&BSS_PHEADER, sizeof(BSS_PHEADER), 1, binary));
+    int fd = mkstemp(tmp_filename);
+    if (fd < 0) {
+        log (ERROR, "Failed to create '%s': %s", tmp_filename, strerror(errno));
+        return result_t::ERROR;
+    }
 
-    // Write stdlib
-    fseek(binary, STDLIB_FILE_POS, SEEK_SET);
-    load_stdlib(binary, STDLIB_FILENAME);
+    bool is_ok = writer(fd, ctx) == result_t::OK && fchmod(fd, mode) == 0;
+    is_ok = (close(fd) == 0) && is_ok;
+    is_ok = is_ok && rename(tmp_filename, filename) == 0;
 
-    // Write code
-    fseek(binary, CODE_FILE_POS, SEEK_SET);
-    UNWRAP_WRITE (fwrite(self->exec_buf, self->exec_buf_size, 1, binary));
+    if (!is_ok) {
+        log (ERROR, "Failed to write '%s': %s", filename, strerror(errno));
+        unlink(tmp_filename);
+        return result_t::ERROR;
+    }
 
-    fclose(binary);
     return result_t::OK;
 }
 
@@ -130,20 +562,764 @@ result_t x64::save(code_t *self, const char *filename) {
 // Static
 // -------------------------------------------------------------------------------------------------
 
-static result_t load_stdlib(FILE *output, const char *filename) {
-    mmaped_file_t stdlib = mmap_file_or_warn(filename);
-    UNWRAP_NULLPTR (stdlib.data);
+static result_t write_regions(const char *filename, iovec *regions, int regions_count, mode_t mode) {
+    regions_t ctx = {.iov = regions, .count = regions_count};
+    return x64::write_atomically(filename, write_regions_to_fd, &ctx, mode);
+}
+
+static result_t write_regions_to_fd(int fd, void *regions) {
+    regions_t *ctx = (regions_t *) regions;
+    return pwritev_all(fd, ctx->iov, ctx->count);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void fill_headers(elf_headers_t *headers, const x64::code_t *code) {
+    headers->elf_header = ELF_HEADER;
+    headers->elf_header.e_entry = x64::CODE_BASE_ADDR + x64::code_entry_offset(code);
+
+    headers->pheaders[0] = SYSTEM_PHEADER;
+
+    Elf64_Phdr *code_pheader = &headers->pheaders[1];
+    *code_pheader = CODE_PHEADER_TEMPLATE;
+    code_pheader->p_filesz = code->exec_buf_size;
+    code_pheader->p_memsz  = code->exec_buf_size;
+
+    Elf64_Phdr *stdlib_pheader = &headers->pheaders[2];
+    *stdlib_pheader = STDLIB_PHEADER_TEMPLATE;
+    stdlib_pheader->p_filesz = sizeof(x64::STDLIB_TEXT);
+    stdlib_pheader->p_memsz  = sizeof(x64::STDLIB_TEXT);
+
+    Elf64_Phdr *stdlib_data_pheader = &headers->pheaders[3];
+    *stdlib_data_pheader = STDLIB_DATA_PHEADER_TEMPLATE;
+    stdlib_data_pheader->p_memsz = x64::STDLIB_DATA_SIZE;
+
+    Elf64_Phdr *bss_pheader = &headers->pheaders[4];
+    *bss_pheader = BSS_PHEADER_TEMPLATE;
+    bss_pheader->p_memsz = code->ram_size;
+
+    Elf64_Phdr *guard_pheader = &headers->pheaders[5];
+    *guard_pheader = GUARD_PHEADER_TEMPLATE;
+    guard_pheader->p_vaddr = x64::RAM_BASE_ADDR + code->ram_size;
+    guard_pheader->p_paddr = x64::RAM_BASE_ADDR + code->ram_size;
+}
+
+static void fill_compact_headers(compact_elf_headers_t *headers, const x64::code_t *code) {
+    const x64::stdlib_link_t *link = code->stdlib_link;
+
+    headers->elf_header = ELF_HEADER;
+    headers->elf_header.e_entry = link->code_addr + x64::code_entry_offset(code);
+    headers->elf_header.e_phnum = COMPACT_NUM_PHEADERS;
+
+    // Headers, stdlib and code
+    Elf64_Phdr *text_pheader = &headers->pheaders[0];
+    *text_pheader = COMPACT_TEXT_PHEADER_TEMPLATE;
+    text_pheader->p_filesz = link->code_addr - x64::COMPACT_BASE_ADDR + code->exec_buf_size;
+    text_pheader->p_memsz  = text_pheader->p_filesz;
+
+    // stdlib .bss and RAM
+    Elf64_Phdr *bss_pheader = &headers->pheaders[1];
+    *bss_pheader = BSS_PHEADER_TEMPLATE;
+    bss_pheader->p_vaddr = link->data_addr;
+    bss_pheader->p_paddr = link->data_addr;
+    bss_pheader->p_memsz = x64::RAM_BASE_ADDR - link->data_addr + code->ram_size;
+
+    Elf64_Phdr *guard_pheader = &headers->pheaders[2];
+    *guard_pheader = GUARD_PHEADER_TEMPLATE;
+    guard_pheader->p_vaddr = x64::RAM_BASE_ADDR + code->ram_size;
+    guard_pheader->p_paddr = x64::RAM_BASE_ADDR + code->ram_size;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Relocation pass: copy fragment to its origin and patch it with addresses of its targets
+static void link_fragment(x64::code_t *code, const x64::fragment_link_t *link) {
+    const x64::fragment_t *fragment = link->fragment;
+
+    uint8_t *dest = code->exec_buf + link->origin;
+    assert (link->origin + fragment->size <= code->exec_buf_size);
 
-    Elf64_Ehdr *elf_hdr = (Elf64_Ehdr *) stdlib.data;
-    assert(elf_hdr->e_phnum == 2 && "can't load with more then just 1 text segment"); // system + text only
+    memcpy(dest, fragment->code, fragment->size);
 
-    // Skip elf header and system pheader
-    Elf64_Phdr *code_phdr = (Elf64_Phdr *) (stdlib.data + sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr));
-    assert(code_phdr->p_flags == PF_R | PF_X && "Unexpected: Not code segment");
-    assert(code_phdr->p_filesz == x64::STDLIB_SIZE && "STDLIB changed");
+    for (size_t i = 0; i < fragment->relocs_count; ++i) {
+        const x64::reloc_t *reloc = &fragment->relocs[i];
 
-    UNWRAP_WRITE (fwrite(stdlib.data + code_phdr->p_offset, code_phdr->p_filesz, 1, output));
+        if (reloc->type == x64::reloc_type_t::ABS64) {
+            const uint64_t addr = x64::code_base_addr(code) + link->targets[i];
+            memcpy(dest + reloc->position, &addr, sizeof(addr));
+        } else {
+            const uint64_t next_offset = link->origin + reloc->position + sizeof(uint32_t);
+            const uint32_t rel_pos     = (uint32_t) (link->targets[i] - next_offset);
+            memcpy(dest + reloc->position, &rel_pos, sizeof(rel_pos));
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Regions go one after another from the start of file. Short writes are resumed, so `iov` is changed
+static result_t pwritev_all(int fd, iovec *iov, int iov_count) {
+    off_t offset = 0;
+
+    while (true) {
+        while (iov_count > 0 && iov->iov_len == 0) {
+            iov++;
+            iov_count--;
+        }
+
+        if (iov_count == 0) {
+            return result_t::OK;
+        }
+
+        ssize_t written = pwritev(fd, iov, iov_count, offset);
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) { return result_t::ERROR; }
+
+        offset += written;
+
+        for (size_t left = (size_t) written; left > 0; ) {
+            size_t part = (left < iov->iov_len) ? left : iov->iov_len;
+
+            iov->iov_base = (uint8_t *) iov->iov_base + part;
+            iov->iov_len -= part;
+            left         -= part;
+
+            if (iov->iov_len == 0) {
+                iov++;
+                iov_count--;
+            }
+        }
+    }
+}
 
-    mmap_close(stdlib);
+/// Region over read-only data, e.g. ZERO_PAGE or STDLIB_TEXT
+static iovec region(const void *base, size_t len) {
+    // iovec is shared with readv, but pwritev never writes through iov_base
+    return {const_cast<void *>(base), len};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Section with all sections it references, stdlib .bss has no relocations itself
+static void mark_used_section(bool *is_used, uint32_t section) {
+    if (is_used[section]) {
+        return;
+    }
+
+    is_used[section] = true;
+    if (section == x64::STDLIB_BSS_SECTION) {
+        return;
+    }
+
+    const x64::stdlib_section_t *info = &x64::STDLIB_SECTIONS[section];
+    for (uint32_t i = 0; i < info->relocs_count; ++i) {
+        mark_used_section(is_used, info->relocs[i].target);
+    }
+}
+
+/// stdlib routine called by instruction of this type, if any
+static bool get_used_impl(ir::instruction_type_t type, bool raw_output, x64::stdlib_symbol_t *impl) {
+    if (type == ir::instruction_type_t::INP) {
+        *impl = x64::STDLIB_INPUT_IMPL;
+    } else if (type == ir::instruction_type_t::OUT) {
+        *impl = (raw_output) ? x64::STDLIB_OUTPUT_RAW_IMPL : x64::STDLIB_OUTPUT_IMPL;
+    } else if (type == ir::instruction_type_t::SQRT) {
+        *impl = x64::STDLIB_SQRT_IMPL;
+    } else if (type == ir::instruction_type_t::HALT) {
+        *impl = x64::STDLIB_EXIT_IMPL;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) / align * align;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Relocatable object
+// -------------------------------------------------------------------------------------------------
+
+/// ELF64 relocatable object, that exports `rl_func_<N>` for each function, `rl_flush` and `rl_ram`
+static result_t save_object(const x64::code_t *code, const char *filename) {
+    elf_object_t object = {};
+
+    result_t res = link_object_text(&object, code);
+    if (res == result_t::OK) {
+        res = add_object_symbols(&object, code);
+    }
+
+    if (res == result_t::OK) {
+        add_object_table_relocs(&object);
+
+        iovec regions[OBJECT_REGIONS_COUNT] = {};
+        fill_object_sections(&object, regions);
+
+        res = write_regions(filename, regions, OBJECT_REGIONS_COUNT, x64::OBJECT_MODE);
+    }
+
+    free(object.text);
+    free(object.text_relocs);
+    free(object.symbols);
+    free(object.strtab);
+
+    return res;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// .text: code without PIC table, then stdlib sections of routines, that code calls, and of rl_flush
+static result_t link_object_text(elf_object_t *object, const x64::code_t *code) {
+    const x64::fragment_t *relocs = code->object->relocs;
+
+    // Code references table slots of routines, that it calls
+    mark_used_section(object->is_used, x64::STDLIB_FLUSH_IMPL.section);
+    for (size_t i = 0; i < relocs->relocs_count; ++i) {
+        const x64::reloc_t *reloc = &relocs->relocs[i];
+        const x64::stdlib_symbol_t *impl = (reloc->target_type == x64::reloc_target_t::OFFSET)
+                                         ? TABLE_SLOT_IMPLS[(size_t) reloc->target / sizeof(uint64_t)] : nullptr;
+        if (impl) {
+            mark_used_section(object->is_used, impl->section);
+        }
+    }
+
+    const size_t code_size = code->exec_buf_size - x64::PIC_TABLE_SIZE;
+    size_t relocs_capacity = relocs->relocs_count;
+
+    object->text_align = OBJECT_TEXT_ALIGN;
+    uint64_t offset    = code_size;
+
+    for (uint32_t i = 0; i < x64::STDLIB_SECTIONS_COUNT; ++i) {
+        if (object->is_used[i]) {
+            const x64::stdlib_section_t *section = &x64::STDLIB_SECTIONS[i];
+
+            offset = align_up(offset, section->align);
+            object->section_offsets[i] = offset;
+            offset += section->size;
+
+            relocs_capacity   += section->relocs_count;
+            object->text_align = (section->align > object->text_align) ? section->align : object->text_align;
+        }
+    }
+
+    // RAM is page aligned, so stdlib .bss after it is aligned too
+    object->text_size = offset;
+    object->section_offsets[x64::STDLIB_BSS_SECTION] = code->ram_size;
+    object->bss_size  = code->ram_size + ((object->is_used[x64::STDLIB_BSS_SECTION]) ? x64::STDLIB_DATA_SIZE : 0);
+
+    object->text        = (uint8_t *)    calloc(object->text_size + 1, sizeof(uint8_t));
+    object->text_relocs = (Elf64_Rela *) calloc(relocs_capacity + 1, sizeof(Elf64_Rela));
+    if (!object->text || !object->text_relocs) { return result_t::ERROR; }
+
+    memcpy(object->text, code->exec_buf + x64::PIC_TABLE_SIZE, code_size);
+
+    // References to table slots, jumps and calls inside code are already resolved: S + A - P, A = slot - 4
+    for (size_t i = 0; i < relocs->relocs_count; ++i) {
+        const x64::reloc_t *reloc = &relocs->relocs[i];
+        if (reloc->target_type != x64::reloc_target_t::OFFSET) {
+            continue;
+        }
+
+        assert (reloc->type == x64::reloc_type_t::REL32 && "PIC code has only relative references");
+        object->text_relocs[object->text_relocs_count++] = {
+                .r_offset = reloc->position - x64::PIC_TABLE_SIZE,
+                .r_info   = ELF64_R_INFO(TABLE_SYMBOL, R_X86_64_PC32),
+                .r_addend = reloc->target - (int64_t) sizeof(uint32_t)
+        };
+    }
+
+    // stdlib references to other sections in .text are resolved now, to .bss are left to linker
+    for (uint32_t i = 0; i < x64::STDLIB_SECTIONS_COUNT; ++i) {
+        if (!object->is_used[i]) {
+            continue;
+        }
+
+        const x64::stdlib_section_t *section = &x64::STDLIB_SECTIONS[i];
+        uint8_t *dest = object->text + object->section_offsets[i];
+        memcpy(dest, section->code, section->size);
+
+        for (uint32_t j = 0; j < section->relocs_count; ++j) {
+            const x64::stdlib_reloc_t *reloc = &section->relocs[j];
+
+            if (reloc->target == x64::STDLIB_BSS_SECTION) {
+                object->text_relocs[object->text_relocs_count++] = {
+                        .r_offset = object->section_offsets[i] + reloc->offset,
+                        .r_info   = ELF64_R_INFO(BSS_SYMBOL, R_X86_64_PC32),
+                        .r_addend = (int64_t) object->section_offsets[reloc->target] + reloc->addend
+                };
+                continue;
+            }
+
+            int32_t rel32 = (int32_t) ((int64_t) (object->section_offsets[reloc->target] -
+                                                  object->section_offsets[i] - reloc->offset) + reloc->addend);
+            memcpy(dest + reloc->offset, &rel32, sizeof(rel32));
+        }
+    }
+
+    return result_t::OK;
+}
+
+/// RAM slot points to .bss start, slots of routines in linked sections to them, others stay zero
+static void add_object_table_relocs(elf_object_t *object) {
+    object->table_relocs[object->table_relocs_count++] = {
+            .r_offset = (int) x64::PIC_TABLE_SLOTS::RAM * sizeof(uint64_t),
+            .r_info   = ELF64_R_INFO(BSS_SYMBOL, R_X86_64_64),
+            .r_addend = 0
+    };
+
+    for (int slot = 0; slot < PIC_TABLE_SLOTS_COUNT; ++slot) {
+        const x64::stdlib_symbol_t *impl = TABLE_SLOT_IMPLS[slot];
+        if (!impl || !object->is_used[impl->section]) {
+            continue;
+        }
+
+        object->table_relocs[object->table_relocs_count++] = {
+                .r_offset = (uint64_t) slot * sizeof(uint64_t),
+                .r_info   = ELF64_R_INFO(TEXT_SYMBOL, R_X86_64_64),
+                .r_addend = (int64_t) (object->section_offsets[impl->section] + impl->offset)
+        };
+    }
+}
+
+static result_t add_object_symbols(elf_object_t *object, const x64::code_t *code) {
+    UNWRAP_ERROR(alloc_object_symbols(object, FUNC_SYMBOLS + code->object->symbols_count));
+
+    const unsigned char SECTION_INFO = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+
+    add_object_symbol(object, "", 0,            SHN_UNDEF,     0, 0);
+    add_object_symbol(object, "", SECTION_INFO, TEXT_SECTION,  0, 0);
+    add_object_symbol(object, "", SECTION_INFO, TABLE_SECTION, 0, 0);
+    add_object_symbol(object, "", SECTION_INFO, BSS_SECTION,   0, 0);
+
+    add_exported_symbols(object, code, TEXT_SECTION, BSS_SECTION);
+    return result_t::OK;
+}
+
+static result_t alloc_object_symbols(elf_object_t *object, size_t capacity) {
+    object->symbols = (Elf64_Sym *) calloc(capacity, sizeof(Elf64_Sym));
+    object->strtab  = (char *)      calloc(capacity, OBJECT_SYMBOL_NAME_MAX);
+    if (!object->symbols || !object->strtab) { return result_t::ERROR; }
+
+    // Empty name at offset 0
+    object->strtab_size = 1;
     return result_t::OK;
-}
\ No newline at end of file
+}
+
+/// `rl_ram`, `rl_flush` and `rl_func_<N>` with values relative to their sections
+static void add_exported_symbols(elf_object_t *object, const x64::code_t *code, uint16_t text_section,
+                                 uint16_t bss_section) {
+    const x64::object_t *code_object = code->object;
+    const unsigned char FUNC_INFO = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+
+    add_object_symbol(object, OBJECT_RAM_SYMBOL, ELF64_ST_INFO(STB_GLOBAL, STT_OBJECT), bss_section, 0,
+                      code->ram_size);
+    add_object_symbol(object, OBJECT_FLUSH_SYMBOL, FUNC_INFO, text_section,
+                      object->section_offsets[x64::STDLIB_FLUSH_IMPL.section] + x64::STDLIB_FLUSH_IMPL.offset, 0);
+
+    for (size_t i = 0; i < code_object->symbols_count; ++i) {
+        const x64::object_symbol_t *symbol = &code_object->symbols[i];
+
+        char name[OBJECT_SYMBOL_NAME_MAX] = "";
+        snprintf(name, sizeof(name), OBJECT_FUNC_SYMBOL_FORMAT, symbol->func);
+
+        add_object_symbol(object, name, FUNC_INFO, text_section, symbol->offset - x64::PIC_TABLE_SIZE, symbol->size);
+    }
+}
+
+/// `name` is shorter than OBJECT_SYMBOL_NAME_MAX, strtab has this much for each symbol
+static void add_object_symbol(elf_object_t *object, const char *name, unsigned char info, uint16_t section,
+                              uint64_t value, uint64_t size) {
+    uint32_t name_offset = 0;
+
+    if (name[0]) {
+        name_offset = (uint32_t) object->strtab_size;
+
+        size_t name_size = strlen(name) + 1;
+        memcpy(object->strtab + object->strtab_size, name, name_size);
+        object->strtab_size += name_size;
+    }
+
+    object->symbols[object->symbols_count++] = {
+            .st_name  = name_offset,
+            .st_info  = info,
+            .st_other = STV_DEFAULT,
+            .st_shndx = section,
+            .st_value = value,
+            .st_size  = size
+    };
+}
+
+/// Sections follow ELF header in order of regions, section header table is the last
+static void fill_object_sections(elf_object_t *object, iovec *regions) {
+    uint32_t name_offsets[OBJECT_SECTIONS_COUNT] = {};
+    for (int i = 0; i < OBJECT_SECTIONS_COUNT; ++i) {
+        size_t name_size = strlen(OBJECT_SECTION_NAMES[i]) + 1;
+
+        name_offsets[i] = (uint32_t) object->shstrtab_size;
+        memcpy(object->shstrtab + object->shstrtab_size, OBJECT_SECTION_NAMES[i], name_size);
+        object->shstrtab_size += name_size;
+    }
+
+    regions[OBJECT_HEADER_REGION]     = {&object->elf_header, sizeof(Elf64_Ehdr)};
+    regions[OBJECT_TEXT_REGION]       = {object->text, object->text_size};
+    regions[OBJECT_TABLE_REGION]      = {object->table, sizeof(object->table)};
+    regions[OBJECT_TEXT_RELA_REGION]  = {object->text_relocs, object->text_relocs_count * sizeof(Elf64_Rela)};
+    regions[OBJECT_TABLE_RELA_REGION] = {object->table_relocs, object->table_relocs_count * sizeof(Elf64_Rela)};
+    regions[OBJECT_SYMTAB_REGION]     = {object->symbols, object->symbols_count * sizeof(Elf64_Sym)};
+    regions[OBJECT_STRTAB_REGION]     = {object->strtab, object->strtab_size};
+    regions[OBJECT_SHSTRTAB_REGION]   = {object->shstrtab, object->shstrtab_size};
+    regions[OBJECT_SECTIONS_REGION]   = {object->sections, sizeof(object->sections)};
+
+    // Gaps align data after them
+    uint64_t offsets[OBJECT_REGIONS_COUNT] = {};
+    uint64_t offset = 0;
+
+    for (int i = 0; i < OBJECT_REGIONS_COUNT; ++i) {
+        if (i == OBJECT_TEXT_GAP_REGION || i == OBJECT_SHSTRTAB_GAP_REGION) {
+            regions[i] = region(ZERO_PAGE, align_up(offset, OBJECT_DATA_ALIGN) - offset);
+        }
+
+        offsets[i] = offset;
+        offset += regions[i].iov_len;
+    }
+
+    Elf64_Shdr *sections = object->sections;
+
+    sections[TEXT_SECTION] = {.sh_type = SHT_PROGBITS, .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+                              .sh_offset = offsets[OBJECT_TEXT_REGION], .sh_size = object->text_size,
+                              .sh_addralign = object->text_align};
+    sections[TEXT_RELA_SECTION] = {.sh_type = SHT_RELA, .sh_flags = SHF_INFO_LINK,
+                                   .sh_offset = offsets[OBJECT_TEXT_RELA_REGION],
+                                   .sh_size = regions[OBJECT_TEXT_RELA_REGION].iov_len,
+                                   .sh_link = SYMTAB_SECTION, .sh_info = TEXT_SECTION,
+                                   .sh_addralign = OBJECT_DATA_ALIGN, .sh_entsize = sizeof(Elf64_Rela)};
+    sections[TABLE_SECTION] = {.sh_type = SHT_PROGBITS, .sh_flags = SHF_ALLOC | SHF_WRITE,
+                               .sh_offset = offsets[OBJECT_TABLE_REGION], .sh_size = sizeof(object->table),
+                               .sh_addralign = OBJECT_DATA_ALIGN};
+    sections[TABLE_RELA_SECTION] = {.sh_type = SHT_RELA, .sh_flags = SHF_INFO_LINK,
+                                    .sh_offset = offsets[OBJECT_TABLE_RELA_REGION],
+                                    .sh_size = regions[OBJECT_TABLE_RELA_REGION].iov_len,
+                                    .sh_link = SYMTAB_SECTION, .sh_info = TABLE_SECTION,
+                                    .sh_addralign = OBJECT_DATA_ALIGN, .sh_entsize = sizeof(Elf64_Rela)};
+    sections[BSS_SECTION] = {.sh_type = SHT_NOBITS, .sh_flags = SHF_ALLOC | SHF_WRITE,
+                             .sh_offset = offsets[OBJECT_TABLE_REGION], .sh_size = object->bss_size,
+                             .sh_addralign = OBJECT_BSS_ALIGN};
+    sections[NOTE_STACK_SECTION] = {.sh_type = SHT_PROGBITS, .sh_offset = offsets[OBJECT_TABLE_REGION],
+                                    .sh_addralign = 1};
+    sections[SYMTAB_SECTION] = {.sh_type = SHT_SYMTAB, .sh_offset = offsets[OBJECT_SYMTAB_REGION],
+                                .sh_size = regions[OBJECT_SYMTAB_REGION].iov_len,
+                                .sh_link = STRTAB_SECTION, .sh_info = RAM_SYMBOL,
+                                .sh_addralign = OBJECT_DATA_ALIGN, .sh_entsize = sizeof(Elf64_Sym)};
+    sections[STRTAB_SECTION] = {.sh_type = SHT_STRTAB, .sh_offset = offsets[OBJECT_STRTAB_REGION],
+                                .sh_size = object->strtab_size, .sh_addralign = 1};
+    sections[SHSTRTAB_SECTION] = {.sh_type = SHT_STRTAB, .sh_offset = offsets[OBJECT_SHSTRTAB_REGION],
+                                  .sh_size = object->shstrtab_size, .sh_addralign = 1};
+
+    for (int i = 0; i < OBJECT_SECTIONS_COUNT; ++i) {
+        sections[i].sh_name = name_offsets[i];
+    }
+
+    Elf64_Ehdr *elf_header = &object->elf_header;
+    *elf_header = ELF_HEADER;
+    elf_header->e_type      = ET_REL;
+    elf_header->e_entry     = 0;
+    elf_header->e_phoff     = 0;
+    elf_header->e_phentsize = 0;
+    elf_header->e_phnum     = 0;
+    elf_header->e_shoff     = offsets[OBJECT_SECTIONS_REGION];
+    elf_header->e_shnum     = OBJECT_SECTIONS_COUNT;
+    elf_header->e_shstrndx  = SHSTRTAB_SECTION;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Shared library
+// -------------------------------------------------------------------------------------------------
+
+/// ELF64 shared library with the same symbols as relocatable object. Each process, that loads it, has own RAM
+static result_t save_shared(const x64::code_t *code, const char *filename) {
+    elf_shared_t shared  = {};
+    elf_object_t *object = &shared.object;
+
+    result_t res = link_object_text(object, code);
+    if (res == result_t::OK) {
+        res = add_shared_symbols(&shared, code);
+    }
+    if (res == result_t::OK) {
+        res = fill_shared_hash(&shared);
+    }
+
+    if (res == result_t::OK) {
+        add_object_table_relocs(object);
+
+        iovec regions[SHARED_REGIONS_COUNT] = {};
+        layout_shared(&shared, regions);
+
+        res = relocate_shared(&shared);
+        if (res == result_t::OK) {
+            res = write_regions(filename, regions, SHARED_REGIONS_COUNT, x64::BINARY_MODE);
+        }
+    }
+
+    free(object->text);
+    free(object->text_relocs);
+    free(object->symbols);
+    free(object->strtab);
+    free(shared.hash);
+
+    return res;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Only exported symbols, section relative values are made absolute by relocate_shared()
+static result_t add_shared_symbols(elf_shared_t *shared, const x64::code_t *code) {
+    elf_object_t *object = &shared->object;
+    UNWRAP_ERROR(alloc_object_symbols(object, FUNC_SYMBOLS + code->object->symbols_count));
+
+    add_object_symbol(object, "", 0, SHN_UNDEF, 0, 0);
+    add_exported_symbols(object, code, SHARED_TEXT_SECTION, SHARED_BSS_SECTION);
+
+    // Code uses own RAM of library, so linker must not move it to executable by copy relocation
+    object->symbols[SHARED_RAM_SYMBOL].st_other = STV_PROTECTED;
+
+    return result_t::OK;
+}
+
+/// SysV hash table with bucket for each symbol, null symbol ends chains
+static result_t fill_shared_hash(elf_shared_t *shared) {
+    const elf_object_t *object = &shared->object;
+    const uint32_t symbols_count = (uint32_t) object->symbols_count;
+
+    shared->hash_size = (2 + 2 * (size_t) symbols_count) * sizeof(uint32_t);
+    shared->hash = (uint32_t *) calloc(shared->hash_size, sizeof(uint8_t));
+    UNWRAP_NULLPTR(shared->hash);
+
+    shared->hash[0] = symbols_count;
+    shared->hash[1] = symbols_count;
+
+    uint32_t *buckets = shared->hash + 2;
+    uint32_t *chains  = buckets + symbols_count;
+
+    for (uint32_t i = 1; i < symbols_count; ++i) {
+        uint32_t bucket = elf_hash(object->strtab + object->symbols[i].st_name) % symbols_count;
+
+        chains[i] = buckets[bucket];
+        buckets[bucket] = i;
+    }
+
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Read-only data and code are first segment, .dynamic, PIC table and .bss start on the next page
+static void layout_shared(elf_shared_t *shared, iovec *regions) {
+    elf_object_t *object = &shared->object;
+
+    uint32_t name_offsets[SHARED_SECTIONS_COUNT] = {};
+    for (int i = 0; i < SHARED_SECTIONS_COUNT; ++i) {
+        size_t name_size = strlen(SHARED_SECTION_NAMES[i]) + 1;
+
+        name_offsets[i] = (uint32_t) shared->shstrtab_size;
+        memcpy(shared->shstrtab + shared->shstrtab_size, SHARED_SECTION_NAMES[i], name_size);
+        shared->shstrtab_size += name_size;
+    }
+
+    regions[SHARED_HEADERS_REGION]  = {&shared->headers, sizeof(shared->headers)};
+    regions[SHARED_DYNSYM_REGION]   = {object->symbols, object->symbols_count * sizeof(Elf64_Sym)};
+    regions[SHARED_RELA_REGION]     = {object->table_relocs, object->table_relocs_count * sizeof(Elf64_Rela)};
+    regions[SHARED_HASH_REGION]     = {shared->hash, shared->hash_size};
+    regions[SHARED_DYNSTR_REGION]   = {object->strtab, object->strtab_size};
+    regions[SHARED_TEXT_REGION]     = {object->text, object->text_size};
+    regions[SHARED_DYNAMIC_REGION]  = {shared->dynamic, sizeof(shared->dynamic)};
+    regions[SHARED_TABLE_REGION]    = {object->table, sizeof(object->table)};
+    regions[SHARED_SHSTRTAB_REGION] = {shared->shstrtab, shared->shstrtab_size};
+    regions[SHARED_SECTIONS_REGION] = {shared->sections, sizeof(shared->sections)};
+
+    // Gaps align data after them, addresses are equal to file offsets
+    uint64_t offsets[SHARED_REGIONS_COUNT] = {};
+    uint64_t offset = 0;
+
+    for (int i = 0; i < SHARED_REGIONS_COUNT; ++i) {
+        if (i == SHARED_TEXT_GAP_REGION) {
+            regions[i] = region(ZERO_PAGE, align_up(offset, object->text_align) - offset);
+        } else if (i == SHARED_DATA_GAP_REGION) {
+            regions[i] = region(ZERO_PAGE, align_up(offset, SHARED_PAGE_SIZE) - offset);
+        } else if (i == SHARED_SHSTRTAB_GAP_REGION) {
+            regions[i] = region(ZERO_PAGE, align_up(offset, OBJECT_DATA_ALIGN) - offset);
+        }
+
+        offsets[i] = offset;
+        offset += regions[i].iov_len;
+    }
+
+    uint64_t *addrs = shared->section_addrs;
+    addrs[SHARED_DYNSYM_SECTION]  = offsets[SHARED_DYNSYM_REGION];
+    addrs[SHARED_RELA_SECTION]    = offsets[SHARED_RELA_REGION];
+    addrs[SHARED_HASH_SECTION]    = offsets[SHARED_HASH_REGION];
+    addrs[SHARED_DYNSTR_SECTION]  = offsets[SHARED_DYNSTR_REGION];
+    addrs[SHARED_TEXT_SECTION]    = offsets[SHARED_TEXT_REGION];
+    addrs[SHARED_DYNAMIC_SECTION] = offsets[SHARED_DYNAMIC_REGION];
+    addrs[SHARED_TABLE_SECTION]   = offsets[SHARED_TABLE_REGION];
+    addrs[SHARED_BSS_SECTION]     = align_up(offsets[SHARED_TABLE_REGION] + sizeof(object->table), OBJECT_BSS_ALIGN);
+
+    fill_shared_headers(shared, offsets, regions);
+    for (int i = 0; i < SHARED_SECTIONS_COUNT; ++i) {
+        shared->sections[i].sh_name = name_offsets[i];
+    }
+}
+
+/// Code references to PIC table and stdlib .bss are resolved now, loader fills only PIC table
+static result_t relocate_shared(elf_shared_t *shared) {
+    elf_object_t *object = &shared->object;
+    const uint64_t text_addr = shared->section_addrs[SHARED_TEXT_SECTION];
+
+    for (size_t i = 0; i < object->text_relocs_count; ++i) {
+        const Elf64_Rela *reloc = &object->text_relocs[i];
+        assert (ELF64_R_TYPE(reloc->r_info) == R_X86_64_PC32 && "Code has only relative references");
+
+        uint32_t symbol = (uint32_t) ELF64_R_SYM(reloc->r_info);
+        uint64_t target = get_shared_symbol_addr(shared, symbol) + (uint64_t) reloc->r_addend;
+        int64_t  rel    = (int64_t) (target - text_addr - reloc->r_offset);
+
+        // stdlib .bss follows RAM
+        if (rel != (int32_t) rel) {
+            log (ERROR, "RAM of shared library is too large for 32-bit relative references");
+            return result_t::ERROR;
+        }
+
+        int32_t rel32 = (int32_t) rel;
+        memcpy(object->text + reloc->r_offset, &rel32, sizeof(rel32));
+    }
+
+    for (size_t i = 0; i < object->table_relocs_count; ++i) {
+        Elf64_Rela *reloc = &object->table_relocs[i];
+        uint32_t symbol = (uint32_t) ELF64_R_SYM(reloc->r_info);
+        uint64_t target = get_shared_symbol_addr(shared, symbol) + (uint64_t) reloc->r_addend;
+
+        *reloc = {.r_offset = shared->section_addrs[SHARED_TABLE_SECTION] + reloc->r_offset,
+                  .r_info   = ELF64_R_INFO(0, R_X86_64_RELATIVE),
+                  .r_addend = (int64_t) target};
+    }
+
+    for (size_t i = 1; i < object->symbols_count; ++i) {
+        object->symbols[i].st_value += shared->section_addrs[object->symbols[i].st_shndx];
+    }
+
+    return result_t::OK;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static void fill_shared_headers(elf_shared_t *shared, const uint64_t *offsets, const iovec *regions) {
+    const elf_object_t *object = &shared->object;
+    const uint64_t *addrs = shared->section_addrs;
+
+    Elf64_Dyn *dynamic = shared->dynamic;
+    dynamic[0] = {.d_tag = DT_HASH,      .d_un = {.d_ptr = addrs[SHARED_HASH_SECTION]}};
+    dynamic[1] = {.d_tag = DT_STRTAB,    .d_un = {.d_ptr = addrs[SHARED_DYNSTR_SECTION]}};
+    dynamic[2] = {.d_tag = DT_SYMTAB,    .d_un = {.d_ptr = addrs[SHARED_DYNSYM_SECTION]}};
+    dynamic[3] = {.d_tag = DT_STRSZ,     .d_un = {.d_val = object->strtab_size}};
+    dynamic[4] = {.d_tag = DT_SYMENT,    .d_un = {.d_val = sizeof(Elf64_Sym)}};
+    dynamic[5] = {.d_tag = DT_RELA,      .d_un = {.d_ptr = addrs[SHARED_RELA_SECTION]}};
+    dynamic[6] = {.d_tag = DT_RELASZ,    .d_un = {.d_val = regions[SHARED_RELA_REGION].iov_len}};
+    dynamic[7] = {.d_tag = DT_RELAENT,   .d_un = {.d_val = sizeof(Elf64_Rela)}};
+    dynamic[8] = {.d_tag = DT_RELACOUNT, .d_un = {.d_val = object->table_relocs_count}};
+    dynamic[9] = {.d_tag = DT_NULL,      .d_un = {.d_val = 0}};
+
+    const uint64_t text_end  = addrs[SHARED_TEXT_SECTION] + object->text_size;
+    const uint64_t data_addr = addrs[SHARED_DYNAMIC_SECTION];
+    const uint64_t data_end  = addrs[SHARED_TABLE_SECTION] + sizeof(object->table);
+    const uint64_t bss_end   = addrs[SHARED_BSS_SECTION] + object->bss_size;
+
+    Elf64_Phdr *pheaders = shared->headers.pheaders;
+    pheaders[SHARED_TEXT_PHEADER] = {.p_type = PT_LOAD, .p_flags = PF_R | PF_X, .p_offset = 0, .p_vaddr = 0,
+                                     .p_paddr = 0, .p_filesz = text_end, .p_memsz = text_end,
+                                     .p_align = SHARED_PAGE_SIZE};
+    pheaders[SHARED_DATA_PHEADER] = {.p_type = PT_LOAD, .p_flags = PF_R | PF_W, .p_offset = data_addr,
+                                     .p_vaddr = data_addr, .p_paddr = data_addr, .p_filesz = data_end - data_addr,
+                                     .p_memsz = bss_end - data_addr, .p_align = SHARED_PAGE_SIZE};
+    pheaders[SHARED_DYNAMIC_PHEADER] = {.p_type = PT_DYNAMIC, .p_flags = PF_R | PF_W, .p_offset = data_addr,
+                                        .p_vaddr = data_addr, .p_paddr = data_addr,
+                                        .p_filesz = sizeof(shared->dynamic), .p_memsz = sizeof(shared->dynamic),
+                                        .p_align = OBJECT_DATA_ALIGN};
+    pheaders[SHARED_STACK_PHEADER] = {.p_type = PT_GNU_STACK, .p_flags = PF_R | PF_W, .p_align = 16};
+
+    Elf64_Shdr *sections = shared->sections;
+
+    sections[SHARED_DYNSYM_SECTION] = {.sh_type = SHT_DYNSYM, .sh_flags = SHF_ALLOC,
+                                       .sh_addr = addrs[SHARED_DYNSYM_SECTION],
+                                       .sh_offset = offsets[SHARED_DYNSYM_REGION],
+                                       .sh_size = regions[SHARED_DYNSYM_REGION].iov_len,
+                                       .sh_link = SHARED_DYNSTR_SECTION, .sh_info = 1,
+                                       .sh_addralign = OBJECT_DATA_ALIGN, .sh_entsize = sizeof(Elf64_Sym)};
+    sections[SHARED_RELA_SECTION] = {.sh_type = SHT_RELA, .sh_flags = SHF_ALLOC,
+                                     .sh_addr = addrs[SHARED_RELA_SECTION], .sh_offset = offsets[SHARED_RELA_REGION],
+                                     .sh_size = regions[SHARED_RELA_REGION].iov_len,
+                                     .sh_link = SHARED_DYNSYM_SECTION,
+                                     .sh_addralign = OBJECT_DATA_ALIGN, .sh_entsize = sizeof(Elf64_Rela)};
+    sections[SHARED_HASH_SECTION] = {.sh_type = SHT_HASH, .sh_flags = SHF_ALLOC,
+                                     .sh_addr = addrs[SHARED_HASH_SECTION], .sh_offset = offsets[SHARED_HASH_REGION],
+                                     .sh_size = shared->hash_size, .sh_link = SHARED_DYNSYM_SECTION,
+                                     .sh_addralign = sizeof(uint32_t), .sh_entsize = sizeof(uint32_t)};
+    sections[SHARED_DYNSTR_SECTION] = {.sh_type = SHT_STRTAB, .sh_flags = SHF_ALLOC,
+                                       .sh_addr = addrs[SHARED_DYNSTR_SECTION],
+                                       .sh_offset = offsets[SHARED_DYNSTR_REGION], .sh_size = object->strtab_size,
+                                       .sh_addralign = 1};
+    sections[SHARED_TEXT_SECTION] = {.sh_type = SHT_PROGBITS, .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+                                     .sh_addr = addrs[SHARED_TEXT_SECTION], .sh_offset = offsets[SHARED_TEXT_REGION],
+                                     .sh_size = object->text_size, .sh_addralign = object->text_align};
+    sections[SHARED_DYNAMIC_SECTION] = {.sh_type = SHT_DYNAMIC, .sh_flags = SHF_ALLOC | SHF_WRITE,
+                                        .sh_addr = addrs[SHARED_DYNAMIC_SECTION],
+                                        .sh_offset = offsets[SHARED_DYNAMIC_REGION],
+                                        .sh_size = sizeof(shared->dynamic), .sh_link = SHARED_DYNSTR_SECTION,
+                                        .sh_addralign = OBJECT_DATA_ALIGN, .sh_entsize = sizeof(Elf64_Dyn)};
+    sections[SHARED_TABLE_SECTION] = {.sh_type = SHT_PROGBITS, .sh_flags = SHF_ALLOC | SHF_WRITE,
+                                      .sh_addr = addrs[SHARED_TABLE_SECTION],
+                                      .sh_offset = offsets[SHARED_TABLE_REGION], .sh_size = sizeof(object->table),
+                                      .sh_addralign = OBJECT_DATA_ALIGN};
+    sections[SHARED_BSS_SECTION] = {.sh_type = SHT_NOBITS, .sh_flags = SHF_ALLOC | SHF_WRITE,
+                                    .sh_addr = addrs[SHARED_BSS_SECTION], .sh_offset = offsets[SHARED_SHSTRTAB_REGION],
+                                    .sh_size = object->bss_size, .sh_addralign = OBJECT_BSS_ALIGN};
+    sections[SHARED_SHSTRTAB_SECTION] = {.sh_type = SHT_STRTAB, .sh_offset = offsets[SHARED_SHSTRTAB_REGION],
+                                         .sh_size = shared->shstrtab_size, .sh_addralign = 1};
+
+    Elf64_Ehdr *elf_header = &shared->headers.elf_header;
+    *elf_header = ELF_HEADER;
+    elf_header->e_type     = ET_DYN;
+    elf_header->e_entry    = 0;
+    elf_header->e_phnum    = SHARED_PHEADERS_COUNT;
+    elf_header->e_shoff    = offsets[SHARED_SECTIONS_REGION];
+    elf_header->e_shnum    = SHARED_SECTIONS_COUNT;
+    elf_header->e_shstrndx = SHARED_SHSTRTAB_SECTION;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+/// Address of section, that is target of relocation in relocatable object, see OBJECT_SYMBOLS
+static uint64_t get_shared_symbol_addr(const elf_shared_t *shared, uint32_t symbol) {
+    if (symbol == TEXT_SYMBOL) {
+        return shared->section_addrs[SHARED_TEXT_SECTION];
+    } else if (symbol == TABLE_SYMBOL) {
+        return shared->section_addrs[SHARED_TABLE_SECTION];
+    }
+
+    assert (symbol == BSS_SYMBOL && "Relocations target only sections");
+    return shared->section_addrs[SHARED_BSS_SECTION];
+}
+
+static uint32_t elf_hash(const char *name) {
+    uint32_t hash = 0;
+
+    for (; *name; ++name) {
+        hash = (hash << 4) + (uint8_t) *name;
+
+        uint32_t high = hash & 0xf0000000;
+        hash ^= high >> 24;
+        hash &= ~high;
+    }
+
+    return hash;
+}
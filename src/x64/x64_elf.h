@@ -1,32 +1,55 @@
 #ifndef X64_TRANSLATOR_X64_ELF_H
 #define X64_TRANSLATOR_X64_ELF_H
 
+#include <elf.h>
+#include <sys/types.h>
 #include "../common.h"
 #include "x64.h"
+#include "stdlib_image.h"
 
 namespace x64 {
     enum BASE_ADDRESSES {
         CODE_BASE_ADDR   = 0x402000,
         STDLIB_BASE_ADDR = 0x401000,
-        RAM_BASE_ADDR    = 0x405000,
-    };
 
-    enum class STDLIB_BINARY_OFFSETS {
-        INPUT  = 0,
-        OUTPUT = 0xAD,
-        EXIT   = 0x1EF,
-        SQRT   = 0x1FB
+        STDLIB_DATA_BASE_ADDR = 0x10000000, // stdlib .bss (output buffer), `ld -Tbss=...` in CMakeLists.txt
+        RAM_BASE_ADDR         = 0x20000000, // Above everything else, so RAM size doesn't limit code size
     };
 
-    const int STDLIB_SIZE     = 689;
     const int STDLIB_FILE_POS = 4096;
     const int CODE_FILE_POS   = 8192;
 
-    const int RAMSIZE = 4096;
+    // Compact layout: headers, stdlib and code are one segment from file start
+    const uint64_t COMPACT_BASE_ADDR = 0x400000;
+
+    const mode_t BINARY_MODE = 0755;    // Executable and shared library
+    const mode_t OBJECT_MODE = 0644;    // Relocatable object, see translate_object
 
-    const char STDLIB_FILENAME[] = "./src/asm_stdlib/stdlib.out";
+    /// Writes whole output into temporary file `fd`
+    typedef result_t (*output_writer_t)(int fd, void *ctx);
 
+    /**
+     * @brief Write ELF with stdlib embedded at build time (see stdlib_image.h), compact one if code has `stdlib_link`
+     *
+     * @note Code with `object` (see translate_object) is written as relocatable object: `rl_func_<N>` for each
+     *       function, `rl_flush` for buffered output and `rl_ram` for RAM. Top level code is not exported.
+     *       With `object->is_shared` the same symbols are exported by shared library with own RAM in each process
+     */
     result_t save(code_t *self, const char *filename);
+
+    /**
+     * @brief Output is written by `writer` next to `filename` and renamed over it with `mode`, so nobody sees
+     *        half-written binary. Temporary file is removed on error
+     */
+    result_t write_atomically(const char *filename, output_writer_t writer, void *ctx, mode_t mode);
+
+    /**
+     * @brief Choose compact ELF layout: link only stdlib sections reachable from stdlib calls in IR
+     *
+     * @note Must precede translation, as generated code is placed after stdlib and calls it directly
+     */
+    result_t link_compact_stdlib(code_t *self, const ir::code_t *ir_code);
+    void stdlib_link_delete(stdlib_link_t *self);
 }
 
 #endif //X64_TRANSLATOR_X64_ELF_H
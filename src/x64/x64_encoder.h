@@ -0,0 +1,207 @@
+#ifndef X64_TRANSLATOR_X64_ENCODER_H
+#define X64_TRANSLATOR_X64_ENCODER_H
+
+#include <assert.h>
+#include <string.h>
+#include "x64_common.h"
+#include "x64_consts.h"
+
+namespace x64 {
+    const uint ENCODING_BUF_SIZE = 16;  // >= 15 (max x64 instruction length), so templates are copied with one memcpy
+
+    /// Ready byte image of instruction with positions of fields that can be patched later
+    struct encoding_t {
+        uint8_t bytes[ENCODING_BUF_SIZE];
+        uint8_t length;
+
+        uint8_t disp32_offset;  // 0 if there is no displacement
+        uint8_t imm_offset;     // 0 if there is no immediate
+    };
+
+    /// Instruction with its precomputed encoding
+    struct form_t {
+        instruction_t instruction;
+        encoding_t encoding;
+    };
+
+//----------------------------------------------------------------------------------------------------------------------
+// Validation
+//----------------------------------------------------------------------------------------------------------------------
+
+    /// Opcodes of `op reg/mem, ...` forms, that must be followed by ModRM byte
+    constexpr bool opcode_requires_modrm(uint8_t opcode) {
+        switch (opcode) {
+            case ADD_mem_reg:   case SUB_mem_reg:   case AND_mem_reg:   case OR_mem_reg:
+            case ADD_reg_mem:   case SUB_reg_mem:   case CMP_reg_reg:   case IMUL_reg_imm:
+            case ARITH_reg_imm: case MOV_mem_reg:   case MOV_reg_mem:   case LEA_reg_mem:
+            case POP_mem:       case MOV_reg_imm64: case DIVMUL_reg:    case PUSH_mem:
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+    /// Opcodes with register number in lower 3 bits (`push r64`, `pop r64`, `mov r, imm`)
+    constexpr bool opcode_has_reg_bits(uint8_t opcode) {
+        uint8_t base = static_cast<uint8_t>(opcode & ~LOWER_REG_BITS_MASK);
+        return base == PUSH_reg || base == POP_reg || base == MOV_reg_imm;
+    }
+
+    constexpr bool is_valid_form(const instruction_t &form) {
+        const uint8_t mod = form.ModRM & ONLY_REG_MODRM_MODE_BIT;
+        const uint8_t rm  = form.ModRM & LOWER_REG_BITS_MASK;
+
+        if (form.require_imm32 && form.require_imm64) {
+            return false;
+        }
+
+        if (form.require_REX && (form.REX & ~0b1111) != REX_PREFIX_BASE) {
+            return false;
+        }
+
+        if (form.require_prefix) {
+            // Two byte opcodes: jcc rel32 has no ModRM, setcc / cmovcc / movzx have one
+            bool is_cond_jmp = (form.opcode & ~0b1111) == (JE_imm & ~0b1111);
+            return form.prefix == TWO_BYTE_OPCODE_prefix && is_cond_jmp == !form.require_ModRM &&
+                   is_cond_jmp == form.require_imm32 && !form.require_SIB && !form.require_disp32;
+        }
+
+        if (opcode_has_reg_bits(form.opcode)) {
+            bool is_wide = form.require_REX && (form.REX & REX_W_BIT);
+            bool imm_ok  = ((form.opcode & ~LOWER_REG_BITS_MASK) == MOV_reg_imm)
+                           ? (is_wide) ? form.require_imm64 : form.require_imm32
+                           : !form.require_imm32 && !form.require_imm64;
+
+            return imm_ok && !form.require_ModRM && !form.require_SIB && !form.require_disp32;
+        }
+
+        if (opcode_requires_modrm(form.opcode) != form.require_ModRM) {
+            return false;
+        }
+
+        if (form.require_ModRM) {
+            bool is_rip_rel = mod == SINGLE_REG_MODRM_MODE_BIT && rm == RIP_RELATIVE_MODRM_RM;
+            bool needs_sib  = mod != ONLY_REG_MODRM_MODE_BIT && rm == DOUBLE_REG_MODRM_MODE_BIT;
+            bool needs_disp = mod == IMM_MODRM_MODE_BIT || is_rip_rel;
+
+            if (needs_sib != form.require_SIB || needs_disp != form.require_disp32 || form.require_imm64) {
+                return false;
+            }
+        }
+
+        switch (form.opcode) {
+            case PUSH_imm:
+            case IMUL_reg_imm:
+            case ARITH_reg_imm:
+            case MOV_reg_imm64:
+            case CALL_rel32:
+            case JMP_rel32:
+                return form.require_imm32;
+
+            default:
+                return !form.require_imm32 && !form.require_imm64;
+        }
+    }
+
+    /// Not constexpr: calling it from make_form() breaks compilation for invalid forms
+    void invalid_instruction_form();
+
+//----------------------------------------------------------------------------------------------------------------------
+// Encoding
+//----------------------------------------------------------------------------------------------------------------------
+
+    constexpr void put_le(uint8_t *dest, uint64_t value, uint size) {
+        for (uint i = 0; i < size; ++i) {
+            dest[i] = (uint8_t) (value >> (8 * i));
+        }
+    }
+
+    /// Field order: [REX] [prefix] opcode [ModRM] [SIB] [disp32] [imm32 / imm64]
+    constexpr encoding_t encode(const instruction_t &form) {
+        encoding_t encoding = {};
+        uint8_t len = 0;
+
+        if (form.require_REX)    { encoding.bytes[len++] = form.REX;    }
+        if (form.require_prefix) { encoding.bytes[len++] = form.prefix; }
+        encoding.bytes[len++] = form.opcode;
+        if (form.require_ModRM)  { encoding.bytes[len++] = form.ModRM;  }
+        if (form.require_SIB)    { encoding.bytes[len++] = form.SIB;    }
+
+        if (form.require_disp32) {
+            encoding.disp32_offset = len;
+            put_le(encoding.bytes + len, form.disp32, sizeof(uint32_t));
+            len += sizeof(uint32_t);
+        }
+
+        if (form.require_imm32) {
+            encoding.imm_offset = len;
+            put_le(encoding.bytes + len, form.imm32, sizeof(uint32_t));
+            len += sizeof(uint32_t);
+        }
+
+        if (form.require_imm64) {
+            encoding.imm_offset = len;
+            put_le(encoding.bytes + len, form.imm64, sizeof(uint64_t));
+            len += sizeof(uint64_t);
+        }
+
+        encoding.length = len;
+        return encoding;
+    }
+
+    /// Compile-time checked instruction form: `constexpr form_t FORM = make_form({...});`
+    consteval form_t make_form(instruction_t form) {
+        if (!is_valid_form(form)) {
+            invalid_instruction_form();
+        }
+
+        return {.instruction = form, .encoding = encode(form)};
+    }
+
+    /// Runtime built instructions (memory operands, peephole rewrites)
+    inline form_t encode_form(const instruction_t &form) {
+        assert (is_valid_form(form) && "Invalid x64 instruction form");
+
+        return {.instruction = form, .encoding = encode(form)};
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+// Patching
+//----------------------------------------------------------------------------------------------------------------------
+
+    inline void patch_imm32(form_t *form, uint32_t imm) {
+        assert (form->instruction.require_imm32);
+
+        form->instruction.imm32 = imm;
+        memcpy(form->encoding.bytes + form->encoding.imm_offset, &imm, sizeof(imm));
+    }
+
+    inline void patch_disp32(form_t *form, uint32_t disp) {
+        assert (form->instruction.require_disp32);
+
+        form->instruction.disp32 = disp;
+        memcpy(form->encoding.bytes + form->encoding.disp32_offset, &disp, sizeof(disp));
+    }
+
+    inline void patch_imm64(form_t *form, uint64_t imm) {
+        assert (form->instruction.require_imm64);
+
+        form->instruction.imm64 = imm;
+        memcpy(form->encoding.bytes + form->encoding.imm_offset, &imm, sizeof(imm));
+    }
+
+    /// Fixed size copy, `dest` must have ENCODING_BUF_SIZE bytes available
+    inline void write_encoding(uint8_t *dest, const encoding_t *encoding) {
+        memcpy(dest, encoding->bytes, ENCODING_BUF_SIZE);
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    void emit_form(code_t *self, const form_t *form);
+
+    /// Throughput of legacy field-by-field writer vs encoded templates, results are printed to stdout
+    void bench_encoder(uint64_t instructions_count);
+}
+
+#endif //X64_TRANSLATOR_X64_ENCODER_H
@@ -3,6 +3,8 @@
 #include "x64_stdlib.h"
 #include "x64_generators.h"
 #include "x64_elf.h"
+#include "x64_peephole.h"
+#include "x64_encoder.h"
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -11,6 +13,202 @@
 
 const int RAM_ADDR_REG    = x64::REG_R8;  // r8
 
+// System V ABI: integer arguments and registers, that callee must preserve
+const int ABI_ARG_REGS[]          = {x64::REG_RDI, x64::REG_RSI, x64::REG_RDX, x64::REG_RCX, x64::REG_R8, x64::REG_R9};
+const int ABI_CALLEE_SAVED_REGS[] = {x64::REG_RBX, x64::REG_RBP, x64::REG_R12, x64::REG_R13,
+                                     x64::REG_R14, x64::REG_R15};
+
+const int ABI_REG_ARGS_COUNT    = sizeof(ABI_ARG_REGS) / sizeof(ABI_ARG_REGS[0]);
+const int ABI_SAVED_REGS_COUNT  = sizeof(ABI_CALLEE_SAVED_REGS) / sizeof(ABI_CALLEE_SAVED_REGS[0]);
+const int ABI_STACK_ARGS_OFFSET = (ABI_SAVED_REGS_COUNT + 1) * sizeof(uint64_t); // Saved registers and return addr
+
+//----------------------------------------------------------------------------------------------------------------------
+// Fixed instruction forms (encoded and validated at compile time)
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace x64::forms {
+    constexpr form_t PUSH_RAX = make_form({.opcode = PUSH_reg | (uint8_t) REG_RAX});
+    constexpr form_t PUSH_RCX = make_form({.opcode = PUSH_reg | (uint8_t) REG_RCX});
+    constexpr form_t PUSH_RDX = make_form({.opcode = PUSH_reg | (uint8_t) REG_RDX});
+    constexpr form_t POP_RAX  = make_form({.opcode = POP_reg  | (uint8_t) REG_RAX});
+    constexpr form_t POP_RCX  = make_form({.opcode = POP_reg  | (uint8_t) REG_RCX});
+    constexpr form_t POP_RDX  = make_form({.opcode = POP_reg  | (uint8_t) REG_RDX});
+    constexpr form_t POP_RSI  = make_form({.opcode = POP_reg  | (uint8_t) REG_RSI});
+    constexpr form_t POP_RDI  = make_form({.opcode = POP_reg  | (uint8_t) REG_RDI});
+
+    constexpr form_t PUSH_R8  = make_form({.require_REX = true, .REX = REX_BYTE_IF_NUM_REGS, .opcode = PUSH_reg});
+    constexpr form_t POP_R8   = make_form({.require_REX = true, .REX = REX_BYTE_IF_NUM_REGS, .opcode = POP_reg});
+    constexpr form_t POP_R12  = make_form({.require_REX = true, .REX = REX_BYTE_IF_NUM_REGS,
+                                           .opcode = POP_reg | (REG_R12 & LOWER_REG_BITS_MASK)});
+
+    constexpr form_t RET      = make_form({.opcode = RET_none});
+    constexpr form_t CQO      = make_form({.require_REX = true, .REX = REX_BYTE_IF_64_BIT, .opcode = CQO_none});
+
+    // mov rax, imm64 (patched with address)
+    constexpr form_t MOV_RAX_IMM64 = make_form({
+            .require_REX   = true,
+            .require_imm64 = true,
+            .REX           = REX_BYTE_IF_64_BIT,
+            .opcode        = MOV_reg_imm | (uint8_t) REG_RAX
+    });
+
+    // mov rdi / rsi, imm64 (patched with host function arguments)
+    constexpr form_t MOV_RDI_IMM64 = make_form({
+            .require_REX   = true,
+            .require_imm64 = true,
+            .REX           = REX_BYTE_IF_64_BIT,
+            .opcode        = MOV_reg_imm | (uint8_t) REG_RDI
+    });
+
+    constexpr form_t MOV_RSI_IMM64 = make_form({
+            .require_REX   = true,
+            .require_imm64 = true,
+            .REX           = REX_BYTE_IF_64_BIT,
+            .opcode        = MOV_reg_imm | (uint8_t) REG_RSI
+    });
+
+    // mov rcx, %FIXED_PRECISION_MULTIPLIER
+    constexpr form_t MOV_RCX_MULTIPLIER = make_form({
+            .require_REX   = true,
+            .require_imm64 = true,
+            .REX           = REX_BYTE_IF_64_BIT,
+            .opcode        = MOV_reg_imm | (uint8_t) REG_RCX,
+            .imm64         = FIXED_PRECISION_MULTIPLIER
+    });
+
+    // mov r8, imm64 (patched with JIT RAM address)
+    constexpr form_t MOV_R8_IMM64 = make_form({
+            .require_REX   = true,
+            .require_imm64 = true,
+            .REX           = REX_BYTE_IF_NUM_REGS | REX_BYTE_IF_64_BIT,
+            .opcode        = MOV_reg_imm | (REG_R8 & LOWER_REG_BITS_MASK)
+    });
+
+    // mov r8, [rip + disp32] (patched with offset of RAM slot in PIC table)
+    constexpr form_t MOV_R8_RIP = make_form({
+            .require_REX    = true,
+            .require_ModRM  = true,
+            .require_disp32 = true,
+            .REX            = REX_PREFIX_BASE | REX_W_BIT | REX_R_BIT,
+            .opcode         = MOV_reg_mem,
+            .ModRM          = SINGLE_REG_MODRM_MODE_BIT | RIP_RELATIVE_MODRM_RM
+    });
+
+    // mov r8, imm32 (sign extended, patched with RAM address)
+    constexpr form_t MOV_R8_IMM32 = make_form({
+            .require_REX   = true,
+            .require_ModRM = true,
+            .require_imm32 = true,
+            .REX           = REX_BYTE_IF_NUM_REGS | REX_BYTE_IF_64_BIT,
+            .opcode        = MOV_reg_imm64,
+            .ModRM         = ONLY_REG_MODRM_MODE_BIT
+    });
+
+    consteval form_t make_reg_form(uint8_t rex, uint8_t opcode, uint8_t modrm) {
+        return make_form({.require_REX = true, .require_ModRM = true, .REX = rex, .opcode = opcode, .ModRM = modrm});
+    }
+
+    // call [rip + disp32] (patched with offset of stdlib slot in PIC table)
+    constexpr form_t CALL_RIP = make_form({.require_ModRM = true, .require_disp32 = true, .opcode = CALL_reg,
+                                           .ModRM = SINGLE_REG_MODRM_MODE_BIT | CALL_MOD_REG_BITS | RIP_RELATIVE_MODRM_RM});
+
+    // call / jmp rel32 (patched)
+    constexpr form_t CALL_REL32 = make_form({.require_imm32 = true, .opcode = CALL_rel32});
+    constexpr form_t JMP_REL32  = make_form({.require_imm32 = true, .opcode = JMP_rel32});
+
+    // mov rax, [rip + disp32] (patched with offset of RAM slot in PIC table)
+    constexpr form_t MOV_RAX_RIP = make_form({
+            .require_REX    = true,
+            .require_ModRM  = true,
+            .require_disp32 = true,
+            .REX            = REX_BYTE_IF_64_BIT,
+            .opcode         = MOV_reg_mem,
+            .ModRM          = SINGLE_REG_MODRM_MODE_BIT | RIP_RELATIVE_MODRM_RM
+    });
+
+    // mov r8, rax
+    constexpr form_t MOV_R8_RAX = make_reg_form(REX_BYTE_IF_64_BIT | REX_B_BIT, MOV_mem_reg,
+                                                ONLY_REG_MODRM_MODE_BIT | (REG_RAX << MODRM_RM_OFFSET) |
+                                                (REG_R8 & LOWER_REG_BITS_MASK));
+
+    // mov rbx, imm32 (sign extended, patched with frame offset)
+    constexpr form_t MOV_RBX_IMM32 = make_form({
+            .require_REX   = true,
+            .require_ModRM = true,
+            .require_imm32 = true,
+            .REX           = REX_BYTE_IF_64_BIT,
+            .opcode        = MOV_reg_imm64,
+            .ModRM         = ONLY_REG_MODRM_MODE_BIT | REG_RBX
+    });
+
+    // mov r10, [rsp + disp32] (patched with offset of stack argument)
+    constexpr form_t MOV_R10_STACK = make_form({
+            .require_REX    = true,
+            .require_ModRM  = true,
+            .require_SIB    = true,
+            .require_disp32 = true,
+            .REX            = REX_BYTE_IF_64_BIT | REX_R_BIT,
+            .opcode         = MOV_reg_mem,
+            .ModRM          = IMM_MODRM_MODE_BIT | ((REG_R10 & LOWER_REG_BITS_MASK) << MODRM_RM_OFFSET) |
+                              DOUBLE_REG_MODRM_MODE_BIT,
+            .SIB            = (REG_RSP << SIB_BASE_OFFSET) | (REG_RSP << SIB_INDEX_OFFSET)
+    });
+
+    constexpr form_t CALL_RAX = make_form({.require_ModRM = true, .opcode = CALL_reg,
+                                           .ModRM = ONLY_REG_MODRM_MODE_BIT | CALL_MOD_REG_BITS | REG_RAX});
+    constexpr form_t JMP_RAX  = make_form({.require_ModRM = true, .opcode = CALL_reg,
+                                           .ModRM = ONLY_REG_MODRM_MODE_BIT | JMP_MOD_REG_BITS  | REG_RAX});
+
+    constexpr form_t CMP_RAX_RCX = make_reg_form(REX_BYTE_IF_64_BIT, CMP_reg_reg,
+                                                 ONLY_REG_MODRM_MODE_BIT | (REG_RCX << MODRM_RM_OFFSET) | REG_RAX);
+
+    // imul / idiv r12, rcx
+    constexpr form_t IMUL_R12 = make_reg_form(REX_BYTE_IF_64_BIT | REX_BYTE_IF_NUM_REGS, DIVMUL_reg,
+                                              ONLY_REG_MODRM_MODE_BIT | MODRM_MUL_REG_BITS | REG_R12);
+    constexpr form_t IDIV_R12 = make_reg_form(REX_BYTE_IF_64_BIT | REX_BYTE_IF_NUM_REGS, DIVMUL_reg,
+                                              ONLY_REG_MODRM_MODE_BIT | MODRM_DIV_REG_BITS | REG_R12);
+    constexpr form_t IMUL_RCX = make_reg_form(REX_BYTE_IF_64_BIT, DIVMUL_reg,
+                                              ONLY_REG_MODRM_MODE_BIT | MODRM_MUL_REG_BITS | REG_RCX);
+    constexpr form_t IDIV_RCX = make_reg_form(REX_BYTE_IF_64_BIT, DIVMUL_reg,
+                                              ONLY_REG_MODRM_MODE_BIT | MODRM_DIV_REG_BITS | REG_RCX);
+
+    // op [rsp], rax
+    consteval form_t make_stack_top_form(uint8_t opcode) {
+        return make_form({
+                .require_REX   = true,
+                .require_ModRM = true,
+                .require_SIB   = true,
+                .REX           = REX_BYTE_IF_64_BIT,
+                .opcode        = opcode,
+                .ModRM         = DOUBLE_REG_MODRM_MODE_BIT,
+                .SIB           = (REG_RSP << SIB_BASE_OFFSET) | (REG_RSP << SIB_INDEX_OFFSET)
+        });
+    }
+
+    constexpr form_t ADD_STACK_TOP_RAX = make_stack_top_form(ADD_mem_reg);
+    constexpr form_t SUB_STACK_TOP_RAX = make_stack_top_form(SUB_mem_reg);
+    constexpr form_t AND_STACK_TOP_RAX = make_stack_top_form(AND_mem_reg);
+    constexpr form_t OR_STACK_TOP_RAX  = make_stack_top_form(OR_mem_reg);
+
+    // movzx eax, al
+    constexpr form_t MOVZX_EAX_AL = make_form({
+            .require_prefix = true,
+            .require_ModRM  = true,
+            .prefix         = TWO_BYTE_OPCODE_prefix,
+            .opcode         = MOVZX_reg_reg8,
+            .ModRM          = ONLY_REG_MODRM_MODE_BIT | (REG_RAX << MODRM_RM_OFFSET) | REG_RAX
+    });
+
+    // imul eax, eax, %FIXED_PRECISION_MULTIPLIER
+    constexpr form_t IMUL_EAX_MULTIPLIER = make_form({
+            .require_ModRM = true,
+            .require_imm32 = true,
+            .opcode        = IMUL_reg_imm,
+            .ModRM         = ONLY_REG_MODRM_MODE_BIT | (REG_RAX << MODRM_RM_OFFSET) | REG_RAX,
+            .imm32         = FIXED_PRECISION_MULTIPLIER
+    });
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // Static Prototypes
 //----------------------------------------------------------------------------------------------------------------------
@@ -23,6 +221,19 @@ namespace x64 {
     static void div_fix_precision_multiplier(code_t *self);
 
     static uint8_t translate_cond_jump_opcode(ir::instruction_t *ir_instruct);
+    static uint8_t translate_set_cond_opcode (ir::instruction_t *ir_instruct);
+    static uint8_t translate_cmov_opcode     (ir::instruction_t *ir_instruct);
+
+    static void emit_pop_and_cmp_operands(code_t *self);
+    static void emit_scaled_add(code_t *self, ir::instruction_t *ir_instruct);
+
+    static void emit_relative(code_t *self, form_t form, reloc_target_t target_type, uint64_t target);
+    static void emit_pic_call(code_t *self, PIC_TABLE_SLOTS slot);
+    static void emit_abs_call(code_t *self, ir::instruction_t *ir_instruct);
+    static const stdlib_addrs *get_stdlib_addrs(const code_t *self);
+
+    static void emit_push_or_pop_reg(code_t *self, uint8_t opcode, int reg);
+    static void emit_store_to_ram_base(code_t *self, int reg, uint32_t disp);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -83,21 +294,10 @@ void x64::emit_add_or_sub(code_t *self, ir::instruction_t *ir_instruct) {
     log (INFO, "emitting add/sub, is_add: %d", is_add);
 
     // pop rax
-    instruction_t pop_instruct = { .opcode = POP_reg | REG_RAX };
-    emit_instruction(self, &pop_instruct);
+    emit_form(self, &forms::POP_RAX);
 
     // add/sub [rsp], rax
-    instruction_t additive_instruct = {
-            .require_REX   = true,
-            .require_ModRM = true,
-            .require_SIB   = true,
-
-            .REX    = REX_BYTE_IF_64_BIT,
-            .opcode = (is_add) ? ADD_mem_reg : SUB_mem_reg,
-            .ModRM  = DOUBLE_REG_MODRM_MODE_BIT,
-            .SIB    = (REG_RSP << SIB_BASE_OFFSET) | (REG_RSP << SIB_INDEX_OFFSET)
-    };
-    emit_instruction(self, &additive_instruct);
+    emit_form(self, (is_add) ? &forms::ADD_STACK_TOP_RAX : &forms::SUB_STACK_TOP_RAX);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -111,20 +311,13 @@ void x64::emit_mull_or_div(x64::code_t *self, ir::instruction_t *ir_instruct) {
     log (INFO, "emitting mul/div, is_mul: %d", is_mul);
 
     // pop r12
-    instruction_t pop_op2_instruct = {.require_REX = true, .REX = REX_BYTE_IF_NUM_REGS, .opcode = POP_reg | REG_R12};
-    emit_instruction(self, &pop_op2_instruct);
+    emit_form(self, &forms::POP_R12);
 
     // pop rax
-    instruction_t pop_op1_instruct = {.opcode = POP_reg | REG_RAX};
-    emit_instruction(self, &pop_op1_instruct);
+    emit_form(self, &forms::POP_RAX);
 
     // cqo (extend rax to rdx:rax to prepare for division)
-    instruction_t extend_rax_to_rdxrax_instruct = {
-            .require_REX = true,
-            .REX         = REX_BYTE_IF_64_BIT,
-            .opcode      = CQO_none
-    };
-    emit_instruction(self, &extend_rax_to_rdxrax_instruct);
+    emit_form(self, &forms::CQO);
 
     // Fix fixed_precision if needed
     if (!is_mul) {
@@ -132,15 +325,7 @@ void x64::emit_mull_or_div(x64::code_t *self, ir::instruction_t *ir_instruct) {
     }
 
     // imul / idiv r12
-    uint8_t modrm_reg_bits = (is_mul) ? MODRM_MUL_REG_BITS : MODRM_DIV_REG_BITS;
-    instruction_t mult_instruct = {
-            .require_REX   = true,
-            .require_ModRM = true,
-            .REX    = REX_BYTE_IF_64_BIT | REX_BYTE_IF_NUM_REGS,
-            .opcode = DIVMUL_reg,
-            .ModRM  = ONLY_REG_MODRM_MODE_BIT | modrm_reg_bits | REG_R12
-    };
-    emit_instruction(self, &mult_instruct);
+    emit_form(self, (is_mul) ? &forms::IMUL_R12 : &forms::IDIV_R12);
 
     // Fix fixed_precision if needed
     if (is_mul) {
@@ -148,29 +333,23 @@ void x64::emit_mull_or_div(x64::code_t *self, ir::instruction_t *ir_instruct) {
     }
 
     // push rax
-    instruction_t push_res_instruct = {.opcode = PUSH_reg | REG_RAX};
-    emit_instruction(self, &push_res_instruct);
+    emit_form(self, &forms::PUSH_RAX);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-struct stdlib_addrs {
-    uint64_t inp;
-    uint64_t out;
-    uint64_t sqrt;
-    uint64_t halt;
-};
-
-const stdlib_addrs JIT_ADDRS = {
+const x64::stdlib_addrs JIT_ADDRS = {
         .inp = (uint64_t) x64::stdlib_inp,
         .out = (uint64_t) x64::stdlib_out,
+        .out_raw = (uint64_t) x64::stdlib_out_raw,
         .sqrt = (uint64_t) x64::stdlib_sqrt,
         .halt = (uint64_t) x64::stdlib_halt
 };
 
-const stdlib_addrs BINARY_ADDRS = {
+const x64::stdlib_addrs BINARY_ADDRS = {
         .inp  = x64::STDLIB_BASE_ADDR + (int) x64::STDLIB_BINARY_OFFSETS::INPUT,
         .out  = x64::STDLIB_BASE_ADDR + (int) x64::STDLIB_BINARY_OFFSETS::OUTPUT,
+        .out_raw = x64::STDLIB_BASE_ADDR + (int) x64::STDLIB_BINARY_OFFSETS::OUTPUT_RAW,
         .sqrt = x64::STDLIB_BASE_ADDR + (int) x64::STDLIB_BINARY_OFFSETS::SQRT,
         .halt = x64::STDLIB_BASE_ADDR + (int) x64::STDLIB_BINARY_OFFSETS::EXIT,
 };
@@ -183,55 +362,97 @@ void x64::emit_lib_func(code_t *self, ir::instruction_t *ir_instruct) {
 
     // If stdlib function has arguments
     if (ir_instruct->type != ir::instruction_type_t::INP && ir_instruct->type != ir::instruction_type_t::HALT) {
-        instruction_t pop_arg_instruct = { .opcode = POP_reg | REG_RDI };
-        emit_instruction(self, &pop_arg_instruct);
+        emit_form(self, &forms::POP_RDI);
     }
 
-    const stdlib_addrs *stdlib_addrs = (self->output_type == output_t::JIT) ? &JIT_ADDRS : &BINARY_ADDRS;
+    if (self->pic) {
+        PIC_TABLE_SLOTS slot = PIC_TABLE_SLOTS::EXIT;
+        if (ir_instruct->type == ir::instruction_type_t::INP) {
+            slot = PIC_TABLE_SLOTS::INPUT;
+        } else if (ir_instruct->type == ir::instruction_type_t::OUT) {
+            slot = (self->raw_output) ? PIC_TABLE_SLOTS::OUTPUT_RAW : PIC_TABLE_SLOTS::OUTPUT;
+        } else if (ir_instruct->type == ir::instruction_type_t::SQRT) {
+            slot = PIC_TABLE_SLOTS::SQRT;
+        } else {
+            assert (ir_instruct->type == ir::instruction_type_t::HALT && "Not a stdlib call");
+        }
 
-    // Determine std function address
-    uint64_t lib_func_addr = 0;
-    switch (ir_instruct->type) {
-        case ir::instruction_type_t::INP:  lib_func_addr = stdlib_addrs->inp;  log(INFO, "\tfunc: INP"); break;
-        case ir::instruction_type_t::OUT:  lib_func_addr = stdlib_addrs->out;  log(INFO, "\tfunc: OUT"); break;
-        case ir::instruction_type_t::SQRT: lib_func_addr = stdlib_addrs->sqrt; log(INFO, "\tfunc: SQR"); break;
-        case ir::instruction_type_t::HALT: lib_func_addr = stdlib_addrs->halt; log(INFO, "\tfunc: HLT"); break;
+        emit_pic_call(self, slot);
+    } else {
+        // mov rax, %addr; push r8; call rax; pop r8
+        emit_abs_call(self, ir_instruct);
     }
 
-    // mov rax, %addr
-    instruction_t mov_addr_instr = {
-            .require_REX   = true,
-            .require_ModRM = true,
-            .require_imm64 = true,
-            .REX           = REX_BYTE_IF_64_BIT,
-            .opcode        = MOV_reg_imm,
-            .ModRM         = IMM_MODRM_MODE_BIT | (REG_RDI << MODRM_RM_OFFSET) | REG_RAX,
-            .imm64         = lib_func_addr
-    };
-    emit_instruction(self, &mov_addr_instr);
+    // If stdlib has return value, push it (push rax)
+    if (ir_instruct->type == ir::instruction_type_t::INP || ir_instruct->type == ir::instruction_type_t::SQRT) {
+        emit_form(self, &forms::PUSH_RAX);
+    }
+}
 
-    // push r8 (because we use it for RAM ptr)
-    instruction_t save_r8    = {.require_REX = true, .REX = REX_BYTE_IF_NUM_REGS, .opcode = PUSH_reg};
-    emit_instruction(self, &save_r8);
+//----------------------------------------------------------------------------------------------------------------------
 
-    // call rax
-    instruction_t call_reg = {
-            .require_ModRM = true,
-            .opcode = CALL_reg,
-            .ModRM = ONLY_REG_MODRM_MODE_BIT | CALL_MOD_REG_BITS | REG_RAX
-    };
-    emit_instruction(self, &call_reg);
+void x64::emit_pic_table(code_t *self) {
+    assert (self && self->pic);
 
-    // pop r8
-    instruction_t restore_r8 = {.require_REX = true, .REX = REX_BYTE_IF_NUM_REGS, .opcode = POP_reg};
-    emit_instruction(self, &restore_r8);
+    const stdlib_addrs *stdlib_addrs = get_stdlib_addrs(self);
+    uint64_t *table = (uint64_t *) self->exec_buf;
 
+    table[(int) PIC_TABLE_SLOTS::RAM]        = (self->output_type == output_t::JIT) ? (uint64_t) self->ram_buf
+                                                                                    : (uint64_t) RAM_BASE_ADDR;
+    table[(int) PIC_TABLE_SLOTS::INPUT]      = stdlib_addrs->inp;
+    table[(int) PIC_TABLE_SLOTS::OUTPUT]     = stdlib_addrs->out;
+    table[(int) PIC_TABLE_SLOTS::OUTPUT_RAW] = stdlib_addrs->out_raw;
+    table[(int) PIC_TABLE_SLOTS::SQRT]       = stdlib_addrs->sqrt;
+    table[(int) PIC_TABLE_SLOTS::EXIT]       = stdlib_addrs->halt;
+}
 
-    // If stdlib has return value, push it (push rax)
-    if (ir_instruct->type == ir::instruction_type_t::INP || ir_instruct->type == ir::instruction_type_t::SQRT) {
-        instruction_t push_res_instr = { .opcode = PUSH_reg | REG_RAX };
-        emit_instruction(self, &push_res_instr);
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::emit_object_wrapper(code_t *self, const ir::func_range_t *range, uint64_t frame) {
+    assert (self && range && self->pic);
+
+    // push rbx; push rbp; push r12 ... r15 (generated code and stdlib don't preserve them)
+    for (int i = 0; i < ABI_SAVED_REGS_COUNT; ++i) {
+        emit_push_or_pop_reg(self, PUSH_reg, ABI_CALLEE_SAVED_REGS[i]);
+    }
+
+    // mov rax, [rip + %ram_slot] (r8 holds argument yet)
+    emit_relative(self, forms::MOV_RAX_RIP, reloc_target_t::OFFSET, (int) PIC_TABLE_SLOTS::RAM * sizeof (uint64_t));
+
+    // Argument i goes to slot i of callee frame, as caller stores it in convert_func_call
+    for (uint i = 0; i < range->args_count; ++i) {
+        const uint32_t slot_disp = (uint32_t) (frame + i * sizeof (uint64_t));
+
+        if (i < ABI_REG_ARGS_COUNT) {
+            // mov [rax + %slot], %arg_reg
+            emit_store_to_ram_base(self, ABI_ARG_REGS[i], slot_disp);
+        } else {
+            // mov r10, [rsp + %stack_arg]; mov [rax + %slot], r10
+            form_t load_form = forms::MOV_R10_STACK;
+            patch_disp32(&load_form, (uint32_t) (ABI_STACK_ARGS_OFFSET + (i - ABI_REG_ARGS_COUNT) * sizeof (uint64_t)));
+            emit_form(self, &load_form);
+
+            emit_store_to_ram_base(self, REG_R10, slot_disp);
+        }
+    }
+
+    // mov r8, rax; mov rbx, %frame
+    emit_form(self, &forms::MOV_R8_RAX);
+
+    form_t mov_frame_form = forms::MOV_RBX_IMM32;
+    patch_imm32(&mov_frame_form, (uint32_t) frame);
+    emit_form(self, &mov_frame_form);
+
+    // call %func; pop rax (function leaves result on stack top)
+    emit_relative(self, forms::CALL_REL32, reloc_target_t::LABEL, range->begin);
+    emit_form(self, &forms::POP_RAX);
+
+    // pop r15 ... r12; pop rbp; pop rbx; ret
+    for (int i = ABI_SAVED_REGS_COUNT - 1; i >= 0; --i) {
+        emit_push_or_pop_reg(self, POP_reg, ABI_CALLEE_SAVED_REGS[i]);
     }
+
+    emit_form(self, &forms::RET);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -241,34 +462,34 @@ void x64::emit_ret(code_t *self) {
     emit_debug_nop(self);
 
     // ret
-    instruction_t ret_instruct = {.opcode = RET_none};
-    emit_instruction(self, &ret_instruct);
+    emit_form(self, &forms::RET);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
 void x64::emit_code_preparation(code_t *self) {
     assert(self);
-    assert(self->exec_buf_size == 0);
+    assert(self->exec_buf_size == code_entry_offset(self));
 
 #ifdef DEBUG_BREAK
-    self->exec_buf[0] = DEBUG_SYSCALL_BYTE;
+    self->exec_buf[self->exec_buf_size] = DEBUG_SYSCALL_BYTE;
     self->exec_buf_size++;
 #endif
 
-    uint64_t ram_addr = (self->output_type == output_t::JIT) ? (uint64_t) self->ram_buf : RAM_BASE_ADDR;
-
-    // mov r8, %ram_addr
-    instruction_t mov_addr_instr = {
-            .require_REX   = true,
-            .require_ModRM = true,
-            .require_imm32 = true,
-            .REX           = REX_BYTE_IF_NUM_REGS | REX_BYTE_IF_64_BIT,
-            .opcode        = MOV_reg_imm64,
-            .ModRM         = ONLY_REG_MODRM_MODE_BIT,
-            .imm32         = ram_addr
-    };
-    emit_instruction(self, &mov_addr_instr);
+    if (self->pic) {
+        // mov r8, [rip + %ram_slot]
+        emit_relative(self, forms::MOV_R8_RIP, reloc_target_t::OFFSET, (int) PIC_TABLE_SLOTS::RAM * sizeof (uint64_t));
+    } else if (self->output_type == output_t::JIT) {
+        // mov r8, %ram_buf (mmap result is anywhere in address space)
+        form_t mov_addr_form = forms::MOV_R8_IMM64;
+        patch_imm64(&mov_addr_form, (uint64_t) self->ram_buf);
+        emit_form(self, &mov_addr_form);
+    } else {
+        // mov r8, %RAM_BASE_ADDR
+        form_t mov_addr_form = forms::MOV_R8_IMM32;
+        patch_imm32(&mov_addr_form, RAM_BASE_ADDR);
+        emit_form(self, &mov_addr_form);
+    }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -277,26 +498,78 @@ void x64::emit_jmp_or_call(code_t *self, ir::instruction_t *ir_instruct) {
     assert(self && ir_instruct);
     emit_debug_nop(self);
 
+    if (self->pic) {
+        // call/jmp %rel_addr
+        emit_relative(self, (ir_instruct->type == ir::instruction_type_t::CALL) ? forms::CALL_REL32 : forms::JMP_REL32,
+                      reloc_target_t::LABEL, ir_instruct->imm_arg);
+        return;
+    }
+
     // mov rax, %jmp_addr
-    instruction_t mov_addr_instr = {
-            .require_REX   = true,
-            .require_ModRM = true,
-            .require_imm64 = true,
-            .REX           = REX_BYTE_IF_64_BIT,
-            .opcode        = MOV_reg_imm,
-            .ModRM         = IMM_MODRM_MODE_BIT | (REG_RDI << MODRM_RM_OFFSET) | REG_RAX,
-            .imm64         = addr_transl_translate(self->addr_transl, ir_instruct->imm_arg)
-    };
-    emit_instruction(self, &mov_addr_instr);
+    form_t mov_addr_form = forms::MOV_RAX_IMM64;
+    patch_imm64(&mov_addr_form, code_base_addr(self) + addr_transl_translate(self->addr_transl, ir_instruct->imm_arg));
+
+    // Address of not yet translated function or of code outside of fragment is patched later,
+    // so its position must be known
+    if (self->lazy || self->fragment) {
+        peephole_flush(self);
+        const size_t imm_position = self->exec_buf_size + mov_addr_form.encoding.imm_offset;
+
+        if (self->lazy) {
+            lazy_add_call_site(self, ir_instruct->imm_arg, imm_position);
+        }
+
+        record_reloc(self, reloc_type_t::ABS64, imm_position, reloc_target_t::LABEL, ir_instruct->imm_arg);
+    }
+
+    emit_form(self, &mov_addr_form);
 
     // call/jmp rax
-    uint8_t MODRM_REG_BITS = (ir_instruct->type == ir::instruction_type_t::CALL) ? CALL_MOD_REG_BITS : JMP_MOD_REG_BITS;
-    instruction_t call_reg = {
-            .require_ModRM = true,
-            .opcode = CALL_reg,
-            .ModRM = ONLY_REG_MODRM_MODE_BIT | MODRM_REG_BITS | REG_RAX
-    };
-    emit_instruction(self, &call_reg);
+    emit_form(self, (ir_instruct->type == ir::instruction_type_t::CALL) ? &forms::CALL_RAX : &forms::JMP_RAX);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::emit_lazy_stub(code_t *self, uint64_t func_index) {
+    assert (self && self->lazy);
+
+    // push rcx; push rdx; push r8 (IR registers and RAM ptr, that host function may clobber)
+    emit_form(self, &forms::PUSH_RCX);
+    emit_form(self, &forms::PUSH_RDX);
+    emit_form(self, &forms::PUSH_R8);
+
+    // mov rdi, %code; mov rsi, %func_index; mov rax, %lazy_compile
+    form_t mov_code_form = forms::MOV_RDI_IMM64;
+    patch_imm64(&mov_code_form, (uint64_t) self);
+    emit_form(self, &mov_code_form);
+
+    form_t mov_index_form = forms::MOV_RSI_IMM64;
+    patch_imm64(&mov_index_form, func_index);
+    emit_form(self, &mov_index_form);
+
+    form_t mov_addr_form = forms::MOV_RAX_IMM64;
+    patch_imm64(&mov_addr_form, (uint64_t) lazy_compile);
+    emit_form(self, &mov_addr_form);
+
+    // call rax; pop r8; pop rdx; pop rcx
+    emit_form(self, &forms::CALL_RAX);
+    emit_form(self, &forms::POP_R8);
+    emit_form(self, &forms::POP_RDX);
+    emit_form(self, &forms::POP_RCX);
+
+    // jmp rax (translated function, return address of original call is on stack top again)
+    emit_form(self, &forms::JMP_RAX);
+}
+
+void x64::emit_abs_jmp(code_t *self, uint64_t addr) {
+    assert (self);
+
+    // mov rax, %addr; jmp rax
+    form_t mov_addr_form = forms::MOV_RAX_IMM64;
+    patch_imm64(&mov_addr_form, addr);
+    emit_form(self, &mov_addr_form);
+
+    emit_form(self, &forms::JMP_RAX);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -305,39 +578,160 @@ void x64::emit_cond_jmp(code_t *self, ir::instruction_t *ir_instruct) {
     assert (self && ir_instruct);
     emit_debug_nop(self);
 
-    // pop rcx
-    instruction_t pop_op2_instruct = {.opcode = POP_reg | REG_RCX};
-    emit_instruction(self, &pop_op2_instruct);
+    // pop rcx, pop rax, cmp rax, rcx
+    emit_pop_and_cmp_operands(self);
+
+    // Jxx %rel_addr
+    instruction_t cond_jmp_instruct = {
+            .require_prefix = true,
+            .require_imm32  = true,
+            .prefix         = CONDJMP_imm_prefix,
+            .opcode         = translate_cond_jump_opcode(ir_instruct),
+    };
+    emit_relative(self, encode_form(cond_jmp_instruct), reloc_target_t::LABEL, ir_instruct->imm_arg);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::emit_and_or(code_t *self, ir::instruction_t *ir_instruct) {
+    assert(self && ir_instruct);
+    assert(ir_instruct->type == ir::instruction_type_t::AND || ir_instruct->type == ir::instruction_type_t::OR);
+    emit_debug_nop(self);
+
+    bool is_and = ir_instruct->type == ir::instruction_type_t::AND;
+    log (INFO, "emitting and/or, is_and: %d", is_and);
 
     // pop rax
-    instruction_t pop_op1_instruct = {.opcode = POP_reg | REG_RAX};
-    emit_instruction(self, &pop_op1_instruct);
+    emit_form(self, &forms::POP_RAX);
 
-    // cmp rax, rcx
-    instruction_t cmp_instruct = {
+    // and/or [rsp], rax
+    emit_form(self, (is_and) ? &forms::AND_STACK_TOP_RAX : &forms::OR_STACK_TOP_RAX);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::emit_set_cond(code_t *self, ir::instruction_t *ir_instruct) {
+    assert (self && ir_instruct);
+    emit_debug_nop(self);
+
+    log (INFO, "emitting setcc");
+
+    // pop rcx, pop rax, cmp rax, rcx
+    emit_pop_and_cmp_operands(self);
+
+    // setcc al
+    instruction_t set_instruct = {
+            .require_prefix = true,
+            .require_ModRM  = true,
+            .prefix         = TWO_BYTE_OPCODE_prefix,
+            .opcode         = translate_set_cond_opcode(ir_instruct),
+            .ModRM          = ONLY_REG_MODRM_MODE_BIT | REG_RAX
+    };
+    emit_instruction(self, &set_instruct);
+
+    // movzx eax, al
+    emit_form(self, &forms::MOVZX_EAX_AL);
+
+    // imul eax, eax, %FIXED_PRECISION_MULTIPLIER (true is 1.00)
+    emit_form(self, &forms::IMUL_EAX_MULTIPLIER);
+
+    // push rax
+    emit_form(self, &forms::PUSH_RAX);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::emit_cmov(code_t *self, ir::instruction_t *ir_instruct) {
+    assert (self && ir_instruct);
+    emit_debug_nop(self);
+
+    log (INFO, "emitting cmovcc");
+
+    // pop rdx (else value)
+    emit_form(self, &forms::POP_RDX);
+
+    // pop rsi (then value)
+    emit_form(self, &forms::POP_RSI);
+
+    // pop rcx, pop rax, cmp rax, rcx
+    emit_pop_and_cmp_operands(self);
+
+    // cmovcc rdx, rsi
+    instruction_t cmov_instruct = {
             .require_REX    = true,
+            .require_prefix = true,
             .require_ModRM  = true,
             .REX            = REX_BYTE_IF_64_BIT,
-            .opcode         = CMP_reg_reg,
-            .ModRM          = ONLY_REG_MODRM_MODE_BIT | (REG_RCX << MODRM_RM_OFFSET) | REG_RAX
+            .prefix         = TWO_BYTE_OPCODE_prefix,
+            .opcode         = translate_cmov_opcode(ir_instruct),
+            .ModRM          = ONLY_REG_MODRM_MODE_BIT | (REG_RDX << MODRM_RM_OFFSET) | REG_RSI
     };
-    emit_instruction(self, &cmp_instruct);
+    emit_instruction(self, &cmov_instruct);
 
-    // Calc relative addr
-    uint64_t base_addr = (self->output_type == output_t::JIT) ? (uint64_t) self->exec_buf : x64::CODE_BASE_ADDR;
+    // push rdx
+    emit_form(self, &forms::PUSH_RDX);
+}
 
-    const uint64_t cur_addr = (base_addr + self->exec_buf_size) + 6;
-    const uint32_t rel_pos  = (uint32_t) (addr_transl_translate(self->addr_transl, ir_instruct->imm_arg)-cur_addr);
+//----------------------------------------------------------------------------------------------------------------------
 
-    // Jxx %rel_addr
-    instruction_t cond_jmp_instruct = {
-            .require_prefix = true,
-            .require_imm32  = true,
-            .prefix         = CONDJMP_imm_prefix,
-            .opcode         = translate_cond_jump_opcode(ir_instruct),
-            .imm32          = rel_pos
+void x64::emit_acc_op(code_t *self, ir::instruction_t *ir_instruct) {
+    assert (self && ir_instruct);
+    emit_debug_nop(self);
+
+    log (INFO, "emitting accumulator op");
+
+    if (ir_instruct->type == ir::instruction_type_t::LEA_ACC) {
+        emit_scaled_add(self, ir_instruct);
+        return;
+    }
+
+    instruction_t x64_instruct = {
+            .require_REX   = true,
+            .require_ModRM = true,
+            .REX           = REX_BYTE_IF_64_BIT
     };
-    emit_instruction(self, &cond_jmp_instruct);
+
+    bool is_imm_form = !ir_instruct->need_mem_arg && !ir_instruct->need_reg_arg;
+    uint8_t imm_reg_bits = 0; // Opcode extension in ModRM.reg for `op r/m64, imm32` forms
+
+    const ir::instruction_type_t type = ir_instruct->type;
+
+    if (type == ir::instruction_type_t::LOAD) {
+        x64_instruct.opcode = (is_imm_form) ? MOV_reg_imm64 : MOV_reg_mem;        // mov rax, imm / [mem]
+    } else if (type == ir::instruction_type_t::STORE) {
+        assert (ir_instruct->need_mem_arg && "Can't store to non-memory");
+        x64_instruct.opcode = MOV_mem_reg;                                        // mov [mem], rax
+    } else if (type == ir::instruction_type_t::ADD_ACC) {
+        x64_instruct.opcode = (is_imm_form) ? ARITH_reg_imm : ADD_reg_mem;        // add rax, imm / [mem] / reg
+        imm_reg_bits        = MODRM_ADD_REG_BITS;
+    } else if (type == ir::instruction_type_t::SUB_ACC) {
+        x64_instruct.opcode = (is_imm_form) ? ARITH_reg_imm : SUB_reg_mem;        // sub rax, imm / [mem] / reg
+        imm_reg_bits        = MODRM_SUB_REG_BITS;
+    } else if (type == ir::instruction_type_t::MUL_ACC) {
+        x64_instruct.opcode        = IMUL_reg_imm;                                // imul rax, rax / [mem], k
+        x64_instruct.require_imm32 = true;
+        x64_instruct.imm32         = (uint32_t) ir_instruct->scale_arg;
+    } else {
+        assert (0 && "Not an accumulator instruction");
+    }
+
+    if (ir_instruct->need_mem_arg) {
+        generate_memory_arguments(&x64_instruct, ir_instruct);
+        x64_instruct.REX   |= REX_BYTE_IF_64_BIT;
+        x64_instruct.ModRM |= REG_RAX << MODRM_RM_OFFSET;
+    } else if (ir_instruct->need_reg_arg) {
+        assert (ir_instruct->reg_num < 8 && "unsupported reg");
+        x64_instruct.ModRM = ONLY_REG_MODRM_MODE_BIT | (REG_RAX << MODRM_RM_OFFSET) | ir_instruct->reg_num;
+    } else if (ir_instruct->type == ir::instruction_type_t::MUL_ACC) {
+        x64_instruct.ModRM = ONLY_REG_MODRM_MODE_BIT | (REG_RAX << MODRM_RM_OFFSET) | REG_RAX;
+    } else {
+        x64_instruct.ModRM         = ONLY_REG_MODRM_MODE_BIT | imm_reg_bits | REG_RAX;
+        x64_instruct.require_imm32 = true;
+        assert (ir::fits_imm((long long) ir_instruct->imm_arg) && "imm doesn't fit imm32");
+        x64_instruct.imm32         = (uint32_t) (ir_instruct->imm_arg * FIXED_PRECISION_MULTIPLIER);
+    }
+
+    emit_instruction(self, &x64_instruct);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -353,8 +747,9 @@ static void x64::generate_memory_arguments(instruction_t *x64_instruct, ir::inst
 
     if (ir_instruct->need_imm_arg) {
         x64_instruct->ModRM |= IMM_MODRM_MODE_BIT;
-        x64_instruct->require_imm32 = true;
-        x64_instruct->imm32 = ir_instruct->imm_arg * sizeof (uint64_t);
+        x64_instruct->require_disp32 = true;
+        assert (ir_instruct->imm_arg <= INT32_MAX / sizeof (uint64_t) && "address doesn't fit disp32");
+        x64_instruct->disp32 = (uint32_t) (ir_instruct->imm_arg * sizeof (uint64_t));
     }
 
     if (ir_instruct->need_reg_arg) {
@@ -369,15 +764,173 @@ static void x64::generate_memory_arguments(instruction_t *x64_instruct, ir::inst
     }
 
     log (INFO, "\tSIB byte: %x", *(uint8_t *) &x64_instruct->SIB);
-    log (INFO, "\timm arg value: %d", x64_instruct->imm32);
+    log (INFO, "\tdisplacement value: %d", x64_instruct->disp32);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 // Static Functions
 //----------------------------------------------------------------------------------------------------------------------
 
+static void x64::emit_pop_and_cmp_operands(code_t *self) {
+    // pop rcx
+    emit_form(self, &forms::POP_RCX);
+
+    // pop rax
+    emit_form(self, &forms::POP_RAX);
+
+    // cmp rax, rcx
+    emit_form(self, &forms::CMP_RAX_RCX);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void x64::emit_scaled_add(code_t *self, ir::instruction_t *ir_instruct) {
+    assert (ir_instruct->need_mem_arg && "Scaled operand must be in memory");
+
+    // mov rcx, [mem]
+    instruction_t load_instruct = {.require_REX = true, .REX = REX_BYTE_IF_64_BIT, .opcode = MOV_reg_mem};
+    generate_memory_arguments(&load_instruct, ir_instruct);
+    load_instruct.REX   |= REX_BYTE_IF_64_BIT;
+    load_instruct.ModRM |= REG_RCX << MODRM_RM_OFFSET;
+    emit_instruction(self, &load_instruct);
+
+    uint8_t scale_bits = 0;
+    switch (ir_instruct->scale_arg) {
+        case 1: scale_bits = 0b00; break;
+        case 2: scale_bits = 0b01; break;
+        case 4: scale_bits = 0b10; break;
+        case 8: scale_bits = 0b11; break;
+
+        default:
+            assert (0 && "Unsupported lea scale");
+    }
+
+    // lea rax, [rax + rcx*scale]
+    instruction_t lea_instruct = {
+            .require_REX   = true,
+            .require_ModRM = true,
+            .require_SIB   = true,
+            .REX           = REX_BYTE_IF_64_BIT,
+            .opcode        = LEA_reg_mem,
+            .ModRM         = SINGLE_REG_MODRM_MODE_BIT | (REG_RAX << MODRM_RM_OFFSET) | DOUBLE_REG_MODRM_MODE_BIT,
+            .SIB           = (uint8_t) ((scale_bits << SIB_SCALE_OFFSET) | (REG_RCX << SIB_INDEX_OFFSET)
+                                      | (REG_RAX << SIB_BASE_OFFSET))
+    };
+    emit_instruction(self, &lea_instruct);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void x64::emit_abs_call(code_t *self, ir::instruction_t *ir_instruct) {
+    const stdlib_addrs *stdlib_addrs = get_stdlib_addrs(self);
+
+    // Determine std function address
+    uint64_t lib_func_addr = 0;
+    if (ir_instruct->type == ir::instruction_type_t::INP) {
+        lib_func_addr = stdlib_addrs->inp;  log(INFO, "\tfunc: INP");
+    } else if (ir_instruct->type == ir::instruction_type_t::OUT) {
+        lib_func_addr = (self->raw_output) ? stdlib_addrs->out_raw : stdlib_addrs->out;
+        log(INFO, "\tfunc: OUT");
+    } else if (ir_instruct->type == ir::instruction_type_t::SQRT) {
+        lib_func_addr = stdlib_addrs->sqrt; log(INFO, "\tfunc: SQR");
+    } else {
+        assert (ir_instruct->type == ir::instruction_type_t::HALT && "Not a stdlib call");
+        lib_func_addr = stdlib_addrs->halt; log(INFO, "\tfunc: HLT");
+    }
+
+    // mov rax, %addr
+    form_t mov_addr_form = forms::MOV_RAX_IMM64;
+    patch_imm64(&mov_addr_form, lib_func_addr);
+    emit_form(self, &mov_addr_form);
+
+    // push r8 (because we use it for RAM ptr)
+    emit_form(self, &forms::PUSH_R8);
+
+    // call rax
+    emit_form(self, &forms::CALL_RAX);
+
+    // pop r8
+    emit_form(self, &forms::POP_R8);
+}
+
+static const x64::stdlib_addrs *x64::get_stdlib_addrs(const code_t *self) {
+    if (self->program) {
+        return get_stdlib_addrs(self->program);
+    }
+
+    if (self->output_type == output_t::JIT) {
+        return &JIT_ADDRS;
+    }
+
+    return (self->stdlib_link) ? &self->stdlib_link->addrs : &BINARY_ADDRS;
+}
+
+/// Emit instruction with rel32 immediate or [rip + disp32] operand (last 4 bytes of both) pointing to IR label or
+/// to offset in exec_buf
+static void x64::emit_relative(code_t *self, form_t form, reloc_target_t target_type, uint64_t target) {
+    // Relative addr is calculated from code size, so all previous instructions must be written
+    peephole_flush(self);
+
+    const uint64_t target_offset = (target_type == reloc_target_t::LABEL)
+                                 ? addr_transl_translate(self->addr_transl, target) : target;
+    const uint64_t next_offset   = self->exec_buf_size + form.encoding.length;
+    const uint32_t rel_pos     = (uint32_t) (target_offset - next_offset);
+
+    if (form.instruction.require_disp32) {
+        patch_disp32(&form, rel_pos);
+    } else {
+        patch_imm32(&form, rel_pos);
+    }
+
+    record_reloc(self, reloc_type_t::REL32, next_offset - sizeof(uint32_t), target_type, target);
+    emit_form(self, &form);
+}
+
+static void x64::emit_pic_call(code_t *self, PIC_TABLE_SLOTS slot) {
+    // push r8 (because we use it for RAM ptr), before flush, so it still cancels previous call's `pop r8`
+    emit_form(self, &forms::PUSH_R8);
+
+    // call [rip + %slot]
+    emit_relative(self, forms::CALL_RIP, reloc_target_t::OFFSET, (size_t) slot * sizeof (uint64_t));
+
+    // pop r8
+    emit_form(self, &forms::POP_R8);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void x64::emit_push_or_pop_reg(code_t *self, uint8_t opcode, int reg) {
+    instruction_t x64_instruct = {.opcode = (uint8_t) (opcode | (reg & LOWER_REG_BITS_MASK))};
+
+    if (reg & EXTENDED_REG_MASK) {
+        x64_instruct.require_REX = true;
+        x64_instruct.REX         = REX_BYTE_IF_NUM_REGS;
+    }
+
+    emit_instruction(self, &x64_instruct);
+}
+
+/// mov [rax + disp32], reg
+static void x64::emit_store_to_ram_base(code_t *self, int reg, uint32_t disp) {
+    instruction_t x64_instruct = {
+            .require_REX    = true,
+            .require_ModRM  = true,
+            .require_disp32 = true,
+            .REX            = (uint8_t) (REX_BYTE_IF_64_BIT | ((reg & EXTENDED_REG_MASK) ? REX_R_BIT : 0)),
+            .opcode         = MOV_mem_reg,
+            .ModRM          = (uint8_t) (IMM_MODRM_MODE_BIT | ((reg & LOWER_REG_BITS_MASK) << MODRM_RM_OFFSET) |
+                                         REG_RAX),
+            .disp32         = disp
+    };
+
+    emit_instruction(self, &x64_instruct);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
 static inline void x64::emit_debug_nop(code_t *self) {
 #ifdef DEBUG_NOP_BYTE
+    peephole_flush(self);
     self->exec_buf[self->exec_buf_size] = 0x90;
     self->exec_buf_size++;
 #endif
@@ -385,75 +938,71 @@ static inline void x64::emit_debug_nop(code_t *self) {
 
 static void x64::mul_fix_precision_multiplier(code_t *self) {
     // mov rcx, %FIXED_PRECISION_MULTIPLIER
-    instruction_t load_precision_multiplier = {
-            .require_REX   = true,
-            .require_ModRM = true,
-            .require_imm64 = true,
-            .REX           = REX_BYTE_IF_64_BIT,
-            .opcode        = MOV_reg_imm,
-            .ModRM         = IMM_MODRM_MODE_BIT | (REG_RDI << MODRM_RM_OFFSET) | REG_RCX,
-            .imm64         = FIXED_PRECISION_MULTIPLIER
-    };
-    emit_instruction(self, &load_precision_multiplier);
+    emit_form(self, &forms::MOV_RCX_MULTIPLIER);
 
     // idiv rcx
-    instruction_t mult_instruct = {
-            .require_REX   = true,
-            .require_ModRM = true,
-            .REX    = REX_BYTE_IF_64_BIT,
-            .opcode = DIVMUL_reg,
-            .ModRM  = ONLY_REG_MODRM_MODE_BIT | MODRM_DIV_REG_BITS | REG_RCX
-    };
-    emit_instruction(self, &mult_instruct);
+    emit_form(self, &forms::IDIV_RCX);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
 static void x64::div_fix_precision_multiplier(code_t *self) {
     // mov rcx, %FIXED_PRECISION_MULTIPLIER
-    instruction_t load_precision_multiplier = {
-            .require_REX   = true,
-            .require_ModRM = true,
-            .require_imm64 = true,
-            .REX           = REX_BYTE_IF_64_BIT,
-            .opcode        = MOV_reg_imm,
-            .ModRM         = IMM_MODRM_MODE_BIT | (REG_RDI << MODRM_RM_OFFSET) | REG_RCX,
-            .imm64         = FIXED_PRECISION_MULTIPLIER
-    };
-    emit_instruction(self, &load_precision_multiplier);
+    emit_form(self, &forms::MOV_RCX_MULTIPLIER);
 
     // imul rcx
-    instruction_t mult_instruct = {
-            .require_REX   = true,
-            .require_ModRM = true,
-            .REX    = REX_BYTE_IF_64_BIT,
-            .opcode = DIVMUL_reg,
-            .ModRM  = ONLY_REG_MODRM_MODE_BIT | MODRM_MUL_REG_BITS | REG_RCX
-    };
-    emit_instruction(self, &mult_instruct);
+    emit_form(self, &forms::IMUL_RCX);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-#define TRANSLATE_TYPE_TO_OPCODE(type, opcode_const)                                \
-    case ir::instruction_type_t::type:                                              \
-        log (INFO, "\tCond type: " #type " resulted in " #opcode_const " opcode");  \
-        opcode = x64::opcode_const; break;
+// Instruction types are a small part of ir::instruction_type_t, so they are compared instead of switch over all
+#define RETURN_OPCODE_FOR_TYPE(cond, opcode_const)                                  \
+    if (ir_instruct->type == ir::instruction_type_t::cond) {                        \
+        log (INFO, "\tCond type: " #cond " resulted in " #opcode_const " opcode");  \
+        return x64::opcode_const;                                                   \
+    }
 
 static uint8_t x64::translate_cond_jump_opcode(ir::instruction_t *ir_instruct) {
-    uint8_t opcode = 0;
     log(INFO, "Decoding conditional IF...");
 
-    switch (ir_instruct->type) {
-        TRANSLATE_TYPE_TO_OPCODE(JE,  JE_imm)
-        TRANSLATE_TYPE_TO_OPCODE(JNE, JNE_imm)
-        TRANSLATE_TYPE_TO_OPCODE(JA,  JG_imm)
-        TRANSLATE_TYPE_TO_OPCODE(JAE, JNL_imm)
-        TRANSLATE_TYPE_TO_OPCODE(JB, JNGE_imm)
-        TRANSLATE_TYPE_TO_OPCODE(JBE, JNG_imm)
-    }
+    RETURN_OPCODE_FOR_TYPE(JE,  JE_imm)
+    RETURN_OPCODE_FOR_TYPE(JNE, JNE_imm)
+    RETURN_OPCODE_FOR_TYPE(JA,  JG_imm)
+    RETURN_OPCODE_FOR_TYPE(JAE, JNL_imm)
+    RETURN_OPCODE_FOR_TYPE(JB, JNGE_imm)
+    RETURN_OPCODE_FOR_TYPE(JBE, JNG_imm)
+
+    assert (0 && "Not a conditional jump");
+    return 0;
+}
+
+static uint8_t x64::translate_set_cond_opcode(ir::instruction_t *ir_instruct) {
+    log(INFO, "Decoding conditional SET...");
+
+    RETURN_OPCODE_FOR_TYPE(SETE,  SETE_reg)
+    RETURN_OPCODE_FOR_TYPE(SETNE, SETNE_reg)
+    RETURN_OPCODE_FOR_TYPE(SETA,  SETG_reg)
+    RETURN_OPCODE_FOR_TYPE(SETAE, SETGE_reg)
+    RETURN_OPCODE_FOR_TYPE(SETB,  SETL_reg)
+    RETURN_OPCODE_FOR_TYPE(SETBE, SETLE_reg)
+
+    assert (0 && "Not a conditional set");
+    return 0;
+}
+
+static uint8_t x64::translate_cmov_opcode(ir::instruction_t *ir_instruct) {
+    log(INFO, "Decoding conditional MOV...");
+
+    RETURN_OPCODE_FOR_TYPE(CMOVE,  CMOVE_reg_reg)
+    RETURN_OPCODE_FOR_TYPE(CMOVNE, CMOVNE_reg_reg)
+    RETURN_OPCODE_FOR_TYPE(CMOVA,  CMOVG_reg_reg)
+    RETURN_OPCODE_FOR_TYPE(CMOVAE, CMOVGE_reg_reg)
+    RETURN_OPCODE_FOR_TYPE(CMOVB,  CMOVL_reg_reg)
+    RETURN_OPCODE_FOR_TYPE(CMOVBE, CMOVLE_reg_reg)
 
-    return opcode;
+    assert (0 && "Not a conditional move");
+    return 0;
 }
 
-#undef TRANSLATE_TYPE_TO_OPCODE
\ No newline at end of file
+#undef RETURN_OPCODE_FOR_TYPE
\ No newline at end of file
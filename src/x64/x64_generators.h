@@ -12,6 +12,20 @@ namespace x64 {
     void emit_code_preparation (code_t *self);
     void emit_jmp_or_call      (code_t *self, ir::instruction_t *ir_instruct);
     void emit_cond_jmp         (code_t *self, ir::instruction_t *ir_instruct);
+    void emit_and_or           (code_t *self, ir::instruction_t *ir_instruct);
+    void emit_set_cond         (code_t *self, ir::instruction_t *ir_instruct);
+    void emit_cmov             (code_t *self, ir::instruction_t *ir_instruct);
+    void emit_acc_op           (code_t *self, ir::instruction_t *ir_instruct);
+
+    /// Stub, that calls x64::lazy_compile() and jumps to translated function
+    void emit_lazy_stub        (code_t *self, uint64_t func_index);
+    void emit_abs_jmp          (code_t *self, uint64_t addr);
+
+    /// Fill PIC table at exec_buf start with addresses of current output type
+    void emit_pic_table        (code_t *self);
+
+    /// System V ABI entry of function: arguments are stored to frame at `frame` (fixed point), result is returned
+    void emit_object_wrapper   (code_t *self, const ir::func_range_t *range, uint64_t frame);
 }
 
 #endif //X64_TRANSLATOR_X64_GENERATORS_H
@@ -0,0 +1,66 @@
+#include <assert.h>
+#include <setjmp.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "x64_jit.h"
+#include "x64_stdlib.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+
+x64::jit_program_t *x64::jit_compile(const char *ast_text, const compile_options_t *options) {
+    assert (ast_text && options && "Invalid pointers");
+
+    jit_program_t *self = (jit_program_t *) calloc(1, sizeof(jit_program_t));
+    if (!self) { return nullptr; }
+
+    self->code = compile_ast(ast_text, output_t::JIT, options);
+    if (!self->code) {
+        free(self);
+        return nullptr;
+    }
+
+    return self;
+}
+
+void x64::jit_delete(jit_program_t *self) {
+    if (self) {
+        code_delete(self->code);
+    }
+    free(self);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+result_t x64::jit_run(jit_program_t *self, const jit_io_t *io) {
+    assert (self && "Invalid pointer");
+
+    jmp_buf halt;
+    const stdlib_hooks_t hooks = {
+            .input  = (io) ? io->input  : nullptr,
+            .output = (io) ? io->output : nullptr,
+            .ctx    = (io) ? io->ctx    : nullptr,
+            .halt   = &halt
+    };
+
+    // Pages of previous run are dropped, they are zero again on next touch
+    if (madvise(self->code->ram_buf, self->code->ram_size, MADV_DONTNEED) != 0) {
+        log (ERROR, "Failed to reset JIT RAM");
+        return result_t::ERROR;
+    }
+
+    const stdlib_hooks_t *prev_hooks = stdlib_set_hooks(&hooks);
+
+    // Object pointer can't be cast to function pointer portably, so its bits are copied
+    void (*entry)() = nullptr;
+    const uint8_t *entry_addr = self->code->exec_buf + code_entry_offset(self->code);
+    static_assert(sizeof(entry) == sizeof(entry_addr));
+    memcpy(&entry, &entry_addr, sizeof(entry));
+
+    // Generated code sets up its registers itself and always ends with HALT, that longjmps back here
+    if (setjmp(halt) == 0) {
+        entry();
+    }
+
+    stdlib_set_hooks(prev_hooks);
+    return result_t::OK;
+}
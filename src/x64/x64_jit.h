@@ -0,0 +1,34 @@
+#ifndef X64_TRANSLATOR_X64_JIT_H
+#define X64_TRANSLATOR_X64_JIT_H
+
+#include "../compiler.h"
+#include "x64.h"
+
+namespace x64 {
+    /// Compiled program, that can be run any number of times
+    struct jit_program_t {
+        code_t *code;
+    };
+
+    /// I/O of one run, values are fixed point (x100). Unset callbacks use stdin / stdout
+    struct jit_io_t {
+        int64_t (*input) (void *ctx);
+        void    (*output)(void *ctx, int64_t value);
+        void *ctx;
+    };
+
+    /// Compile AST text into executable memory. Returns nullptr on error
+    jit_program_t *jit_compile(const char *ast_text, const compile_options_t *options);
+    void jit_delete(jit_program_t *self);
+
+    /**
+     * @brief Run program until HALT and return to caller
+     *
+     * @note Each run starts with zeroed RAM. Runs may be nested (from I/O callbacks). Runs in several threads at once
+     *       need both `input` and `output` callbacks: fallback I/O uses stdlib buffers, that are shared by process.
+     *       One program must not run in several threads at once anyway, as they would share its RAM
+     */
+    result_t jit_run(jit_program_t *self, const jit_io_t *io);
+}
+
+#endif //X64_TRANSLATOR_X64_JIT_H
@@ -0,0 +1,399 @@
+#include <assert.h>
+#include "../common.h"
+#include "x64_consts.h"
+#include "x64_peephole.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+
+const int NO_REG = -1;
+
+const char PATTERN_NAMES[][24] = {
+        "push X; pop X",
+        "push X; pop Y",
+        "push imm; pop Y",
+        "push mem; pop Y",
+        "push X; pop mem",
+        "pop r8; push r8",
+        "mov rcx, 100 reload",
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Static Prototypes
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace x64 {
+    static bool rewrite_window_tail(peephole_t *self);
+    static bool rewrite_push_pop(peephole_t *self, form_t *push_form, form_t *pop_form);
+    static void commit_first(code_t *self);
+    static void register_hit(peephole_t *self, peephole_pattern_t pattern);
+
+    static int  get_pushed_reg(const instruction_t *instruct);
+    static int  get_popped_reg(const instruction_t *instruct);
+    static bool is_push_imm   (const instruction_t *instruct);
+    static bool is_push_mem   (const instruction_t *instruct);
+    static bool is_pop_mem    (const instruction_t *instruct);
+    static bool is_mov_imm64  (const instruction_t *instruct, int reg);
+    static int  get_opcode_reg(const instruction_t *instruct);
+    static bool writes_reg    (const instruction_t *instruct, int reg);
+
+    static int  get_modrm_reg(const instruction_t *instruct);
+    static int  get_modrm_rm (const instruction_t *instruct);
+    static bool is_reg_modrm (const instruction_t *instruct);
+
+    static instruction_t make_mov_reg_reg(int dst, int src);
+    static instruction_t make_mov_reg_imm(int dst, uint32_t imm);
+    static instruction_t make_mov_with_mem(const instruction_t *mem_instruct, uint8_t opcode, int reg);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Public
+//----------------------------------------------------------------------------------------------------------------------
+
+x64::peephole_t *x64::peephole_new() {
+    return (peephole_t *) calloc(1, sizeof(peephole_t));
+}
+
+void x64::peephole_delete(peephole_t *self) {
+    free(self);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::peephole_emit(code_t *self, const form_t *form) {
+    assert (self && form);
+    peephole_t *peephole = self->peephole;
+    const instruction_t *x64_instruct = &form->instruction;
+
+    if (is_mov_imm64(x64_instruct, REG_RCX) && x64_instruct->imm64 == FIXED_PRECISION_MULTIPLIER) {
+        if (peephole->rcx_holds_multiplier) {
+            register_hit(peephole, MULTIPLIER_RELOAD);
+            return;
+        }
+
+        peephole->rcx_holds_multiplier = true;
+    } else if (writes_reg(x64_instruct, REG_RCX)) {
+        peephole->rcx_holds_multiplier = false;
+    }
+
+    peephole->window[peephole->size++] = *form;
+
+    while (rewrite_window_tail(peephole)) {}
+
+    if (peephole->size > PEEPHOLE_WINDOW_SIZE) {
+        commit_first(self);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::peephole_flush(code_t *self) {
+    assert (self);
+
+    while (self->peephole->size > 0) {
+        commit_first(self);
+    }
+
+    // Flush is done on control flow merge points, so register contents are unknown
+    self->peephole->rcx_holds_multiplier = false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::peephole_reset(peephole_t *self) {
+    assert (self);
+
+    *self = {};
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void x64::peephole_log_stats(peephole_t *self) {
+    for (uint i = 0; i < PEEPHOLE_PATTERNS_COUNT; ++i) {
+        log (INFO, "Peephole: %-20s %lu hits", PATTERN_NAMES[i], self->hits[i]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Static
+//----------------------------------------------------------------------------------------------------------------------
+
+static bool x64::rewrite_window_tail(peephole_t *self) {
+    form_t *window = self->window;
+    uint size      = self->size;
+
+    if (size >= 2 && rewrite_push_pop(self, &window[size - 2], &window[size - 1])) {
+        return true;
+    }
+
+    // pop r8; push r8 -- restore and save RAM base register between two stdlib calls
+    if (size >= 2 && get_popped_reg(&window[size - 2].instruction) == REG_R8 &&
+                     get_pushed_reg(&window[size - 1].instruction) == REG_R8) {
+        self->size -= 2;
+        register_hit(self, RESTORE_SAVE_R8);
+        return true;
+    }
+
+    // Same with stdlib address loading in the middle, it doesn't use r8 or stack
+    if (size >= 3 && get_popped_reg(&window[size - 3].instruction) == REG_R8 &&
+                     is_mov_imm64  (&window[size - 2].instruction, get_opcode_reg(&window[size - 2].instruction)) &&
+                     get_pushed_reg(&window[size - 1].instruction) == REG_R8) {
+        window[size - 3] = window[size - 2];
+        self->size -= 2;
+        register_hit(self, RESTORE_SAVE_R8);
+        return true;
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static bool x64::rewrite_push_pop(peephole_t *self, form_t *push_form, form_t *pop_form) {
+    instruction_t *push_instruct = &push_form->instruction;
+    instruction_t *pop_instruct  = &pop_form->instruction;
+
+    int src = get_pushed_reg(push_instruct);
+    int dst = get_popped_reg(pop_instruct);
+
+    if (src != NO_REG && dst != NO_REG) {
+        if (src == dst) {
+            self->size -= 2;
+            register_hit(self, PUSH_POP_SAME_REG);
+        } else {
+            *push_form = encode_form(make_mov_reg_reg(dst, src));
+            self->size--;
+            register_hit(self, PUSH_POP_REG);
+        }
+
+        return true;
+    }
+
+    if (src != NO_REG && is_pop_mem(pop_instruct)) {
+        *push_form = encode_form(make_mov_with_mem(pop_instruct, MOV_mem_reg, src));
+        self->size--;
+        register_hit(self, PUSH_REG_POP_MEM);
+        return true;
+    }
+
+    if (dst == NO_REG) {
+        return false;
+    }
+
+    if (is_push_imm(push_instruct)) {
+        *push_form = encode_form(make_mov_reg_imm(dst, push_instruct->imm32));
+        self->size--;
+        register_hit(self, PUSH_IMM_POP_REG);
+        return true;
+    }
+
+    if (is_push_mem(push_instruct)) {
+        *push_form = encode_form(make_mov_with_mem(push_instruct, MOV_reg_mem, dst));
+        self->size--;
+        register_hit(self, PUSH_MEM_POP_REG);
+        return true;
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void x64::commit_first(code_t *self) {
+    peephole_t *peephole = self->peephole;
+    assert (peephole->size > 0);
+
+    commit_instruction(self, &peephole->window[0].encoding);
+
+    for (uint i = 1; i < peephole->size; ++i) {
+        peephole->window[i - 1] = peephole->window[i];
+    }
+
+    peephole->size--;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void x64::register_hit(peephole_t *self, peephole_pattern_t pattern) {
+    self->hits[pattern]++;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Instruction decoding
+//----------------------------------------------------------------------------------------------------------------------
+
+static int x64::get_pushed_reg(const instruction_t *instruct) {
+    if (instruct->require_ModRM || instruct->require_prefix || instruct->require_imm32 || instruct->require_imm64 ||
+        (instruct->opcode & ~LOWER_REG_BITS_MASK) != PUSH_reg) {
+        return NO_REG;
+    }
+
+    int extended = (instruct->require_REX && (instruct->REX & REX_B_BIT)) ? EXTENDED_REG_MASK : 0;
+    return extended | (instruct->opcode & LOWER_REG_BITS_MASK);
+}
+
+static int x64::get_popped_reg(const instruction_t *instruct) {
+    if (instruct->require_ModRM || instruct->require_prefix || instruct->require_imm32 || instruct->require_imm64 ||
+        (instruct->opcode & ~LOWER_REG_BITS_MASK) != POP_reg) {
+        return NO_REG;
+    }
+
+    int extended = (instruct->require_REX && (instruct->REX & REX_B_BIT)) ? EXTENDED_REG_MASK : 0;
+    return extended | (instruct->opcode & LOWER_REG_BITS_MASK);
+}
+
+static bool x64::is_push_imm(const instruction_t *instruct) {
+    return instruct->opcode == PUSH_imm && instruct->require_imm32 && !instruct->require_ModRM;
+}
+
+static bool x64::is_push_mem(const instruction_t *instruct) {
+    return instruct->opcode == PUSH_mem && instruct->require_ModRM && !is_reg_modrm(instruct) &&
+           (instruct->ModRM & MODRM_REG_FIELD_MASK) == PUSH_MOD_REG_BITS;
+}
+
+static bool x64::is_pop_mem(const instruction_t *instruct) {
+    return instruct->opcode == POP_mem && instruct->require_ModRM && !is_reg_modrm(instruct);
+}
+
+/// `mov reg, imm64` (`reg` is not r8-r15)
+static bool x64::is_mov_imm64(const instruction_t *instruct, int reg) {
+    return (instruct->opcode & ~LOWER_REG_BITS_MASK) == MOV_reg_imm && instruct->require_imm64 &&
+           (instruct->REX & REX_B_BIT) == 0 && get_opcode_reg(instruct) == reg;
+}
+
+/// Conservative: true if instruction may change `reg` (r0-r7)
+static bool x64::writes_reg(const instruction_t *instruct, int reg) {
+    if (instruct->require_prefix) {
+        // setcc writes r/m, movzx / cmovcc write reg; conditional jumps write nothing
+        if (instruct->opcode == JE_imm  || instruct->opcode == JNE_imm || instruct->opcode == JG_imm ||
+            instruct->opcode == JNG_imm || instruct->opcode == JNL_imm || instruct->opcode == JNGE_imm) {
+            return false;
+        }
+
+        return true;
+    }
+
+    if (get_pushed_reg(instruct) != NO_REG || is_push_imm(instruct) || is_push_mem(instruct)) {
+        return false;
+    }
+
+    if (get_popped_reg(instruct) != NO_REG) {
+        return get_popped_reg(instruct) == reg;
+    }
+
+    if (!instruct->require_ModRM && (instruct->opcode & ~LOWER_REG_BITS_MASK) == MOV_reg_imm) {
+        return !(instruct->require_REX && (instruct->REX & REX_B_BIT)) &&
+               (instruct->opcode & LOWER_REG_BITS_MASK) == reg;
+    }
+
+    bool reg_is_extended = instruct->require_REX && (instruct->REX & REX_R_BIT);
+    bool rm_is_extended  = instruct->require_REX && (instruct->REX & REX_B_BIT);
+
+    switch (instruct->opcode) {
+        case CMP_reg_reg:
+        case CQO_none:
+        case RET_none:
+            return false;
+
+        case DIVMUL_reg:        // imul / idiv write rdx:rax
+            return reg == REG_RAX || reg == REG_RDX;
+
+        case MOV_reg_mem:
+        case ADD_reg_mem:
+        case SUB_reg_mem:
+        case IMUL_reg_imm:
+        case LEA_reg_mem:
+            return !reg_is_extended && get_modrm_reg(instruct) == reg;
+
+        case MOV_mem_reg:
+        case MOV_reg_imm64:
+        case ADD_mem_reg:
+        case SUB_mem_reg:
+        case AND_mem_reg:
+        case OR_mem_reg:
+        case ARITH_reg_imm:
+            return is_reg_modrm(instruct) && !rm_is_extended && get_modrm_rm(instruct) == reg;
+
+        default:
+            return true;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static int x64::get_modrm_reg(const instruction_t *instruct) {
+    return (instruct->ModRM >> MODRM_RM_OFFSET) & LOWER_REG_BITS_MASK;
+}
+
+static int x64::get_modrm_rm(const instruction_t *instruct) {
+    return instruct->ModRM & LOWER_REG_BITS_MASK;
+}
+
+static int x64::get_opcode_reg(const instruction_t *instruct) {
+    return instruct->opcode & LOWER_REG_BITS_MASK;
+}
+
+static bool x64::is_reg_modrm(const instruction_t *instruct) {
+    return (instruct->ModRM & ONLY_REG_MODRM_MODE_BIT) == ONLY_REG_MODRM_MODE_BIT;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Instruction building
+//----------------------------------------------------------------------------------------------------------------------
+
+static x64::instruction_t x64::make_mov_reg_reg(int dst, int src) {
+    // mov dst, src
+    instruction_t mov_instruct = {
+            .require_REX   = true,
+            .require_ModRM = true,
+            .REX           = static_cast<uint8_t>(REX_BYTE_IF_64_BIT | ((src & EXTENDED_REG_MASK) ? REX_R_BIT : 0)
+                                                                     | ((dst & EXTENDED_REG_MASK) ? REX_B_BIT : 0)),
+            .opcode        = MOV_mem_reg,
+            .ModRM         = static_cast<uint8_t>(ONLY_REG_MODRM_MODE_BIT
+                                                  | ((src & LOWER_REG_BITS_MASK) << MODRM_RM_OFFSET)
+                                                  |  (dst & LOWER_REG_BITS_MASK))
+    };
+
+    return mov_instruct;
+}
+
+static x64::instruction_t x64::make_mov_reg_imm(int dst, uint32_t imm) {
+    // mov dst32, imm32 (zero extended, so only for non-negative values, but shorter)
+    if ((int32_t) imm >= 0) {
+        instruction_t mov_instruct = {
+                .require_REX   = (dst & EXTENDED_REG_MASK) != 0,
+                .require_imm32 = true,
+                .REX           = REX_BYTE_IF_NUM_REGS,
+                .opcode        = static_cast<uint8_t>(MOV_reg_imm | (dst & LOWER_REG_BITS_MASK)),
+                .imm32         = imm
+        };
+
+        return mov_instruct;
+    }
+
+    // mov dst, imm32 (sign extended, same as push imm32)
+    instruction_t mov_instruct = {
+            .require_REX   = true,
+            .require_ModRM = true,
+            .require_imm32 = true,
+            .REX           = static_cast<uint8_t>(REX_BYTE_IF_64_BIT | ((dst & EXTENDED_REG_MASK) ? REX_B_BIT : 0)),
+            .opcode        = MOV_reg_imm64,
+            .ModRM         = static_cast<uint8_t>(ONLY_REG_MODRM_MODE_BIT | (dst & LOWER_REG_BITS_MASK)),
+            .imm32         = imm
+    };
+
+    return mov_instruct;
+}
+
+/// Reuse memory operand (ModRM.rm, SIB, displacement) of push/pop for `mov reg, [m]` or `mov [m], reg`
+static x64::instruction_t x64::make_mov_with_mem(const instruction_t *mem_instruct, uint8_t opcode, int reg) {
+    instruction_t mov_instruct = *mem_instruct;
+
+    mov_instruct.require_REX = true;
+    mov_instruct.REX         = static_cast<uint8_t>(REX_BYTE_IF_64_BIT | ((reg & EXTENDED_REG_MASK) ? REX_R_BIT : 0) |
+                                                    ((mem_instruct->require_REX) ? mem_instruct->REX : 0));
+    mov_instruct.opcode      = opcode;
+    mov_instruct.ModRM       = static_cast<uint8_t>((mem_instruct->ModRM & ~MODRM_REG_FIELD_MASK) |
+                                                    ((reg & LOWER_REG_BITS_MASK) << MODRM_RM_OFFSET));
+
+    return mov_instruct;
+}
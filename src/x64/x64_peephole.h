@@ -0,0 +1,50 @@
+#ifndef X64_TRANSLATOR_X64_PEEPHOLE_H
+#define X64_TRANSLATOR_X64_PEEPHOLE_H
+
+#include "x64_common.h"
+#include "x64_encoder.h"
+
+namespace x64 {
+    const uint PEEPHOLE_WINDOW_SIZE = 4;
+
+    enum peephole_pattern_t {
+        PUSH_POP_SAME_REG,  // push X;   pop X              -> (nothing)
+        PUSH_POP_REG,       // push X;   pop Y              -> mov Y, X
+        PUSH_IMM_POP_REG,   // push imm; pop Y              -> mov Y, imm
+        PUSH_MEM_POP_REG,   // push [m]; pop Y              -> mov Y, [m]
+        PUSH_REG_POP_MEM,   // push X;   pop [m]            -> mov [m], X
+        RESTORE_SAVE_R8,    // pop r8; [mov reg, imm64;] push r8 between stdlib calls -> [mov reg, imm64]
+        MULTIPLIER_RELOAD,  // mov rcx, 100 when rcx still holds it              -> (nothing)
+
+        PEEPHOLE_PATTERNS_COUNT
+    };
+
+    struct peephole_t {
+        form_t window[PEEPHOLE_WINDOW_SIZE + 1];
+        uint size;
+
+        bool rcx_holds_multiplier;
+
+        uint64_t hits[PEEPHOLE_PATTERNS_COUNT];
+    };
+
+    peephole_t *peephole_new();
+    void peephole_delete(peephole_t *self);
+
+    /// Buffer instruction in window, rewrite window tail and commit instructions that left the window
+    void peephole_emit(code_t *self, const form_t *form);
+
+    /**
+     * @brief Commit all buffered instructions
+     *
+     * @note Must be called before code address is used: at branch targets and before relative jumps
+     */
+    void peephole_flush(code_t *self);
+
+    /// Forget window contents and hit counters before new pass
+    void peephole_reset(peephole_t *self);
+
+    void peephole_log_stats(peephole_t *self);
+}
+
+#endif //X64_TRANSLATOR_X64_PEEPHOLE_H
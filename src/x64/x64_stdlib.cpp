@@ -5,20 +5,58 @@
 
 //----------------------------------------------------------------------------------------------------------------------
 
+static thread_local const x64::stdlib_hooks_t *current_hooks = nullptr;
+
+const x64::stdlib_hooks_t *x64::stdlib_set_hooks(const stdlib_hooks_t *hooks) {
+    const stdlib_hooks_t *prev_hooks = current_hooks;
+    current_hooks = hooks;
+
+    return prev_hooks;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
 extern "C" int64_t input_asm();
 
-int64_t x64::stdlib_inp() {
+JIT_CALLED int64_t x64::stdlib_inp() {
+    if (current_hooks && current_hooks->input) {
+        return current_hooks->input(current_hooks->ctx);
+    }
+
     return input_asm();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
 extern "C" void output_asm(int64_t);
+extern "C" void output_raw_asm(int64_t);
+
+JIT_CALLED void x64::stdlib_out(int64_t arg) {
+    if (current_hooks && current_hooks->output) {
+        current_hooks->output(current_hooks->ctx, arg);
+        return;
+    }
 
-void x64::stdlib_out(int64_t arg) {
     output_asm(arg);
 }
 
+JIT_CALLED void x64::stdlib_out_raw(int64_t arg) {
+    if (current_hooks && current_hooks->output) {
+        current_hooks->output(current_hooks->ctx, arg);
+        return;
+    }
+
+    output_raw_asm(arg);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+extern "C" char *format_asm(int64_t value, char *buf);
+
+char *x64::stdlib_format(char *buf, int64_t value) {
+    return format_asm(value, buf);
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 
 extern "C" uint64_t sqrt_asm(uint64_t sqrt);
@@ -30,8 +68,14 @@ uint64_t x64::stdlib_sqrt(uint64_t arg) {
 //----------------------------------------------------------------------------------------------------------------------
 
 extern "C" [[noreturn]] void exit_asm();
+extern "C" void flush_asm();
 
 [[noreturn]]
 void x64::stdlib_halt() {
+    if (current_hooks && current_hooks->halt) {
+        flush_asm();
+        longjmp(*current_hooks->halt, 1);
+    }
+
     exit_asm();
 }
\ No newline at end of file
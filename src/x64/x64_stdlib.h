@@ -2,12 +2,36 @@
 #define X64_TRANSLATOR_X64_STDLIB_H
 
 #include <stdint.h>
+#include <setjmp.h>
+
+// JIT code keeps no stack alignment, while host functions called from it may rely on it
+#define JIT_CALLED __attribute__((force_align_arg_pointer))
 
 namespace x64 {
+    /// Host side of stdlib calls from JIT code, unset fields fall back to syscalls
+    struct stdlib_hooks_t {
+        int64_t (*input) (void *ctx);                   // Returns fixed point value
+        void    (*output)(void *ctx, int64_t value);    // Gets fixed point value, for both OUT forms
+        void *ctx;
+
+        jmp_buf *halt;  // Where stdlib_halt() returns to instead of exiting process
+    };
+
+    /// Sets hooks of current thread (nullptr to reset), returns previous ones
+    const stdlib_hooks_t *stdlib_set_hooks(const stdlib_hooks_t *hooks);
+
+    /// Output is buffered by stdlib and flushed before input, on overflow and in stdlib_halt()
     void     stdlib_out (int64_t arg);
+    void     stdlib_out_raw(int64_t arg); // Without "OUTPUT: " prefix
     int64_t stdlib_inp ();
     uint64_t stdlib_sqrt(uint64_t arg);
-    [[noreturn]] void stdlib_halt();
+    [[noreturn]] void stdlib_halt(); // Flushes output, then exits or jumps to hooks' `halt`
+
+    /// Writes `[-]int.frac\n` (at most 30 bytes) as stdlib_out() does, returns end of text
+    char *stdlib_format(char *buf, int64_t value);
+
+    /// Throughput of per digit formatting vs stdlib digit pairs formatter, results are printed to stdout
+    void bench_format(uint64_t values_count);
 }
 
 #endif //X64_TRANSLATOR_X64_STDLIB_H